@@ -0,0 +1,713 @@
+#include <algorithm>
+#include "Benchmark.hpp"
+#include "famitracker-core/APU/APU.h"
+#include "famitracker-core/APU/Square.h"
+#include "famitracker-core/APU/Triangle.h"
+#include "famitracker-core/APU/Noise.h"
+#include "famitracker-core/APU/DPCM.h"
+#include "famitracker-core/APU/VRC6.h"
+#include "famitracker-core/APU/VRC7.h"
+#include "famitracker-core/APU/FDS.h"
+#include "famitracker-core/APU/FDSSound.h"
+#include "famitracker-core/APU/MMC5.h"
+#include "famitracker-core/APU/N106.h"
+
+static const uint32 SAMPLE_RATE = 48000;
+// A batch is a second of sound, NTSC
+static const unsigned int FRAMES = 60;
+// CAPU runs the chips at most a frame sequencer step at a time
+static const uint32 STEP_CYCLES = 7458;
+// of the OPLL in the VRC7, CVRC7 keeps it to itself
+static const uint32 OPLL_CLOCK = 3579545;
+
+static uint32 frame_cycles()
+{
+	return CAPU::BASE_FREQ_NTSC / CAPU::FRAME_RATE_NTSC;
+}
+
+// Values of the synthetic register traces. The same seed gives the same
+// trace, so every batch does the same work
+class TraceRandom
+{
+public:
+	explicit TraceRandom(core::u32 seed) : m_state(seed){ }
+
+	core::u8 next()
+	{
+		m_state = m_state * 1103515245 + 12345;
+		return (core::u8)(m_state >> 16);
+	}
+private:
+	core::u32 m_state;
+};
+
+// A new note every NOTE_FRAMES frames, the period changes every frame
+static const unsigned int NOTE_FRAMES = 8;
+
+static bool note_frame(unsigned int frame)
+{
+	return frame % NOTE_FRAMES == 0;
+}
+
+/*
+ * A chip (or 2A03 channel) alone on a mixer, like CAPU sets it up. Every
+ * frame of the trace the registers are written, then the frame is run in
+ * CAPU sized steps and ended. Only running and ending the frame is timed,
+ * the mixer output is read and thrown away outside the timer.
+ */
+class ChipBenchmark : public Benchmark
+{
+public:
+	ChipBenchmark(const std::string &name, int chip)
+		: Benchmark(name, "cycle")
+	{
+		m_mixer.ExternalSound(chip);
+		m_mixer.AllocateBuffer(SAMPLE_RATE / CAPU::FRAME_RATE_PAL, SAMPLE_RATE, 1, false);
+		m_mixer.SetClockRate(CAPU::BASE_FREQ_NTSC);
+		m_mixer.UpdateSettings(16, 12000, 24, 100);
+		m_buffer = new core::s16[SAMPLE_RATE];
+	}
+	~ChipBenchmark()
+	{
+		delete[] m_buffer;
+	}
+
+	core::u64 run(BenchTimer &timer)
+	{
+		const uint32 cycles = frame_cycles();
+
+		m_mixer.ClearBuffer();
+		reset();
+
+		TraceRandom r(1);
+		for (unsigned int frame = 0; frame < FRAMES; frame++)
+		{
+			write(frame, r);
+
+			timer.start();
+			for (uint32 t = 0; t < cycles; t += STEP_CYCLES)
+				process(std::min(STEP_CYCLES, cycles - t));
+			endFrame();
+			timer.stop();
+
+			int avail = m_mixer.FinishBuffer(cycles);
+			m_mixer.ReadBuffer(avail, m_buffer, false);
+		}
+
+		return (core::u64)FRAMES * cycles;
+	}
+protected:
+	virtual void reset() = 0;
+	virtual void write(unsigned int frame, TraceRandom &r) = 0;
+	virtual void process(uint32 time) = 0;
+	virtual void endFrame() = 0;
+
+	CMixer m_mixer;
+private:
+	core::s16 *m_buffer;
+};
+
+class SquareBenchmark : public ChipBenchmark
+{
+public:
+	SquareBenchmark()
+		: ChipBenchmark("apu/CSquare::Process", SNDCHIP_NONE),
+		  m_square(&m_mixer, CHANID_SQUARE1, SNDCHIP_NONE)
+	{
+	}
+protected:
+	void reset()
+	{
+		m_square.Reset();
+		m_square.WriteControl(1);
+		m_square.Write(0x01, 0x08);
+	}
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		// constant volume, the duty changes with the note
+		if (note_frame(frame))
+		{
+			m_square.Write(0x00, 0x30 | (r.next() & 0xC0) | 0x0F);
+			m_square.Write(0x02, r.next());
+			m_square.Write(0x03, 0xF8 | (r.next() & 0x03));
+		}
+		else
+		{
+			m_square.Write(0x02, r.next());
+		}
+	}
+	void process(uint32 time){ m_square.Process(time); }
+	void endFrame(){ m_square.EndFrame(); }
+private:
+	CSquare m_square;
+};
+
+class TriangleBenchmark : public ChipBenchmark
+{
+public:
+	TriangleBenchmark()
+		: ChipBenchmark("apu/CTriangle::Process", SNDCHIP_NONE),
+		  m_triangle(&m_mixer, CHANID_TRIANGLE)
+	{
+	}
+protected:
+	void reset()
+	{
+		m_triangle.Reset();
+		m_triangle.WriteControl(1);
+		m_triangle.Write(0x00, 0xFF);
+	}
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		m_triangle.Write(0x02, r.next());
+		if (note_frame(frame))
+			m_triangle.Write(0x03, 0xF8 | (r.next() & 0x03));
+		// loads the linear counter, the frame sequencer of CAPU would
+		m_triangle.LinearCounterUpdate();
+	}
+	void process(uint32 time){ m_triangle.Process(time); }
+	void endFrame(){ m_triangle.EndFrame(); }
+private:
+	CTriangle m_triangle;
+};
+
+class NoiseBenchmark : public ChipBenchmark
+{
+public:
+	NoiseBenchmark()
+		: ChipBenchmark("apu/CNoise::Process", SNDCHIP_NONE),
+		  m_noise(&m_mixer, CHANID_NOISE)
+	{
+	}
+protected:
+	void reset()
+	{
+		m_noise.Reset();
+		m_noise.WriteControl(1);
+		m_noise.Write(0x00, 0x3F);
+	}
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		m_noise.Write(0x02, r.next() & 0x8F);
+		if (note_frame(frame))
+			m_noise.Write(0x03, 0xF8);
+	}
+	void process(uint32 time){ m_noise.Process(time); }
+	void endFrame(){ m_noise.EndFrame(); }
+private:
+	CNoise m_noise;
+};
+
+class DPCMBenchmark : public ChipBenchmark
+{
+public:
+	DPCMBenchmark()
+		: ChipBenchmark("apu/CDPCM::Process", SNDCHIP_NONE),
+		  m_dpcm(&m_mixer, &m_samplemem, CHANID_DPCM)
+	{
+		// a looping sample of random bits, at $C000
+		TraceRandom r(2);
+		char sample[SAMPLE_SIZE];
+		for (int i = 0; i < SAMPLE_SIZE; i++)
+			sample[i] = (char)r.next();
+		m_samplemem.SetMem(sample, SAMPLE_SIZE);
+	}
+protected:
+	static const int SAMPLE_SIZE = 0xFF1;
+
+	void reset()
+	{
+		m_dpcm.Reset();
+		m_dpcm.Write(0x00, 0x4F);
+		m_dpcm.Write(0x02, 0x00);
+		m_dpcm.Write(0x03, 0xFF);
+		m_dpcm.WriteControl(1);
+	}
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		// the rate changes with the note, the sample keeps looping
+		if (note_frame(frame))
+			m_dpcm.Write(0x00, 0x40 | (r.next() & 0x0F));
+	}
+	void process(uint32 time){ m_dpcm.Process(time); }
+	void endFrame(){ m_dpcm.EndFrame(); }
+private:
+	CSampleMem m_samplemem;
+	CDPCM m_dpcm;
+};
+
+// Expansion chips are written at their addresses, like CAPU::ExternalWrite
+class ExternalBenchmark : public ChipBenchmark
+{
+public:
+	ExternalBenchmark(const std::string &name, int chip)
+		: ChipBenchmark(name, chip), m_external(NULL)
+	{
+	}
+	~ExternalBenchmark()
+	{
+		delete m_external;
+	}
+protected:
+	void reset(){ m_external->Reset(); }
+	void process(uint32 time){ m_external->Process(time); }
+	void endFrame(){ m_external->EndFrame(); }
+
+	void writeRegister(uint16 address, uint8 value){ m_external->Write(address, value); }
+	// made by the subclass, on the mixer
+	void setExternal(CExternal *external){ m_external = external; }
+private:
+	CExternal *m_external;
+};
+
+class VRC6Benchmark : public ExternalBenchmark
+{
+public:
+	VRC6Benchmark()
+		: ExternalBenchmark("apu/CVRC6::Process", SNDCHIP_VRC6)
+	{
+		setExternal(new CVRC6(&m_mixer));
+	}
+protected:
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		// two pulses at $9000 and $A000, the sawtooth at $B000
+		for (uint16 base = 0x9000; base <= 0xB000; base += 0x1000)
+		{
+			if (note_frame(frame))
+			{
+				if (base == 0xB000)
+					writeRegister(base, r.next() & 0x3F);
+				else
+					writeRegister(base, (r.next() & 0x70) | 0x0F);
+			}
+			writeRegister(base+1, r.next());
+			writeRegister(base+2, 0x80 | (r.next() & 0x0F));
+		}
+	}
+};
+
+class VRC7Benchmark : public ExternalBenchmark
+{
+public:
+	VRC7Benchmark()
+		: ExternalBenchmark("apu/CVRC7::EndFrame", SNDCHIP_VRC7)
+	{
+		m_vrc7 = new CVRC7(&m_mixer);
+		setExternal(m_vrc7);
+		m_vrc7->SetSampleSpeed(SAMPLE_RATE, CAPU::BASE_FREQ_NTSC, CAPU::FRAME_RATE_NTSC);
+		m_vrc7->SetVolume(1.0f);
+	}
+protected:
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		// six channels, keyed on again with every note. OPLL_calc runs
+		// in EndFrame
+		for (uint8 ch = 0; ch < 6; ch++)
+		{
+			uint8 block = 0x10 | ((r.next() & 0x07) << 1);
+			if (note_frame(frame))
+			{
+				writeOPLL(0x30 + ch, (ch + 1) << 4);
+				writeOPLL(0x20 + ch, block & 0x0F);
+			}
+			writeOPLL(0x10 + ch, r.next());
+			writeOPLL(0x20 + ch, block);
+		}
+	}
+	void writeOPLL(uint8 reg, uint8 value)
+	{
+		writeRegister(0x9010, reg);
+		writeRegister(0x9030, value);
+	}
+private:
+	CVRC7 *m_vrc7;
+};
+
+class FDSBenchmark : public ExternalBenchmark
+{
+public:
+	FDSBenchmark()
+		: ExternalBenchmark("apu/CFDS::Process", SNDCHIP_FDS)
+	{
+		setExternal(new CFDS(&m_mixer));
+	}
+protected:
+	// the same trace on another FDS, made by the subclass
+	explicit FDSBenchmark(const std::string &name)
+		: ExternalBenchmark(name, SNDCHIP_FDS)
+	{
+	}
+
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		if (frame == 0)
+		{
+			// a random wave and modulation table
+			writeRegister(0x4089, 0x80);
+			for (uint16 a = 0x4040; a < 0x4080; a++)
+				writeRegister(a, r.next() & 0x3F);
+			writeRegister(0x4089, 0x00);
+
+			writeRegister(0x4087, 0x80);
+			for (int i = 0; i < 32; i++)
+				writeRegister(0x4088, r.next() & 0x07);
+		}
+
+		if (note_frame(frame))
+		{
+			writeRegister(0x4080, 0x80 | 0x20);
+			writeRegister(0x4084, 0x80 | (r.next() & 0x3F));
+			writeRegister(0x4085, 0x00);
+		}
+		writeRegister(0x4082, r.next());
+		writeRegister(0x4083, r.next() & 0x0F);
+		writeRegister(0x4086, r.next());
+		writeRegister(0x4087, r.next() & 0x0F);
+	}
+};
+
+// The FDS sound core alone, without the mixer. Renders every cycle, or
+// skips the cycles FDSSoundAdvance allows like CFDS does, to compare the two
+class FDSSoundChip : public CExternal
+{
+public:
+	explicit FDSSoundChip(bool advance)
+		: m_advance(advance), m_sum(0)
+	{
+		FDSSoundInstall3();
+		m_fds = FDSSoundNew();
+	}
+	~FDSSoundChip()
+	{
+		FDSSoundDelete(m_fds);
+	}
+
+	void Reset()
+	{
+		FDSSoundReset(m_fds);
+		FDSSoundVolume(m_fds, 0);
+	}
+	void Process(uint32 Time)
+	{
+		int32 sum = 0;
+		while (Time > 0)
+		{
+			sum += FDSSoundRender(m_fds);
+			Time--;
+			if (m_advance)
+				Time -= FDSSoundAdvance(m_fds, Time);
+		}
+		m_sum = sum;
+	}
+	void EndFrame(){ }
+
+	void Write(uint16 Address, uint8 Value){ FDSSoundWrite(m_fds, Address, Value); }
+	uint8 Read(uint16 Address, bool &Mapped){ Mapped = false; return 0; }
+private:
+	bool m_advance;
+	FDSSOUND *m_fds;
+	// keeps the output from being optimized out
+	volatile int32 m_sum;
+};
+
+class FDSSoundBenchmark : public FDSBenchmark
+{
+public:
+	explicit FDSSoundBenchmark(bool advance)
+		: FDSBenchmark(advance ? "apu/FDSSoundAdvance" : "apu/FDSSoundRender")
+	{
+		setExternal(new FDSSoundChip(advance));
+	}
+};
+
+class MMC5Benchmark : public ExternalBenchmark
+{
+public:
+	MMC5Benchmark()
+		: ExternalBenchmark("apu/CMMC5::Process", SNDCHIP_MMC5)
+	{
+		setExternal(new CMMC5(&m_mixer));
+	}
+protected:
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		if (frame == 0)
+			writeRegister(0x5015, 0x03);
+
+		// two pulses at $5000 and $5004
+		for (uint16 base = 0x5000; base <= 0x5004; base += 4)
+		{
+			if (note_frame(frame))
+			{
+				writeRegister(base, 0x30 | (r.next() & 0xC0) | 0x0F);
+				writeRegister(base+2, r.next());
+				writeRegister(base+3, 0xF8 | (r.next() & 0x03));
+			}
+			else
+			{
+				writeRegister(base+2, r.next());
+			}
+		}
+	}
+};
+
+class N106Benchmark : public ExternalBenchmark
+{
+public:
+	N106Benchmark()
+		: ExternalBenchmark("apu/CN106::Process", SNDCHIP_N106)
+	{
+		setExternal(new CN106(&m_mixer));
+	}
+protected:
+	static const int CHANNELS = 4;
+
+	void write(unsigned int frame, TraceRandom &r)
+	{
+		if (frame == 0)
+		{
+			// a random wave, 32 samples at the start of the RAM
+			writeRegister(0xF800, 0x80);
+			for (int i = 0; i < 0x10; i++)
+				writeRegister(0x4800, r.next());
+		}
+
+		// the last CHANNELS channels, the RAM address auto-increments
+		for (int ch = 8 - CHANNELS; ch < 8; ch++)
+		{
+			writeRegister(0xF800, 0x80 | (0x40 + ch*8));
+			writeRegister(0x4800, r.next());
+			writeRegister(0x4800, 0x00);
+			writeRegister(0x4800, r.next());
+			writeRegister(0x4800, 0x00);
+			writeRegister(0x4800, 0x00 | (r.next() & 0x03));
+			writeRegister(0x4800, 0x00);
+			writeRegister(0x4800, 0x00);
+			writeRegister(0x4800, ((CHANNELS-1) << 4) | 0x0F);
+		}
+	}
+};
+
+// OPLL_calc alone, the samples CVRC7 asks for in a second
+class OPLLBenchmark : public Benchmark
+{
+public:
+	OPLLBenchmark()
+		: Benchmark("apu/OPLL_calc", "sample")
+	{
+		m_opll = OPLL_new(OPLL_CLOCK, SAMPLE_RATE);
+		OPLL_reset(m_opll);
+		OPLL_reset_patch(m_opll, 1);
+
+		TraceRandom r(3);
+		for (uint32 ch = 0; ch < 6; ch++)
+		{
+			OPLL_writeReg(m_opll, 0x30 + ch, ((ch + 1) << 4));
+			OPLL_writeReg(m_opll, 0x10 + ch, r.next());
+			OPLL_writeReg(m_opll, 0x20 + ch, 0x10 | ((r.next() & 0x07) << 1));
+		}
+	}
+	~OPLLBenchmark()
+	{
+		OPLL_delete(m_opll);
+	}
+
+	core::u64 run(BenchTimer &timer)
+	{
+		int sum = 0;
+		timer.start();
+		for (uint32 i = 0; i < SAMPLE_RATE; i++)
+			sum += OPLL_calc(m_opll);
+		timer.stop();
+
+		m_sink = sum;
+		return SAMPLE_RATE;
+	}
+private:
+	OPLL *m_opll;
+	// keeps the samples from being optimized out
+	volatile int m_sink;
+};
+
+// Blip_Synth::offset, as often as the 2A03 squares call it in a busy frame
+class BlipSynthBenchmark : public Benchmark
+{
+public:
+	BlipSynthBenchmark()
+		: Benchmark("blip/Blip_Synth::offset", "call")
+	{
+		m_buffer.set_sample_rate(SAMPLE_RATE, 1000 / 10);
+		m_buffer.clock_rate(CAPU::BASE_FREQ_NTSC);
+		m_synth.volume(1.0);
+		m_synth.output(&m_buffer);
+	}
+
+	core::u64 run(BenchTimer &timer)
+	{
+		const uint32 cycles = frame_cycles();
+		core::u64 calls = 0;
+
+		m_buffer.clear();
+		TraceRandom r(4);
+		for (unsigned int frame = 0; frame < FRAMES; frame++)
+		{
+			// a delta every few cycles, a high square wave
+			uint32 step = 8 + (r.next() & 0x3F);
+
+			timer.start();
+			int delta = 15;
+			for (uint32 t = 0; t < cycles; t += step)
+			{
+				m_synth.offset(t, delta);
+				delta = -delta;
+				calls++;
+			}
+			timer.stop();
+
+			m_buffer.end_frame(cycles);
+			m_buffer.remove_samples(m_buffer.samples_avail());
+		}
+
+		return calls;
+	}
+private:
+	Blip_Buffer m_buffer;
+	Blip_Synth<blip_good_quality, -500> m_synth;
+};
+
+// Reading a frame of samples out of a Blip_Buffer, clamped to 16 bits or
+// unclamped like CMixer::ReadBuffer does
+class BlipReadBenchmark : public Benchmark
+{
+public:
+	BlipReadBenchmark(bool unclamped)
+		: Benchmark(unclamped ? "blip/Blip_Buffer::read_samples_unclamped" : "blip/Blip_Buffer::read_samples",
+					"sample"),
+		  m_unclamped(unclamped)
+	{
+		m_buffer.set_sample_rate(SAMPLE_RATE, 1000 / 10);
+		m_buffer.clock_rate(CAPU::BASE_FREQ_NTSC);
+		m_buffer.bass_freq(16);
+		m_synth.volume(1.0);
+		m_synth.output(&m_buffer);
+		m_samples = new int[SAMPLE_RATE];
+	}
+	~BlipReadBenchmark()
+	{
+		delete[] m_samples;
+	}
+
+	core::u64 run(BenchTimer &timer)
+	{
+		const uint32 cycles = frame_cycles();
+		core::u64 samples = 0;
+
+		m_buffer.clear();
+		TraceRandom r(5);
+		for (unsigned int frame = 0; frame < FRAMES; frame++)
+		{
+			int delta = 15;
+			for (uint32 t = 0; t < cycles; t += 64 + r.next())
+			{
+				m_synth.offset(t, delta);
+				delta = -delta;
+			}
+			m_buffer.end_frame(cycles);
+
+			long avail = m_buffer.samples_avail();
+			timer.start();
+			if (m_unclamped)
+				samples += m_buffer.read_samples_unclamped(m_samples, avail);
+			else
+				samples += m_buffer.read_samples((blip_sample_t*)m_samples, avail);
+			timer.stop();
+		}
+
+		return samples;
+	}
+private:
+	bool m_unclamped;
+	Blip_Buffer m_buffer;
+	Blip_Synth<blip_good_quality, -500> m_synth;
+	int *m_samples;
+};
+
+// CMixer::AddValue for every channel of the 2A03 and VRC6, the way the
+// channels call it when their output changes
+class MixerBenchmark : public Benchmark
+{
+public:
+	MixerBenchmark()
+		: Benchmark("mixer/CMixer::AddValue", "call")
+	{
+		m_mixer.ExternalSound(SNDCHIP_VRC6);
+		m_mixer.AllocateBuffer(SAMPLE_RATE / CAPU::FRAME_RATE_PAL, SAMPLE_RATE, 1, false);
+		m_mixer.SetClockRate(CAPU::BASE_FREQ_NTSC);
+		m_mixer.UpdateSettings(16, 12000, 24, 100);
+		m_buffer = new core::s16[SAMPLE_RATE];
+	}
+	~MixerBenchmark()
+	{
+		delete[] m_buffer;
+	}
+
+	core::u64 run(BenchTimer &timer)
+	{
+		static const int channels[][2] = {
+			{CHANID_SQUARE1, SNDCHIP_NONE}, {CHANID_SQUARE2, SNDCHIP_NONE},
+			{CHANID_TRIANGLE, SNDCHIP_NONE}, {CHANID_NOISE, SNDCHIP_NONE},
+			{CHANID_DPCM, SNDCHIP_NONE},
+			{CHANID_VRC6_PULSE1, SNDCHIP_VRC6}, {CHANID_VRC6_PULSE2, SNDCHIP_VRC6},
+			{CHANID_VRC6_SAWTOOTH, SNDCHIP_VRC6}
+		};
+		static const int count = sizeof(channels) / sizeof(channels[0]);
+
+		const uint32 cycles = frame_cycles();
+		core::u64 calls = 0;
+
+		m_mixer.ClearBuffer();
+		TraceRandom r(6);
+		for (unsigned int frame = 0; frame < FRAMES; frame++)
+		{
+			timer.start();
+			int c = 0;
+			for (uint32 t = 0; t < cycles; t += 16)
+			{
+				int value = r.next() & 0x0F;
+				m_mixer.AddValue(channels[c][0], channels[c][1], value, value, t);
+				c = (c + 1) % count;
+				calls++;
+			}
+			timer.stop();
+
+			int avail = m_mixer.FinishBuffer(cycles);
+			m_mixer.ReadBuffer(avail, m_buffer, false);
+		}
+
+		return calls;
+	}
+private:
+	CMixer m_mixer;
+	core::s16 *m_buffer;
+};
+
+void addAPUBenchmarks(std::vector<Benchmark*> &b)
+{
+	b.push_back(new SquareBenchmark);
+	b.push_back(new TriangleBenchmark);
+	b.push_back(new NoiseBenchmark);
+	b.push_back(new DPCMBenchmark);
+	b.push_back(new VRC6Benchmark);
+	b.push_back(new VRC7Benchmark);
+	b.push_back(new OPLLBenchmark);
+	b.push_back(new FDSBenchmark);
+	b.push_back(new FDSSoundBenchmark(false));
+	b.push_back(new FDSSoundBenchmark(true));
+	b.push_back(new MMC5Benchmark);
+	b.push_back(new N106Benchmark);
+	b.push_back(new BlipSynthBenchmark);
+	b.push_back(new BlipReadBenchmark(false));
+	b.push_back(new BlipReadBenchmark(true));
+	b.push_back(new MixerBenchmark);
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include "Benchmark.hpp"
+#include "core/profile.hpp"
+#include "../version.hpp"
+
+void BenchTimer::start()
+{
+	m_start = core::profileNanoseconds();
+}
+
+void BenchTimer::stop()
+{
+	m_ns += core::profileNanoseconds() - m_start;
+}
+
+void runBenchmark(Benchmark *b, unsigned int min_ms, unsigned int min_batches, benchresult_t &r)
+{
+	// the first batch warms up caches and lazily made tables, it isn't counted
+	{
+		BenchTimer warmup;
+		b->run(warmup);
+	}
+
+	std::vector<double> ns_per_unit;
+	core::u64 total_ns = 0;
+	core::u64 units = 0;
+	while (total_ns < (core::u64)min_ms * 1000000 || ns_per_unit.size() < min_batches)
+	{
+		BenchTimer timer;
+		units = b->run(timer);
+		total_ns += timer.ns();
+		ns_per_unit.push_back(units > 0 ? (double)timer.ns() / units : 0.0);
+
+		// a batch that takes no time would never end the loop
+		if (timer.ns() == 0 && ns_per_unit.size() >= min_batches)
+			break;
+	}
+
+	std::sort(ns_per_unit.begin(), ns_per_unit.end());
+
+	r.name = b->name();
+	r.unit = b->unit();
+	r.batches = ns_per_unit.size();
+	r.units = units;
+	r.median_ns = ns_per_unit[ns_per_unit.size() / 2];
+	r.best_ns = ns_per_unit.front();
+	r.worst_ns = ns_per_unit.back();
+}
+
+// Names are file names and fixed strings, only quotes and backslashes need
+// escaping
+static std::string json_string(const std::string &s)
+{
+	std::string j = "\"";
+	for (unsigned int i = 0; i < s.size(); i++)
+	{
+		if (s[i] == '"' || s[i] == '\\')
+			j += '\\';
+		j += s[i];
+	}
+	j += '"';
+	return j;
+}
+
+void writeResults(FILE *f, const std::string &label, const std::vector<benchresult_t> &results)
+{
+	fprintf(f, "{\n");
+	fprintf(f, "  \"version\": %s,\n", json_string(VERSION_STRING).c_str());
+	fprintf(f, "  \"label\": %s,\n", json_string(label).c_str());
+	fprintf(f, "  \"benchmarks\": [\n");
+	for (unsigned int i = 0; i < results.size(); i++)
+	{
+		const benchresult_t &r = results[i];
+		double per_second = r.median_ns > 0 ? 1e9 / r.median_ns : 0.0;
+		fprintf(f, "    {\"name\": %s, \"unit\": %s, \"units_per_batch\": %llu, \"batches\": %u, "
+				"\"ns_per_unit\": %.4f, \"best_ns_per_unit\": %.4f, \"worst_ns_per_unit\": %.4f, "
+				"\"units_per_second\": %.1f}%s\n",
+				json_string(r.name).c_str(), json_string(r.unit).c_str(), (unsigned long long)r.units,
+				r.batches, r.median_ns, r.best_ns, r.worst_ns, per_second,
+				i+1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+}
@@ -0,0 +1,72 @@
+#ifndef _BENCHMARK_HPP_
+#define _BENCHMARK_HPP_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "core/types.hpp"
+
+// Times only what's between start() and stop(), a batch may start and stop
+// it many times
+class BenchTimer
+{
+public:
+	BenchTimer() : m_ns(0), m_start(0){ }
+
+	void start();
+	void stop();
+	core::u64 ns() const{ return m_ns; }
+private:
+	core::u64 m_ns;
+	core::u64 m_start;
+};
+
+/*
+ * A benchmark does the same batch of work every time run() is called, and
+ * returns how many units of work it was (cycles, samples, bytes...), so
+ * results compare across machines and inputs as time per unit.
+ * Setting up the batch, like writing the registers of a synthetic trace,
+ * is left out of the timer.
+ */
+class Benchmark
+{
+public:
+	Benchmark(const std::string &name, const char *unit)
+		: m_name(name), m_unit(unit)
+	{
+	}
+	virtual ~Benchmark(){ }
+
+	virtual core::u64 run(BenchTimer &timer) = 0;
+
+	const std::string & name() const{ return m_name; }
+	const char * unit() const{ return m_unit; }
+private:
+	std::string m_name;
+	const char *m_unit;
+};
+
+struct benchresult_t
+{
+	std::string name;
+	const char *unit;
+	unsigned int batches;
+	core::u64 units;			// of one batch
+	double median_ns;			// per unit, of the batches
+	double best_ns;
+	double worst_ns;
+};
+
+// Runs batches until at least min_ms have been timed and there were at
+// least min_batches
+void runBenchmark(Benchmark *b, unsigned int min_ms, unsigned int min_batches, benchresult_t &r);
+
+// One JSON document with every result, for tracking them across commits.
+// label names the run, like the commit it was built from
+void writeResults(FILE *f, const std::string &label, const std::vector<benchresult_t> &results);
+
+void addAPUBenchmarks(std::vector<Benchmark*> &b);
+// A read and a render benchmark for each module
+void addDocumentBenchmarks(std::vector<Benchmark*> &b, const std::vector<std::string> &files);
+
+#endif
@@ -0,0 +1,157 @@
+#include "Benchmark.hpp"
+#include "core/io.hpp"
+#include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/SoundGen.hpp"
+#include "famitracker-core/TrackerController.hpp"
+
+// Renders are only timed, the samples are thrown away
+class NullOutput : public core::SoundSinkExport
+{
+public:
+	NullOutput(int channels, int sampleRate)
+		: core::SoundSinkExport(NULL, sampleRate, channels)
+	{
+	}
+
+	void flushBuffer(core::s16 *, core::u32){ }
+	void flush(){ }
+};
+
+static std::string base_name(const std::string &file)
+{
+	std::string::size_type slash = file.find_last_of("/\\");
+	return slash == std::string::npos ? file : file.substr(slash+1);
+}
+
+// Every module of the corpus is read from memory, so the disk isn't timed
+class ReadBenchmark : public Benchmark
+{
+public:
+	ReadBenchmark()
+		: Benchmark("document/FtmDocument::read", "byte")
+	{
+	}
+	~ReadBenchmark()
+	{
+		for (unsigned int i = 0; i < m_modules.size(); i++)
+			delete m_modules[i];
+	}
+
+	void add(const std::string &file)
+	{
+		core::FileIO io(file.c_str(), core::IO_READ);
+		core::MemoryIO *mem = new core::MemoryIO;
+
+		char buf[4096];
+		core::Quantity sz;
+		while ((sz = io.read(buf, sizeof(buf))) > 0)
+			mem->write(buf, sz);
+
+		m_modules.push_back(mem);
+	}
+	bool empty() const{ return m_modules.empty(); }
+
+	core::u64 run(BenchTimer &timer)
+	{
+		core::u64 bytes = 0;
+		for (unsigned int i = 0; i < m_modules.size(); i++)
+		{
+			core::MemoryIO *mem = m_modules[i];
+			mem->seek(0, core::IO_SEEK_SET);
+
+			FtmDocument *doc = new FtmDocument;
+			timer.start();
+			doc->read(mem);
+			timer.stop();
+			delete doc;
+
+			bytes += mem->size();
+		}
+		return bytes;
+	}
+private:
+	std::vector<core::MemoryIO*> m_modules;
+};
+
+// The first track of a module, played through once
+class RenderBenchmark : public Benchmark
+{
+public:
+	RenderBenchmark(const std::string &file, FtmDocument *doc)
+		: Benchmark("render/" + base_name(file), "sample"), m_doc(doc)
+	{
+	}
+	~RenderBenchmark()
+	{
+		delete m_doc;
+	}
+
+	core::u64 run(BenchTimer &timer)
+	{
+		SoundGen *sg = new SoundGen;
+		NullOutput *out = new NullOutput(1, 48000);
+
+		sg->setSoundSink(out);
+		sg->setDocument(m_doc, 0);
+		sg->setRenderEnd(SONG_LOOP_LIMIT, 1);
+		sg->trackerController()->startAt(0, 0);
+		sg->startTracker();
+
+		timer.start();
+		out->render();
+		timer.stop();
+
+		core::u64 samples = out->renderedSamples();
+
+		delete sg;
+		delete out;
+
+		return samples;
+	}
+private:
+	FtmDocument *m_doc;
+};
+
+void addDocumentBenchmarks(std::vector<Benchmark*> &b, const std::vector<std::string> &files)
+{
+	ReadBenchmark *read = new ReadBenchmark;
+	std::vector<Benchmark*> renders;
+
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		// modules that can't be read are left out of the corpus
+		FtmDocument *doc = new FtmDocument;
+		{
+			core::MappedFileIO io(files[i].c_str());
+			if (!io.isReadable())
+			{
+				fprintf(stderr, "Cannot open file: %s\n", files[i].c_str());
+				delete doc;
+				continue;
+			}
+
+			try
+			{
+				doc->read(&io);
+			}
+			catch (const FtmDocumentException &e)
+			{
+				fprintf(stderr, "Could not open file: %s\n%s\n", files[i].c_str(), e.what());
+				delete doc;
+				continue;
+			}
+		}
+
+		read->add(files[i]);
+		renders.push_back(new RenderBenchmark(files[i], doc));
+	}
+
+	if (read->empty())
+	{
+		delete read;
+		return;
+	}
+
+	b.push_back(read);
+	b.insert(b.end(), renders.begin(), renders.end());
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "Benchmark.hpp"
+#include "../parse_arguments.hpp"
+
+struct arguments_t
+{
+	bool help;
+	bool list;
+
+	std::string filter;
+	std::string output;
+	std::string label;
+	int ms;
+	int batches;
+	std::vector<std::string> files;
+};
+
+static void parse_arguments(int argc, char *argv[], arguments_t &a)
+{
+	ParseArguments pa;
+	const char *flagfields[] = {"-help", "-list"};
+	pa.setFlagFields(flagfields, 2);
+	pa.parse(argv, argc);
+
+	a.help = pa.flag("-help");
+
+	if (a.help)
+		return;
+
+	a.list = pa.flag("-list");
+	a.filter = pa.string("filter", "");
+	a.output = pa.string("o", "");
+	a.label = pa.string("label", "");
+	a.ms = pa.integer("ms", 500);
+	a.batches = pa.integer("batches", 3);
+
+	for (int i = 0; i < pa.argumentCount(); i++)
+	{
+		a.files.push_back(pa.string(i));
+	}
+}
+
+static void print_help()
+{
+	printf(
+"Usage: app [MODULE...] [-filter TEXT] [-ms MILLISECONDS] [-batches BATCHES]\n"
+"           [-o OUTPUT] [-label LABEL] [--list] [--help]\n\n"
+"Benchmarks the APU chips, the mixer and Blip_Buffer on synthetic register\n"
+"traces, and reading and rendering the given modules. The results are\n"
+"written as JSON, the time of each benchmark is per unit of its work.\n\n"
+"    -filter TEXT\n"
+"        Only run the benchmarks whose name contains TEXT. (eg. -filter apu/)\n"
+"    -ms MILLISECONDS\n"
+"        Time each benchmark for at least MILLISECONDS. Default is 500.\n"
+"    -batches BATCHES\n"
+"        Run each benchmark at least BATCHES times. Default is 3.\n"
+"    -o OUTPUT\n"
+"        Write the results to OUTPUT instead of the standard output.\n"
+"    -label LABEL\n"
+"        Name the run in the results, like the commit it was built from.\n"
+"    --list\n"
+"        Print the names of the benchmarks and exit\n"
+"    --help\n"
+"        Print this message\n\n"
+"MODULE is a FamiTracker module. They are read as one corpus, and the first\n"
+"track of each is rendered once through.\n"
+	);
+}
+
+int main(int argc, char *argv[])
+{
+	arguments_t args;
+	parse_arguments(argc-1, argv+1, args);
+
+	if (args.help)
+	{
+		print_help();
+		return 0;
+	}
+
+	std::vector<Benchmark*> benchmarks;
+	addAPUBenchmarks(benchmarks);
+	addDocumentBenchmarks(benchmarks, args.files);
+
+	std::vector<Benchmark*> selected;
+	for (unsigned int i = 0; i < benchmarks.size(); i++)
+	{
+		if (benchmarks[i]->name().find(args.filter) != std::string::npos)
+			selected.push_back(benchmarks[i]);
+	}
+
+	if (args.list)
+	{
+		for (unsigned int i = 0; i < selected.size(); i++)
+			printf("%s\n", selected[i]->name().c_str());
+	}
+	else
+	{
+		FILE *f = stdout;
+		if (!args.output.empty())
+		{
+			f = fopen(args.output.c_str(), "w");
+			if (f == NULL)
+			{
+				fprintf(stderr, "Cannot write to file: %s\n", args.output.c_str());
+				return 1;
+			}
+		}
+
+		// progress goes to stderr, so stdout is only the results
+		std::vector<benchresult_t> results(selected.size());
+		for (unsigned int i = 0; i < selected.size(); i++)
+		{
+			benchresult_t &r = results[i];
+			runBenchmark(selected[i], args.ms, args.batches, r);
+			fprintf(stderr, "%-48s %12.3f ns/%s (%u batches)\n", r.name.c_str(), r.median_ns, r.unit, r.batches);
+		}
+
+		writeResults(f, args.label, results);
+
+		if (f != stdout)
+			fclose(f);
+	}
+
+	for (unsigned int i = 0; i < benchmarks.size(); i++)
+		delete benchmarks[i];
+
+	return 0;
+}
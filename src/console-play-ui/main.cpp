@@ -1,61 +1,164 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <vector>
 #include "famitracker-core/App.hpp"
 #include "famitracker-core/Document.hpp"
 #include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/NSFPlayer.hpp"
 #include "famitracker-core/SoundGen.hpp"
 #include "famitracker-core/TrackerController.hpp"
+#include "famitracker-core/wavoutput.hpp"
+#include "core/profile.hpp"
 #include "../parse_arguments.hpp"
 #include "../defaults.hpp"
 
 const char *default_sound=DEFAULT_SOUND;
 
+// --stats, the playback status shows the counters too
+static bool show_stats = false;
+
 struct arguments_t
 {
 	bool help;
+	bool stats;
 
 	int track;
 	int sampleRate;
+	int channels;
+	std::string pan;
 	std::string sound;
 	std::string file;
+	std::string wav;
+	int loops;
+	int seconds;
 };
 
 static void parse_arguments(int argc, char *argv[], arguments_t &a)
 {
 	ParseArguments pa;
-	const char *flagfields[] = {"-help"};
-	pa.setFlagFields(flagfields, 1);
+	const char *flagfields[] = {"-help", "-stats"};
+	pa.setFlagFields(flagfields, 2);
 	pa.parse(argv, argc);
 
 	a.help = pa.flag("-help");
+	a.stats = pa.flag("-stats");
 
 	if (a.help)
 		return;
 
-	a.track = pa.integer("t", 1);
+	a.track = pa.integer("t", 0);
 	a.sampleRate = pa.integer("sr", 48000);
+	a.channels = pa.integer("channels", 1) == 2 ? 2 : 1;
+	a.pan = pa.string("pan", "");
 	a.sound = pa.string("sound", default_sound);
+	a.wav = pa.string("wav", "");
+	a.loops = pa.integer("loops", 1);
+	a.seconds = pa.integer("seconds", 0);
 	a.file = pa.string(0);
 }
 
 static void print_help()
 {
 	printf(
-"Usage: app FILE [-t TRACK] [-sr SAMPLERATE] [-sound ENGINE] [--help]\n\n"
+"Usage: app FILE [-t TRACK] [-sr SAMPLERATE] [-sound ENGINE] [-wav OUTPUT]\n"
+"           [-channels CHANNELS] [-pan PAN[,PAN...]]\n"
+"           [-loops LOOPS] [-seconds SECONDS] [--stats] [--help]\n\n"
 "    -t TRACK\n"
-"        Select the track number to play. 1 is the first song.\n"
+"        Select the track number to play. 1 is the first song. Default is 1,\n"
+"        or the start song of an NSF.\n"
 "    -sr SAMPLERATE\n"
 "        Set the playback sample rate in herz. Default is 48000.\n"
 "    -sound ENGINE\n"
 "        Specify which sound engine to use. This will load a module\n"
 "        in your PATH named " SOUNDSINKLIB_FORMAT ". Default is " DEFAULT_SOUND ".\n"
 "        (eg. -sound jack)\n"
+"    -wav OUTPUT\n"
+"        Render the track to a WAV file instead of playing it. Rendering\n"
+"        is not tied to realtime and runs as fast as possible.\n"
+"    -channels CHANNELS\n"
+"        1 for mono or 2 for stereo output. Default is 1.\n"
+"    -pan PAN[,PAN...]\n"
+"        Pan of each channel in stereo, from -100 (left) to 100 (right).\n"
+"        Channels without a value stay centered. (eg. -pan -50,50,0,0,0)\n"
+"    -loops LOOPS\n"
+"        When rendering, stop after the song loops LOOPS times. Default is 1.\n"
+"    -seconds SECONDS\n"
+"        When rendering, stop after SECONDS seconds. Overrides -loops.\n"
+"        NSFs don't loop, they are rendered for 120 seconds by default.\n"
+"    --stats\n"
+"        Show the frame time and underruns while playing, and where the\n"
+"        time of the render pipeline went at the end. Needs a build with\n"
+"        cmake -DPROFILING=ON\n"
 "    --help\n"
-"        Print this message\n",
+"        Print this message\n\n"
+"FILE is a FamiTracker module, or an NSF file when it ends in .nsf\n",
 
 				"ENGINE"
 	);
 }
 
+static const core::profile_snapshot_t * find_counter(const std::vector<core::profile_snapshot_t> &s, const char *name)
+{
+	for (unsigned int i = 0; i < s.size(); i++)
+	{
+		if (s[i].name == name)
+			return &s[i];
+	}
+	return NULL;
+}
+
+// Appended to the playback status line
+static void print_stats_status()
+{
+	std::vector<core::profile_snapshot_t> s;
+	core::profileSnapshot(s);
+
+	const core::profile_snapshot_t *frame = find_counter(s, "frame");
+	const core::profile_snapshot_t *underruns = find_counter(s, "soundgen/rowframe queue underruns");
+	const core::profile_snapshot_t *fill = find_counter(s, "soundgen/sound queue fill (samples)");
+	if (frame != NULL)
+		printf(" frame %5.1f us, max %5.1f", frame->average() / 1000, frame->max / 1000.0);
+	if (fill != NULL)
+		printf(", queue %4llu", (unsigned long long)fill->last);
+	if (underruns != NULL)
+		printf(", %llu underruns", (unsigned long long)underruns->count);
+}
+
+static void print_stats()
+{
+	if (!core::profileEnabled())
+	{
+		printf("No stats, the counters were compiled out. Build with cmake -DPROFILING=ON\n");
+		return;
+	}
+
+	std::vector<core::profile_snapshot_t> s;
+	core::profileSnapshot(s);
+
+	// times are in us, levels as they are, events only count
+	printf("\n%-56s %9s %10s %10s %10s %10s\n", "counter", "count", "avg", "p50", "p99", "max");
+	for (unsigned int i = 0; i < s.size(); i++)
+	{
+		const core::profile_snapshot_t &c = s[i];
+		if (c.count == 0)
+			continue;
+
+		printf("%-56s %9llu", c.name.c_str(), (unsigned long long)c.count);
+		if (c.kind == core::PROFILE_TIME)
+		{
+			printf(" %10.1f %10.1f %10.1f %10.1f", c.average() / 1000, c.percentile(0.5) / 1000.0,
+				   c.percentile(0.99) / 1000.0, c.max / 1000.0);
+		}
+		else if (c.kind == core::PROFILE_LEVEL)
+		{
+			printf(" %10.1f %10llu %10llu %10llu", c.average(), (unsigned long long)c.percentile(0.5),
+				   (unsigned long long)c.percentile(0.99), (unsigned long long)c.max);
+		}
+		printf("\n");
+	}
+}
+
 static void tracker_update(SoundGen::rowframe_t rf, FtmDocument *doc, void *)
 {
 	if (!rf.rowframe_changed)
@@ -67,8 +170,186 @@ static void tracker_update(SoundGen::rowframe_t rf, FtmDocument *doc, void *)
 	{
 		printf("%02X ", doc->GetPatternAtFrame(frame, i));
 	}
-	printf("]\r");
+	printf("]");
+	if (show_stats)
+		print_stats_status();
+	printf("\r");
+	fflush(stdout);
+}
+
+// Applies a comma separated list of pans, one per channel of the module,
+// from -100 (left) to 100 (right)
+static void apply_pan(SoundGen *sg, const std::string &pan)
+{
+	std::string::size_type pos = 0;
+	unsigned int channel = 0;
+	while (pos < pan.size())
+	{
+		std::string::size_type comma = pan.find(',', pos);
+		if (comma == std::string::npos)
+			comma = pan.size();
+
+		if (comma > pos)
+			sg->setChannelPan(channel, atoi(pan.substr(pos, comma-pos).c_str()));
+
+		channel++;
+		pos = comma+1;
+	}
+}
+
+static int render_wav(FtmDocument &doc, const arguments_t &args)
+{
+	core::FileIO wav_io(args.wav.c_str(), core::IO_WRITE);
+	if (!wav_io.isWritable())
+	{
+		printf("Cannot write to file: %s\n", args.wav.c_str());
+		return 1;
+	}
+
+	WavOutput *out = new WavOutput(&wav_io, args.channels, args.sampleRate);
+
+	SoundGen *sg = new SoundGen;
+	sg->setSoundSink(out);
+	sg->setDocument(&doc);
+	apply_pan(sg, args.pan);
+	if (args.seconds > 0)
+		sg->setRenderEnd(SONG_TIME_LIMIT, args.seconds);
+	else
+		sg->setRenderEnd(SONG_LOOP_LIMIT, args.loops);
+
+	sg->trackerController()->startAt(0, 0);
+	sg->startTracker();
+	out->render();
+	out->finalize();
+
+	printf("Rendered %.2f seconds in %.2f seconds (%.1fx realtime)\n",
+		   (double)out->renderedSamples() / out->sampleRate(),
+		   out->renderSeconds(), out->realtimeMultiple());
+	if (args.stats)
+		print_stats();
+
+	delete sg;
+	delete out;
+
+	return 0;
+}
+
+static const int NSF_DEFAULT_SECONDS = 120;
+
+static bool is_nsf(const std::string &file)
+{
+	if (file.size() < 4)
+		return false;
+
+	std::string ext = file.substr(file.size()-4);
+	for (unsigned int i = 0; i < ext.size(); i++)
+		ext[i] = tolower(ext[i]);
+
+	return ext == ".nsf";
+}
+
+static void nsf_update(unsigned int frame, void *data)
+{
+	const NSFPlayer *player = (const NSFPlayer*)data;
+
+	unsigned int seconds = (unsigned int)(frame / player->frameRate());
+	printf("[ %02u:%02u ]", seconds / 60, seconds % 60);
+	if (show_stats)
+		print_stats_status();
+	printf("\r");
+	fflush(stdout);
+}
+
+static int play_nsf(const arguments_t &args)
+{
+	NSFPlayer player;
+	{
+		core::FileIO nsf_io(args.file.c_str(), core::IO_READ);
+		if (!nsf_io.isReadable())
+		{
+			printf("Cannot open file\n");
+			return 1;
+		}
+
+		try
+		{
+			player.load(&nsf_io);
+		}
+		catch (const NSFException &e)
+		{
+			fprintf(stderr, "Could not open file: %s\n%s\n", args.file.c_str(), e.what());
+			return 1;
+		}
+	}
+
+	unsigned int song = args.track > 0 ? args.track-1 : player.startSong();
+	if (song >= player.songCount())
+	{
+		fprintf(stderr, "No track %u (file has %u)\n", song+1, player.songCount());
+		return 1;
+	}
+
+	printf("Name: %s\nArtist: %s\nCopyright: %s\n", player.title(), player.artist(), player.copyright());
+	printf("Track %u/%u\n", song+1, player.songCount());
+	printf("Rate: %.2f Hz%s\n\n", player.frameRate(), player.isPAL() ? " (PAL)" : "");
+
+	if (!args.wav.empty())
+	{
+		core::FileIO wav_io(args.wav.c_str(), core::IO_WRITE);
+		if (!wav_io.isWritable())
+		{
+			printf("Cannot write to file: %s\n", args.wav.c_str());
+			return 1;
+		}
+
+		WavOutput *out = new WavOutput(&wav_io, args.channels, args.sampleRate);
+
+		int seconds = args.seconds > 0 ? args.seconds : NSF_DEFAULT_SECONDS;
+		player.setSoundSink(out);
+		player.setRenderEnd((unsigned int)(seconds * player.frameRate() + 0.5));
+
+		player.start(song);
+		out->render();
+		out->finalize();
+
+		printf("Rendered %.2f seconds in %.2f seconds (%.1fx realtime)\n",
+			   (double)out->renderedSamples() / out->sampleRate(),
+			   out->renderSeconds(), out->realtimeMultiple());
+		printf("PLAY used %.1f%% of the CPU\n", 100.0 * player.playLoad());
+		if (args.stats)
+			print_stats();
+
+		player.setSoundSink(NULL);
+		delete out;
+
+		return 0;
+	}
+
+	core::SoundSinkPlayback *sink = (core::SoundSinkPlayback*)core::loadSoundSink(args.sound.c_str());
+	if (sink == NULL)
+	{
+		return 1;
+	}
+	sink->initialize(48000, args.channels, 150);
+
+	player.setSoundSink(sink);
+	player.setPlayerUpdate(nsf_update, &player);
+	if (args.seconds > 0)
+		player.setRenderEnd((unsigned int)(args.seconds * player.frameRate() + 0.5));
+
+	player.start(song);
+	sink->blockUntilStopped();
+	sink->blockUntilTimerEmpty();
+
+	player.setSoundSink(NULL);
+	delete sink;
+
 	fflush(stdout);
+	printf("\n");
+	if (args.stats)
+		print_stats();
+
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -85,6 +366,7 @@ int main(int argc, char *argv[])
 		print_help();
 		return 0;
 	}
+	show_stats = args.stats;
 
 	if (args.file.empty())
 	{
@@ -96,12 +378,17 @@ int main(int argc, char *argv[])
 	{
 		song = args.file.c_str();
 	}
-	track = args.track;
+	if (is_nsf(args.file))
+	{
+		return play_nsf(args);
+	}
+
+	track = args.track > 0 ? args.track : 1;
 	sound = args.sound.c_str();
 
 	FtmDocument doc;
 	{
-		core::FileIO ftm_io(song, core::IO_READ);
+		core::MappedFileIO ftm_io(song);
 		if (!ftm_io.isReadable())
 		{
 			printf("Cannot open file\n");
@@ -124,6 +411,12 @@ int main(int argc, char *argv[])
 	printf("Name: %s\nArtist: %s\nCopyright: %s\n", doc.GetSongName(), doc.GetSongArtist(), doc.GetSongCopyright());
 	printf("Track %u/%u: %s\n", track, doc.GetTrackCount(), doc.GetTrackTitle(track-1));
 	printf("BPM: %u [Tempo: %u, Speed: %u]\n\n", doc.GetSongTempo()*6/doc.GetSongSpeed(), doc.GetSongTempo(), doc.GetSongSpeed());
+
+	if (!args.wav.empty())
+	{
+		return render_wav(doc, args);
+	}
+
 	{
 		unsigned int rate = 48000;
 
@@ -132,11 +425,12 @@ int main(int argc, char *argv[])
 		{
 			return 1;
 		}
-		sink->initialize(rate, 1, 150);
+		sink->initialize(rate, args.channels, 150);
 
 		SoundGen *sg = new SoundGen;
 		sg->setSoundSink(sink);
 		sg->setDocument(&doc);
+		apply_pan(sg, args.pan);
 		sg->setTrackerUpdate(tracker_update);
 
 		sg->trackerController()->startAt(0, 0);
@@ -149,6 +443,8 @@ int main(int argc, char *argv[])
 
 		fflush(stdout);
 		printf("\n");
+		if (args.stats)
+			print_stats();
 	}
 
 	return 0;
@@ -0,0 +1,1275 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include "famitracker-core/App.hpp"
+#include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/Compiler.h"
+#include "famitracker-core/NSFPlayer.hpp"
+#include "famitracker-core/RegisterPlayer.hpp"
+#include "famitracker-core/RegisterStream.hpp"
+#include "famitracker-core/SoundGen.hpp"
+#include "famitracker-core/TrackerController.hpp"
+#include "famitracker-core/VGMExport.hpp"
+#include "famitracker-core/wavoutput.hpp"
+#include "core/io.hpp"
+#include "core/memoryoutput.hpp"
+#include "core/time.hpp"
+#include "../parse_arguments.hpp"
+
+struct arguments_t
+{
+	bool help;
+	bool nsf;
+	bool verify;
+	bool info;
+	bool regs;
+	bool vgm;
+	bool queue;
+	bool stats;
+
+	int jobs;
+	int sampleRate;
+	int channels;
+	std::string pan;
+	int loops;
+	int seconds;
+	std::string outdir;
+	std::vector<std::string> files;
+};
+
+// A module the jobs render tracks of. The first worker to render one of its
+// tracks loads it, the workers rendering the others share it, and the last
+// one frees it
+struct module_t
+{
+	std::string file;
+	boost::mutex mtx;
+	bool loaded;
+	FtmDocument *doc;		// NULL if not loaded, or it didn't load
+	unsigned int jobs_left;
+};
+
+struct job_t
+{
+	std::string file;
+	module_t *module;		// NULL if file is a register write stream
+	unsigned int track;		// 0 is the first song
+	std::string output;
+	std::string regs;		// with -regs
+
+	bool ok;
+	double audio_s;
+	double render_s;
+	SoundGen::songinfo_t info;		// with -info
+	vgminfo_t vgm;					// with -vgm
+	SoundGen::framestats_t stats;	// of renders
+};
+
+static void parse_arguments(int argc, char *argv[], arguments_t &a)
+{
+	ParseArguments pa;
+	const char *flagfields[] = {"-help", "nsf", "verify", "info", "regs", "vgm", "queue", "-stats"};
+	pa.setFlagFields(flagfields, 8);
+	pa.parse(argv, argc);
+
+	a.help = pa.flag("-help");
+
+	if (a.help)
+		return;
+
+	a.nsf = pa.flag("nsf");
+	a.verify = pa.flag("verify");
+	a.info = pa.flag("info");
+	a.regs = pa.flag("regs");
+	a.vgm = pa.flag("vgm");
+	a.queue = pa.flag("queue");
+	a.stats = pa.flag("-stats");
+	a.jobs = pa.integer("j", boost::thread::hardware_concurrency());
+	a.sampleRate = pa.integer("sr", 48000);
+	a.channels = pa.integer("channels", 1) == 2 ? 2 : 1;
+	a.pan = pa.string("pan", "");
+	a.loops = pa.integer("loops", 1);
+	a.seconds = pa.integer("seconds", 0);
+	a.outdir = pa.string("o", ".");
+
+	for (int i = 0; i < pa.argumentCount(); i++)
+	{
+		a.files.push_back(pa.string(i));
+	}
+}
+
+static void print_help()
+{
+	printf(
+"Usage: app FILE[:TRACK[,TRACK...]]... [-j JOBS] [-o DIRECTORY]\n"
+"           [-sr SAMPLERATE] [-channels CHANNELS] [-pan PAN[,PAN...]]\n"
+"           [-loops LOOPS] [-seconds SECONDS] [-nsf [-verify]] [-info]\n"
+"           [-regs] [-vgm] [-queue] [--stats] [--help]\n\n"
+"Renders tracks of one or more modules to WAV files, without realtime\n"
+"playback. All tracks of a module are rendered unless TRACK is given.\n"
+"Output files are named FILE-TRACK.wav. Register write streams (FILE.regs)\n"
+"are played back to FILE.wav.\n\n"
+"    -j JOBS\n"
+"        Number of tracks to render at the same time. Default is the number\n"
+"        of processors.\n"
+"    -o DIRECTORY\n"
+"        Directory to write the WAV files to. Default is the current directory.\n"
+"    -sr SAMPLERATE\n"
+"        Set the sample rate in herz. Default is 48000.\n"
+"    -channels CHANNELS\n"
+"        1 for mono or 2 for stereo output. Default is 1.\n"
+"    -pan PAN[,PAN...]\n"
+"        Pan of each channel in stereo, from -100 (left) to 100 (right).\n"
+"        Channels without a value stay centered. (eg. -pan -50,50,0,0,0)\n"
+"    -loops LOOPS\n"
+"        Stop after the song loops LOOPS times. Default is 1.\n"
+"    -seconds SECONDS\n"
+"        Stop after SECONDS seconds. Overrides -loops.\n"
+"    -nsf\n"
+"        Export each module to FILE.nsf instead of rendering, and print the\n"
+"        size and compile time of each part of the music data.\n"
+"    -verify\n"
+"        With -nsf, play every track of the exported NSF and compare what\n"
+"        each channel plays in every frame to the tracker. Fails if more\n"
+"        than 5%% of the frames differ. The loudness of the two renders is\n"
+"        printed too, in dB below the signal, higher is closer.\n"
+"    -info\n"
+"        Print the length and loop point of each track, and how many notes\n"
+"        each channel plays, instead of rendering. Nothing is synthesized,\n"
+"        so this is much faster than rendering.\n"
+"    -regs\n"
+"        Also write the register writes of each track to FILE-TRACK.regs.\n"
+"        The stream can be rendered again at another sample rate or channel\n"
+"        count, without the module. -pan doesn't apply to streams.\n"
+"    -vgm\n"
+"        Export each track to FILE-TRACK.vgm instead of rendering. Songs\n"
+"        that loop get a loop point. VRC6, MMC5 and N106 aren't in VGM and\n"
+"        are left out.\n"
+"    -queue\n"
+"        Queue the register writes of each frame and make them in one pass,\n"
+"        instead of processing the APU up to each write as the channels make\n"
+"        it. The sound is the same. Compare with --stats.\n"
+"    --stats\n"
+"        Print the render time, APU processing calls and APU runs per frame\n"
+"        of each track.\n"
+"    --help\n"
+"        Print this message\n"
+	);
+}
+
+static std::string output_base(const arguments_t &args, const std::string &file)
+{
+	std::string base = file;
+
+	std::string::size_type slash = base.find_last_of('/');
+	if (slash != std::string::npos)
+		base = base.substr(slash+1);
+
+	std::string::size_type dot = base.find_last_of('.');
+	if (dot != std::string::npos && dot > 0)
+		base = base.substr(0, dot);
+
+	return args.outdir + "/" + base;
+}
+
+static std::string output_name(const arguments_t &args, const std::string &file, unsigned int track,
+							   const char *extension = ".wav")
+{
+	char suffix[16];
+	sprintf(suffix, "-%02u", track+1);
+
+	return output_base(args, file) + suffix + extension;
+}
+
+static bool is_register_stream(const std::string &file)
+{
+	const std::string extension = ".regs";
+	return file.size() > extension.size() &&
+		file.compare(file.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// threads decode the patterns, when nothing else is running
+static bool read_document(FtmDocument &doc, const std::string &file, unsigned int threads = 1)
+{
+	core::MappedFileIO ftm_io(file.c_str());
+	if (!ftm_io.isReadable())
+	{
+		fprintf(stderr, "Cannot open file: %s\n", file.c_str());
+		return false;
+	}
+
+	try
+	{
+		doc.read(&ftm_io, threads);
+	}
+	catch (const FtmDocumentException &e)
+	{
+		fprintf(stderr, "Could not open file: %s\n%s\n", file.c_str(), e.what());
+		return false;
+	}
+
+	return true;
+}
+
+// RMS of each window of the given size
+static std::vector<double> envelope(const std::vector<core::s16> &samples, core::u64 count, unsigned int window)
+{
+	std::vector<double> env;
+	for (core::u64 start = 0; start + window <= count; start += window)
+	{
+		double sum = 0.0;
+		for (core::u64 i = start; i < start + window; i++)
+			sum += (double)samples[i] * samples[i];
+		env.push_back(sqrt(sum / window));
+	}
+	return env;
+}
+
+// The registers of the sound chips, as far as the channels' sound goes
+class ChipRegisters
+{
+public:
+	ChipRegisters() : m_vrc7Address(0)
+	{
+		memset(m_regs, 0, sizeof(m_regs));
+		memset(m_vrc7, 0, sizeof(m_vrc7));
+	}
+
+	void write(core::u16 address, core::u8 value)
+	{
+		// VRC7 registers are written through an address and a data port
+		if (address == 0x9010)
+			m_vrc7Address = value & 0x3F;
+		else if (address == 0x9030)
+			m_vrc7[m_vrc7Address] = value;
+		else
+			m_regs[address] = value;
+	}
+
+	core::u8 reg(core::u16 address) const{ return m_regs[address]; }
+	core::u8 vrc7(unsigned int address) const{ return m_vrc7[address]; }
+private:
+	core::u8 m_regs[0x10000];
+	core::u8 m_vrc7Address;
+	core::u8 m_vrc7[0x40];
+};
+
+// What a channel plays, the rest is 0 while it's not heard
+struct chanstate_t
+{
+	bool on;
+	core::u32 timbre;		// duty, mode, instrument or octave
+	core::u32 volume;
+	core::u32 pitch;		// period or frequency
+	core::u32 wrap;			// pitches wrap around at this, if not 0
+};
+
+static chanstate_t silent_channel()
+{
+	chanstate_t c = {false, 0, 0, 0, 0};
+	return c;
+}
+
+static chanstate_t pulse_state(const ChipRegisters &r, core::u16 base)
+{
+	chanstate_t c = silent_channel();
+	if (r.reg(base) & 0x0F)
+	{
+		c.on = true;
+		c.timbre = r.reg(base) & 0xF0;
+		c.volume = r.reg(base) & 0x0F;
+		c.pitch = r.reg(base+2) | ((r.reg(base+3) & 0x07) << 8);
+	}
+	return c;
+}
+
+// The state of every channel that the tracker plays. N106 and 5B aren't
+// played yet, and DPCM is left out
+static void channel_states(const ChipRegisters &r, unsigned char chip, std::vector<chanstate_t> &out)
+{
+	out.clear();
+
+	out.push_back(pulse_state(r, 0x4000));
+	out.push_back(pulse_state(r, 0x4004));
+
+	chanstate_t tri = silent_channel();
+	if (r.reg(0x4008) & 0x7F)
+	{
+		tri.on = true;
+		tri.pitch = r.reg(0x400A) | ((r.reg(0x400B) & 0x07) << 8);
+	}
+	out.push_back(tri);
+
+	chanstate_t noise = silent_channel();
+	if (r.reg(0x400C) & 0x0F)
+	{
+		noise.on = true;
+		noise.timbre = r.reg(0x400E) & 0x80;
+		noise.volume = r.reg(0x400C) & 0x0F;
+		noise.pitch = r.reg(0x400E) & 0x0F;
+		noise.wrap = 0x10;
+	}
+	out.push_back(noise);
+
+	if (chip & SNDCHIP_VRC6)
+	{
+		static const core::u16 bases[] = {0x9000, 0xA000, 0xB000};
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			core::u8 mask = i == 2 ? 0x3F : 0x0F;
+			core::u8 high = r.reg(bases[i]+2);
+			chanstate_t c = silent_channel();
+			if ((high & 0x80) && (r.reg(bases[i]) & mask))
+			{
+				c.on = true;
+				c.timbre = r.reg(bases[i]) & ~mask;
+				c.volume = r.reg(bases[i]) & mask;
+				c.pitch = r.reg(bases[i]+1) | ((high & 0x0F) << 8);
+			}
+			out.push_back(c);
+		}
+	}
+
+	if (chip & SNDCHIP_VRC7)
+	{
+		for (unsigned int i = 0; i < 6; i++)
+		{
+			// released notes fade out, they're taken as silent
+			core::u8 high = r.vrc7(0x20+i);
+			chanstate_t c = silent_channel();
+			if (high & 0x10)
+			{
+				c.on = true;
+				c.timbre = (r.vrc7(0x30+i) & 0xF0) | ((high >> 1) & 0x07);
+				c.volume = 0x0F - (r.vrc7(0x30+i) & 0x0F);
+				c.pitch = r.vrc7(0x10+i) | ((high & 0x01) << 8);
+			}
+			out.push_back(c);
+		}
+	}
+
+	if (chip & SNDCHIP_FDS)
+	{
+		// the tracker sets the volume directly, without the envelope
+		core::u8 vol = r.reg(0x4080);
+		core::u8 high = r.reg(0x4083);
+		chanstate_t c = silent_channel();
+		if (!(high & 0x80) && (vol & 0x3F))
+		{
+			c.on = true;
+			c.volume = vol & 0x3F;
+			c.pitch = r.reg(0x4082) | ((high & 0x0F) << 8);
+		}
+		out.push_back(c);
+	}
+
+	if (chip & SNDCHIP_MMC5)
+	{
+		out.push_back(pulse_state(r, 0x5000));
+		out.push_back(pulse_state(r, 0x5004));
+	}
+}
+
+// The channel states at the end of each frame
+typedef std::vector<std::vector<chanstate_t> > framestates_t;
+
+struct nsf_write_t
+{
+	unsigned int frame;
+	core::u16 address;
+	core::u8 value;
+};
+
+static void nsf_write(unsigned int frame, core::u32 cycle, core::u16 addr, core::u8 value, void *data)
+{
+	nsf_write_t w = {frame, addr, value};
+	((std::vector<nsf_write_t>*)data)->push_back(w);
+}
+
+// Frame 0 holds the writes of INIT, and each PLAY call the next frame
+static void nsf_frames(const std::vector<nsf_write_t> &writes, unsigned char chip, framestates_t &frames)
+{
+	ChipRegisters *r = new ChipRegisters;
+	std::vector<chanstate_t> state;
+	for (unsigned int i = 0; i < writes.size(); i++)
+	{
+		while (frames.size() < writes[i].frame)
+		{
+			channel_states(*r, chip, state);
+			frames.push_back(state);
+		}
+		r->write(writes[i].address, writes[i].value);
+	}
+	channel_states(*r, chip, state);
+	frames.push_back(state);
+	delete r;
+}
+
+// Frames end where the tracker's ticks do
+static void tracker_frames(const FtmDocument &doc, unsigned int track, core::u64 ticks, framestates_t &frames)
+{
+	core::MemoryIO stream;
+	{
+		RegisterStreamWriter writer(&stream);
+		SoundGen::captureSong(&doc, track, ticks, &writer);
+	}
+	stream.seek(0, core::IO_SEEK_SET);
+
+	RegisterStreamReader reader(&stream);
+	regstream_header_t header;
+	reader.readHeader(header);
+
+	ChipRegisters *r = new ChipRegisters;
+	std::vector<chanstate_t> state;
+	regstream_event_t e;
+	while (reader.next(e))
+	{
+		if (e.type == regstream_event_t::WRITE || e.type == regstream_event_t::EXTERNAL_WRITE)
+		{
+			r->write(e.address, e.value);
+		}
+		else if (e.type == regstream_event_t::FRAME)
+		{
+			channel_states(*r, header.chip, state);
+			frames.push_back(state);
+		}
+	}
+	delete r;
+}
+
+// How far apart two pitches of the same note can be. The tracker stops the
+// vibrato of a channel while it's silent and the NSF driver doesn't, so
+// their phases differ after a note was halted. That's up to twice the
+// deepest vibrato of the track
+static core::u32 pitch_tolerance(const FtmDocument &doc, const SoundGen &sg)
+{
+	int depth = -1;
+	for (unsigned int f = 0; f < doc.GetFrameCount(); f++)
+	{
+		for (unsigned int ch = 0; ch < doc.GetAvailableChannels(); ch++)
+		{
+			for (unsigned int row = 0; row < doc.GetPatternLength(); row++)
+			{
+				stChanNote note;
+				doc.GetNoteData(f, ch, row, &note);
+				for (unsigned int i = 0; i < MAX_EFFECT_COLUMNS; i++)
+				{
+					if (note.EffNumber[i] == EF_VIBRATO)
+						depth = std::max(depth, (int)(note.EffParam[i] & 0x0F));
+				}
+			}
+		}
+	}
+
+	if (depth < 0)
+		return 0;
+	return 2 * sg.readVibratoTable(depth * 16 + 15);
+}
+
+static bool same_channel(const chanstate_t &a, const chanstate_t &b, core::u32 tolerance, bool linear)
+{
+	if (a.on != b.on)
+		return false;
+	if (!a.on)
+		return true;
+
+	// the FDS driver rounds volumes a step off the tracker
+	core::u32 dv = a.volume > b.volume ? a.volume - b.volume : b.volume - a.volume;
+	if (a.timbre != b.timbre || dv > 1)
+		return false;
+
+	core::u32 d = a.pitch > b.pitch ? a.pitch - b.pitch : b.pitch - a.pitch;
+	if (a.wrap != 0 && d > a.wrap / 2)
+		d = a.wrap - d;
+
+	// linear pitch scales the vibrato by the period, in 128ths
+	if (linear)
+		return d * 128 <= tolerance * std::max(a.pitch, b.pitch);
+	return d <= tolerance;
+}
+
+static bool same_frame(const std::vector<chanstate_t> &a, const std::vector<chanstate_t> &b,
+					   core::u32 tolerance, bool linear)
+{
+	if (a.size() != b.size())
+		return false;
+	for (unsigned int i = 0; i < a.size(); i++)
+	{
+		if (!same_channel(a[i], b[i], tolerance, linear))
+			return false;
+	}
+	return true;
+}
+
+// Plays each track with SoundGen and with NSFPlayer from the exported file,
+// and compares what every channel plays at the end of each frame: whether
+// it's heard, its volume and timbre, and its pitch. The NSF passes if no
+// more than a few frames differ.
+// The loudness of each frame is printed as well. It can't tell if the NSF
+// is right: the RMS of a frame of a mix of oscillators depends on their
+// phases, and on when in the frame the registers are written, so renders
+// with the same registers in every frame are only 15 to 19 dB apart
+static bool verify_nsf(const arguments_t &args, FtmDocument &doc, const std::string &nsf)
+{
+	// the fraction of frames that must match
+	const double PASS = 0.95;
+
+	NSFPlayer player;
+	{
+		core::FileIO nsf_io(nsf.c_str(), core::IO_READ);
+		try
+		{
+			player.load(&nsf_io);
+		}
+		catch (const NSFException &e)
+		{
+			fprintf(stderr, "Could not play %s\n%s\n", nsf.c_str(), e.what());
+			return false;
+		}
+	}
+
+	bool ok = true;
+	for (unsigned int track = 0; track < doc.GetTrackCount(); track++)
+	{
+		doc.SelectTrack(track);
+
+		core::MemoryOutput tracker(args.channels, args.sampleRate);
+		SoundGen *sg = new SoundGen;
+		sg->setSoundSink(&tracker);
+		sg->setDocument(&doc);
+		if (args.seconds > 0)
+			sg->setRenderEnd(SONG_TIME_LIMIT, args.seconds);
+		else
+			sg->setRenderEnd(SONG_LOOP_LIMIT, args.loops);
+		sg->trackerController()->startAt(0, 0);
+		sg->startTracker();
+		tracker.render();
+		core::u32 tolerance = pitch_tolerance(doc, *sg);
+		delete sg;
+
+		// leave out the tail both add after stopping
+		core::u64 frames = tracker.samples().size() / args.channels;
+		core::u64 tail = args.sampleRate / 2;
+		frames = frames > tail ? frames - tail : 0;
+		unsigned int ticks = (unsigned int)(frames * player.frameRate() / args.sampleRate + 0.5);
+
+		std::vector<nsf_write_t> writes;
+		core::MemoryOutput exported(args.channels, args.sampleRate);
+		player.setSoundSink(&exported);
+		player.setRegisterWrite(nsf_write, &writes);
+		player.setRenderEnd(ticks);
+		player.start(track);
+		exported.render();
+		player.setSoundSink(NULL);
+		player.setRegisterWrite(NULL);
+
+		framestates_t tracker_states, nsf_states;
+		tracker_frames(doc, track, ticks, tracker_states);
+		nsf_frames(writes, doc.GetExpansionChip(), nsf_states);
+
+		core::u64 n = frames * args.channels;
+		unsigned int window = (unsigned int)(args.sampleRate / player.frameRate() + 0.5) * args.channels;
+		std::vector<double> a = envelope(tracker.samples(), n, window);
+		std::vector<double> b = envelope(exported.samples(), std::min<core::u64>(n, exported.samples().size()), window);
+
+		// the drivers may start a frame apart
+		const int MAX_LAG = 2;
+
+		int compared = (int)std::min(tracker_states.size(), nsf_states.size()) - 2*MAX_LAG;
+		int best_match = -1, best_lag = 0;
+		for (int lag = -MAX_LAG; lag <= MAX_LAG; lag++)
+		{
+			int match = 0;
+			for (int i = MAX_LAG; i < MAX_LAG + compared; i++)
+			{
+				if (same_frame(tracker_states[i], nsf_states[i + lag], tolerance, doc.GetLinearPitch()))
+					match++;
+			}
+			if (match > best_match)
+			{
+				best_match = match;
+				best_lag = lag;
+			}
+		}
+
+		double signal = 0.0, noise = 0.0;
+		for (int i = MAX_LAG; i + MAX_LAG < (int)a.size(); i++)
+		{
+			double d = i + best_lag < (int)b.size() ? a[i] - b[i + best_lag] : a[i];
+			signal += a[i] * a[i];
+			noise += d * d;
+		}
+
+		printf("    track %u: ", track+1);
+		if (compared <= 0)
+		{
+			printf("too short to compare\n");
+			continue;
+		}
+
+		bool pass = best_match >= PASS * compared;
+		printf("%d of %d frames the same", best_match, compared);
+		if (best_lag != 0)
+			printf(", NSF %d frame%s %s", abs(best_lag), abs(best_lag) == 1 ? "" : "s", best_lag < 0 ? "early" : "late");
+		if (noise == 0.0)
+			printf(", loudness identical");
+		else if (signal > 0.0)
+			printf(", loudness %.1f dB apart", 10.0 * log10(signal / noise));
+		printf(", %s\n", pass ? "ok" : "FAILED");
+
+		if (!pass)
+			ok = false;
+	}
+
+	return ok;
+}
+
+static bool export_nsf(const arguments_t &args, const std::string &arg)
+{
+	// Tracks don't apply, the NSF holds all of them
+	std::string file = arg;
+	std::string::size_type colon = arg.find_last_of(':');
+	if (colon != std::string::npos && colon > 0 && arg.find('/', colon) == std::string::npos)
+		file = arg.substr(0, colon);
+
+	FtmDocument doc;
+	if (!read_document(doc, file, args.jobs))
+		return false;
+
+	std::string output = output_base(args, file) + ".nsf";
+	CCompiler compiler(&doc);
+	{
+		core::FileIO nsf_io(output.c_str(), core::IO_WRITE);
+		if (!nsf_io.isWritable())
+		{
+			fprintf(stderr, "Cannot write to file: %s\n", output.c_str());
+			return false;
+		}
+
+		try
+		{
+			compiler.ExportNSF(&nsf_io);
+		}
+		catch (const CompilerException &e)
+		{
+			fprintf(stderr, "Could not export %s\n%s\n", file.c_str(), e.what());
+			return false;
+		}
+	}
+
+	printf("%s -> %s\n", file.c_str(), output.c_str());
+	printf("    %-12s %6s %6s %8s %8s\n", "block", "items", "dups", "bytes", "us");
+
+	const std::vector<stCompileBlock> &blocks = compiler.GetBlocks();
+	for (unsigned int i = 0; i < blocks.size(); i++)
+	{
+		printf("    %-12s %6u %6u %8u %8d\n", blocks[i].Name, blocks[i].Items,
+			   blocks[i].Duplicates, blocks[i].Size, blocks[i].Time_us);
+	}
+	printf("    %-12s %6s %6s %8u %8d\n", "total", "", "", compiler.GetTotalSize(), compiler.GetTotalTime());
+
+	if (args.verify)
+		return verify_nsf(args, doc, output);
+
+	return true;
+}
+
+// Expands FILE[:TRACK[,TRACK...]] into jobs. Tracks are 1-based on the
+// command line.
+static bool add_jobs(const arguments_t &args, const std::string &arg, std::vector<job_t> &jobs,
+					 std::vector<module_t*> &modules)
+{
+	std::string file = arg;
+	std::string tracks;
+
+	std::string::size_type colon = arg.find_last_of(':');
+	if (colon != std::string::npos && colon > 0 && arg.find('/', colon) == std::string::npos)
+	{
+		file = arg.substr(0, colon);
+		tracks = arg.substr(colon+1);
+	}
+
+	if (is_register_stream(arg))
+	{
+		if (args.info || args.vgm)
+		{
+			fprintf(stderr, "%s: %s needs a module\n", arg.c_str(), args.info ? "-info" : "-vgm");
+			return false;
+		}
+
+		job_t job;
+		job.file = arg;
+		job.module = NULL;
+		job.track = 0;
+		job.output = output_base(args, arg) + ".wav";
+		job.ok = false;
+		job.audio_s = 0.0;
+		job.render_s = 0.0;
+		jobs.push_back(job);
+		return true;
+	}
+
+	// the workers load the module, only its header is read here
+	unsigned int count;
+	{
+		core::MappedFileIO ftm_io(file.c_str());
+		if (!ftm_io.isReadable())
+		{
+			fprintf(stderr, "Cannot open file: %s\n", file.c_str());
+			return false;
+		}
+
+		try
+		{
+			count = FtmDocument::readTrackCount(&ftm_io);
+		}
+		catch (const FtmDocumentException &e)
+		{
+			fprintf(stderr, "Could not open file: %s\n%s\n", file.c_str(), e.what());
+			return false;
+		}
+	}
+
+	std::vector<unsigned int> selected;
+	if (tracks.empty())
+	{
+		for (unsigned int i = 0; i < count; i++)
+			selected.push_back(i);
+	}
+	else
+	{
+		std::string::size_type pos = 0;
+		while (pos <= tracks.size())
+		{
+			std::string::size_type comma = tracks.find(',', pos);
+			if (comma == std::string::npos)
+				comma = tracks.size();
+
+			int t = atoi(tracks.substr(pos, comma-pos).c_str());
+			if (t < 1 || (unsigned int)t > count)
+			{
+				fprintf(stderr, "%s: no track %d (module has %u)\n", file.c_str(), t, count);
+				return false;
+			}
+			selected.push_back(t-1);
+
+			pos = comma+1;
+		}
+	}
+
+	module_t *module = new module_t;
+	module->file = file;
+	module->loaded = false;
+	module->doc = NULL;
+	module->jobs_left = selected.size();
+	modules.push_back(module);
+
+	for (unsigned int i = 0; i < selected.size(); i++)
+	{
+		job_t job;
+		job.file = file;
+		job.module = module;
+		job.track = selected[i];
+		job.output = output_name(args, file, selected[i], args.vgm ? ".vgm" : ".wav");
+		if (args.regs)
+			job.regs = output_name(args, file, selected[i], ".regs");
+		job.ok = false;
+		job.audio_s = 0.0;
+		job.render_s = 0.0;
+		jobs.push_back(job);
+	}
+
+	return true;
+}
+
+// Every worker owns a deque of jobs. A worker takes jobs from the front of
+// its own deque, and when that runs dry it steals from the back of another
+// worker's deque. No jobs are created while rendering, so a worker is done
+// once every deque is empty.
+class Scheduler
+{
+public:
+	Scheduler(unsigned int workers)
+		: m_count(workers)
+	{
+		m_queues = new queue_t[workers];
+	}
+	~Scheduler()
+	{
+		delete[] m_queues;
+	}
+
+	unsigned int workers() const{ return m_count; }
+
+	void push(unsigned int worker, job_t *job)
+	{
+		queue_t &q = m_queues[worker];
+		boost::lock_guard<boost::mutex> lock(q.mtx);
+		q.jobs.push_back(job);
+	}
+
+	job_t * take(unsigned int worker)
+	{
+		job_t *job = popFront(worker);
+		if (job != NULL)
+			return job;
+
+		for (unsigned int i = 1; i < m_count; i++)
+		{
+			job = popBack((worker + i) % m_count);
+			if (job != NULL)
+				return job;
+		}
+
+		return NULL;
+	}
+private:
+	struct queue_t
+	{
+		boost::mutex mtx;
+		std::deque<job_t*> jobs;
+	};
+
+	job_t * popFront(unsigned int worker)
+	{
+		queue_t &q = m_queues[worker];
+		boost::lock_guard<boost::mutex> lock(q.mtx);
+		if (q.jobs.empty())
+			return NULL;
+
+		job_t *job = q.jobs.front();
+		q.jobs.pop_front();
+		return job;
+	}
+	job_t * popBack(unsigned int worker)
+	{
+		queue_t &q = m_queues[worker];
+		boost::lock_guard<boost::mutex> lock(q.mtx);
+		if (q.jobs.empty())
+			return NULL;
+
+		job_t *job = q.jobs.back();
+		q.jobs.pop_back();
+		return job;
+	}
+
+	queue_t *m_queues;
+	unsigned int m_count;
+};
+
+struct shared_t
+{
+	const arguments_t *args;
+	Scheduler *scheduler;
+
+	boost::mutex mtx_print;
+	unsigned int done, total;
+};
+
+// Applies a comma separated list of pans, one per channel of the module,
+// from -100 (left) to 100 (right)
+static void apply_pan(SoundGen *sg, const std::string &pan)
+{
+	std::string::size_type pos = 0;
+	unsigned int channel = 0;
+	while (pos < pan.size())
+	{
+		std::string::size_type comma = pan.find(',', pos);
+		if (comma == std::string::npos)
+			comma = pan.size();
+
+		if (comma > pos)
+			sg->setChannelPan(channel, atoi(pan.substr(pos, comma-pos).c_str()));
+
+		channel++;
+		pos = comma+1;
+	}
+}
+
+static void render_job(const FtmDocument &doc, const arguments_t &args, job_t &job)
+{
+	core::FileIO wav_io(job.output.c_str(), core::IO_WRITE);
+	if (!wav_io.isWritable())
+	{
+		fprintf(stderr, "Cannot write to file: %s\n", job.output.c_str());
+		return;
+	}
+
+	core::FileIO *regs_io = NULL;
+	RegisterStreamWriter *regs = NULL;
+	if (!job.regs.empty())
+	{
+		regs_io = new core::FileIO(job.regs.c_str(), core::IO_WRITE);
+		if (!regs_io->isWritable())
+		{
+			fprintf(stderr, "Cannot write to file: %s\n", job.regs.c_str());
+			delete regs_io;
+			return;
+		}
+		regs = new RegisterStreamWriter(regs_io);
+	}
+
+	// a fresh sound generator (and APU) for every track, so the output
+	// doesn't depend on what the worker rendered before
+	SoundGen *sg = new SoundGen;
+	WavOutput *out = new WavOutput(&wav_io, args.channels, args.sampleRate);
+
+	sg->setSoundSink(out);
+	// other workers may be rendering tracks of the same document
+	sg->setDocument(&doc, job.track);
+	apply_pan(sg, args.pan);
+	if (args.seconds > 0)
+		sg->setRenderEnd(SONG_TIME_LIMIT, args.seconds);
+	else
+		sg->setRenderEnd(SONG_LOOP_LIMIT, args.loops);
+
+	if (regs != NULL)
+		sg->setRegisterCapture(regs);
+	if (args.queue)
+		sg->setQueueWrites(true);
+
+	sg->trackerController()->startAt(0, 0);
+	sg->startTracker();
+	out->render();
+	out->finalize();
+
+	if (regs != NULL)
+	{
+		sg->setRegisterCapture(NULL);
+		if (!regs->ok())
+			fprintf(stderr, "Could not write all of %s\n", job.regs.c_str());
+		delete regs;
+		delete regs_io;
+	}
+
+	job.ok = true;
+	job.audio_s = (double)out->renderedSamples() / out->sampleRate();
+	job.render_s = out->renderSeconds();
+	sg->frameStats(job.stats);
+
+	delete sg;
+	delete out;
+}
+
+static void replay_job(const arguments_t &args, job_t &job)
+{
+	core::MappedFileIO regs_io(job.file.c_str());
+	if (!regs_io.isReadable())
+	{
+		fprintf(stderr, "Cannot open file: %s\n", job.file.c_str());
+		return;
+	}
+
+	RegisterPlayer player;
+	try
+	{
+		player.load(&regs_io);
+	}
+	catch (const RegisterStreamException &e)
+	{
+		fprintf(stderr, "Could not play %s\n%s\n", job.file.c_str(), e.what());
+		return;
+	}
+
+	core::FileIO wav_io(job.output.c_str(), core::IO_WRITE);
+	if (!wav_io.isWritable())
+	{
+		fprintf(stderr, "Cannot write to file: %s\n", job.output.c_str());
+		return;
+	}
+
+	WavOutput *out = new WavOutput(&wav_io, args.channels, args.sampleRate);
+
+	player.setSoundSink(out);
+	player.start();
+	out->render();
+	out->finalize();
+	player.setSoundSink(NULL);
+
+	job.ok = true;
+	job.audio_s = (double)out->renderedSamples() / out->sampleRate();
+	job.render_s = out->renderSeconds();
+
+	delete out;
+}
+
+static void analyze_job(const FtmDocument &doc, job_t &job)
+{
+	core::timestamp_t start;
+	start.gettime();
+
+	SoundGen::analyzeSong(&doc, job.track, job.info);
+
+	core::timestamp_t end;
+	end.gettime();
+
+	job.ok = true;
+	job.audio_s = job.info.seconds;
+	job.render_s = end.diff_us(start) / 1000000.0;
+}
+
+static void vgm_job(const FtmDocument &doc, job_t &job)
+{
+	core::FileIO vgm_io(job.output.c_str(), core::IO_WRITE);
+	if (!vgm_io.isWritable())
+	{
+		fprintf(stderr, "Cannot write to file: %s\n", job.output.c_str());
+		return;
+	}
+
+	core::timestamp_t start;
+	start.gettime();
+
+	VGMExporter exporter;
+	try
+	{
+		exporter.exportTrack(&doc, job.track, &vgm_io);
+	}
+	catch (const VGMException &e)
+	{
+		fprintf(stderr, "Could not export %s #%u\n%s\n", job.file.c_str(), job.track+1, e.what());
+		return;
+	}
+
+	core::timestamp_t end;
+	end.gettime();
+
+	job.ok = true;
+	job.vgm = exporter.info();
+	job.audio_s = (double)job.vgm.samples / 44100;
+	job.render_s = end.diff_us(start) / 1000000.0;
+}
+
+static void print_vgm(const job_t &job)
+{
+	const vgminfo_t &vgm = job.vgm;
+	printf("    %.2f s", job.audio_s);
+	if (vgm.loopSamples > 0)
+		printf(", loops the last %.2f s", (double)vgm.loopSamples / 44100);
+	printf(", %u bytes, %u writes (%u unchanged left out), %.1f ms\n",
+		   vgm.size, vgm.writes, vgm.coalesced, job.render_s * 1000.0);
+	if (vgm.unsupported > 0)
+		printf("    %u writes to VRC6, MMC5 or N106 left out\n", vgm.unsupported);
+}
+
+static void print_info(const job_t &job)
+{
+	const SoundGen::songinfo_t &info = job.info;
+	unsigned int ms = (unsigned int)(info.seconds * 1000.0 + 0.5);
+	printf("    %u:%02u.%03u (%u ticks), ", ms / 60000, ms / 1000 % 60, ms % 1000,
+		   (unsigned int)info.ticks);
+
+	switch (info.end)
+	{
+	case SoundGen::songinfo_t::END_LOOP:
+		printf("loops to frame %02X row %02X at tick %u\n", info.loopFrame, info.loopRow,
+			   (unsigned int)info.loopTicks);
+		break;
+	case SoundGen::songinfo_t::END_HALT:
+		printf("halts\n");
+		break;
+	default:
+		printf("doesn't loop or halt\n");
+		break;
+	}
+
+	printf("    notes:");
+	for (unsigned int i = 0; i < info.channels; i++)
+		printf(" %u", info.notes[i]);
+	printf("\n");
+}
+
+static const FtmDocument * acquire_module(module_t *m)
+{
+	boost::lock_guard<boost::mutex> lock(m->mtx);
+	if (!m->loaded)
+	{
+		m->loaded = true;
+		m->doc = new FtmDocument;
+		if (!read_document(*m->doc, m->file))
+		{
+			delete m->doc;
+			m->doc = NULL;
+		}
+	}
+	return m->doc;
+}
+
+static void release_module(module_t *m)
+{
+	boost::lock_guard<boost::mutex> lock(m->mtx);
+	if (--m->jobs_left == 0)
+	{
+		delete m->doc;
+		m->doc = NULL;
+	}
+}
+
+static void worker(shared_t *shared, unsigned int id)
+{
+	job_t *job;
+	while ((job = shared->scheduler->take(id)) != NULL)
+	{
+		if (job->module == NULL)
+		{
+			replay_job(*shared->args, *job);
+		}
+		else
+		{
+			const FtmDocument *doc = acquire_module(job->module);
+			if (doc != NULL)
+			{
+				if (shared->args->info)
+					analyze_job(*doc, *job);
+				else if (shared->args->vgm)
+					vgm_job(*doc, *job);
+				else
+					render_job(*doc, *shared->args, *job);
+			}
+			release_module(job->module);
+		}
+
+		boost::lock_guard<boost::mutex> lock(shared->mtx_print);
+		shared->done++;
+		if (job->ok && shared->args->info)
+		{
+			printf("[%u/%u] %s #%u\n", shared->done, shared->total, job->file.c_str(), job->track+1);
+			print_info(*job);
+		}
+		else if (job->ok && shared->args->vgm)
+		{
+			printf("[%u/%u] %s #%u -> %s\n", shared->done, shared->total, job->file.c_str(), job->track+1,
+				   job->output.c_str());
+			print_vgm(*job);
+		}
+		else if (job->ok && job->module == NULL)
+		{
+			printf("[%u/%u] %s -> %s (%.2f s, %.1fx realtime)\n",
+				   shared->done, shared->total, job->file.c_str(),
+				   job->output.c_str(), job->audio_s,
+				   job->render_s > 0.0 ? job->audio_s / job->render_s : 0.0);
+		}
+		else if (job->ok)
+		{
+			printf("[%u/%u] %s #%u -> %s (%.2f s, %.1fx realtime)\n",
+				   shared->done, shared->total, job->file.c_str(), job->track+1,
+				   job->output.c_str(), job->audio_s,
+				   job->render_s > 0.0 ? job->audio_s / job->render_s : 0.0);
+			if (shared->args->stats)
+			{
+				double frames = job->stats.frames > 0 ? (double)job->stats.frames : 1.0;
+				printf("    %.1f us, %.1f APU processing calls, %.1f runs per frame\n",
+					   job->render_s * 1000000.0 / frames, job->stats.processCalls / frames,
+					   job->stats.apuRuns / frames);
+			}
+		}
+		else
+		{
+			printf("[%u/%u] %s #%u failed\n",
+				   shared->done, shared->total, job->file.c_str(), job->track+1);
+		}
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	arguments_t args;
+	parse_arguments(argc-1, argv+1, args);
+
+	if (args.help)
+	{
+		print_help();
+		return 0;
+	}
+
+	if (args.files.empty())
+	{
+		printf("Please specify a song\n\n");
+		print_help();
+		return 1;
+	}
+
+	if (args.nsf)
+	{
+		bool ok = true;
+		for (unsigned int i = 0; i < args.files.size(); i++)
+		{
+			if (!export_nsf(args, args.files[i]))
+				ok = false;
+		}
+		return ok ? 0 : 1;
+	}
+
+	std::vector<job_t> jobs;
+	std::vector<module_t*> modules;
+	for (unsigned int i = 0; i < args.files.size(); i++)
+	{
+		if (!add_jobs(args, args.files[i], jobs, modules))
+			return 1;
+	}
+
+	unsigned int workers = args.jobs < 1 ? 1 : args.jobs;
+	if (workers > jobs.size())
+		workers = jobs.size();
+
+	Scheduler scheduler(workers);
+
+	// hand out contiguous runs, fewer modules are loaded at the same time
+	for (unsigned int i = 0; i < jobs.size(); i++)
+	{
+		scheduler.push(i * workers / jobs.size(), &jobs[i]);
+	}
+
+	shared_t shared;
+	shared.args = &args;
+	shared.scheduler = &scheduler;
+	shared.done = 0;
+	shared.total = jobs.size();
+
+	core::timestamp_t start;
+	start.gettime();
+
+	boost::thread_group threads;
+	for (unsigned int i = 0; i < workers; i++)
+	{
+		threads.create_thread(boost::bind(worker, &shared, i));
+	}
+	threads.join_all();
+
+	core::timestamp_t end;
+	end.gettime();
+
+	double wall_s = end.diff_us(start) / 1000000.0;
+	double audio_s = 0.0;
+	unsigned int failed = 0;
+	for (unsigned int i = 0; i < jobs.size(); i++)
+	{
+		audio_s += jobs[i].audio_s;
+		if (!jobs[i].ok)
+			failed++;
+	}
+
+	printf(args.info ?
+		   "Analyzed %u tracks (%.2f s of audio) in %.2f s on %u threads (%.1fx realtime)\n" :
+		   args.vgm ?
+		   "Exported %u tracks (%.2f s of audio) in %.2f s on %u threads (%.1fx realtime)\n" :
+		   "Rendered %u tracks (%.2f s of audio) in %.2f s on %u threads (%.1fx realtime)\n",
+		   (unsigned int)jobs.size() - failed, audio_s, wall_s, workers,
+		   wall_s > 0.0 ? audio_s / wall_s : 0.0);
+
+	for (unsigned int i = 0; i < modules.size(); i++)
+	{
+		delete modules[i];
+	}
+
+	return failed == 0 ? 0 : 1;
+}
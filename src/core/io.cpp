@@ -1,5 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "io.hpp"
+#ifdef UNIX
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#elif defined(WINDOWS)
+#   include <Windows.h>
+#endif
 
 namespace core
 {
@@ -88,4 +98,228 @@ namespace core
 			fclose(f);
 		}
 	}
+
+	MappedFileIO::MappedFileIO(const char *filename)
+		: m_data(NULL), m_size(0), m_pos(0), m_handle(NULL)
+	{
+#ifdef UNIX
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			return;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0)
+		{
+			if (st.st_size == 0)
+			{
+				// an empty file can't be mapped, but is readable
+				m_handle = (void*)1;
+			}
+			else
+			{
+				void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED)
+				{
+					// read front to back
+					madvise(p, st.st_size, MADV_SEQUENTIAL);
+					m_data = (const char*)p;
+					m_size = st.st_size;
+					m_handle = (void*)1;
+				}
+			}
+		}
+
+		// the mapping keeps the file open
+		close(fd);
+#elif defined(WINDOWS)
+		HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+								  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+
+		LARGE_INTEGER sz;
+		if (GetFileSizeEx(file, &sz))
+		{
+			if (sz.QuadPart == 0)
+			{
+				// an empty file can't be mapped, but is readable
+				m_handle = (void*)1;
+			}
+			else
+			{
+				HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (mapping != NULL)
+				{
+					void *p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+					if (p != NULL)
+					{
+						m_data = (const char*)p;
+						m_size = (Quantity)sz.QuadPart;
+						m_handle = (void*)1;
+					}
+					// the view keeps the mapping open
+					CloseHandle(mapping);
+				}
+			}
+		}
+
+		CloseHandle(file);
+#endif
+	}
+
+	Quantity MappedFileIO::read(void *buf, Quantity sz)
+	{
+		// nothing is mapped of an empty file
+		if (m_data == NULL)
+			return 0;
+
+		if (sz > m_size - m_pos)
+			sz = m_size - m_pos;
+
+		memcpy(buf, m_data + m_pos, sz);
+		m_pos += sz;
+		return sz;
+	}
+
+	Quantity MappedFileIO::write(const void *buf, Quantity sz)
+	{
+		return 0;
+	}
+
+	Quantity MappedFileIO::size()
+	{
+		return m_size;
+	}
+
+	bool MappedFileIO::seek(int offset, SeekOrigin origin)
+	{
+		long base;
+		switch (origin)
+		{
+		case IO_SEEK_SET: base = 0; break;
+		case IO_SEEK_CUR: base = m_pos; break;
+		case IO_SEEK_END: base = m_size; break;
+		default: return false;
+		}
+
+		long pos = base + offset;
+		if (pos < 0 || pos > (long)m_size)
+			return false;
+
+		m_pos = pos;
+		return true;
+	}
+	bool MappedFileIO::isReadable()
+	{
+		return m_handle != NULL;
+	}
+	bool MappedFileIO::isWritable()
+	{
+		return false;
+	}
+
+	const void * MappedFileIO::view(Quantity sz)
+	{
+		if (m_data == NULL || sz > m_size - m_pos)
+			return NULL;
+
+		const char *p = m_data + m_pos;
+		m_pos += sz;
+		return p;
+	}
+
+	MappedFileIO::~MappedFileIO()
+	{
+		if (m_data == NULL)
+			return;
+#ifdef UNIX
+		munmap((void*)m_data, m_size);
+#elif defined(WINDOWS)
+		UnmapViewOfFile(m_data);
+#endif
+	}
+
+	MemoryIO::MemoryIO()
+		: m_data(NULL), m_size(0), m_capacity(0), m_pos(0)
+	{
+	}
+
+	Quantity MemoryIO::read(void *buf, Quantity sz)
+	{
+		if (sz > m_size - m_pos)
+			sz = m_size - m_pos;
+
+		memcpy(buf, m_data + m_pos, sz);
+		m_pos += sz;
+		return sz;
+	}
+
+	Quantity MemoryIO::write(const void *buf, Quantity sz)
+	{
+		if (sz > m_capacity - m_pos)
+		{
+			Quantity capacity = m_capacity < 4096 ? 4096 : m_capacity;
+			while (capacity - m_pos < sz)
+				capacity *= 2;
+
+			char *data = (char*)realloc(m_data, capacity);
+			if (data == NULL)
+				return 0;
+			m_data = data;
+			m_capacity = capacity;
+		}
+
+		memcpy(m_data + m_pos, buf, sz);
+		m_pos += sz;
+		if (m_pos > m_size)
+			m_size = m_pos;
+		return sz;
+	}
+
+	Quantity MemoryIO::size()
+	{
+		return m_size;
+	}
+
+	bool MemoryIO::seek(int offset, SeekOrigin origin)
+	{
+		long base;
+		switch (origin)
+		{
+		case IO_SEEK_SET: base = 0; break;
+		case IO_SEEK_CUR: base = m_pos; break;
+		case IO_SEEK_END: base = m_size; break;
+		default: return false;
+		}
+
+		long pos = base + offset;
+		if (pos < 0 || pos > (long)m_size)
+			return false;
+
+		m_pos = pos;
+		return true;
+	}
+	bool MemoryIO::isReadable()
+	{
+		return true;
+	}
+	bool MemoryIO::isWritable()
+	{
+		return true;
+	}
+
+	const void * MemoryIO::view(Quantity sz)
+	{
+		if (sz > m_size - m_pos)
+			return NULL;
+
+		const char *p = m_data + m_pos;
+		m_pos += sz;
+		return p;
+	}
+
+	MemoryIO::~MemoryIO()
+	{
+		free(m_data);
+	}
 }
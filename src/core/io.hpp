@@ -30,6 +30,12 @@ namespace core
 		virtual bool isWritable() = 0;
 		virtual ~IO(){ }
 
+		// Returns the next sz bytes in place and skips them, so they can be
+		// read without copying. The bytes stay valid as long as the IO.
+		// Returns NULL, without skipping, if there aren't sz bytes or the IO
+		// can't do it; read() them then
+		virtual const void * view(Quantity sz){ return NULL; }
+
 		bool read_e(void *buf, Quantity sz)
 		{
 			return read(buf, sz) == sz;
@@ -91,6 +97,49 @@ namespace core
 	private:
 		void *m_handle;
 	};
+
+	// Reads a file mapped into memory, view() never copies
+	class LIBEXPORT MappedFileIO : public IO
+	{
+	public:
+		MappedFileIO(const char *filename);
+		Quantity read(void *buf, Quantity sz);
+		Quantity write(const void *buf, Quantity sz);
+		Quantity size();
+		bool seek(int offset, SeekOrigin o);
+		bool isReadable();
+		bool isWritable();
+		const void * view(Quantity sz);
+		~MappedFileIO();
+	private:
+		const char *m_data;
+		Quantity m_size;
+		Quantity m_pos;
+		void *m_handle;
+	};
+
+	// Reads and writes a buffer in memory, which grows as it's written
+	class LIBEXPORT MemoryIO : public IO
+	{
+	public:
+		MemoryIO();
+		Quantity read(void *buf, Quantity sz);
+		Quantity write(const void *buf, Quantity sz);
+		Quantity size();
+		bool seek(int offset, SeekOrigin o);
+		bool isReadable();
+		bool isWritable();
+		const void * view(Quantity sz);
+		~MemoryIO();
+
+		// valid until the next write
+		const void * data() const{ return m_data; }
+	private:
+		char *m_data;
+		Quantity m_size;
+		Quantity m_capacity;
+		Quantity m_pos;
+	};
 }
 
 #endif
@@ -0,0 +1,14 @@
+#include "memoryoutput.hpp"
+
+namespace core
+{
+	MemoryOutput::MemoryOutput(unsigned int channels, unsigned int sampleRate)
+		: SoundSinkExport(NULL, sampleRate, channels)
+	{
+	}
+
+	void MemoryOutput::flushBuffer(core::s16 *Buffer, core::u32 Size)
+	{
+		m_samples.insert(m_samples.end(), Buffer, Buffer+Size);
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef CORE_MEMORYOUTPUT_HPP
+#define CORE_MEMORYOUTPUT_HPP
+
+#include <vector>
+#include "common.hpp"
+#include "soundsink.hpp"
+
+namespace core
+{
+	// Keeps the rendered samples in memory
+	class COREAPI MemoryOutput : public SoundSinkExport
+	{
+	public:
+		MemoryOutput(unsigned int channels, unsigned int sampleRate);
+
+		void flushBuffer(core::s16 *Buffer, core::u32 Size);
+		void flush(){}
+
+		const std::vector<core::s16> & samples() const{ return m_samples; }
+	private:
+		MemoryOutput(const MemoryOutput&);
+		MemoryOutput & operator =(const MemoryOutput&);
+
+		std::vector<core::s16> m_samples;
+	};
+}
+
+#endif
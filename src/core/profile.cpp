@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include "profile.hpp"
+#ifdef UNIX
+#   include <time.h>
+#elif defined(WINDOWS)
+#   include <Windows.h>
+#endif
+
+namespace core
+{
+	class ProfileRegistry
+	{
+	public:
+		ProfileRegistry()
+			: first(NULL)
+		{
+		}
+
+		void add(ProfileCounter *c)
+		{
+			boost::lock_guard<boost::mutex> lock(mtx);
+			c->m_next = first;
+			first = c;
+		}
+		void remove(ProfileCounter *c)
+		{
+			boost::lock_guard<boost::mutex> lock(mtx);
+			for (ProfileCounter **p = &first; *p != NULL; p = &(*p)->m_next)
+			{
+				if (*p == c)
+				{
+					*p = c->m_next;
+					break;
+				}
+			}
+		}
+		ProfileCounter * find(const std::string &name)
+		{
+			for (ProfileCounter *c = first; c != NULL; c = c->m_next)
+			{
+				if (c->m_name == name)
+					return c;
+			}
+			return NULL;
+		}
+		void snapshot(std::vector<profile_snapshot_t> &s)
+		{
+			boost::lock_guard<boost::mutex> lock(mtx);
+			for (const ProfileCounter *c = first; c != NULL; c = c->m_next)
+			{
+				s.push_back(profile_snapshot_t());
+				c->snapshot(s.back());
+			}
+		}
+		void reset()
+		{
+			boost::lock_guard<boost::mutex> lock(mtx);
+			for (ProfileCounter *c = first; c != NULL; c = c->m_next)
+				c->reset();
+		}
+
+		boost::mutex mtx;
+		// locked by mtx
+		ProfileCounter *first;
+		// made by ProfileCounter::named
+		boost::mutex mtx_named;
+	};
+
+	// made by the first counter, so it's there for counters made before
+	// main() in any library
+	static ProfileRegistry & registry()
+	{
+		static ProfileRegistry r;
+		return r;
+	}
+
+	u64 profile_snapshot_t::percentile(double p) const
+	{
+		u64 target = (u64)(p * count);
+		u64 seen = 0;
+		for (int i = 0; i < PROFILE_BUCKETS; i++)
+		{
+			seen += buckets[i];
+			if (seen > target)
+				return i == 0 ? 0 : std::min(((u64)1 << i) - 1, max);
+		}
+		return max;
+	}
+
+	ProfileCounter::ProfileCounter(const char *name, ProfileKind kind)
+		: m_name(name), m_kind(kind), m_next(NULL)
+	{
+		reset();
+		registry().add(this);
+	}
+
+	ProfileCounter::~ProfileCounter()
+	{
+		registry().remove(this);
+	}
+
+	ProfileCounter * ProfileCounter::named(const std::string &name, ProfileKind kind)
+	{
+		ProfileRegistry &r = registry();
+		boost::lock_guard<boost::mutex> lock_named(r.mtx_named);
+
+		ProfileCounter *c;
+		{
+			boost::lock_guard<boost::mutex> lock(r.mtx);
+			c = r.find(name);
+		}
+		if (c == NULL)
+			c = new ProfileCounter(name.c_str(), kind);
+		return c;
+	}
+
+	void ProfileCounter::snapshot(profile_snapshot_t &s) const
+	{
+		s.name = m_name;
+		s.kind = m_kind;
+		s.count = m_count.load(boost::memory_order_relaxed);
+		s.sum = m_sum.load(boost::memory_order_relaxed);
+		s.max = m_max.load(boost::memory_order_relaxed);
+		s.last = m_last.load(boost::memory_order_relaxed);
+		for (int i = 0; i < PROFILE_BUCKETS; i++)
+			s.buckets[i] = m_buckets[i].load(boost::memory_order_relaxed);
+	}
+
+	void ProfileCounter::reset()
+	{
+		m_count = 0;
+		m_sum = 0;
+		m_max = 0;
+		m_last = 0;
+		for (int i = 0; i < PROFILE_BUCKETS; i++)
+			m_buckets[i] = 0;
+	}
+
+#ifdef UNIX
+	u64 profileNanoseconds()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+#elif defined(WINDOWS)
+	u64 profileNanoseconds()
+	{
+		LARGE_INTEGER freq, now;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		return (u64)(now.QuadPart / (double)freq.QuadPart * 1000000000.0);
+	}
+#else
+#error Unimplemented
+#endif
+
+	static bool snapshot_less(const profile_snapshot_t &a, const profile_snapshot_t &b)
+	{
+		return a.name < b.name;
+	}
+
+	void profileSnapshot(std::vector<profile_snapshot_t> &s)
+	{
+		s.clear();
+		registry().snapshot(s);
+		std::sort(s.begin(), s.end(), snapshot_less);
+	}
+
+	void profileReset()
+	{
+		registry().reset();
+	}
+
+	bool profileEnabled()
+	{
+#ifdef FAMI_PROFILING
+		return true;
+#else
+		return false;
+#endif
+	}
+}
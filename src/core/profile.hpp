@@ -0,0 +1,149 @@
+#ifndef CORE_PROFILE_HPP
+#define CORE_PROFILE_HPP
+
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include "common.hpp"
+
+namespace core
+{
+	// Profiling counters. A counter sums what it's given and keeps a
+	// histogram of it, by powers of two:
+	//   PROFILE_TIME    nanoseconds a stage took
+	//   PROFILE_LEVEL   a level it was at, like the fill of a buffer
+	//   PROFILE_EVENT   only counts, like underruns
+	// Any thread may add to a counter without locking. The fields of a
+	// snapshot taken while adds happen can be a few adds apart.
+	//
+	// Code is instrumented with the PROFILE_ macros below, which compile to
+	// nothing unless FAMI_PROFILING is defined (cmake -DPROFILING=ON).
+	// Counters are named by where they are, parts separated with '/', so
+	// sorting the names groups them
+
+	enum ProfileKind
+	{
+		PROFILE_TIME,
+		PROFILE_LEVEL,
+		PROFILE_EVENT
+	};
+
+	static const int PROFILE_BUCKETS = 40;
+
+	struct COREAPI profile_snapshot_t
+	{
+		std::string name;
+		ProfileKind kind;
+		u64 count;
+		u64 sum;
+		u64 max;
+		u64 last;
+		// bucket 0 counts 0, bucket i values from 2^(i-1) to 2^i - 1. The
+		// last bucket counts everything above
+		u64 buckets[PROFILE_BUCKETS];
+
+		double average() const{ return count > 0 ? (double)sum / count : 0.0; }
+		// The upper bound of the bucket holding the p'th fraction (0 to 1)
+		// of the values, at most max
+		u64 percentile(double p) const;
+	};
+
+	class COREAPI ProfileCounter
+	{
+	public:
+		// Counters are registered for their whole life, make them static
+		ProfileCounter(const char *name, ProfileKind kind);
+		~ProfileCounter();
+
+		// The counter with name, made if there isn't one. Made counters
+		// live until exit
+		static ProfileCounter * named(const std::string &name, ProfileKind kind);
+
+		void add(u64 value)
+		{
+			m_count.fetch_add(1, boost::memory_order_relaxed);
+			m_sum.fetch_add(value, boost::memory_order_relaxed);
+			m_last.store(value, boost::memory_order_relaxed);
+			m_buckets[bucket(value)].fetch_add(1, boost::memory_order_relaxed);
+
+			u64 max = m_max.load(boost::memory_order_relaxed);
+			while (value > max && !m_max.compare_exchange_weak(max, value, boost::memory_order_relaxed))
+				;
+		}
+
+		void snapshot(profile_snapshot_t &s) const;
+		void reset();
+
+		const std::string & name() const{ return m_name; }
+	private:
+		ProfileCounter(const ProfileCounter&);
+		ProfileCounter & operator =(const ProfileCounter&);
+
+		static int bucket(u64 value)
+		{
+			int b = 0;
+			while (value != 0 && b < PROFILE_BUCKETS-1)
+			{
+				value >>= 1;
+				b++;
+			}
+			return b;
+		}
+
+		std::string m_name;
+		ProfileKind m_kind;
+		boost::atomic<u64> m_count;
+		boost::atomic<u64> m_sum;
+		boost::atomic<u64> m_max;
+		boost::atomic<u64> m_last;
+		boost::atomic<u64> m_buckets[PROFILE_BUCKETS];
+
+		friend class ProfileRegistry;
+		ProfileCounter *m_next;
+	};
+
+	// Monotonic, for timing
+	COREAPI u64 profileNanoseconds();
+
+	// Snapshots of all counters, sorted by name
+	COREAPI void profileSnapshot(std::vector<profile_snapshot_t> &s);
+	COREAPI void profileReset();
+	// false if the counters were compiled out
+	COREAPI bool profileEnabled();
+
+	class ProfileScope
+	{
+	public:
+		explicit ProfileScope(ProfileCounter &c)
+			: m_counter(c), m_start(profileNanoseconds())
+		{
+		}
+		~ProfileScope()
+		{
+			m_counter.add(profileNanoseconds() - m_start);
+		}
+	private:
+		ProfileCounter &m_counter;
+		u64 m_start;
+	};
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef FAMI_PROFILING
+	// A counter in the scope it's declared in
+#	define PROFILE_COUNTER(var, name, kind) static core::ProfileCounter var(name, core::kind)
+	// Adds the time until the end of the scope to a counter
+#	define PROFILE_SCOPE(counter) core::ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(counter)
+#	define PROFILE_ADD(counter, value) (counter).add(value)
+	// Code only compiled with the counters
+#	define PROFILE_ONLY(code) code
+#else
+#	define PROFILE_COUNTER(var, name, kind)
+#	define PROFILE_SCOPE(counter)
+#	define PROFILE_ADD(counter, value)
+#	define PROFILE_ONLY(code)
+#endif
+
+#endif
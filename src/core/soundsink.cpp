@@ -11,12 +11,17 @@
 #elif defined(WINDOWS)
 #   include <Windows.h>
 #endif
-#include "ringbuffer.hpp"
+#include "spscringbuffer.hpp"
 #include "soundsink.hpp"
 #include "time.hpp"
+#include "profile.hpp"
 
 namespace core
 {
+	PROFILE_COUNTER(prof_callback, "sink/sound callback", PROFILE_TIME);
+	PROFILE_COUNTER(prof_jitter, "sink/sound callback jitter (us)", PROFILE_LEVEL);
+	PROFILE_COUNTER(prof_overruns, "sink/timestamp queue overruns", PROFILE_EVENT);
+
 	struct _soundsink_threading_t
 	{
 		boost::thread *t;
@@ -28,6 +33,29 @@ namespace core
 		boost::mutex mtx_time_ringbuffer;
 		boost::condition cond_time_ringbuffer;
 
+#ifdef FAMI_PROFILING
+		// the last sound callback, to compare the time between callbacks
+		// with the sound they were asked for
+		bool timed;
+		core::u64 last_callback_ns;
+		core::u32 last_callback_sz;
+
+		void profileCallback(core::u64 start, core::u32 sz, core::u32 sr)
+		{
+			core::u64 now = core::profileNanoseconds();
+			prof_callback.add(now - start);
+			if (timed && last_callback_sz != 0)
+			{
+				core::s64 interval = (core::s64)(start - last_callback_ns);
+				core::s64 expected = (core::s64)last_callback_sz * 1000000000 / sr;
+				core::s64 jitter = interval > expected ? interval - expected : expected - interval;
+				prof_jitter.add(jitter / 1000);
+			}
+			last_callback_ns = start;
+			last_callback_sz = sz;
+		}
+#endif
+
 		void delthread()
 		{
 			delete t;
@@ -36,16 +64,32 @@ namespace core
 	};
 
 	SoundSink::SoundSink()
-		: m_timeidxsz(0), m_playing(false)
+		: m_channels(1), m_format(SAMPLE_S16), m_timeidxsz(0), m_playing(false)
+	{
+		_init(true);
+	}
+	SoundSink::SoundSink(bool timed)
+		: m_channels(1), m_format(SAMPLE_S16), m_timeidxsz(0), m_playing(false)
 	{
-		m_timeidx_ringbuffer = new RingBuffer(sizeof(core::timestamp_t));
+		_init(timed);
+	}
+	void SoundSink::_init(bool timed)
+	{
+		m_timeidx_ringbuffer = new SPSCRingBuffer(sizeof(core::timestamp_t));
 		// give the ring buffer a generous amount of memory
 		m_timeidx_ringbuffer->resize(MAX_TIMEIDX*16);
 
 		m_threading = new _soundsink_threading_t;
 		m_threading->destructing = false;
-		m_threading->running = true;
-		m_threading->t = new boost::thread(_timeloop_bootstrap, this);
+		m_threading->running = timed;
+		m_threading->t = NULL;
+		PROFILE_ONLY(m_threading->timed = timed);
+		PROFILE_ONLY(m_threading->last_callback_ns = 0);
+		PROFILE_ONLY(m_threading->last_callback_sz = 0);
+		if (timed)
+		{
+			m_threading->t = new boost::thread(_timeloop_bootstrap, this);
+		}
 	}
 	SoundSink::~SoundSink()
 	{
@@ -103,17 +147,23 @@ namespace core
 		mtx.lock();
 		while (!sinkDestruction && m_timeidx_ringbuffer->isEmpty())
 		{
-			// notify that the ringbuffer is empty
-			// (this shouldn't affect the wait we have shortly after)
-			m_threading->cond_time_ringbuffer.notify_all();
-
 			if (skip > 0)
 			{
-				// perform skip callbacks before waiting
-				(*m_timeCallback)(skip, m_callbackData);
+				// perform skip callbacks before waiting. applyTime takes the
+				// mutex to signal, so don't make the audio callback wait on them
+				core::u32 s = skip;
 				skip = 0;
+				mtx.unlock();
+				(*m_timeCallback)(s, m_callbackData);
+				mtx.lock();
+				// timestamps may have arrived meanwhile
+				continue;
 			}
 
+			// notify that the ringbuffer is empty
+			// (this shouldn't affect the wait we have shortly after)
+			m_threading->cond_time_ringbuffer.notify_all();
+
 			// SoundSink could be destructing. let's check
 			if (m_threading->destructing)
 			{
@@ -122,7 +172,9 @@ namespace core
 			}
 			else
 			{
-				// wait until the ring buffer is filled
+				// wait until the ring buffer is filled. applyTime signals
+				// under the mutex, so the signal can't slip in between the
+				// isEmpty() check and the wait
 				m_threading->cond_time_ringbuffer.wait(mtx);
 			}
 		}
@@ -193,7 +245,17 @@ namespace core
 
 	void SoundSink::performSoundCallback(s16 *buf, u32 sz)
 	{
+		PROFILE_ONLY(core::u64 start = profileNanoseconds());
+		core::u32 timec = (*m_soundCallback)(buf, sz, m_callbackData, m_timeidx);
+		PROFILE_ONLY(m_threading->profileCallback(start, sz, sampleRate()));
+
+		m_timeidxsz = timec;
+	}
+	void SoundSink::performSoundCallback(float *buf, u32 sz)
+	{
+		PROFILE_ONLY(core::u64 start = profileNanoseconds());
 		core::u32 timec = (*m_soundCallback)(buf, sz, m_callbackData, m_timeidx);
+		PROFILE_ONLY(m_threading->profileCallback(start, sz, sampleRate()));
 
 		m_timeidxsz = timec;
 	}
@@ -219,18 +281,34 @@ namespace core
 			arr[i] = ts;
 		}
 
+		// this runs in the audio callback. the ring buffer needs no lock,
+		// so nothing here can block on the timestamp thread
+		if (m_timeidx_ringbuffer->write(arr, m_timeidxsz) < m_timeidxsz)
 		{
-			boost::lock_guard<boost::mutex>(m_threading->mtx_time_ringbuffer);
+			PROFILE_ADD(prof_overruns, 1);
+			fprintf(stderr, "m_timeidx_ringbuffer overrun\n");
+			// buffer overrun
+		}
 
-			if (m_timeidx_ringbuffer->write(arr, m_timeidxsz) < m_timeidxsz)
-			{
-				fprintf(stderr, "m_timeidx_ringbuffer overrun\n");
-				// buffer overrun
-			}
+		// in case the timer thread is waiting on the ring buffer, signal the
+		// thread. the mutex is only held for the signal, so it can't be lost
+		// between the thread's isEmpty() check and its wait
+		{
+			boost::lock_guard<boost::mutex> lock(m_threading->mtx_time_ringbuffer);
+			m_threading->cond_time_ringbuffer.notify_all();
 		}
-		// in case the timer thread is waiting on the ring buffer, signal the thread
 
-		m_threading->cond_time_ringbuffer.notify_all();
+		m_timeidxsz = 0;
+	}
+
+	void SoundSink::dispatchTime()
+	{
+		// the sound is consumed right away, so every timestamp has already
+		// elapsed. perform them as skips
+		if (m_timeidxsz == 0)
+			return;
+
+		(*m_timeCallback)(m_timeidxsz, m_callbackData);
 
 		m_timeidxsz = 0;
 	}
@@ -360,20 +438,66 @@ namespace core
 	SoundSinkPlayback::SoundSinkPlayback()
 	{
 	}
-	SoundSinkPlayback::SoundSinkPlayback(const SoundSinkPlayback &)
+
+	SoundSinkPlayback::~SoundSinkPlayback()
 	{
 	}
-	SoundSinkPlayback & SoundSinkPlayback::operator =(const SoundSinkPlayback &)
+
+	SoundSinkExport::SoundSinkExport(core::IO *io, unsigned int sampleRate, unsigned int channels)
+		: SoundSink(false),
+		  m_io(io), m_sampleRate(sampleRate),
+		  m_renderedSamples(0), m_render_us(0)
 	{
-		return *this;
+		m_channels = channels;
 	}
 
-	SoundSinkPlayback::~SoundSinkPlayback()
+	SoundSinkExport::~SoundSinkExport()
 	{
 	}
 
 	void SoundSinkExport::render()
 	{
+		// no timestamp thread and no sleeping. frames are requested as fast
+		// as they can be generated, until the sound generator stops the sink
+		const core::u32 sz = RENDER_BUFFER_SIZE * m_channels;
+		core::s16 *buf = new core::s16[sz];
+
+		m_renderedSamples = 0;
+		m_render_us = 0;
+
+		timestamp_t last;
+		last.gettime();
+
+		while (isPlaying())
+		{
+			performSoundCallback(buf, RENDER_BUFFER_SIZE);
+			flushBuffer(buf, sz);
+			dispatchTime();
+
+			m_renderedSamples += RENDER_BUFFER_SIZE;
+
+			// diff_us() only holds about 35 minutes, so the render time is
+			// added up a buffer at a time
+			timestamp_t now;
+			now.gettime();
+			m_render_us += now.diff_us(last);
+			last = now;
+		}
+
+		delete[] buf;
+	}
+
+	double SoundSinkExport::renderSeconds() const
+	{
+		return m_render_us / 1000000.0;
+	}
+
+	double SoundSinkExport::realtimeMultiple() const
+	{
+		if (m_render_us <= 0)
+			return 0.0;
 
+		double audio_s = (double)m_renderedSamples / m_sampleRate;
+		return audio_s / renderSeconds();
 	}
 }
@@ -8,16 +8,27 @@ namespace core
 	class IO;
 	struct _soundsink_threading_t;
 	struct timestamp_t;
-	class RingBuffer;
+	class SPSCRingBuffer;
+
+	enum SampleFormat
+	{
+		SAMPLE_S16,
+		SAMPLE_FLOAT	// -1.0 to 1.0, not clamped
+	};
+
 	class COREAPI SoundSink
 	{
 	public:
-		typedef core::u32 (*sound_callback_t)(core::s16 *buffer, core::u32 size, void *data, core::u32 *timeidx);
+		// size is in sample frames. a frame holds one sample per channel,
+		// interleaved, in the format of sampleFormat()
+		typedef core::u32 (*sound_callback_t)(void *buffer, core::u32 size, void *data, core::u32 *timeidx);
 		typedef void (*time_callback_t)(core::u32 skip, void *data);
 
 		SoundSink();
 		virtual ~SoundSink();
 		virtual int sampleRate() const = 0;
+		unsigned int channels() const{ return m_channels; }
+		SampleFormat sampleFormat() const{ return m_format; }
 
 		virtual void setPlaying(bool playing);
 
@@ -27,11 +38,22 @@ namespace core
 		void setCallbackData(void *data){ m_callbackData = data; }
 
 		void performSoundCallback(core::s16 *buf, core::u32 sz);
+		void performSoundCallback(float *buf, core::u32 sz);
 		void applyTime(core::s32 delay_us);
 
 		void blockUntilStopped();
 		void blockUntilTimerEmpty();
+	protected:
+		// untimed sinks have no timestamp thread. the time callback is
+		// performed by the sink itself (see dispatchTime)
+		explicit SoundSink(bool timed);
+		void dispatchTime();
+
+		unsigned int m_channels;
+		SampleFormat m_format;
 	private:
+		void _init(bool timed);
+
 		static const int MAX_TIMEIDX=64;
 
 		bool _timeloop_readNextTimestamp(core::timestamp_t &, u32 &skip);
@@ -46,34 +68,50 @@ namespace core
 		core::u32 m_timeidxsz;
 		_soundsink_threading_t *m_threading;
 		core::u32 m_timeidx[MAX_TIMEIDX];
-		core::RingBuffer *m_timeidx_ringbuffer;
+		// written by applyTime, read by the timestamp thread
+		core::SPSCRingBuffer *m_timeidx_ringbuffer;
 	};
 
 	class COREAPI SoundSinkPlayback : public SoundSink
 	{
 	public:
 		SoundSinkPlayback();
-		SoundSinkPlayback(const SoundSinkPlayback&);
-		SoundSinkPlayback & operator =(const SoundSinkPlayback&);
 		virtual ~SoundSinkPlayback();
 		virtual void initialize(unsigned int sampleRate, unsigned int channels, unsigned int latency_ms) = 0;
 		virtual void close() = 0;
+	private:
+		SoundSinkPlayback(const SoundSinkPlayback&);
+		SoundSinkPlayback & operator =(const SoundSinkPlayback&);
 	};
 
 	class COREAPI SoundSinkExport : public SoundSink
 	{
 	public:
+		// renders as fast as possible until the sink is stopped
 		void render();
+
+		int sampleRate() const{ return m_sampleRate; }
+
+		// statistics of the last render() call
+		core::u64 renderedSamples() const{ return m_renderedSamples; }
+		double renderSeconds() const;
+		double realtimeMultiple() const;
 	protected:
 		SoundSinkExport(core::IO *io, unsigned int sampleRate, unsigned int channels);
 		SoundSinkExport(const SoundSinkExport&);
 		SoundSinkExport & operator =(const SoundSinkExport&);
 		virtual ~SoundSinkExport();
 
-		virtual void flushBuffer(core::s16 *Buffer, core::u32 Size);
+		virtual void flushBuffer(core::s16 *Buffer, core::u32 Size) = 0;
 
+		core::IO *m_io;
 	private:
+		static const core::u32 RENDER_BUFFER_SIZE = 4096;
+
+		unsigned int m_sampleRate;
 
+		core::u64 m_renderedSamples;
+		core::s64 m_render_us;
 	};
 
 	COREAPI core::SoundSink * loadSoundSink(const char *name);
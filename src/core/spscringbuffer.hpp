@@ -0,0 +1,163 @@
+#ifndef CORE_SPSCRINGBUFFER_HPP
+#define CORE_SPSCRINGBUFFER_HPP
+
+#include "types.hpp"
+#include <string.h>
+#include <boost/atomic.hpp>
+
+namespace core
+{
+	static const Quantity CACHE_LINE_SIZE = 64;
+
+	// A ring buffer for exactly one producer thread and one consumer thread,
+	// without locks. Only the producer may call write() and availWrite(), and
+	// only the consumer may call read(), skipRead() and availRead().
+	// resize() and clear() require that neither side is active.
+	//
+	// The capacity is rounded up to a power of two. The read and write
+	// positions count up forever and are masked on access, so a full buffer
+	// needs no extra flag.
+	//
+	// Please do NOT use non-plain-old-data structures as T!
+	class SPSCRingBuffer
+	{
+	public:
+		SPSCRingBuffer(Quantity elementSize=1)
+			: m_elementcount(0), m_mask(0), m_elementsize(elementSize),
+			  m_buffer(NULL)
+		{
+			m_readpos = 0;
+			m_writepos = 0;
+		}
+		~SPSCRingBuffer()
+		{
+			delete[] m_buffer;
+		}
+
+		void resize(Quantity total_elements)
+		{
+			Quantity count = 1;
+			while (count < total_elements)
+				count <<= 1;
+
+			core::byte *buf = new core::byte[count*m_elementsize];
+			delete[] m_buffer;
+			m_buffer = buf;
+			m_elementcount = count;
+			m_mask = count - 1;
+			clear();
+		}
+		Quantity capacity() const
+		{
+			return m_elementcount;
+		}
+		Quantity availRead() const
+		{
+			return m_writepos.load(boost::memory_order_acquire) - m_readpos.load(boost::memory_order_relaxed);
+		}
+		Quantity availWrite() const
+		{
+			return m_elementcount - (m_writepos.load(boost::memory_order_relaxed) - m_readpos.load(boost::memory_order_acquire));
+		}
+		bool isFull() const
+		{
+			return availWrite() == 0;
+		}
+		bool isEmpty() const
+		{
+			// safe from any thread, though the answer may be stale
+			return m_writepos.load(boost::memory_order_acquire) == m_readpos.load(boost::memory_order_acquire);
+		}
+		Quantity read(void *data, Quantity sz)
+		{
+			// clip sz to availRead()
+			Quantity avail = availRead();
+			if (sz > avail)
+				sz = avail;
+
+			if (sz == 0)
+				return 0;
+
+			Quantity pos = m_readpos.load(boost::memory_order_relaxed);
+			Quantity start = pos & m_mask;
+			Quantity r = m_elementcount - start;
+
+			if (sz > r)
+			{
+				memcpy(data, m_buffer+start*m_elementsize, r*m_elementsize);
+				memcpy((core::byte*)data+(r*m_elementsize), m_buffer, (sz-r)*m_elementsize);
+			}
+			else
+			{
+				memcpy(data, m_buffer+start*m_elementsize, sz*m_elementsize);
+			}
+			m_readpos.store(pos + sz, boost::memory_order_release);
+
+			return sz;
+		}
+		Quantity skipRead(Quantity sz)
+		{
+			// clip sz to availRead()
+			Quantity avail = availRead();
+			if (sz > avail)
+				sz = avail;
+
+			m_readpos.store(m_readpos.load(boost::memory_order_relaxed) + sz, boost::memory_order_release);
+
+			return sz;
+		}
+		Quantity write(const void *data, Quantity sz)
+		{
+			// clip sz to availWrite()
+			Quantity avail = availWrite();
+			if (sz > avail)
+				sz = avail;
+
+			if (sz == 0)
+				return 0;
+
+			Quantity pos = m_writepos.load(boost::memory_order_relaxed);
+			Quantity start = pos & m_mask;
+			Quantity r = m_elementcount - start;
+
+			if (sz > r)
+			{
+				memcpy(m_buffer+start*m_elementsize, data, r*m_elementsize);
+				memcpy(m_buffer, (const core::byte*)data+(r*m_elementsize), (sz-r)*m_elementsize);
+			}
+			else
+			{
+				memcpy(m_buffer+start*m_elementsize, data, sz*m_elementsize);
+			}
+			m_writepos.store(pos + sz, boost::memory_order_release);
+
+			return sz;
+		}
+		void clear()
+		{
+			m_readpos.store(0, boost::memory_order_relaxed);
+			m_writepos.store(0, boost::memory_order_release);
+		}
+
+	private:
+		SPSCRingBuffer(const SPSCRingBuffer&);
+		SPSCRingBuffer & operator =(const SPSCRingBuffer&);
+
+		Quantity m_elementcount;
+		Quantity m_mask;
+		Quantity m_elementsize;
+		core::byte *m_buffer;
+
+		// the consumer and the producer each own one position. keep them on
+		// separate cache lines so the two threads don't keep stealing the
+		// line from each other
+		char m_pad0[CACHE_LINE_SIZE];
+		boost::atomic<Quantity> m_readpos;
+		char m_pad1[CACHE_LINE_SIZE - sizeof(boost::atomic<Quantity>)];
+		boost::atomic<Quantity> m_writepos;
+		char m_pad2[CACHE_LINE_SIZE - sizeof(boost::atomic<Quantity>)];
+	};
+}
+
+#endif
+
@@ -143,6 +143,8 @@ namespace core
 			{
 				m_mtx.lock();
 				m_doKeepRunning = yes;
+				// wake the threads waiting for events, so they can stop
+				m_cond.notify_all();
 				m_mtx.unlock();
 			}
 
@@ -153,6 +155,8 @@ namespace core
 				while (doKeepRunning())
 				{
 					e = pullEvent();
+					if (e == NULL)
+						break;
 					e->run(data);
 					e->pimpl()->setBlockHandleDone();
 					delete e;
@@ -175,14 +179,20 @@ namespace core
 			boost::condition m_cond;
 			bool m_doKeepRunning;
 
+			// NULL once the queue stops running
 			Event * pullEvent()
 			{
 				m_mtx.lock();
 
-				while (m_events.empty())
+				while (m_events.empty() && m_doKeepRunning)
 				{
 					m_cond.wait(m_mtx);
 				}
+				if (!m_doKeepRunning)
+				{
+					m_mtx.unlock();
+					return NULL;
+				}
 				Event *e = m_events.front();
 				m_events.pop();
 				m_mtx.unlock();
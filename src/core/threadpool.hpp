@@ -45,6 +45,8 @@ namespace core
 			BlockHandle * postEventWithBlockHandle(Event *e);
 
 			bool doKeepRunning();
+			// Stopping wakes every thread in run(), so several threads can
+			// run the same queue
 			void setDoKeepRunning(bool yes);
 
 			void run(void *data);
@@ -43,6 +43,7 @@
 #include <cmath>
 #include "APU.h"
 #include "core/soundsink.hpp"
+#include "core/profile.hpp"
 
 #include "Square.h"
 #include "Triangle.h"
@@ -73,15 +74,19 @@ const uint8 CAPU::LENGTH_TABLE[] = {
 	0xC0, 0x18, 0x48, 0x1A, 0x10, 0x1C, 0x20, 0x1E
 };
 
-static std::vector<CExternal*> ExChips;
-
 CAPU::CAPU(CSampleMem *pSampleMem) :
 	m_pParent(NULL),
+	m_pWriteCallback(NULL),
+	m_pWriteData(NULL),
 	m_iFrameCycles(0),
 	m_pSoundBuffer(NULL),
 	m_pMixer(new CMixer()),
 	m_iExternalSoundChip(0),
-	m_iCyclesToRun(0)
+	m_iCyclesToRun(0),
+	m_iCycles(0),
+	m_iProcessCalls(0),
+	m_iRuns(0),
+	m_bQueueWrites(false)
 {
 	m_pSquare1 = new CSquare(m_pMixer, CHANID_SQUARE1, SNDCHIP_NONE);
 	m_pSquare2 = new CSquare(m_pMixer, CHANID_SQUARE2, SNDCHIP_NONE);
@@ -98,10 +103,6 @@ CAPU::CAPU(CSampleMem *pSampleMem) :
 
 	m_fLevelVRC7 = 1.0f;
 	m_fLevelS5B = 1.0f;
-
-#ifdef LOGGING
-	m_pLog = new CFile("apu_log.txt", CFile::modeCreate | CFile::modeWrite);
-#endif
 }
 
 CAPU::~CAPU()
@@ -122,11 +123,6 @@ CAPU::~CAPU()
 	SAFE_RELEASE(m_pMixer);
 
 	SAFE_RELEASE_ARRAY(m_pSoundBuffer);
-
-#ifdef LOGGING
-	m_pLog->Close();
-	delete m_pLog;
-#endif
 }
 
 inline void CAPU::Clock_240Hz()
@@ -200,7 +196,90 @@ void CAPU::Process()
 	// The amount of cycles that will be emulated is added by CAPU::AddCycles
 	//
 	
-	static uint32 Time, i;
+	m_iProcessCalls++;
+
+	if (!m_QueuedWrites.empty())
+		ApplyQueue();
+
+	Run();
+}
+
+void CAPU::Sync()
+{
+	if (!m_bQueueWrites)
+	{
+		Process();
+		return;
+	}
+
+	// Nothing would run if no time was added since the last write
+	if (m_iCyclesToRun > (m_QueuedWrites.empty() ? 0 : m_QueuedWrites.back().Time))
+		QueueWrite(QUEUED_SYNC, 0, 0);
+}
+
+void CAPU::SetQueueWrites(bool Enable)
+{
+	if (!Enable && !m_QueuedWrites.empty())
+		ApplyQueue();
+
+	m_bQueueWrites = Enable;
+}
+
+void CAPU::QueueWrite(uint8 Type, uint16 Address, uint8 Value)
+{
+	QueuedWrite w;
+	w.Time = m_iCyclesToRun;
+	w.Address = Address;
+	w.Value = Value;
+	w.Type = Type;
+	m_QueuedWrites.push_back(w);
+}
+
+void CAPU::ApplyQueue()
+{
+	// Runs up to each write and makes it, splitting the emulation where
+	// Process() would have been called if it wasn't queued. Processing
+	// reached from the writes finds the queue empty and nothing to run
+	m_QueuedWrites.swap(m_AppliedWrites);
+
+	const uint32 Total = m_iCyclesToRun;
+	uint32 Done = 0;
+	m_iCyclesToRun = 0;
+
+	for (std::vector<QueuedWrite>::const_iterator it = m_AppliedWrites.begin(); it != m_AppliedWrites.end(); ++it)
+	{
+		if (it->Time > Done)
+		{
+			m_iCyclesToRun = it->Time - Done;
+			Run();
+			Done = it->Time;
+		}
+
+		switch (it->Type)
+		{
+			case QUEUED_WRITE: WriteRegister(it->Address, it->Value); break;
+			case QUEUED_EXTERNAL_WRITE: WriteExternalRegister(it->Address, it->Value); break;
+		}
+	}
+
+	m_AppliedWrites.clear();
+	m_iCyclesToRun = Total - Done;
+}
+
+PROFILE_COUNTER(prof_2a03, "apu/Process 2A03", PROFILE_TIME);
+PROFILE_COUNTER(prof_vrc6, "apu/Process VRC6", PROFILE_TIME);
+PROFILE_COUNTER(prof_vrc7, "apu/Process VRC7", PROFILE_TIME);
+PROFILE_COUNTER(prof_fds, "apu/Process FDS", PROFILE_TIME);
+PROFILE_COUNTER(prof_mmc5, "apu/Process MMC5", PROFILE_TIME);
+PROFILE_COUNTER(prof_n106, "apu/Process N106", PROFILE_TIME);
+PROFILE_COUNTER(prof_finish, "apu/CMixer::FinishBuffer", PROFILE_TIME);
+
+void CAPU::Run()
+{
+	uint32 Time, i;
+
+	if (m_iCyclesToRun > 0)
+		m_iRuns++;
 
 	while (m_iCyclesToRun > 0)
 	{
@@ -211,32 +290,37 @@ void CAPU::Process()
 		if (Time > m_iFrameClock)
 			Time = m_iFrameClock;
 		
-		// Fixes the problem with distortion due to volume modulation
-		i = Time;
-		while (i > 0)
 		{
-			uint32 Period = min(m_pSquare1->GetPeriod(), m_pSquare2->GetPeriod());
-			Period = min(max<uint32>(Period, 7), i);
-			m_pSquare1->Process(Period);
-			m_pSquare2->Process(Period);
-			i -= Period;
+			PROFILE_SCOPE(prof_2a03);
+
+			// Fixes the problem with distortion due to volume modulation
+			i = Time;
+			while (i > 0)
+			{
+				uint32 Period = min(m_pSquare1->GetPeriod(), m_pSquare2->GetPeriod());
+				Period = min(max<uint32>(Period, 7), i);
+				m_pSquare1->Process(Period);
+				m_pSquare2->Process(Period);
+				i -= Period;
+			}
+
+			i = Time;
+			while (i > 0)
+			{
+				uint32 Period = min(m_pTriangle->GetPeriod(), m_pNoise->GetPeriod());
+				Period = min<uint32>(Period, m_pDPCM->GetPeriod());
+				Period = min(max<uint32>(Period, 7), i);
+				m_pTriangle->Process(Period);
+				m_pNoise->Process(Period);
+				m_pDPCM->Process(Period);
+				i -= Period;
+			}
 		}
 
-		i = Time;
-		while (i > 0)
+		for (std::vector<CExternal*>::size_type c = 0; c < m_ExternalChips.size(); c++)
 		{
-			uint32 Period = min(m_pTriangle->GetPeriod(), m_pNoise->GetPeriod());
-			Period = min<uint32>(Period, m_pDPCM->GetPeriod());
-			Period = min(max<uint32>(Period, 7), i);
-			m_pTriangle->Process(Period);
-			m_pNoise->Process(Period);
-			m_pDPCM->Process(Period);
-			i -= Period;
-		}
-
-		for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
-		{
-			(*iter)->Process(Time);
+			PROFILE_SCOPE(*m_ExternalProfile[c]);
+			m_ExternalChips[c]->Process(Time);
 		}
 
 		m_iFrameCycles		+= Time;
@@ -263,21 +347,21 @@ void CAPU::EndFrame()
 	m_pNoise->EndFrame();
 	m_pDPCM->EndFrame();
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+	for (std::vector<CExternal*>::iterator iter = m_ExternalChips.begin(); iter != m_ExternalChips.end(); ++iter)
 	{
 		(*iter)->EndFrame();
 	}
 
-	int SamplesAvail = m_pMixer->FinishBuffer(m_iFrameCycles);
+	int SamplesAvail;
+	{
+		PROFILE_SCOPE(prof_finish);
+		SamplesAvail = m_pMixer->FinishBuffer(m_iFrameCycles);
+	}
 	int ReadSamples	= m_pMixer->ReadBuffer(SamplesAvail, m_pSoundBuffer, m_bStereoEnabled);
 	(*m_pParent)(m_pSoundBuffer, ReadSamples, m_pParentData);
 	
 	m_iFrameClock /*+*/= m_iFrameCycleCount;
 	m_iFrameCycles = 0;
-
-#ifdef LOGGING
-	m_iFrame++;
-#endif
 }
 
 void CAPU::Reset()
@@ -286,6 +370,10 @@ void CAPU::Reset()
 	//
 	
 	m_iCyclesToRun		= 0;
+	m_iCycles			= 0;
+	m_iProcessCalls		= 0;
+	m_iRuns				= 0;
+	m_QueuedWrites.clear();
 	m_iFrameCycles		= 0;
 	m_iSequencerClock	= SEQUENCER_PERIOD;
 	m_iFrameSequence	= 0;
@@ -300,14 +388,10 @@ void CAPU::Reset()
 	m_pNoise->Reset();
 	m_pDPCM->Reset();
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+	for (std::vector<CExternal*>::iterator iter = m_ExternalChips.begin(); iter != m_ExternalChips.end(); ++iter)
 	{
 		(*iter)->Reset();
 	}
-
-#ifdef LOGGING
-	m_iFrame = 0;
-#endif
 }
 
 void CAPU::SetupMixer(int LowCut, int HighCut, int HighDamp, int Volume) const
@@ -323,20 +407,36 @@ void CAPU::SetExternalSound(uint8 Chip)
 	m_iExternalSoundChip = Chip;
 	m_pMixer->ExternalSound(Chip);
 
-	ExChips.clear();
+	m_ExternalChips.clear();
+	PROFILE_ONLY(m_ExternalProfile.clear());
 
 	if (Chip & SNDCHIP_VRC6)
-		ExChips.push_back(m_pVRC6);
+	{
+		m_ExternalChips.push_back(m_pVRC6);
+		PROFILE_ONLY(m_ExternalProfile.push_back(&prof_vrc6));
+	}
 	if (Chip & SNDCHIP_VRC7)
-		ExChips.push_back(m_pVRC7);
+	{
+		m_ExternalChips.push_back(m_pVRC7);
+		PROFILE_ONLY(m_ExternalProfile.push_back(&prof_vrc7));
+	}
 	if (Chip & SNDCHIP_FDS)
-		ExChips.push_back(m_pFDS);
+	{
+		m_ExternalChips.push_back(m_pFDS);
+		PROFILE_ONLY(m_ExternalProfile.push_back(&prof_fds));
+	}
 	if (Chip & SNDCHIP_MMC5)
-		ExChips.push_back(m_pMMC5);
+	{
+		m_ExternalChips.push_back(m_pMMC5);
+		PROFILE_ONLY(m_ExternalProfile.push_back(&prof_mmc5));
+	}
 	if (Chip & SNDCHIP_N106)
-		ExChips.push_back(m_pN106);
+	{
+		m_ExternalChips.push_back(m_pN106);
+		PROFILE_ONLY(m_ExternalProfile.push_back(&prof_n106));
+	}
 //	if (Chip & SNDCHIP_S5B)
-//		ExChips.push_back(m_pS5B);
+//		m_ExternalChips.push_back(m_pS5B);
 
 	Reset();
 }
@@ -361,7 +461,7 @@ void CAPU::ChangeMachine(int Machine)
 	}
 }
 
-bool CAPU::SetupSound(int SampleRate, int NrChannels, int Machine)
+bool CAPU::SetupSound(int SampleRate, int NrChannels, int Machine, bool FloatSamples)
 {
 	// Allocate a sound buffer
 	//
@@ -377,14 +477,14 @@ bool CAPU::SetupSound(int SampleRate, int NrChannels, int Machine)
 	m_iSampleSizeShift	  = (NrChannels == 2) ? 1 : 0;
 	m_iBufferPointer	  = 0;
 
-	if (!m_pMixer->AllocateBuffer(m_iSoundBufferSamples, SampleRate, NrChannels))
+	if (!m_pMixer->AllocateBuffer(m_iSoundBufferSamples, SampleRate, NrChannels, FloatSamples))
 		return false;
 
 	m_pMixer->SetClockRate(BaseFreq);
 
 	SAFE_RELEASE_ARRAY(m_pSoundBuffer);
 
-	m_pSoundBuffer = new int16[m_iSoundBufferSize << 1];
+	m_pSoundBuffer = new uint8[(m_iSoundBufferSize << 1) * (FloatSamples ? sizeof(float) : sizeof(int16))];
 
 	if (m_pSoundBuffer == NULL)
 		return false;
@@ -408,6 +508,14 @@ void CAPU::AddTime(int32 Cycles)
 	if (Cycles < 0)
 		return;
 	m_iCyclesToRun += Cycles;
+	m_iCycles += Cycles;
+}
+
+void CAPU::SkipTime(int32 Cycles)
+{
+	if (Cycles < 0)
+		return;
+	m_iCycles += Cycles;
 }
 
 void CAPU::Write(uint16 Address, uint8 Value)
@@ -415,8 +523,21 @@ void CAPU::Write(uint16 Address, uint8 Value)
 	// Data was written to an APU register
 	//
 
+	if (m_pWriteCallback != NULL)
+		(*m_pWriteCallback)(m_iCycles, Address, Value, false, m_pWriteData);
+
+	if (m_bQueueWrites)
+	{
+		QueueWrite(QUEUED_WRITE, Address, Value);
+		return;
+	}
+
 	Process();
+	WriteRegister(Address, Value);
+}
 
+void CAPU::WriteRegister(uint16 Address, uint8 Value)
+{
 	if (Address == 0x4015)
 	{
 		Write4015(Value);
@@ -438,10 +559,6 @@ void CAPU::Write(uint16 Address, uint8 Value)
 	}
 
 	m_iRegs[Address & 0x1F] = Value;
-
-#ifdef LOGGING
-	m_iRegs[Address & 0x1F] = Value;
-#endif
 }
 
 void CAPU::Write4017(uint8 Value)
@@ -509,9 +626,22 @@ void CAPU::ExternalWrite(uint16 Address, uint8 Value)
 	// (this doesn't really belong in the APU but are here for convenience)
 	//
 
+	if (m_pWriteCallback != NULL)
+		(*m_pWriteCallback)(m_iCycles, Address, Value, true, m_pWriteData);
+
+	if (m_bQueueWrites)
+	{
+		QueueWrite(QUEUED_EXTERNAL_WRITE, Address, Value);
+		return;
+	}
+
 	Process();
+	WriteExternalRegister(Address, Value);
+}
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+void CAPU::WriteExternalRegister(uint16 Address, uint8 Value)
+{
+	for (std::vector<CExternal*>::iterator iter = m_ExternalChips.begin(); iter != m_ExternalChips.end(); ++iter)
 	{
 		(*iter)->Write(Address, Value);
 	}
@@ -529,7 +659,7 @@ uint8 CAPU::ExternalRead(uint16 Address)
 
 	Process();
 
-	for (std::vector<CExternal*>::iterator iter = ExChips.begin(); iter != ExChips.end(); ++iter)
+	for (std::vector<CExternal*>::iterator iter = m_ExternalChips.begin(); iter != m_ExternalChips.end(); ++iter)
 	{
 		if (!Mapped)
 			Value = (*iter)->Read(Address, Mapped);
@@ -563,18 +693,6 @@ bool CAPU::DPCMPlaying() const
 	return m_pDPCM->IsPlaying();
 }
 
-#ifdef LOGGING
-void CAPU::Log()
-{
-	CString str;
-	str.Format("Frame %08i: ", m_iFrame);
-	for (int i = 0; i < 0x14; i++)
-		str.AppendFormat("%02X ", m_iRegs[i]);
-	str.Append("\n");
-	m_pLog->Write(str, str.GetLength());
-}
-#endif
-
 void CAPU::SetChipLevel(int Chip, int Level)
 {
 	float fLevel = expf(float(Level) / 20.0f);	// dB -> gain
@@ -592,6 +710,17 @@ void CAPU::SetChipLevel(int Chip, int Level)
 	}
 }
 
+void CAPU::SetChannelPan(int ChanID, int Pan)
+{
+	// -100 is left, 100 is right
+	m_pMixer->SetChannelPan(ChanID, Pan);
+}
+
+void CAPU::SetChipPan(int Chip, int Pan)
+{
+	m_pMixer->SetChipPan(Chip, Pan);
+}
+
 void CAPU::LogExternalWrite(uint16 Address, uint8 Value)
 {
 	if (Address >= 0x9000 && Address <= 0x9003)
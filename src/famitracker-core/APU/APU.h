@@ -21,11 +21,15 @@
 #ifndef _APU_H_
 #define _APU_H_
 
-//#define LOGGING
-
+#include <vector>
 #include "../Common.h"
 #include "Mixer.h"
 
+namespace core
+{
+	class ProfileCounter;
+}
+
 namespace core
 {
 	class SoundSink;
@@ -61,29 +65,49 @@ public:
 	CAPU(CSampleMem *pSampleMem);
 	~CAPU();
 
-	typedef void (*callback_t)(const int16 *buf, uint32 sz, void *data);
+	// buf holds sz sample frames, of int16 or float samples
+	typedef void (*callback_t)(const void *buf, uint32 sz, void *data);
+	// Called for each register write, Cycle is GetCycles() when it's written
+	typedef void (*writecallback_t)(uint64 Cycle, uint16 Address, uint8 Value, bool External, void *data);
 
 	void	SetCallback(callback_t callback, void *data)
 	{
 		m_pParent = callback;
 		m_pParentData = data;
 	}
+	void	SetWriteCallback(writecallback_t callback, void *data)
+	{
+		m_pWriteCallback = callback;
+		m_pWriteData = data;
+	}
 
 	void	Reset();
 	void	Process();
+	void	Sync();							// Splits the emulation here, see SetQueueWrites()
 	void	AddTime(int32 Cycles);
+	void	SkipTime(int32 Cycles);			// Counts cycles that aren't emulated
+	uint64	GetCycles() const { return m_iCycles; }	// Cycles added since Reset()
+	// Calls to Process() since Reset(), and the steps that emulated any time
+	uint64	GetProcessCalls() const { return m_iProcessCalls; }
+	uint64	GetRuns() const { return m_iRuns; }
 
 	uint8	Read4015();
 	void	Write4017(uint8 Value);
 	void	Write4015(uint8 Value);
 	void	Write(uint16 Address, uint8 Value);
 
+	// Queued, Write() and ExternalWrite() only store the write with the
+	// time added before it, and Process() runs up to each one and makes it
+	// in a single pass. Sync() stores where Process() would have run.
+	// Reads apply the queue first. The output is the same either way
+	void	SetQueueWrites(bool Enable);
+
 	void	SetExternalSound(uint8 Chip);
 	void	ExternalWrite(uint16 Address, uint8 Value);
 	uint8	ExternalRead(uint16 Address);
 	
 	void	ChangeMachine(int Machine);
-	bool	SetupSound(int SampleRate, int NrChannels, int Speed);
+	bool	SetupSound(int SampleRate, int NrChannels, int Speed, bool FloatSamples = false);
 	void	SetupMixer(int LowCut, int HighCut, int HighDamp, int Volume) const;
 
 	int32	GetVol(uint8 Chan) const;
@@ -93,10 +117,8 @@ public:
 	uint8	GetReg(int Chip, int Reg) const;
 
 	void	SetChipLevel(int Chip, int Level);
-
-#ifdef LOGGING
-	void	Log();
-#endif
+	void	SetChannelPan(int ChanID, int Pan);
+	void	SetChipPan(int Chip, int Pan);
 
 public:
 	static const uint8	LENGTH_TABLE[];
@@ -107,6 +129,16 @@ public:
 
 private:
 	static const int SEQUENCER_PERIOD;
+
+	enum { QUEUED_WRITE, QUEUED_EXTERNAL_WRITE, QUEUED_SYNC };
+
+	struct QueuedWrite
+	{
+		uint32	Time;								// m_iCyclesToRun when it was queued
+		uint16	Address;
+		uint8	Value;
+		uint8	Type;
+	};
 	
 private:
 	inline void Clock_240Hz();
@@ -115,6 +147,11 @@ private:
 	inline void	ClockSequence();
 
 	void EndFrame();
+	void Run();
+	void QueueWrite(uint8 Type, uint16 Address, uint8 Value);
+	void ApplyQueue();
+	void WriteRegister(uint16 Address, uint8 Value);
+	void WriteExternalRegister(uint16 Address, uint8 Value);
 
 	void LogExternalWrite(uint16 Address, uint8 Value);
 		
@@ -122,6 +159,8 @@ private:
 	CMixer		*m_pMixer;
 	callback_t	m_pParent;
 	void		*m_pParentData;
+	writecallback_t m_pWriteCallback;
+	void		*m_pWriteData;
 
 	// Internal channels
 	CSquare		*m_pSquare1;
@@ -138,6 +177,11 @@ private:
 	CVRC7		*m_pVRC7;
 	CS5B		*m_pS5B;
 
+	std::vector<CExternal*> m_ExternalChips;		// Enabled expansion chips
+#ifdef FAMI_PROFILING
+	std::vector<core::ProfileCounter*> m_ExternalProfile;	// Counter of each chip in m_ExternalChips
+#endif
+
 	uint8		m_iExternalSoundChip;				// External sound chip, if used
 
 	uint32		m_iFramePeriod;						// Cycles per frame
@@ -149,6 +193,14 @@ private:
 	uint32		m_iFrameCycleCount;
 	uint32		m_iFrameClock;
 	uint32		m_iCyclesToRun;						// Number of cycles to process
+	uint64		m_iCycles;							// Cycles added since reset
+
+	uint64		m_iProcessCalls;
+	uint64		m_iRuns;
+
+	bool		m_bQueueWrites;
+	std::vector<QueuedWrite> m_QueuedWrites;
+	std::vector<QueuedWrite> m_AppliedWrites;		// Swapped with m_QueuedWrites while it's applied
 
 	uint32		m_iSoundBufferSamples;				// Size of buffer, in samples
 	bool		m_bStereoEnabled;					// If stereo is enabled
@@ -156,7 +208,7 @@ private:
 	uint32		m_iSampleSizeShift;					// To convert samples to bytes
 	uint32		m_iSoundBufferSize;					// Size of buffer, in samples
 	uint32		m_iBufferPointer;					// Fill pos in buffer
-	int16		*m_pSoundBuffer;					// Sound transfer buffer
+	uint8		*m_pSoundBuffer;					// Sound transfer buffer, int16 or float samples
 
 	uint8		m_iRegs[0x20];
 	uint8		m_iRegsVRC6[0x10];
@@ -165,12 +217,6 @@ private:
 	float		m_fLevelVRC7;
 	float		m_fLevelS5B;
 
-#ifdef LOGGING
-	CFile		  *m_pLog;
-	int			  m_iFrame = 0;
-	unsigned char m_iRegs[32];
-#endif
-
 };
 
 #endif /* _APU_H_ */
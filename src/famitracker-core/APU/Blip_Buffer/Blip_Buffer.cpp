@@ -388,6 +388,32 @@ long Blip_Buffer::read_samples( blip_sample_t* out, long max_samples, int stereo
 	return count;
 }
 
+long Blip_Buffer::read_samples_unclamped( int* out, long max_samples )
+{
+	long count = samples_avail();
+	if ( count > max_samples )
+		count = max_samples;
+	
+	if ( count )
+	{
+		int const sample_shift = blip_sample_bits - 16;
+		int const bass_shift = this->bass_shift;
+		long accum = reader_accum;
+		buf_t_* in = buffer_;
+		
+		for ( long n = count; n--; )
+		{
+			*out++ = (int) (accum >> sample_shift);
+			accum -= accum >> bass_shift;
+			accum += *in++;
+		}
+		
+		reader_accum = accum;
+		remove_samples( count );
+	}
+	return count;
+}
+
 void Blip_Buffer::mix_samples( blip_sample_t const* in, long count )
 {
 	buf_t_* out = buffer_ + (offset_ >> BLIP_BUFFER_ACCURACY) + blip_widest_impulse_ / 2;
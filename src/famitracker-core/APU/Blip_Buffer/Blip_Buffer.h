@@ -36,6 +36,10 @@ public:
 	// easy interleving of two channels into a stereo output buffer.
 	long read_samples( blip_sample_t* dest, long max_samples, int stereo = 0 );
 	
+	// Same as read_samples(), but writes the samples at 16-bit scale without
+	// clamping, so they can be converted to any output format afterwards.
+	long read_samples_unclamped( int* dest, long max_samples );
+	
 // Additional optional features
 
 	// Current output sample rate
@@ -29,27 +29,29 @@
 CFDS::CFDS(CMixer *pMixer) : CExChannel(pMixer, SNDCHIP_FDS, CHANID_FDS)
 {
 	FDSSoundInstall3();
+	m_pFDSSound = FDSSoundNew();
 }
 
 CFDS::~CFDS()
 {
+	FDSSoundDelete(m_pFDSSound);
 }
 
 void CFDS::Reset()
 {
-	FDSSoundReset();
-	FDSSoundVolume(0);
+	FDSSoundReset(m_pFDSSound);
+	FDSSoundVolume(m_pFDSSound, 0);
 }
 
 void CFDS::Write(uint16 Address, uint8 Value)
 {
-	FDSSoundWrite(Address, Value);
+	FDSSoundWrite(m_pFDSSound, Address, Value);
 }
 
 uint8 CFDS::Read(uint16 Address, bool &Mapped)
 {
 	Mapped = ((0x4040 <= Address && Address <= 0x407f) || (0x4090 == Address) || (0x4092 == Address));
-	return FDSSoundRead(Address);
+	return FDSSoundRead(m_pFDSSound, Address);
 }
 
 void CFDS::EndFrame()
@@ -62,9 +64,16 @@ void CFDS::Process(uint32 Time)
 	if (!Time)
 		return;
 
-	while (Time--)
+	// Only cycles that may change the output are rendered one at a time,
+	// the FDS core skips over the rest
+	while (Time > 0)
 	{
-		Mix(FDSSoundRender() >> 12);
+		Mix(FDSSoundRender(m_pFDSSound) >> 12);
 		m_iTime++;
+		Time--;
+
+		uint32 Skipped = FDSSoundAdvance(m_pFDSSound, Time);
+		m_iTime += Skipped;
+		Time -= Skipped;
 	}
 }
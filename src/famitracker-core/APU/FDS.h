@@ -23,6 +23,7 @@
 
 #include "External.h"
 #include "Channel.h"
+#include "FDSSound.h"
 
 class CFDS : public CExternal, CExChannel {
 public:
@@ -76,6 +77,8 @@ private:
 
 	uint8	m_iWaveTable[0x40];		// Waveform	table
 	uint8	m_iModTable[0x40];		// Frequency modulation table
+
+	FDSSOUND	*m_pFDSSound;			// Emulation state
 };
 
-#endif /* _FDS_H_ */
\ No newline at end of file
+#endif /* _FDS_H_ */
\ No newline at end of file
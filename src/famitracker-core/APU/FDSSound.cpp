@@ -1,6 +1,7 @@
 #include <cmath>
 #include <memory>
 #include <string.h>
+#include <boost/thread/once.hpp>
 #include "APU.h"
 #include "FDSSound.h"
 
@@ -34,12 +35,12 @@ int32 LogToLinear(uint32 l, uint32 sft)
 	return (l & 1) ? -ret : ret;
 }
 
-void LogTableInitialize(void)
+// The tables never change once built, and are shared by all instances
+static boost::once_flag logtable_once = BOOST_ONCE_INIT;
+
+static void LogTableBuild(void)
 {
-	static volatile uint32 initialized = 0;
 	double a;
-	if (initialized) return;
-	initialized = 1;
 	for (uint32 i = 0; i < (1 << LOG_BITS); i++)
 	{
 		a = (1 << LOG_LIN_BITS) / pow(2, i / (double)(1 << LOG_BITS));
@@ -55,6 +56,11 @@ void LogTableInitialize(void)
 	}
 }
 
+void LogTableInitialize(void)
+{
+	boost::call_once(LogTableBuild, logtable_once);
+}
+
 
 void FDSSoundInstall(void);
 void FDSSelect(unsigned type);
@@ -100,7 +106,8 @@ typedef struct FDSSOUND_tag {
 	uint32 envspd;
 	uint32 envcps;
 	uint8 envdisable;
-	uint8 d[3];
+	uint8 envstepped;	// the envelopes stepped in the last FDSSoundRender
+	uint8 d[2];
 	uint32 lvl;
 	int32 mastervolumel[4];
 	uint32 mastervolume;
@@ -108,8 +115,6 @@ typedef struct FDSSOUND_tag {
 	uint8 reg[0x10];
 } FDSSOUND;
 
-static FDSSOUND fdssound;
-
 static void FDSSoundWGStep(FDS_WG *pwg)
 {
 #if 0
@@ -135,101 +140,176 @@ static void FDSSoundEGStep(FDS_EG *peg)
 }
 
 
-int32 FDSCALL FDSSoundRender(void)
+int32 FDSCALL FDSSoundRender(FDSSOUND *fdssound)
 {
 	int32 output;
 	/* Wave Generator */
-	FDSSoundWGStep(&fdssound.op[0].wg);
+	FDSSoundWGStep(&fdssound->op[0].wg);
 	// EDIT not using FDSSoundWGStep for modulator (op[1]), need to adjust bias when sample changes
 
 	/* Frequency Modulator */
-	fdssound.op[1].pg.spd = fdssound.op[1].pg.spdbase;
-	if (fdssound.op[1].wg.disable)
-		fdssound.op[0].pg.spd = fdssound.op[0].pg.spdbase;
+	fdssound->op[1].pg.spd = fdssound->op[1].pg.spdbase;
+	if (fdssound->op[1].wg.disable)
+		fdssound->op[0].pg.spd = fdssound->op[0].pg.spdbase;
 	else
 	{
 		// EDIT this step has been entirely rewritten to match FDS.txt by Disch
 
 		// advance the mod table wave and adjust the bias when/if next table entry is reached
 		const uint32 ENTRY_WIDTH = 1 << (PGCPS_BITS + 16);
-		uint32 spd = fdssound.op[1].pg.spd; // phase to add
+		uint32 spd = fdssound->op[1].pg.spd; // phase to add
 		while (spd)
 		{
-			uint32 left = ENTRY_WIDTH - (fdssound.op[1].wg.phase & (ENTRY_WIDTH-1));
+			uint32 left = ENTRY_WIDTH - (fdssound->op[1].wg.phase & (ENTRY_WIDTH-1));
 			uint32 advance = spd;
 			if (spd >= left) // advancing to the next entry
 			{
 				advance = left;
-				fdssound.op[1].wg.phase += advance;
-				fdssound.op[1].wg.output = fdssound.op[1].wg.wave[(fdssound.op[1].wg.phase >> (PGCPS_BITS+16)) & 0x3f];
+				fdssound->op[1].wg.phase += advance;
+				fdssound->op[1].wg.output = fdssound->op[1].wg.wave[(fdssound->op[1].wg.phase >> (PGCPS_BITS+16)) & 0x3f];
 
 				// adjust bias
-				int8 value = fdssound.op[1].wg.output & 7;
+				int8 value = fdssound->op[1].wg.output & 7;
 				const int8 MOD_ADJUST[8] = { 0, 1, 2, 4, 0, -4, -2, -1 };
 				if (value == 4)
-					fdssound.op[1].bias = 0;
+					fdssound->op[1].bias = 0;
 				else
-					fdssound.op[1].bias += MOD_ADJUST[value];
-				while (fdssound.op[1].bias >  63) fdssound.op[1].bias -= 128;
-				while (fdssound.op[1].bias < -64) fdssound.op[1].bias += 128;
+					fdssound->op[1].bias += MOD_ADJUST[value];
+				while (fdssound->op[1].bias >  63) fdssound->op[1].bias -= 128;
+				while (fdssound->op[1].bias < -64) fdssound->op[1].bias += 128;
 			}
 			else // not advancing to the next entry
 			{
-				fdssound.op[1].wg.phase += advance;
+				fdssound->op[1].wg.phase += advance;
 			}
 			spd -= advance;
 		}
 
 		// modulation calculation
-		int32 mod = fdssound.op[1].bias * (int32)(fdssound.op[1].eg.volume);
+		int32 mod = fdssound->op[1].bias * (int32)(fdssound->op[1].eg.volume);
 		mod >>= 4;
 		if (mod & 0x0F)
 		{
-			if (fdssound.op[1].bias < 0) mod -= 1;
+			if (fdssound->op[1].bias < 0) mod -= 1;
 			else                         mod += 2;
 		}
 		if (mod > 193) mod -= 258;
 		if (mod < -64) mod += 256;
-		mod = (mod * (int32)(fdssound.op[0].pg.freq)) >> 6;
+		mod = (mod * (int32)(fdssound->op[0].pg.freq)) >> 6;
 
 		// calculate new frequency with modulation
-		int32 new_freq = fdssound.op[0].pg.freq + mod;
+		int32 new_freq = fdssound->op[0].pg.freq + mod;
 		if (new_freq < 0) new_freq = 0;
-		fdssound.op[0].pg.spd = (uint32)(new_freq) * fdssound.phasecps;
+		fdssound->op[0].pg.spd = (uint32)(new_freq) * fdssound->phasecps;
 	}
 
 	/* Accumulator */
-	output = fdssound.op[0].eg.volume;
+	output = fdssound->op[0].eg.volume;
 	if (output > 0x20) output = 0x20;
-	output = (fdssound.op[0].wg.output * output * fdssound.mastervolumel[fdssound.lvl]) >> (VOL_BITS - 4);
+	output = (fdssound->op[0].wg.output * output * fdssound->mastervolumel[fdssound->lvl]) >> (VOL_BITS - 4);
 
 	/* Envelope Generator */
-	if (!fdssound.envdisable && fdssound.envspd)
+	fdssound->envstepped = 0;
+	if (!fdssound->envdisable && fdssound->envspd)
 	{
-		fdssound.envcnt += fdssound.envcps;
-		while (fdssound.envcnt >= fdssound.envspd)
+		fdssound->envcnt += fdssound->envcps;
+		while (fdssound->envcnt >= fdssound->envspd)
 		{
-			fdssound.envcnt -= fdssound.envspd;
-			FDSSoundEGStep(&fdssound.op[1].eg);
-			FDSSoundEGStep(&fdssound.op[0].eg);
+			fdssound->envcnt -= fdssound->envspd;
+			fdssound->envstepped = 1;
+			FDSSoundEGStep(&fdssound->op[1].eg);
+			FDSSoundEGStep(&fdssound->op[0].eg);
 		}
 	}
 
 	/* Phase Generator */
-	fdssound.op[0].wg.phase += fdssound.op[0].pg.spd;
+	fdssound->op[0].wg.phase += fdssound->op[0].pg.spd;
 	// EDIT modulator op[1] phase now updated above.
 
-	return (fdssound.op[0].pg.freq != 0) ? output : 0;
+	return (fdssound->op[0].pg.freq != 0) ? output : 0;
+}
+
+// Cycles until a phase counter advancing by spd per cycle reaches the next
+// table entry, 0 if it never does
+static uint32 CyclesToEntry(uint32 phase, uint32 spd)
+{
+	const uint32 ENTRY_WIDTH = 1 << (PGCPS_BITS + 16);
+	if (spd == 0)
+		return 0;
+	uint32 left = ENTRY_WIDTH - (phase & (ENTRY_WIDTH-1));
+	return (left + spd - 1) / spd;
+}
+
+uint32 FDSCALL FDSSoundAdvance(FDSSOUND *fdssound, uint32 maxcycles)
+{
+	// Cycles are skipped only while FDSSoundRender would return the same
+	// value as last time, and its only side effects are counters moving in
+	// a straight line. That holds until the wave generator reads another
+	// table entry, the modulator reaches its next entry (changing the bias)
+	// or the envelope ticks. Those cycles are left for FDSSoundRender.
+	uint32 cycles = maxcycles;
+	uint32 n;
+
+	FDS_OP *car = &fdssound->op[0];
+	FDS_OP *mod = &fdssound->op[1];
+
+	// an envelope step in the last FDSSoundRender may have changed the
+	// volume of the next output, or how deep the modulation is
+	if (fdssound->envstepped)
+		return 0;
+
+	if (!(car->wg.disable || car->wg.disable2))
+	{
+		// output must not change on the very next cycle
+		if (car->wg.wave[(car->wg.phase >> (PGCPS_BITS+16)) & 0x3f] != car->wg.output)
+			return 0;
+
+		n = CyclesToEntry(car->wg.phase, car->pg.spd);
+		if (n != 0 && n < cycles)
+			cycles = n;
+	}
+
+	if (!mod->wg.disable)
+	{
+		// the modulator phase is added before the output, so the entry
+		// is reached one cycle earlier
+		n = CyclesToEntry(mod->wg.phase, mod->pg.spdbase);
+		if (n != 0 && n - 1 < cycles)
+			cycles = n - 1;
+	}
+
+	bool env = !fdssound->envdisable && fdssound->envspd;
+	if (env)
+	{
+		// a $408A write can leave the count past a lowered speed, the
+		// envelope then ticks on the very next cycle
+		if (fdssound->envcnt >= fdssound->envspd)
+			return 0;
+		n = (fdssound->envspd - fdssound->envcnt + fdssound->envcps - 1) / fdssound->envcps;
+		if (n - 1 < cycles)
+			cycles = n - 1;
+	}
+
+	if (cycles == 0)
+		return 0;
+
+	car->wg.phase += cycles * car->pg.spd;
+	if (!mod->wg.disable)
+		mod->wg.phase += cycles * mod->pg.spdbase;
+	if (env)
+		fdssound->envcnt += cycles * fdssound->envcps;
+
+	return cycles;
 }
 
-void FDSCALL FDSSoundVolume(unsigned int volume)
+void FDSCALL FDSSoundVolume(FDSSOUND *fdssound, unsigned int volume)
 {
 	volume += 196;
-	fdssound.mastervolume = (volume << (LOG_BITS - 8)) << 1;
-	fdssound.mastervolumel[0] = LogToLinear(fdssound.mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 2;
-	fdssound.mastervolumel[1] = LogToLinear(fdssound.mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 4 / 3;
-	fdssound.mastervolumel[2] = LogToLinear(fdssound.mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 2 / 2;
-	fdssound.mastervolumel[3] = LogToLinear(fdssound.mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 8 / 10;
+	fdssound->mastervolume = (volume << (LOG_BITS - 8)) << 1;
+	fdssound->mastervolumel[0] = LogToLinear(fdssound->mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 2;
+	fdssound->mastervolumel[1] = LogToLinear(fdssound->mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 4 / 3;
+	fdssound->mastervolumel[2] = LogToLinear(fdssound->mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 2 / 2;
+	fdssound->mastervolumel[3] = LogToLinear(fdssound->mastervolume, LOG_LIN_BITS - LIN_BITS - VOL_BITS) * 8 / 10;
 }
 
 static const uint8 wave_delta_table[8] = {
@@ -237,16 +317,16 @@ static const uint8 wave_delta_table[8] = {
 	0,256 - (4 << FM_DEPTH),256 - (2 << FM_DEPTH),256 - (1 << FM_DEPTH),
 };
 
-void FDSCALL FDSSoundWrite(uint16 address, uint8 value)
+void FDSCALL FDSSoundWrite(FDSSOUND *fdssound, uint16 address, uint8 value)
 {
 	if (0x4040 <= address && address <= 0x407F)
 	{
-		fdssound.op[0].wg.wave[address - 0x4040] = ((int)(value & 0x3f)) - 0x20;
+		fdssound->op[0].wg.wave[address - 0x4040] = ((int)(value & 0x3f)) - 0x20;
 	}
 	else if (0x4080 <= address && address <= 0x408F)
 	{
-		FDS_OP *pop = &fdssound.op[(address & 4) >> 2];
-		fdssound.reg[address - 0x4080] = value;
+		FDS_OP *pop = &fdssound->op[(address & 4) >> 2];
+		fdssound->reg[address - 0x4080] = value;
 		switch (address & 0xf)
 		{
 			case 0:
@@ -263,25 +343,25 @@ void FDSCALL FDSSoundWrite(uint16 address, uint8 value)
 				break;
 			case 5:
 				// EDIT rewrote modulator/bias code
-				fdssound.op[1].bias = value & 0x3F;
-				if (value & 0x40) fdssound.op[1].bias -= 0x40; // extend sign bit
-				fdssound.op[1].wg.phase = 0;
+				fdssound->op[1].bias = value & 0x3F;
+				if (value & 0x40) fdssound->op[1].bias -= 0x40; // extend sign bit
+				fdssound->op[1].wg.phase = 0;
 
 				break;
 			case 2:	case 6:
 				pop->pg.freq &= 0x00000F00;
 				pop->pg.freq |= (value & 0xFF) << 0;
-				pop->pg.spdbase = pop->pg.freq * fdssound.phasecps;
+				pop->pg.spdbase = pop->pg.freq * fdssound->phasecps;
 				break;
 			case 3:
-				fdssound.envdisable = value & 0x40;
+				fdssound->envdisable = value & 0x40;
 			case 7:
 #if 0
 				pop->wg.phase = 0;
 #endif
 				pop->pg.freq &= 0x000000FF;
 				pop->pg.freq |= (value & 0x0F) << 8;
-				pop->pg.spdbase = pop->pg.freq * fdssound.phasecps;
+				pop->pg.spdbase = pop->pg.freq * fdssound->phasecps;
 				pop->wg.disable = value & 0x80;
 				if (pop->wg.disable)
 				{
@@ -292,23 +372,23 @@ void FDSCALL FDSSoundWrite(uint16 address, uint8 value)
 				break;
 			case 8:
 				// EDIT rewrote modulator/bias code
-				if (fdssound.op[1].wg.disable)
+				if (fdssound->op[1].wg.disable)
 				{
 					int8 append = value & 0x07;
 					for (int i = 0; i < 0x3E; i++)
 					{
-						fdssound.op[1].wg.wave[i] = fdssound.op[1].wg.wave[i+2];
+						fdssound->op[1].wg.wave[i] = fdssound->op[1].wg.wave[i+2];
 					}
-					fdssound.op[1].wg.wave[0x3E] = append;
-					fdssound.op[1].wg.wave[0x3F] = append;
+					fdssound->op[1].wg.wave[0x3E] = append;
+					fdssound->op[1].wg.wave[0x3F] = append;
 				}
 				break;
 			case 9:
-				fdssound.lvl = (value & 3);
-				fdssound.op[0].wg.disable2 = value & 0x80;
+				fdssound->lvl = (value & 3);
+				fdssound->op[0].wg.disable2 = value & 0x80;
 				break;
 			case 10:
-				fdssound.envspd = value << EGCPS_BITS;
+				fdssound->envspd = value << EGCPS_BITS;
 				break;
 			default:
 				break;
@@ -316,16 +396,16 @@ void FDSCALL FDSSoundWrite(uint16 address, uint8 value)
 	}
 }
 
-uint8 FDSCALL FDSSoundRead(uint16 address)
+uint8 FDSCALL FDSSoundRead(FDSSOUND *fdssound, uint16 address)
 {
 	if (0x4040 <= address && address <= 0x407f)
 	{
-		return fdssound.op[0].wg.wave[address & 0x3f] + 0x20;
+		return fdssound->op[0].wg.wave[address & 0x3f] + 0x20;
 	}
 	if (0x4090 == address)
-		return fdssound.op[0].eg.volume | 0x40;
+		return fdssound->op[0].eg.volume | 0x40;
 	if (0x4092 == address) /* 4094? */
-		return fdssound.op[1].eg.volume | 0x40;
+		return fdssound->op[1].eg.volume | 0x40;
 	return 0;
 }
 
@@ -347,19 +427,31 @@ static uint32 DivFix(uint32 p1, uint32 p2, uint32 fix)
 	return ret;
 }
 
-void FDSCALL FDSSoundReset(void)
+FDSSOUND *FDSSoundNew(void)
+{
+	FDSSOUND *fdssound = new FDSSOUND;
+	memset(fdssound, 0, sizeof(FDSSOUND));
+	return fdssound;
+}
+
+void FDSSoundDelete(FDSSOUND *fdssound)
+{
+	delete fdssound;
+}
+
+void FDSCALL FDSSoundReset(FDSSOUND *fdssound)
 {
-	memset(&fdssound, 0, sizeof(FDSSOUND));
+	memset(fdssound, 0, sizeof(FDSSOUND));
 	// TODO: Fix srate
-	fdssound.srate = CAPU::BASE_FREQ_NTSC; ///NESAudioFrequencyGet();
-	fdssound.envcps = DivFix(NES_BASECYCLES, 12 * fdssound.srate, EGCPS_BITS + 5 - 9 + 1);
-	fdssound.envspd = 0xe8 << EGCPS_BITS;
-	fdssound.envdisable = 1;
-	fdssound.phasecps = DivFix(NES_BASECYCLES, 12 * fdssound.srate, PGCPS_BITS);
+	fdssound->srate = CAPU::BASE_FREQ_NTSC; ///NESAudioFrequencyGet();
+	fdssound->envcps = DivFix(NES_BASECYCLES, 12 * fdssound->srate, EGCPS_BITS + 5 - 9 + 1);
+	fdssound->envspd = 0xe8 << EGCPS_BITS;
+	fdssound->envdisable = 1;
+	fdssound->phasecps = DivFix(NES_BASECYCLES, 12 * fdssound->srate, PGCPS_BITS);
 	for (uint32 i = 0; i < 0x40; i++)
 	{
-		fdssound.op[0].wg.wave[i] = (i < 0x20) ? 0x1f : -0x20;
-		fdssound.op[1].wg.wave[i] = 64;
+		fdssound->op[0].wg.wave[i] = (i < 0x20) ? 0x1f : -0x20;
+		fdssound->op[1].wg.wave[i] = 64;
 	}
 }
 
@@ -11,11 +11,22 @@
 #define FDSCALL
 #endif
 
-void FDSCALL FDSSoundReset(void);
-uint8 FDSCALL FDSSoundRead(uint16 address);
-void FDSCALL FDSSoundWrite(uint16 address, uint8 value);
-int32 FDSCALL FDSSoundRender(void);
-void FDSCALL FDSSoundVolume(unsigned int volume);
+// Emulation state, one per FDS instance
+typedef struct FDSSOUND_tag FDSSOUND;
+
+FDSSOUND *FDSSoundNew(void);
+void FDSSoundDelete(FDSSOUND *fdssound);
+
+void FDSCALL FDSSoundReset(FDSSOUND *fdssound);
+uint8 FDSCALL FDSSoundRead(FDSSOUND *fdssound, uint16 address);
+void FDSCALL FDSSoundWrite(FDSSOUND *fdssound, uint16 address, uint8 value);
+int32 FDSCALL FDSSoundRender(FDSSOUND *fdssound);
+// Call after FDSSoundRender. Skips ahead over at most maxcycles cycles that
+// would render the same output again, and returns how many were skipped.
+uint32 FDSCALL FDSSoundAdvance(FDSSOUND *fdssound, uint32 maxcycles);
+void FDSCALL FDSSoundVolume(FDSSOUND *fdssound, unsigned int volume);
+
+// Initializes the shared log tables, safe to call from any thread
 void FDSSoundInstall3(void);
 
 #endif /* _FDSSOUND_H_ */
@@ -56,7 +56,8 @@
 #include <cmath>
 #include "Mixer.h"
 #include "APU.h"
-#include "emu2413.h"
+#include "SampleConvert.h"
+#include "core/profile.hpp"
 // TODO - dan
 //#include "emu2149.h"
 
@@ -77,10 +78,32 @@ CMixer::CMixer()
 	m_fLevelVRC6 = 1.0f;
 	m_fLevelMMC5 = 1.0f;
 	m_fLevelFDS = 1.0f;
+
+	m_pBuffers[0] = &BlipBuffer;
+	m_pBuffers[1] = &BlipBufferRight;
+	m_iSides = 1;
+
+	m_bFloatSamples = false;
+	m_pReadBuffer[0] = m_pReadBuffer[1] = NULL;
+	m_iReadBufferSize = 0;
+
+	m_pMixBuffer = NULL;
+	m_iMixBufferSize = 0;
+
+	for (int i = 0; i < CHANNELS; i++)
+		SetChannelPan(i, 0);
+
+	memset(m_iPanOutput, 0, sizeof(m_iPanOutput));
+
+	m_dLastSumSS[0] = m_dLastSumSS[1] = 0.0;
+	m_dLastSumTND[0] = m_dLastSumTND[1] = 0.0;
 }
 
 CMixer::~CMixer()
 {
+	delete[] m_pMixBuffer;
+	delete[] m_pReadBuffer[0];
+	delete[] m_pReadBuffer[1];
 }
 
 inline double CMixer::CalcPin1(double Val1, double Val2)
@@ -129,6 +152,66 @@ void CMixer::SetChipLevel(int Chip, float Level)
 	}
 }
 
+void CMixer::SetChannelPan(int ChanID, int Pan)
+{
+	if (Pan < -100)
+		Pan = -100;
+	if (Pan > 100)
+		Pan = 100;
+
+	m_iChannelPan[ChanID] = Pan;
+
+	// Balance law, a centered channel is as loud on both sides as in mono
+	m_fPanGain[0][ChanID] = Pan > 0 ? float(100 - Pan) / 100.0f : 1.0f;
+	m_fPanGain[1][ChanID] = Pan < 0 ? float(100 + Pan) / 100.0f : 1.0f;
+}
+
+void CMixer::SetChipPan(int Chip, int Pan)
+{
+	int First, Last;
+
+	switch (Chip) {
+		case SNDCHIP_NONE:
+			First = CHANID_SQUARE1;
+			Last = CHANID_DPCM;
+			break;
+		case SNDCHIP_VRC6:
+			First = CHANID_VRC6_PULSE1;
+			Last = CHANID_VRC6_SAWTOOTH;
+			break;
+		case SNDCHIP_MMC5:
+			First = CHANID_MMC5_SQUARE1;
+			Last = CHANID_MMC5_VOICE;
+			break;
+		case SNDCHIP_N106:
+			First = CHANID_N106_CHAN1;
+			Last = CHANID_N106_CHAN8;
+			break;
+		case SNDCHIP_FDS:
+			First = CHANID_FDS;
+			Last = CHANID_FDS;
+			break;
+		case SNDCHIP_VRC7:
+			First = CHANID_VRC7_CH1;
+			Last = CHANID_VRC7_CH6;
+			break;
+		case SNDCHIP_S5B:
+			First = CHANID_S5B_CH1;
+			Last = CHANID_S5B_CH3;
+			break;
+		default:
+			return;
+	}
+
+	for (int i = First; i <= Last; i++)
+		SetChannelPan(i, Pan);
+}
+
+int CMixer::GetChannelPan(int ChanID) const
+{
+	return m_iChannelPan[ChanID];
+}
+
 void CMixer::UpdateSettings(int LowCut,	int HighCut, int HighDamp, int OverallVol)
 {
 	float fVolume = float(OverallVol) / 100.0f;
@@ -148,7 +231,8 @@ void CMixer::UpdateSettings(int LowCut,	int HighCut, int HighDamp, int OverallVo
 	fVolume *= m_fDamping;
 
 	// Blip-buffer filtering
-	BlipBuffer.bass_freq(LowCut);
+	for (int i = 0; i < m_iSides; i++)
+		m_pBuffers[i]->bass_freq(LowCut);
 
 	blip_eq_t eq(-HighDamp, HighCut, m_iSampleRate);
 
@@ -180,7 +264,24 @@ void CMixer::UpdateSettings(int LowCut,	int HighCut, int HighDamp, int OverallVo
 void CMixer::MixSamples(blip_sample_t *pBuffer, uint32 Count)
 {
 	// For VRC7
-	BlipBuffer.mix_samples(pBuffer, Count);
+	if (m_iSides == 1)
+	{
+		BlipBuffer.mix_samples(pBuffer, Count);
+		return;
+	}
+
+	// The chip renders a mono stream, so it is panned as a whole by the
+	// pan of its first channel
+	if (Count > m_iMixBufferSize)
+		Count = m_iMixBufferSize;
+
+	for (int i = 0; i < 2; i++)
+	{
+		float Gain = m_fPanGain[i][CHANID_VRC7_CH1];
+		for (uint32 j = 0; j < Count; j++)
+			m_pMixBuffer[j] = blip_sample_t(pBuffer[j] * Gain);
+		m_pBuffers[i]->mix_samples(m_pMixBuffer, Count);
+	}
 }
 
 uint32 CMixer::GetMixSampleCount(int t) const
@@ -188,22 +289,51 @@ uint32 CMixer::GetMixSampleCount(int t) const
 	return BlipBuffer.count_samples(t);
 }
 
-bool CMixer::AllocateBuffer(unsigned int BufferLength, uint32 SampleRate, uint8 NrChannels)
+bool CMixer::AllocateBuffer(unsigned int BufferLength, uint32 SampleRate, uint8 NrChannels, bool FloatSamples)
 {
 	m_iSampleRate = SampleRate;
-	BlipBuffer.sample_rate(SampleRate, (BufferLength * 1000 * 2) / SampleRate);
+	m_iSides = (NrChannels == 2) ? 2 : 1;
+	m_bFloatSamples = FloatSamples;
+
+	for (int i = 0; i < m_iSides; i++)
+	{
+		if (m_pBuffers[i]->sample_rate(SampleRate, (BufferLength * 1000 * 2) / SampleRate))
+			return false;
+	}
+
+	m_iReadBufferSize = BlipBuffer.buffer_size_;
+	for (int i = 0; i < 2; i++)
+	{
+		delete[] m_pReadBuffer[i];
+		m_pReadBuffer[i] = (i < m_iSides) ? new int[m_iReadBufferSize] : NULL;
+	}
+
+	delete[] m_pMixBuffer;
+	m_pMixBuffer = NULL;
+	m_iMixBufferSize = 0;
+
+	if (m_iSides == 2)
+	{
+		m_iMixBufferSize = BufferLength * 2;
+		m_pMixBuffer = new blip_sample_t[m_iMixBufferSize];
+	}
+
 	return true;
 }
 
 void CMixer::SetClockRate(uint32 Rate)
 {
 	// Change the clockrate
-	BlipBuffer.clock_rate(Rate);
+	for (int i = 0; i < m_iSides; i++)
+		m_pBuffers[i]->clock_rate(Rate);
 }
 
 void CMixer::ClearBuffer()
 {
-	BlipBuffer.clear();
+	for (int i = 0; i < m_iSides; i++)
+		m_pBuffers[i]->clear();
+
+	memset(m_iPanOutput, 0, sizeof(m_iPanOutput));
 }
 
 int CMixer::SamplesAvail() const
@@ -213,11 +343,10 @@ int CMixer::SamplesAvail() const
 
 int CMixer::FinishBuffer(int t)
 {
-	BlipBuffer.end_frame(t);
+	for (int i = 0; i < m_iSides; i++)
+		m_pBuffers[i]->end_frame(t);
 
-	// Get channel levels for VRC7
-	for (int i = 0; i < 6; i++)
-		StoreChannelLevel(CHANID_VRC7_CH1 + i, OPLL_getchanvol(i));
+	// VRC7 channel levels are stored by CVRC7::EndFrame
 /*
 	// Get channel levels for Sunsoft
 	for (int i = 0; i < 3; i++)
@@ -247,36 +376,43 @@ int CMixer::FinishBuffer(int t)
 
 void CMixer::MixInternal1(int Time)
 {
-	static double LastSum;
 	double Sum, Delta;
 
 #ifdef LINEAR_MIXING
 	SumL = ((m_iChannels[CHANID_SQUARE1].Left + m_iChannels[CHANID_SQUARE2].Left) * 0.00752) * InternalVol;
 	SumR = ((m_iChannels[CHANID_SQUARE1].Right + m_iChannels[CHANID_SQUARE2].Right) *  0.00752) * InternalVol;
 #else
-	Sum = CalcPin1(m_iChannels[CHANID_SQUARE1], m_iChannels[CHANID_SQUARE2]);
-#endif
+	for (int i = 0; i < m_iSides; i++)
+	{
+		Sum = CalcPin1(m_iChannels[CHANID_SQUARE1] * m_fPanGain[i][CHANID_SQUARE1],
+					   m_iChannels[CHANID_SQUARE2] * m_fPanGain[i][CHANID_SQUARE2]);
 
-	Delta = (Sum - LastSum) * AMP_2A03;
-	Synth2A03SS.offset(Time, (int)Delta, &BlipBuffer);
-	LastSum = Sum;
+		Delta = (Sum - m_dLastSumSS[i]) * AMP_2A03;
+		Synth2A03SS.offset(Time, (int)Delta, m_pBuffers[i]);
+		m_dLastSumSS[i] = Sum;
+	}
+#endif
 }
 
 void CMixer::MixInternal2(int Time)
 {
-	static double LastSum;
 	double Sum, Delta;
 
 #ifdef LINEAR_MIXING
 	SumL = ((0.00851 * m_iChannels[CHANID_TRIANGLE].Left + 0.00494 * m_iChannels[CHANID_NOISE].Left + 0.00335 * m_iChannels[CHANID_DPCM].Left)) * InternalVol;
 	SumR = ((0.00851 * m_iChannels[CHANID_TRIANGLE].Right + 0.00494 * m_iChannels[CHANID_NOISE].Right + 0.00335 * m_iChannels[CHANID_DPCM].Right)) * InternalVol;
 #else
-	Sum = CalcPin2(m_iChannels[CHANID_TRIANGLE], m_iChannels[CHANID_NOISE], m_iChannels[CHANID_DPCM]);
-#endif
+	for (int i = 0; i < m_iSides; i++)
+	{
+		Sum = CalcPin2(m_iChannels[CHANID_TRIANGLE] * m_fPanGain[i][CHANID_TRIANGLE],
+					   m_iChannels[CHANID_NOISE] * m_fPanGain[i][CHANID_NOISE],
+					   m_iChannels[CHANID_DPCM] * m_fPanGain[i][CHANID_DPCM]);
 
-	Delta = (Sum - LastSum) * AMP_2A03;
-	Synth2A03TND.offset(Time, (int)Delta, &BlipBuffer);
-	LastSum = Sum;
+		Delta = (Sum - m_dLastSumTND[i]) * AMP_2A03;
+		Synth2A03TND.offset(Time, (int)Delta, m_pBuffers[i]);
+		m_dLastSumTND[i] = Sum;
+	}
+#endif
 }
 
 void CMixer::MixN106(int Value, int Time)
@@ -304,6 +440,18 @@ void CMixer::MixS5B(int Value, int Time)
 	SynthS5B.offset(Time, Value, &BlipBuffer);
 }
 
+template <class T>
+void CMixer::MixPanned(const T &Synth, int ChanID, int Value, int Time)
+{
+	// Value is the absolute output, every side follows its own scaled copy
+	for (int i = 0; i < 2; i++)
+	{
+		int32 Output = int32(Value * m_fPanGain[i][ChanID]);
+		Synth.offset(Time, Output - m_iPanOutput[i][ChanID], m_pBuffers[i]);
+		m_iPanOutput[i][ChanID] = Output;
+	}
+}
+
 void CMixer::AddValue(int ChanID, int Chip, int Value, int AbsValue, int FrameCycles)
 {
 	// Add sound to mixer
@@ -313,6 +461,25 @@ void CMixer::AddValue(int ChanID, int Chip, int Value, int AbsValue, int FrameCy
 	StoreChannelLevel(ChanID, AbsValue);
 	m_iChannels[ChanID] = Value;
 
+	if (m_iSides == 2)
+	{
+		switch (Chip)
+		{
+			case SNDCHIP_N106:
+				MixPanned(SynthN106, ChanID, AbsValue, FrameCycles);
+				return;
+			case SNDCHIP_FDS:
+				MixPanned(SynthFDS, ChanID, AbsValue, FrameCycles);
+				return;
+			case SNDCHIP_MMC5:
+				MixPanned(SynthMMC5, ChanID, AbsValue, FrameCycles);
+				return;
+			case SNDCHIP_VRC6:
+				MixPanned(SynthVRC6, ChanID, AbsValue, FrameCycles);
+				return;
+		}
+	}
+
 	switch (Chip)
 	{
 		case SNDCHIP_NONE:
@@ -344,9 +511,38 @@ void CMixer::AddValue(int ChanID, int Chip, int Value, int AbsValue, int FrameCy
 	}
 }
 
+PROFILE_COUNTER(prof_read_samples, "apu/Blip_Buffer::read_samples", PROFILE_TIME);
+
 int CMixer::ReadBuffer(int Size, void *Buffer, bool Stereo)
 {
-	return BlipBuffer.read_samples((blip_sample_t*)Buffer, Size);
+	// Size and the return value are in sample frames. The blip buffers are
+	// integrated first, then converted to the output format in one pass
+	if ((uint32)Size > m_iReadBufferSize)
+		Size = m_iReadBufferSize;
+
+	long Count = 0;
+	{
+		PROFILE_SCOPE(prof_read_samples);
+		for (int i = 0; i < m_iSides; i++)
+			Count = m_pBuffers[i]->read_samples_unclamped(m_pReadBuffer[i], Size);
+	}
+
+	if (m_iSides == 1)
+	{
+		if (m_bFloatSamples)
+			ConvertSamples(m_pReadBuffer[0], (float*)Buffer, Count);
+		else
+			ConvertSamples(m_pReadBuffer[0], (blip_sample_t*)Buffer, Count);
+	}
+	else
+	{
+		if (m_bFloatSamples)
+			InterleaveSamples(m_pReadBuffer[0], m_pReadBuffer[1], (float*)Buffer, Count);
+		else
+			InterleaveSamples(m_pReadBuffer[0], m_pReadBuffer[1], (blip_sample_t*)Buffer, Count);
+	}
+
+	return Count;
 }
 
 int32 CMixer::GetChanOutput(uint8 Chan) const
@@ -74,7 +74,7 @@ class CMixer
 		void	AddValue(int ChanID, int Chip, int Value, int AbsValue, int FrameCycles);
 		void	UpdateSettings(int LowCut,	int HighCut, int HighDamp, int OverallVol);
 
-		bool	AllocateBuffer(unsigned int Size, uint32 SampleRate, uint8 NrChannels);
+		bool	AllocateBuffer(unsigned int Size, uint32 SampleRate, uint8 NrChannels, bool FloatSamples);
 		void	SetClockRate(uint32 Rate);
 		void	ClearBuffer();
 		int		FinishBuffer(int t);
@@ -84,6 +84,7 @@ class CMixer
 		uint32	GetMixSampleCount(int t) const;
 
 		void	AddSample(int ChanID, int Value);
+		void	StoreChannelLevel(int Channel, int Value);
 
 		int		ReadBuffer(int Size, void *Buffer, bool Stereo);
 
@@ -91,6 +92,12 @@ class CMixer
 
 		void	SetChipLevel(int Chip, float Level);
 
+		// Stereo panning, from -100 (left) to 100 (right). Only heard when
+		// the buffer was allocated with two channels
+		void	SetChannelPan(int ChanID, int Pan);
+		void	SetChipPan(int Chip, int Pan);
+		int		GetChannelPan(int ChanID) const;
+
 		uint32	getFramesToFalloff() const;
 
 	private:
@@ -105,7 +112,8 @@ class CMixer
 		void MixMMC5(int Value, int Time);
 		void MixS5B(int Value, int Time);
 
-		void StoreChannelLevel(int Channel, int Value);
+		template <class T>
+		void MixPanned(const T &Synth, int ChanID, int Value, int Time);
 
 		// Blip buffer synths
 		Blip_Synth<blip_good_quality, -500>		Synth2A03SS;
@@ -117,8 +125,21 @@ class CMixer
 		Blip_Synth<blip_good_quality, -2000>	SynthS5B;
 		
 
-		// Blip buffer object
+		// Blip buffer objects, the right one is only used in stereo
 		Blip_Buffer	BlipBuffer;
+		Blip_Buffer	BlipBufferRight;
+		Blip_Buffer	*m_pBuffers[2];
+		int			m_iSides;
+
+		// Output format, and the integrated samples of every side before
+		// they are converted to it
+		bool	m_bFloatSamples;
+		int		*m_pReadBuffer[2];
+		uint32	m_iReadBufferSize;
+
+		// Scaled copy of the VRC7 samples for one side
+		blip_sample_t	*m_pMixBuffer;
+		uint32			m_iMixBufferSize;
 
 		// Random variables
 		int32		*m_pSampleBuffer;
@@ -137,6 +158,15 @@ class CMixer
 
 		float		m_fDamping;
 
+		// Stereo panning
+		int			m_iChannelPan[CHANNELS];
+		float		m_fPanGain[2][CHANNELS];
+		int32		m_iPanOutput[2][CHANNELS];	// Last output of external channels, per side
+
+		// Last output of the two 2A03 audio pins, per side
+		double		m_dLastSumSS[2];
+		double		m_dLastSumTND[2];
+
 		float		m_fLevel2A03;
 		float		m_fLevelVRC6;
 		float		m_fLevelMMC5;
@@ -0,0 +1,130 @@
+#include "SampleConvert.h"
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define SAMPLECONVERT_SSE2
+#endif
+
+static const float FLOAT_SCALE = 1.0f / 32768.0f;
+
+static inline short Saturate(int s)
+{
+	if (s > 32767)
+		return 32767;
+	if (s < -32768)
+		return -32768;
+	return (short)s;
+}
+
+void ConvertSamples(const int *In, short *Out, long Count)
+{
+	long i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 16 <= Count; i += 16)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(In + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(In + i + 8));
+		// packs works within 128-bit lanes, put the quadwords back in order
+		__m256i s = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i*)(Out + i), s);
+	}
+#endif
+#if defined(SAMPLECONVERT_SSE2)
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(In + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(In + i + 4));
+		_mm_storeu_si128((__m128i*)(Out + i), _mm_packs_epi32(a, b));
+	}
+#endif
+
+	for (; i < Count; i++)
+		Out[i] = Saturate(In[i]);
+}
+
+void ConvertSamples(const int *In, float *Out, long Count)
+{
+	long i = 0;
+
+#if defined(__AVX2__)
+	const __m256 scale8 = _mm256_set1_ps(FLOAT_SCALE);
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(In + i));
+		_mm256_storeu_ps(Out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale8));
+	}
+#endif
+#if defined(SAMPLECONVERT_SSE2)
+	const __m128 scale4 = _mm_set1_ps(FLOAT_SCALE);
+	for (; i + 4 <= Count; i += 4)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(In + i));
+		_mm_storeu_ps(Out + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale4));
+	}
+#endif
+
+	for (; i < Count; i++)
+		Out[i] = float(In[i]) * FLOAT_SCALE;
+}
+
+void InterleaveSamples(const int *Left, const int *Right, short *Out, long Count)
+{
+	long i = 0;
+
+#if defined(SAMPLECONVERT_SSE2)
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m128i l = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(Left + i)),
+									_mm_loadu_si128((const __m128i*)(Left + i + 4)));
+		__m128i r = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(Right + i)),
+									_mm_loadu_si128((const __m128i*)(Right + i + 4)));
+		_mm_storeu_si128((__m128i*)(Out + i*2), _mm_unpacklo_epi16(l, r));
+		_mm_storeu_si128((__m128i*)(Out + i*2 + 8), _mm_unpackhi_epi16(l, r));
+	}
+#endif
+
+	for (; i < Count; i++)
+	{
+		Out[i*2] = Saturate(Left[i]);
+		Out[i*2 + 1] = Saturate(Right[i]);
+	}
+}
+
+void InterleaveSamples(const int *Left, const int *Right, float *Out, long Count)
+{
+	long i = 0;
+
+#if defined(__AVX2__)
+	const __m256 scale8 = _mm256_set1_ps(FLOAT_SCALE);
+	for (; i + 8 <= Count; i += 8)
+	{
+		__m256 l = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(Left + i))), scale8);
+		__m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(Right + i))), scale8);
+		// unpack works within 128-bit lanes, swap the middle halves
+		__m256 lo = _mm256_unpacklo_ps(l, r);
+		__m256 hi = _mm256_unpackhi_ps(l, r);
+		_mm256_storeu_ps(Out + i*2, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(Out + i*2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+#endif
+#if defined(SAMPLECONVERT_SSE2)
+	const __m128 scale4 = _mm_set1_ps(FLOAT_SCALE);
+	for (; i + 4 <= Count; i += 4)
+	{
+		__m128 l = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(Left + i))), scale4);
+		__m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(Right + i))), scale4);
+		_mm_storeu_ps(Out + i*2, _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps(Out + i*2 + 4, _mm_unpackhi_ps(l, r));
+	}
+#endif
+
+	for (; i < Count; i++)
+	{
+		Out[i*2] = float(Left[i]) * FLOAT_SCALE;
+		Out[i*2 + 1] = float(Right[i]) * FLOAT_SCALE;
+	}
+}
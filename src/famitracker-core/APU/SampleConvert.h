@@ -0,0 +1,17 @@
+#ifndef _SAMPLECONVERT_H_
+#define _SAMPLECONVERT_H_
+
+// Output stage of the mixer. The input is integrated blip buffer output at
+// 16-bit scale, not clamped. 16-bit output saturates, float output is scaled
+// to +-1.0 and keeps any overshoot.
+//
+// SSE2 is used on x86 and x86-64, AVX2 when the compiler targets it.
+
+void ConvertSamples(const int *In, short *Out, long Count);
+void ConvertSamples(const int *In, float *Out, long Count);
+
+// Interleave two sides into a stereo stream
+void InterleaveSamples(const int *Left, const int *Right, short *Out, long Count);
+void InterleaveSamples(const int *Left, const int *Right, float *Out, long Count);
+
+#endif /* _SAMPLECONVERT_H_ */
@@ -19,15 +19,53 @@
 */
 
 #include <memory>
+#include <map>
 #include <stdlib.h>
 #include <string.h>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 #include "APU.h"
 #include "VRC7.h"
 
 const float  CVRC7::AMPLIFY	  = 2.88f;		// Mixing amplification, VRC7 patch 14 is 4,88 times stronger than a 50% square @ v=15
 const uint32 CVRC7::OPL_CLOCK = 3579545;	// Clock frequency
 
-CVRC7::CVRC7(CMixer *pMixer) : CExternal(pMixer), m_pBuffer(NULL), m_pOPLLInt(NULL), m_fVolume(1.0f)
+// The OPLL tables only depend on the clock and the sample rate. Each set is
+// built the first time it's needed and then shared, read-only, by every
+// VRC7 until the program exits.
+class OPLLTableCache
+{
+public:
+	~OPLLTableCache()
+	{
+		for (tables_t::iterator it = m_tables.begin(); it != m_tables.end(); ++it)
+			OPLL_tables_delete(it->second);
+	}
+
+	const OPLL_TABLES * get(uint32 Clock, uint32 SampleRate)
+	{
+		boost::lock_guard<boost::mutex> lock(m_mtx);
+
+		std::pair<uint32, uint32> key(Clock, SampleRate);
+		tables_t::const_iterator it = m_tables.find(key);
+		if (it != m_tables.end())
+			return it->second;
+
+		OPLL_TABLES *tables = OPLL_tables_new(Clock, SampleRate);
+		m_tables[key] = tables;
+		return tables;
+	}
+private:
+	typedef std::map<std::pair<uint32, uint32>, OPLL_TABLES*> tables_t;
+
+	boost::mutex m_mtx;
+	tables_t m_tables;
+};
+
+static OPLLTableCache opll_tables;
+
+CVRC7::CVRC7(CMixer *pMixer) : CExternal(pMixer), m_pOPLLInt(NULL), m_pBuffer(NULL), m_iLastSample(0),
+	m_fVolume(1.0f)
 {
 	Reset();
 }
@@ -59,7 +97,7 @@ void CVRC7::SetSampleSpeed(uint32 SampleRate, double ClockRate, uint32 FrameRate
 		m_pOPLLInt = NULL;
 	}
 
-	m_pOPLLInt = OPLL_new(OPL_CLOCK, SampleRate);
+	m_pOPLLInt = OPLL_new_with_tables(opll_tables.get(OPL_CLOCK, SampleRate));
 
 	OPLL_reset(m_pOPLLInt);
 	OPLL_reset_patch(m_pOPLLInt, 1);
@@ -100,17 +138,19 @@ void CVRC7::EndFrame()
 {
 	uint32 WantSamples = m_pMixer->GetMixSampleCount(m_iTime);
 
-	static int32 LastSample = 0;
-
 	// Generate VRC7 samples
 	while (m_iBufferPtr < WantSamples) {
 		int32 Sample = int(float(OPLL_calc(m_pOPLLInt)) * m_fVolume);
-		m_pBuffer[m_iBufferPtr++] = int16((Sample + LastSample) >> 1);
-		LastSample = Sample;
+		m_pBuffer[m_iBufferPtr++] = int16((Sample + m_iLastSample) >> 1);
+		m_iLastSample = Sample;
 	}
 
 	m_pMixer->MixSamples((blip_sample_t*)m_pBuffer, WantSamples);
 
+	// Get channel levels
+	for (int i = 0; i < 6; i++)
+		m_pMixer->StoreChannelLevel(CHANID_VRC7_CH1 + i, OPLL_getchanvol(m_pOPLLInt, i));
+
 	m_iBufferPtr -= WantSamples;
 	m_iTime = 0;
 }
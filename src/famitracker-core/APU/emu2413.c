@@ -171,62 +171,65 @@ static unsigned char default_inst[OPLL_TONE_NUM][(16 + 3) * 16] = {
 #define EXPAND_BITS_X(x,s,d) (((x)<<((d)-(s)))|((1<<((d)-(s)))-1))
 
 /* Adjust envelope speed which depends on sampling rate. */
-#define RATE_ADJUST(x) (rate==49716?x:(uint32)((double)(x)*clk/72/rate + 0.5))        /* added 0.5 to round the value*/
+#define RATE_ADJUST(t,x) ((t)->rate==49716?x:(uint32)((double)(x)*(t)->clk/72/(t)->rate + 0.5))        /* added 0.5 to round the value*/
 
 #define MOD(o,x) (&(o)->slot[(x)<<1])
 #define CAR(o,x) (&(o)->slot[((x)<<1)|1])
 
 #define BIT(s,b) (((s)>>(b))&1)
 
-/* Input clock */
-static uint32 clk = 844451141;
-/* Sampling rate */
-static uint32 rate = 3354932;
-
-/* WaveTable for each envelope amp */
-static uint16 fullsintable[PG_WIDTH];
-static uint16 halfsintable[PG_WIDTH];
+/* Empty voice data */
+static OPLL_PATCH null_patch = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
-static uint16 *waveform[2] = { fullsintable, halfsintable };
+/* Definition of envelope mode */
+enum OPLL_EG_STATE 
+{ READY, ATTACK, DECAY, SUSHOLD, SUSTINE, RELEASE, SETTLE, FINISH };
 
-/* LFO Table */
-static int32 pmtable[PM_PG_WIDTH];
-static int32 amtable[AM_PG_WIDTH];
+/* Everything derived from the clock and the sampling rate. A table set is
+   never modified after OPLL_tables_new, so one set can be shared by any
+   number of OPLL instances and threads. */
+struct __OPLL_TABLES
+{
+  /* Input clock */
+  uint32 clk;
+  /* Sampling rate */
+  uint32 rate;
 
-/* Phase delta for LFO */
-static uint32 pm_dphase;
-static uint32 am_dphase;
+  /* WaveTable for each envelope amp */
+  uint16 fullsintable[PG_WIDTH];
+  uint16 halfsintable[PG_WIDTH];
 
-/* dB to Liner table */
-static int16 DB2LIN_TABLE[(DB_MUTE + DB_MUTE) * 2];
+  const uint16 *waveform[2];
 
-/* Liner to Log curve conversion table (for Attack rate). */
-static uint16 AR_ADJUST_TABLE[1 << EG_BITS];
+  /* LFO Table */
+  int32 pmtable[PM_PG_WIDTH];
+  int32 amtable[AM_PG_WIDTH];
 
-/* Empty voice data */
-static OPLL_PATCH null_patch = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  /* Phase delta for LFO */
+  uint32 pm_dphase;
+  uint32 am_dphase;
 
-/* Basic voice Data */
-static OPLL_PATCH default_patch[OPLL_TONE_NUM][(16 + 3) * 2];
+  /* dB to Liner table */
+  int16 DB2LIN_TABLE[(DB_MUTE + DB_MUTE) * 2];
 
-/* Definition of envelope mode */
-enum OPLL_EG_STATE 
-{ READY, ATTACK, DECAY, SUSHOLD, SUSTINE, RELEASE, SETTLE, FINISH };
+  /* Liner to Log curve conversion table (for Attack rate). */
+  uint16 AR_ADJUST_TABLE[1 << EG_BITS];
 
-/* Phase incr table for Attack */
-static uint32 dphaseARTable[16][16];
-/* Phase incr table for Decay and Release */
-static uint32 dphaseDRTable[16][16];
+  /* Basic voice Data */
+  OPLL_PATCH default_patch[OPLL_TONE_NUM][(16 + 3) * 2];
 
-/* KSL + TL Table */
-static uint32 tllTable[16][8][1 << TL_BITS][4];
-static int32 rksTable[2][8][2];
+  /* Phase incr table for Attack */
+  uint32 dphaseARTable[16][16];
+  /* Phase incr table for Decay and Release */
+  uint32 dphaseDRTable[16][16];
 
-/* Phase incr table for PG */
-static uint32 dphaseTable[512][8][16];
+  /* KSL + TL Table */
+  uint32 tllTable[16][8][1 << TL_BITS][4];
+  int32 rksTable[2][8][2];
 
-// Added by jsr
-int32 opll_volumes[10];
+  /* Phase incr table for PG */
+  uint32 dphaseTable[512][8][16];
+};
 
 /***************************************************
  
@@ -244,27 +247,27 @@ Min (int32 i, int32 j)
 
 /* Table for AR to LogCurve. */
 static void
-makeAdjustTable (void)
+makeAdjustTable (OPLL_TABLES * t)
 {
   int32 i;
 
-  AR_ADJUST_TABLE[0] = (1 << EG_BITS) - 1;
+  t->AR_ADJUST_TABLE[0] = (1 << EG_BITS) - 1;
   for (i = 1; i < (1<<EG_BITS); i++)
-    AR_ADJUST_TABLE[i] = (uint16) ((double) (1<<EG_BITS)-1 - ((1<<EG_BITS)-1)*log(i)/log(127));
+    t->AR_ADJUST_TABLE[i] = (uint16) ((double) (1<<EG_BITS)-1 - ((1<<EG_BITS)-1)*log(i)/log(127));
 }
 
 
 /* Table for dB(0 -- (1<<DB_BITS)-1) to Liner(0 -- DB2LIN_AMP_WIDTH) */
 static void
-makeDB2LinTable (void)
+makeDB2LinTable (OPLL_TABLES * t)
 {
   int32 i;
 
   for (i = 0; i < DB_MUTE + DB_MUTE; i++)
   {
-    DB2LIN_TABLE[i] = (int16) ((double) ((1 << DB2LIN_AMP_BITS) - 1) * pow (10, -(double) i * DB_STEP / 20));
-    if (i >= DB_MUTE) DB2LIN_TABLE[i] = 0;
-    DB2LIN_TABLE[i + DB_MUTE + DB_MUTE] = (int16) (-DB2LIN_TABLE[i]);
+    t->DB2LIN_TABLE[i] = (int16) ((double) ((1 << DB2LIN_AMP_BITS) - 1) * pow (10, -(double) i * DB_STEP / 20));
+    if (i >= DB_MUTE) t->DB2LIN_TABLE[i] = 0;
+    t->DB2LIN_TABLE[i + DB_MUTE + DB_MUTE] = (int16) (-t->DB2LIN_TABLE[i]);
   }
 }
 
@@ -281,29 +284,29 @@ lin2db (double d)
 
 /* Sin Table */
 static void
-makeSinTable (void)
+makeSinTable (OPLL_TABLES * t)
 {
   int32 i;
 
   for (i = 0; i < PG_WIDTH / 4; i++)
   {
-    fullsintable[i] = (uint32) lin2db (sin (2.0 * PI * i / PG_WIDTH) );
+    t->fullsintable[i] = (uint32) lin2db (sin (2.0 * PI * i / PG_WIDTH) );
   }
 
   for (i = 0; i < PG_WIDTH / 4; i++)
   {
-    fullsintable[PG_WIDTH / 2 - 1 - i] = fullsintable[i];
+    t->fullsintable[PG_WIDTH / 2 - 1 - i] = t->fullsintable[i];
   }
 
   for (i = 0; i < PG_WIDTH / 2; i++)
   {
-    fullsintable[PG_WIDTH / 2 + i] = (uint32) (DB_MUTE + DB_MUTE + fullsintable[i]);
+    t->fullsintable[PG_WIDTH / 2 + i] = (uint32) (DB_MUTE + DB_MUTE + t->fullsintable[i]);
   }
 
   for (i = 0; i < PG_WIDTH / 2; i++)
-    halfsintable[i] = fullsintable[i];
+    t->halfsintable[i] = t->fullsintable[i];
   for (i = PG_WIDTH / 2; i < PG_WIDTH; i++)
-    halfsintable[i] = fullsintable[0];
+    t->halfsintable[i] = t->fullsintable[0];
 }
 
 static double saw(double phase)
@@ -318,29 +321,29 @@ static double saw(double phase)
 
 /* Table for Pitch Modulator */
 static void
-makePmTable (void)
+makePmTable (OPLL_TABLES * t)
 {
   int32 i;
 
   for (i = 0; i < PM_PG_WIDTH; i++)
     /* pmtable[i] = (int32) ((double) PM_AMP * pow (2, (double) PM_DEPTH * sin (2.0 * PI * i / PM_PG_WIDTH) / 1200)); */
-    pmtable[i] = (int32) ((double) PM_AMP * pow (2, (double) PM_DEPTH * saw (2.0 * PI * i / PM_PG_WIDTH) / 1200));
+    t->pmtable[i] = (int32) ((double) PM_AMP * pow (2, (double) PM_DEPTH * saw (2.0 * PI * i / PM_PG_WIDTH) / 1200));
 }
 
 /* Table for Amp Modulator */
 static void
-makeAmTable (void)
+makeAmTable (OPLL_TABLES * t)
 {
   int32 i;
 
   for (i = 0; i < AM_PG_WIDTH; i++)
     /* amtable[i] = (int32) ((double) AM_DEPTH / 2 / DB_STEP * (1.0 + sin (2.0 * PI * i / PM_PG_WIDTH))); */
-    amtable[i] = (int32) ((double) AM_DEPTH / 2 / DB_STEP * (1.0 + saw (2.0 * PI * i / PM_PG_WIDTH)));
+    t->amtable[i] = (int32) ((double) AM_DEPTH / 2 / DB_STEP * (1.0 + saw (2.0 * PI * i / PM_PG_WIDTH)));
 }
 
 /* Phase increment counter table */
 static void
-makeDphaseTable (void)
+makeDphaseTable (OPLL_TABLES * t)
 {
   uint32 fnum, block, ML;
   uint32 mltable[16] =
@@ -349,11 +352,11 @@ makeDphaseTable (void)
   for (fnum = 0; fnum < 512; fnum++)
     for (block = 0; block < 8; block++)
       for (ML = 0; ML < 16; ML++)
-        dphaseTable[fnum][block][ML] = RATE_ADJUST (((fnum * mltable[ML]) << block) >> (20 - DP_BITS));
+        t->dphaseTable[fnum][block][ML] = RATE_ADJUST (t, ((fnum * mltable[ML]) << block) >> (20 - DP_BITS));
 }
 
 static void
-makeTllTable (void)
+makeTllTable (OPLL_TABLES * t)
 {
 #define dB2(x) ((x)*2)
 
@@ -372,15 +375,15 @@ makeTllTable (void)
         {
           if (KL == 0)
           {
-            tllTable[fnum][block][TL][KL] = TL2EG (TL);
+            t->tllTable[fnum][block][TL][KL] = TL2EG (TL);
           }
           else
           {
             tmp = (int32) (kltable[fnum] - dB2 (3.000) * (7 - block));
             if (tmp <= 0)
-              tllTable[fnum][block][TL][KL] = TL2EG (TL);
+              t->tllTable[fnum][block][TL][KL] = TL2EG (TL);
             else
-              tllTable[fnum][block][TL][KL] = (uint32) ((tmp >> (3 - KL)) / EG_STEP) + TL2EG (TL);
+              t->tllTable[fnum][block][TL][KL] = (uint32) ((tmp >> (3 - KL)) / EG_STEP) + TL2EG (TL);
           }
         }
 }
@@ -427,7 +430,7 @@ static double decaytime[16][4] = {
 
 /* Rate Table for Attack */
 static void
-makeDphaseARTable (void)
+makeDphaseARTable (OPLL_TABLES * t)
 {
   int32 AR, Rks, RM, RL;
 
@@ -457,16 +460,16 @@ makeDphaseARTable (void)
       switch (AR)
       {
       case 0:
-        dphaseARTable[AR][Rks] = 0;
+        t->dphaseARTable[AR][Rks] = 0;
         break;
       case 15:
-        dphaseARTable[AR][Rks] = 0;/*EG_DP_WIDTH;*/ 
+        t->dphaseARTable[AR][Rks] = 0;/*EG_DP_WIDTH;*/ 
         break;
       default:
 #ifdef USE_SPEC_ENV_SPEED
-        dphaseARTable[AR][Rks] = RATE_ADJUST (attacktable[RM][RL]);
+        t->dphaseARTable[AR][Rks] = RATE_ADJUST (t, attacktable[RM][RL]);
 #else
-        dphaseARTable[AR][Rks] = RATE_ADJUST ((3 * (RL + 4) << (RM + 1)));
+        t->dphaseARTable[AR][Rks] = RATE_ADJUST (t, (3 * (RL + 4) << (RM + 1)));
 #endif
         break;
       }
@@ -475,7 +478,7 @@ makeDphaseARTable (void)
 
 /* Rate Table for Decay and Release */
 static void
-makeDphaseDRTable (void)
+makeDphaseDRTable (OPLL_TABLES * t)
 {
   int32 DR, Rks, RM, RL;
 
@@ -500,13 +503,13 @@ makeDphaseDRTable (void)
       switch (DR)
       {
       case 0:
-        dphaseDRTable[DR][Rks] = 0;
+        t->dphaseDRTable[DR][Rks] = 0;
         break;
       default:
 #ifdef USE_SPEC_ENV_SPEED
-        dphaseDRTable[DR][Rks] = RATE_ADJUST (decaytable[RM][RL]);
+        t->dphaseDRTable[DR][Rks] = RATE_ADJUST (t, decaytable[RM][RL]);
 #else
-        dphaseDRTable[DR][Rks] = RATE_ADJUST ((RL + 4) << (RM - 1));
+        t->dphaseDRTable[DR][Rks] = RATE_ADJUST (t, (RL + 4) << (RM - 1));
 #endif
         break;
       }
@@ -514,7 +517,7 @@ makeDphaseDRTable (void)
 }
 
 static void
-makeRksTable (void)
+makeRksTable (OPLL_TABLES * t)
 {
 
   int32 fnum8, block, KR;
@@ -524,9 +527,9 @@ makeRksTable (void)
       for (KR = 0; KR < 2; KR++)
       {
         if (KR != 0)
-          rksTable[fnum8][block][KR] = (block << 1) + fnum8;
+          t->rksTable[fnum8][block][KR] = (block << 1) + fnum8;
         else
-          rksTable[fnum8][block][KR] = block >> 1;
+          t->rksTable[fnum8][block][KR] = block >> 1;
       }
 }
 
@@ -566,13 +569,13 @@ OPLL_getDefaultPatch (int32 type, int32 num, OPLL_PATCH * patch)
 }
 
 static void
-makeDefaultPatch ()
+makeDefaultPatch (OPLL_TABLES * t)
 {
   int32 i, j;
 
   for (i = 0; i < OPLL_TONE_NUM; i++)
     for (j = 0; j < 19; j++)
-      OPLL_getDefaultPatch (i, j, &default_patch[i][j * 2]);
+      OPLL_getDefaultPatch (i, j, &t->default_patch[i][j * 2]);
 
 }
 
@@ -624,27 +627,27 @@ calc_eg_dphase (OPLL_SLOT * slot)
   switch (slot->eg_mode)
   {
   case ATTACK:
-    return dphaseARTable[slot->patch->AR][slot->rks];
+    return slot->tables->dphaseARTable[slot->patch->AR][slot->rks];
 
   case DECAY:
-    return dphaseDRTable[slot->patch->DR][slot->rks];
+    return slot->tables->dphaseDRTable[slot->patch->DR][slot->rks];
 
   case SUSHOLD:
     return 0;
 
   case SUSTINE:
-    return dphaseDRTable[slot->patch->RR][slot->rks];
+    return slot->tables->dphaseDRTable[slot->patch->RR][slot->rks];
 
   case RELEASE:
     if (slot->sustine)
-      return dphaseDRTable[5][slot->rks];
+      return slot->tables->dphaseDRTable[5][slot->rks];
     else if (slot->patch->EG)
-      return dphaseDRTable[slot->patch->RR][slot->rks];
+      return slot->tables->dphaseDRTable[slot->patch->RR][slot->rks];
     else
-      return dphaseDRTable[7][slot->rks];
+      return slot->tables->dphaseDRTable[7][slot->rks];
 
   case SETTLE:
-    return dphaseDRTable[15][0];
+    return slot->tables->dphaseDRTable[15][0];
 
   case FINISH:
     return 0;
@@ -666,13 +669,13 @@ calc_eg_dphase (OPLL_SLOT * slot)
 #define SLOT_TOM 16
 #define SLOT_CYM 17
 
-#define UPDATE_PG(S)  (S)->dphase = dphaseTable[(S)->fnum][(S)->block][(S)->patch->ML]
+#define UPDATE_PG(S)  (S)->dphase = (S)->tables->dphaseTable[(S)->fnum][(S)->block][(S)->patch->ML]
 #define UPDATE_TLL(S)\
 (((S)->type==0)?\
-((S)->tll = tllTable[((S)->fnum)>>5][(S)->block][(S)->patch->TL][(S)->patch->KL]):\
-((S)->tll = tllTable[((S)->fnum)>>5][(S)->block][(S)->volume][(S)->patch->KL]))
-#define UPDATE_RKS(S) (S)->rks = rksTable[((S)->fnum)>>8][(S)->block][(S)->patch->KR]
-#define UPDATE_WF(S)  (S)->sintbl = waveform[(S)->patch->WF]
+((S)->tll = (S)->tables->tllTable[((S)->fnum)>>5][(S)->block][(S)->patch->TL][(S)->patch->KL]):\
+((S)->tll = (S)->tables->tllTable[((S)->fnum)>>5][(S)->block][(S)->volume][(S)->patch->KL]))
+#define UPDATE_RKS(S) (S)->rks = (S)->tables->rksTable[((S)->fnum)>>8][(S)->block][(S)->patch->KR]
+#define UPDATE_WF(S)  (S)->sintbl = (S)->tables->waveform[(S)->patch->WF]
 #define UPDATE_EG(S)  (S)->eg_dphase = calc_eg_dphase(S)
 #define UPDATE_ALL(S)\
   UPDATE_PG(S);\
@@ -706,7 +709,7 @@ INLINE static void
 slotOff (OPLL_SLOT * slot)
 {
   if (slot->eg_mode == ATTACK)
-    slot->eg_phase = EXPAND_BITS (AR_ADJUST_TABLE[HIGHBITS (slot->eg_phase, EG_DP_BITS - EG_BITS)], EG_BITS, EG_DP_BITS);
+    slot->eg_phase = EXPAND_BITS (slot->tables->AR_ADJUST_TABLE[HIGHBITS (slot->eg_phase, EG_DP_BITS - EG_BITS)], EG_BITS, EG_DP_BITS);
   slot->eg_mode = RELEASE;
   UPDATE_EG(slot);
 }
@@ -929,7 +932,7 @@ update_key_status (OPLL * opll)
 }
 
 void
-OPLL_copyPatch (OPLL * opll, int32 num, OPLL_PATCH * patch)
+OPLL_copyPatch (OPLL * opll, int32 num, const OPLL_PATCH * patch)
 {
   memcpy (&opll->patch[num], patch, sizeof (OPLL_PATCH));
 }
@@ -944,7 +947,7 @@ static void
 OPLL_SLOT_reset (OPLL_SLOT * slot, int type)
 {
   slot->type = type;
-  slot->sintbl = waveform[0];
+  slot->sintbl = slot->tables->waveform[0];
   slot->phase = 0;
   slot->dphase = 0;
   slot->output[0] = 0;
@@ -965,50 +968,70 @@ OPLL_SLOT_reset (OPLL_SLOT * slot, int type)
 }
 
 static void
-internal_refresh (void)
+internal_refresh (OPLL_TABLES * t)
 {
-  makeDphaseTable ();
-  makeDphaseARTable ();
-  makeDphaseDRTable ();
-  pm_dphase = (uint32) RATE_ADJUST (PM_SPEED * PM_DP_WIDTH / (clk / 72));
-  am_dphase = (uint32) RATE_ADJUST (AM_SPEED * AM_DP_WIDTH / (clk / 72));
+  makeDphaseTable (t);
+  makeDphaseARTable (t);
+  makeDphaseDRTable (t);
+  t->pm_dphase = (uint32) RATE_ADJUST (t, PM_SPEED * PM_DP_WIDTH / (t->clk / 72));
+  t->am_dphase = (uint32) RATE_ADJUST (t, AM_SPEED * AM_DP_WIDTH / (t->clk / 72));
 }
 
 static void
-maketables (uint32 c, uint32 r)
+maketables (OPLL_TABLES * t)
 {
-  if (c != clk)
-  {
-    clk = c;
-    makePmTable ();
-    makeAmTable ();
-    makeDB2LinTable ();
-    makeAdjustTable ();
-    makeTllTable ();
-    makeRksTable ();
-    makeSinTable ();
-    makeDefaultPatch ();
-  }
+  t->waveform[0] = t->fullsintable;
+  t->waveform[1] = t->halfsintable;
 
-  if (r != rate)
-  {
-    rate = r;
-    internal_refresh ();
-  }
+  makePmTable (t);
+  makeAmTable (t);
+  makeDB2LinTable (t);
+  makeAdjustTable (t);
+  makeTllTable (t);
+  makeRksTable (t);
+  makeSinTable (t);
+  makeDefaultPatch (t);
+
+  internal_refresh (t);
 }
 
-OPLL *
-OPLL_new (uint32 clk, uint32 rate)
+OPLL_TABLES *
+OPLL_tables_new (uint32 clk, uint32 rate)
+{
+  OPLL_TABLES *t;
+
+  t = (OPLL_TABLES *) calloc (sizeof (OPLL_TABLES), 1);
+  if (t == NULL)
+    return NULL;
+
+  t->clk = clk;
+  t->rate = rate;
+  maketables (t);
+
+  return t;
+}
+
+void
+OPLL_tables_delete (OPLL_TABLES * t)
+{
+  free (t);
+}
+
+static OPLL *
+create (const OPLL_TABLES * tables, int32 own_tables)
 {
   OPLL *opll;
   int32 i;
 
-  maketables (clk, rate);
-
   opll = (OPLL *) calloc (sizeof (OPLL), 1);
   if (opll == NULL)
     return NULL;
 
+  opll->tables = tables;
+  opll->own_tables = own_tables;
+  opll->clk = tables->clk;
+  opll->rate = tables->rate;
+
   for (i = 0; i < 19 * 2; i++)
     memcpy(&opll->patch[i],&null_patch,sizeof(OPLL_PATCH));
 
@@ -1020,10 +1043,37 @@ OPLL_new (uint32 clk, uint32 rate)
   return opll;
 }
 
+/* Creates an OPLL with a private table set. */
+OPLL *
+OPLL_new (uint32 clk, uint32 rate)
+{
+  OPLL_TABLES *tables;
+  OPLL *opll;
+
+  tables = OPLL_tables_new (clk, rate);
+  if (tables == NULL)
+    return NULL;
+
+  opll = create (tables, 1);
+  if (opll == NULL)
+    OPLL_tables_delete (tables);
+
+  return opll;
+}
+
+/* Creates an OPLL that reads from tables, which must outlive it. */
+OPLL *
+OPLL_new_with_tables (const OPLL_TABLES * tables)
+{
+  return create (tables, 0);
+}
+
 
 void
 OPLL_delete (OPLL * opll)
 {
+  if (opll->own_tables)
+    OPLL_tables_delete ((OPLL_TABLES *) opll->tables);
   free (opll);
 }
 
@@ -1035,7 +1085,7 @@ OPLL_reset_patch (OPLL * opll, int32 type)
   int32 i;
 
   for (i = 0; i < 19 * 2; i++)
-    OPLL_copyPatch (opll, i, &default_patch[type % OPLL_TONE_NUM][i]);
+    OPLL_copyPatch (opll, i, &opll->tables->default_patch[type % OPLL_TONE_NUM][i]);
 }
 
 /* Reset whole of OPLL except patch datas. */
@@ -1057,7 +1107,10 @@ OPLL_reset (OPLL * opll)
   opll->mask = 0;
 
   for (i = 0; i <18; i++)
+  {
+    opll->slot[i].tables = opll->tables;
     OPLL_SLOT_reset(&opll->slot[i], i%2);
+  }
 
   for (i = 0; i < 9; i++)
   {
@@ -1069,8 +1122,8 @@ OPLL_reset (OPLL * opll)
     OPLL_writeReg (opll, i, 0);
 
 #ifndef EMU2413_COMPACTION
-  opll->realstep = (uint32) ((1 << 31) / rate);
-  opll->opllstep = (uint32) ((1 << 31) / (clk / 72));
+  opll->realstep = (uint32) ((1 << 31) / opll->rate);
+  opll->opllstep = (uint32) ((1 << 31) / (opll->clk / 72));
   opll->oplltime = 0;
   for (i = 0; i < 14; i++)
     opll->pan[i] = 2;
@@ -1104,19 +1157,34 @@ OPLL_forceRefresh (OPLL * opll)
 void
 OPLL_set_rate (OPLL * opll, uint32 r)
 {
-  if (opll->quality)
-    rate = 49716;
-  else
-    rate = r;
-  internal_refresh ();
-  rate = r;
+  const OPLL_TABLES *old = opll->tables;
+  OPLL_TABLES *tables;
+  int32 i;
+
+  /* The current set may be shared, so build a private one */
+  tables = OPLL_tables_new (opll->clk, opll->quality ? 49716 : r);
+  if (tables == NULL)
+    return;
+
+  for (i = 0; i < 18; i++)
+  {
+    opll->slot[i].tables = tables;
+    opll->slot[i].sintbl = tables->waveform[opll->slot[i].sintbl == old->halfsintable ? 1 : 0];
+  }
+
+  if (opll->own_tables)
+    OPLL_tables_delete ((OPLL_TABLES *) old);
+
+  opll->tables = tables;
+  opll->own_tables = 1;
+  opll->rate = r;
 }
 
 void
 OPLL_set_quality (OPLL * opll, uint32 q)
 {
   opll->quality = q;
-  OPLL_set_rate (opll, rate);
+  OPLL_set_rate (opll, opll->rate);
 }
 
 /*********************************************************
@@ -1153,10 +1221,12 @@ OPLL_set_quality (OPLL * opll, uint32 q)
 static void
 update_ampm (OPLL * opll)
 {
-  opll->pm_phase = (opll->pm_phase + pm_dphase) & (PM_DP_WIDTH - 1);
-  opll->am_phase = (opll->am_phase + am_dphase) & (AM_DP_WIDTH - 1);
-  opll->lfo_am = amtable[HIGHBITS (opll->am_phase, AM_DP_BITS - AM_PG_BITS)];
-  opll->lfo_pm = pmtable[HIGHBITS (opll->pm_phase, PM_DP_BITS - PM_PG_BITS)];
+  const OPLL_TABLES *t = opll->tables;
+
+  opll->pm_phase = (opll->pm_phase + t->pm_dphase) & (PM_DP_WIDTH - 1);
+  opll->am_phase = (opll->am_phase + t->am_dphase) & (AM_DP_WIDTH - 1);
+  opll->lfo_am = t->amtable[HIGHBITS (opll->am_phase, AM_DP_BITS - AM_PG_BITS)];
+  opll->lfo_pm = t->pmtable[HIGHBITS (opll->pm_phase, PM_DP_BITS - PM_PG_BITS)];
 }
 
 /* PG */
@@ -1197,7 +1267,7 @@ calc_envelope (OPLL_SLOT * slot, int32 lfo)
   switch (slot->eg_mode)
   {
   case ATTACK:
-    egout = AR_ADJUST_TABLE[HIGHBITS (slot->eg_phase, EG_DP_BITS - EG_BITS)];
+    egout = slot->tables->AR_ADJUST_TABLE[HIGHBITS (slot->eg_phase, EG_DP_BITS - EG_BITS)];
     slot->eg_phase += slot->eg_dphase;
     if((EG_DP_WIDTH & slot->eg_phase)||(slot->patch->AR==15))
     {
@@ -1289,7 +1359,7 @@ calc_slot_car (OPLL_SLOT * slot, int32 fm)
   }
   else
   {
-    slot->output[0] = DB2LIN_TABLE[slot->sintbl[(slot->pgout+wave2_8pi(fm))&(PG_WIDTH-1)] + slot->egout];
+    slot->output[0] = slot->tables->DB2LIN_TABLE[slot->sintbl[(slot->pgout+wave2_8pi(fm))&(PG_WIDTH-1)] + slot->egout];
   }
 
   slot->output[1] = (slot->output[1] + slot->output[0]) >> 1;
@@ -1311,11 +1381,11 @@ calc_slot_mod (OPLL_SLOT * slot)
   else if (slot->patch->FB != 0)
   {
     fm = wave2_4pi (slot->feedback) >> (7 - slot->patch->FB);
-    slot->output[0] = DB2LIN_TABLE[slot->sintbl[(slot->pgout+fm)&(PG_WIDTH-1)] + slot->egout];
+    slot->output[0] = slot->tables->DB2LIN_TABLE[slot->sintbl[(slot->pgout+fm)&(PG_WIDTH-1)] + slot->egout];
   }
   else
   {
-    slot->output[0] = DB2LIN_TABLE[slot->sintbl[slot->pgout] + slot->egout];
+    slot->output[0] = slot->tables->DB2LIN_TABLE[slot->sintbl[slot->pgout] + slot->egout];
   }
 
   slot->feedback = (slot->output[1] + slot->output[0]) >> 1;
@@ -1331,7 +1401,7 @@ calc_slot_tom (OPLL_SLOT * slot)
   if (slot->egout >= (DB_MUTE - 1))
     return 0;
 
-  return DB2LIN_TABLE[slot->sintbl[slot->pgout] + slot->egout];
+  return slot->tables->DB2LIN_TABLE[slot->sintbl[slot->pgout] + slot->egout];
 
 }
 
@@ -1343,9 +1413,9 @@ calc_slot_snare (OPLL_SLOT * slot, uint32 noise)
     return 0;
   
   if(BIT(slot->pgout,7))
-    return DB2LIN_TABLE[(noise?DB_POS(0.0):DB_POS(15.0))+slot->egout];
+    return slot->tables->DB2LIN_TABLE[(noise?DB_POS(0.0):DB_POS(15.0))+slot->egout];
   else
-    return DB2LIN_TABLE[(noise?DB_NEG(0.0):DB_NEG(15.0))+slot->egout];
+    return slot->tables->DB2LIN_TABLE[(noise?DB_NEG(0.0):DB_NEG(15.0))+slot->egout];
 }
 
 /* 
@@ -1368,7 +1438,7 @@ calc_slot_cym (OPLL_SLOT * slot, uint32 pgout_hh)
   else
     dbout = DB_POS(3.0);
 
-  return DB2LIN_TABLE[dbout + slot->egout];
+  return slot->tables->DB2LIN_TABLE[dbout + slot->egout];
 }
 
 /* 
@@ -1401,7 +1471,7 @@ calc_slot_hat (OPLL_SLOT *slot, int32 pgout_cym, uint32 noise)
       dbout = DB_POS(24.0);
   }
 
-  return DB2LIN_TABLE[dbout + slot->egout];
+  return slot->tables->DB2LIN_TABLE[dbout + slot->egout];
 }
 
 static int16
@@ -1424,8 +1494,8 @@ calc (OPLL * opll)
 		int32 absval, val = calc_slot_car (CAR(opll,i), calc_slot_mod(MOD(opll,i)));
 		inst += val;
 		absval = abs(val);
-		if (absval > opll_volumes[i])
-			opll_volumes[i] = val;
+		if (absval > opll->chanvol[i])
+			opll->chanvol[i] = val;
 	  }
 
   /* CH6 */
@@ -1878,9 +1948,9 @@ OPLL_calc_stereo (OPLL * opll, int32 out[2])
 #endif /* EMU2413_COMPACTION */
 
 
-int32 OPLL_getchanvol(int i)
+int32 OPLL_getchanvol(OPLL *opll, int i)
 {
-	int retval = opll_volumes[i];
-	opll_volumes[i] = 0;
+	int retval = opll->chanvol[i];
+	opll->chanvol[i] = 0;
 	return retval;
 }
@@ -31,9 +31,14 @@ typedef struct __OPLL_PATCH {
   uint32 TL,FB,EG,ML,AR,DR,SL,RR,KR,KL,AM,PM,WF ;
 } OPLL_PATCH ;
 
+/* Immutable tables, shared by every OPLL built with the same clock and rate */
+typedef struct __OPLL_TABLES OPLL_TABLES ;
+
 /* slot */
 typedef struct __OPLL_SLOT {
 
+  const OPLL_TABLES *tables ;
+
   OPLL_PATCH *patch;  
 
   int32 type ;          /* 0 : modulator 1 : carrier */
@@ -43,7 +48,7 @@ typedef struct __OPLL_SLOT {
   int32 output[2] ;   /* Output value of slot */
 
   /* for Phase Generator (PG) */
-  uint16 *sintbl ;    /* Wavetable */
+  const uint16 *sintbl ;    /* Wavetable */
   uint32 phase ;      /* Phase */
   uint32 dphase ;     /* Phase increment amount */
   uint32 pgout ;      /* output */
@@ -74,6 +79,11 @@ typedef struct __OPLL_SLOT {
 /* opll */
 typedef struct __OPLL {
 
+  const OPLL_TABLES *tables ;
+  int32 own_tables ;
+  uint32 clk ;
+  uint32 rate ;
+
   uint32 adr ;
   int32 out ;
 
@@ -116,10 +126,14 @@ typedef struct __OPLL {
 
   uint32 mask ;
 
+  /* Peak channel outputs, read by OPLL_getchanvol */
+  int32 chanvol[10] ;
+
 } OPLL ;
 
 /* Create Object */
 EMU2413_API OPLL *OPLL_new(uint32 clk, uint32 rate) ;
+EMU2413_API OPLL *OPLL_new_with_tables(const OPLL_TABLES *tables) ;
 EMU2413_API void OPLL_delete(OPLL *) ;
 
 /* Setup */
@@ -139,7 +153,7 @@ EMU2413_API void OPLL_calc_stereo(OPLL *, int32 out[2]) ;
 
 /* Misc */
 EMU2413_API void OPLL_setPatch(OPLL *, const uint8 *dump) ;
-EMU2413_API void OPLL_copyPatch(OPLL *, int32, OPLL_PATCH *) ;
+EMU2413_API void OPLL_copyPatch(OPLL *, int32, const OPLL_PATCH *) ;
 EMU2413_API void OPLL_forceRefresh(OPLL *) ;
 /* Utility */
 EMU2413_API void OPLL_dump2patch(const uint8 *dump, OPLL_PATCH *patch) ;
@@ -150,9 +164,13 @@ EMU2413_API void OPLL_getDefaultPatch(int32 type, int32 num, OPLL_PATCH *) ;
 EMU2413_API uint32 OPLL_setMask(OPLL *, uint32 mask) ;
 EMU2413_API uint32 OPLL_toggleMask(OPLL *, uint32 mask) ;
 
+/* Tables */
+EMU2413_API OPLL_TABLES *OPLL_tables_new(uint32 clk, uint32 rate) ;
+EMU2413_API void OPLL_tables_delete(OPLL_TABLES *) ;
+
 #define dump2patch OPLL_dump2patch
 
-int32 OPLL_getchanvol(int i);
+EMU2413_API int32 OPLL_getchanvol(OPLL *, int i) ;
 
 #ifdef __cplusplus
 }
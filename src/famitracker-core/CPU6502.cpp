@@ -0,0 +1,384 @@
+#include <string.h>
+#include "CPU6502.hpp"
+
+enum
+{
+	FLAG_C = 0x01,
+	FLAG_Z = 0x02,
+	FLAG_I = 0x04,
+	FLAG_D = 0x08,
+	FLAG_B = 0x10,
+	FLAG_U = 0x20,
+	FLAG_V = 0x40,
+	FLAG_N = 0x80
+};
+
+// Base cycles of each opcode. Page crossings and taken branches are added
+// when the instruction runs
+const core::u8 CPU6502::CYCLES[0x100] = {
+	7,6,2,8,3,3,5,5,3,2,2,2,4,4,6,6,
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+	6,6,2,8,3,3,5,5,4,2,2,2,4,4,6,6,
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+	6,6,2,8,3,3,5,5,3,2,2,2,3,4,6,6,
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+	6,6,2,8,3,3,5,5,4,2,2,2,5,4,6,6,
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+	2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4,
+	2,6,2,6,4,4,4,4,2,5,2,5,5,5,5,5,
+	2,6,2,6,3,3,3,3,2,2,2,2,4,4,4,4,
+	2,5,2,5,4,4,4,4,2,4,2,4,4,4,4,4,
+	2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6,
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7,
+	2,6,2,8,3,3,5,5,2,2,2,2,4,4,6,6,
+	2,5,2,8,4,4,6,6,2,4,2,7,4,4,7,7
+};
+
+static core::u8 null_read(core::u16 addr, void *)
+{
+	return addr >> 8;
+}
+
+static void null_write(core::u16, core::u8, core::u32, void *)
+{
+}
+
+CPU6502::CPU6502()
+	: m_read(null_read), m_write(null_write), m_data(NULL),
+	  m_cycles(0), m_pc(0), m_a(0), m_x(0), m_y(0), m_sp(0xFD), m_p(FLAG_I | FLAG_U),
+	  m_jammed(false), m_callSP(0xFD), m_returned(false)
+{
+	memset(m_mem, 0, sizeof(m_mem));
+	memset(m_pages, 0, sizeof(m_pages));
+
+	// Internal RAM
+	setPages(0x00, 0x08, PAGE_WRITE);
+}
+
+void CPU6502::setHandlers(read_f r, write_f w, void *data)
+{
+	m_read = r != NULL ? r : null_read;
+	m_write = w != NULL ? w : null_write;
+	m_data = data;
+}
+
+void CPU6502::setPages(unsigned int first, unsigned int count, core::u8 flags)
+{
+	for (unsigned int i = first; i < first + count && i < 0x100; i++)
+		m_pages[i] = flags;
+}
+
+inline core::u8 CPU6502::read(core::u16 addr)
+{
+	if (m_pages[addr >> 8] & PAGE_READ_IO)
+		return (*m_read)(addr, m_data);
+
+	return m_mem[addr];
+}
+
+inline void CPU6502::write(core::u16 addr, core::u8 value)
+{
+	core::u8 flags = m_pages[addr >> 8];
+
+	if (flags & PAGE_WRITE_IO)
+		(*m_write)(addr, value, m_cycles, m_data);
+	else if (flags & PAGE_WRITE)
+		m_mem[addr] = value;
+}
+
+inline void CPU6502::push(core::u8 value)
+{
+	m_mem[0x100 | m_sp--] = value;
+}
+
+inline core::u8 CPU6502::pop()
+{
+	return m_mem[0x100 | ++m_sp];
+}
+
+bool CPU6502::call(core::u16 addr, core::u8 a, core::u8 x, core::u8 y, core::u32 maxCycles)
+{
+	m_a = a;
+	m_x = x;
+	m_y = y;
+	m_p = FLAG_I | FLAG_U;
+	m_sp = 0xFD;
+	m_jammed = false;
+
+	// Return address, the RTS that pops it ends the call
+	m_callSP = m_sp;
+	push(0xFF);
+	push(0xFF);
+
+	m_pc = addr;
+	m_returned = false;
+
+	core::u32 end = m_cycles + maxCycles;
+	if (end < m_cycles)
+		end = 0xFFFFFFFF;
+
+	run(end);
+
+	return m_returned;
+}
+
+// Operand addresses. Code and its operands are always read from memory
+#define AM_ZP	addr = m_mem[m_pc++]
+#define AM_ZPX	addr = (core::u8)(m_mem[m_pc++] + m_x)
+#define AM_ZPY	addr = (core::u8)(m_mem[m_pc++] + m_y)
+#define AM_ABS	addr = m_mem[m_pc] | (m_mem[(core::u16)(m_pc + 1)] << 8); m_pc += 2
+#define AM_IZX	{ core::u8 z = m_mem[m_pc++] + m_x; addr = m_mem[z] | (m_mem[(core::u8)(z + 1)] << 8); }
+#define AM_IZY_BASE	{ core::u8 z = m_mem[m_pc++]; addr = m_mem[z] | (m_mem[(core::u8)(z + 1)] << 8); }
+
+// Indexed reads take a cycle more when they cross a page
+#define PAGE_CROSS(base, index) m_cycles += (((base) & 0xFF) + (index)) >> 8
+#define AM_ABX	AM_ABS; addr += m_x
+#define AM_ABY	AM_ABS; addr += m_y
+#define AM_IZY	AM_IZY_BASE; addr += m_y
+#define AM_ABX_R	AM_ABS; PAGE_CROSS(addr, m_x); addr += m_x
+#define AM_ABY_R	AM_ABS; PAGE_CROSS(addr, m_y); addr += m_y
+#define AM_IZY_R	AM_IZY_BASE; PAGE_CROSS(addr, m_y); addr += m_y
+
+#define SET_NZ(v) m_p = (m_p & ~(FLAG_N | FLAG_Z)) | ((v) & FLAG_N) | ((v) ? 0 : FLAG_Z)
+
+// Operations on v
+#define OP_ORA	m_a |= v; SET_NZ(m_a)
+#define OP_AND	m_a &= v; SET_NZ(m_a)
+#define OP_EOR	m_a ^= v; SET_NZ(m_a)
+#define OP_ADC	{ \
+	unsigned int s = m_a + v + (m_p & FLAG_C); \
+	m_p = (m_p & ~(FLAG_C | FLAG_V)) | (s > 0xFF ? FLAG_C : 0) | ((~(m_a ^ v) & (m_a ^ s) & 0x80) ? FLAG_V : 0); \
+	m_a = (core::u8)s; SET_NZ(m_a); }
+#define OP_SBC	v ^= 0xFF; OP_ADC
+#define OP_CMP(r)	m_p = (m_p & ~FLAG_C) | ((r) >= v ? FLAG_C : 0); SET_NZ((core::u8)((r) - v))
+#define OP_LDA	m_a = v; SET_NZ(m_a)
+#define OP_LDX	m_x = v; SET_NZ(m_x)
+#define OP_LDY	m_y = v; SET_NZ(m_y)
+#define OP_BIT	m_p = (m_p & ~(FLAG_N | FLAG_V | FLAG_Z)) | (v & (FLAG_N | FLAG_V)) | ((m_a & v) ? 0 : FLAG_Z)
+#define OP_NOP
+
+#define OP_ASL	m_p = (m_p & ~FLAG_C) | (v >> 7); v <<= 1; SET_NZ(v)
+#define OP_LSR	m_p = (m_p & ~FLAG_C) | (v & 1); v >>= 1; SET_NZ(v)
+#define OP_ROL	{ core::u8 c = m_p & FLAG_C; m_p = (m_p & ~FLAG_C) | (v >> 7); v = (v << 1) | c; SET_NZ(v); }
+#define OP_ROR	{ core::u8 c = (m_p & FLAG_C) << 7; m_p = (m_p & ~FLAG_C) | (v & 1); v = (v >> 1) | c; SET_NZ(v); }
+#define OP_INC	v++; SET_NZ(v)
+#define OP_DEC	v--; SET_NZ(v)
+
+#define IMM(code, op) \
+	case code: v = m_mem[m_pc++]; op; break;
+#define READ(code, am, op) \
+	case code: am; v = read(addr); op; break;
+#define STORE(code, am, r) \
+	case code: am; write(addr, r); break;
+#define MODIFY(code, am, op) \
+	case code: am; v = read(addr); op; write(addr, v); break;
+#define MODIFY_A(code, op) \
+	case code: v = m_a; op; m_a = v; break;
+
+// The eight addressing modes of the ALU instructions
+#define ALU(base, op) \
+	READ(base + 0x01, AM_IZX, op) \
+	READ(base + 0x05, AM_ZP, op) \
+	IMM(base + 0x09, op) \
+	READ(base + 0x0D, AM_ABS, op) \
+	READ(base + 0x11, AM_IZY_R, op) \
+	READ(base + 0x15, AM_ZPX, op) \
+	READ(base + 0x19, AM_ABY_R, op) \
+	READ(base + 0x1D, AM_ABX_R, op)
+
+#define SHIFT(base, op) \
+	MODIFY(base + 0x06, AM_ZP, op) \
+	MODIFY_A(base + 0x0A, op) \
+	MODIFY(base + 0x0E, AM_ABS, op) \
+	MODIFY(base + 0x16, AM_ZPX, op) \
+	MODIFY(base + 0x1E, AM_ABX, op)
+
+#define BRANCH(code, cond) \
+	case code: { \
+		core::u16 t = m_pc + 1 + (core::s8)m_mem[m_pc]; \
+		m_pc++; \
+		if (cond) \
+		{ \
+			m_cycles += ((t ^ m_pc) & 0xFF00) ? 2 : 1; \
+			m_pc = t; \
+		} \
+	} break;
+
+void CPU6502::run(core::u32 endCycle)
+{
+	core::u16 addr;
+	core::u8 v;
+
+	while (m_cycles < endCycle)
+	{
+		core::u8 op = m_mem[m_pc++];
+		m_cycles += CYCLES[op];
+
+		switch (op)
+		{
+			ALU(0x00, OP_ORA)
+			ALU(0x20, OP_AND)
+			ALU(0x40, OP_EOR)
+			ALU(0x60, OP_ADC)
+			ALU(0xC0, OP_CMP(m_a))
+			ALU(0xE0, OP_SBC)
+
+			READ(0xA1, AM_IZX, OP_LDA)
+			READ(0xA5, AM_ZP, OP_LDA)
+			IMM(0xA9, OP_LDA)
+			READ(0xAD, AM_ABS, OP_LDA)
+			READ(0xB1, AM_IZY_R, OP_LDA)
+			READ(0xB5, AM_ZPX, OP_LDA)
+			READ(0xB9, AM_ABY_R, OP_LDA)
+			READ(0xBD, AM_ABX_R, OP_LDA)
+
+			IMM(0xA2, OP_LDX)
+			READ(0xA6, AM_ZP, OP_LDX)
+			READ(0xAE, AM_ABS, OP_LDX)
+			READ(0xB6, AM_ZPY, OP_LDX)
+			READ(0xBE, AM_ABY_R, OP_LDX)
+
+			IMM(0xA0, OP_LDY)
+			READ(0xA4, AM_ZP, OP_LDY)
+			READ(0xAC, AM_ABS, OP_LDY)
+			READ(0xB4, AM_ZPX, OP_LDY)
+			READ(0xBC, AM_ABX_R, OP_LDY)
+
+			STORE(0x81, AM_IZX, m_a)
+			STORE(0x85, AM_ZP, m_a)
+			STORE(0x8D, AM_ABS, m_a)
+			STORE(0x91, AM_IZY, m_a)
+			STORE(0x95, AM_ZPX, m_a)
+			STORE(0x99, AM_ABY, m_a)
+			STORE(0x9D, AM_ABX, m_a)
+
+			STORE(0x86, AM_ZP, m_x)
+			STORE(0x8E, AM_ABS, m_x)
+			STORE(0x96, AM_ZPY, m_x)
+
+			STORE(0x84, AM_ZP, m_y)
+			STORE(0x8C, AM_ABS, m_y)
+			STORE(0x94, AM_ZPX, m_y)
+
+			IMM(0xE0, OP_CMP(m_x))
+			READ(0xE4, AM_ZP, OP_CMP(m_x))
+			READ(0xEC, AM_ABS, OP_CMP(m_x))
+			IMM(0xC0, OP_CMP(m_y))
+			READ(0xC4, AM_ZP, OP_CMP(m_y))
+			READ(0xCC, AM_ABS, OP_CMP(m_y))
+
+			READ(0x24, AM_ZP, OP_BIT)
+			READ(0x2C, AM_ABS, OP_BIT)
+
+			SHIFT(0x00, OP_ASL)
+			SHIFT(0x20, OP_ROL)
+			SHIFT(0x40, OP_LSR)
+			SHIFT(0x60, OP_ROR)
+
+			MODIFY(0xC6, AM_ZP, OP_DEC)
+			MODIFY(0xCE, AM_ABS, OP_DEC)
+			MODIFY(0xD6, AM_ZPX, OP_DEC)
+			MODIFY(0xDE, AM_ABX, OP_DEC)
+			MODIFY(0xE6, AM_ZP, OP_INC)
+			MODIFY(0xEE, AM_ABS, OP_INC)
+			MODIFY(0xF6, AM_ZPX, OP_INC)
+			MODIFY(0xFE, AM_ABX, OP_INC)
+
+			case 0xE8: m_x++; SET_NZ(m_x); break;
+			case 0xCA: m_x--; SET_NZ(m_x); break;
+			case 0xC8: m_y++; SET_NZ(m_y); break;
+			case 0x88: m_y--; SET_NZ(m_y); break;
+			case 0xAA: m_x = m_a; SET_NZ(m_x); break;
+			case 0xA8: m_y = m_a; SET_NZ(m_y); break;
+			case 0x8A: m_a = m_x; SET_NZ(m_a); break;
+			case 0x98: m_a = m_y; SET_NZ(m_a); break;
+			case 0xBA: m_x = m_sp; SET_NZ(m_x); break;
+			case 0x9A: m_sp = m_x; break;
+
+			case 0x48: push(m_a); break;
+			case 0x08: push(m_p | FLAG_B | FLAG_U); break;
+			case 0x68: m_a = pop(); SET_NZ(m_a); break;
+			case 0x28: m_p = (pop() & ~FLAG_B) | FLAG_U; break;
+
+			case 0x18: m_p &= ~FLAG_C; break;
+			case 0x38: m_p |= FLAG_C; break;
+			case 0x58: m_p &= ~FLAG_I; break;
+			case 0x78: m_p |= FLAG_I; break;
+			case 0xB8: m_p &= ~FLAG_V; break;
+			case 0xD8: m_p &= ~FLAG_D; break;
+			case 0xF8: m_p |= FLAG_D; break;
+
+			BRANCH(0x10, !(m_p & FLAG_N))
+			BRANCH(0x30, m_p & FLAG_N)
+			BRANCH(0x50, !(m_p & FLAG_V))
+			BRANCH(0x70, m_p & FLAG_V)
+			BRANCH(0x90, !(m_p & FLAG_C))
+			BRANCH(0xB0, m_p & FLAG_C)
+			BRANCH(0xD0, !(m_p & FLAG_Z))
+			BRANCH(0xF0, m_p & FLAG_Z)
+
+			case 0x4C:
+				AM_ABS;
+				m_pc = addr;
+				break;
+			case 0x6C:
+				// The pointer doesn't carry into the next page
+				AM_ABS;
+				m_pc = m_mem[addr] | (m_mem[(addr & 0xFF00) | ((addr + 1) & 0xFF)] << 8);
+				break;
+			case 0x20:
+				AM_ABS;
+				m_pc--;
+				push(m_pc >> 8);
+				push(m_pc & 0xFF);
+				m_pc = addr;
+				break;
+			case 0x60:
+				m_pc = pop();
+				m_pc |= pop() << 8;
+				m_pc++;
+				if (m_sp == m_callSP)
+				{
+					m_returned = true;
+					return;
+				}
+				break;
+			case 0x40:
+				m_p = (pop() & ~FLAG_B) | FLAG_U;
+				m_pc = pop();
+				m_pc |= pop() << 8;
+				break;
+			case 0x00:
+				m_pc++;
+				push(m_pc >> 8);
+				push(m_pc & 0xFF);
+				push(m_p | FLAG_B | FLAG_U);
+				m_p |= FLAG_I;
+				m_pc = m_mem[0xFFFE] | (m_mem[0xFFFF] << 8);
+				break;
+
+			case 0xEA:
+			// Unofficial NOPs
+			case 0x1A: case 0x3A: case 0x5A: case 0x7A: case 0xDA: case 0xFA:
+				break;
+			case 0x80: case 0x82: case 0x89: case 0xC2: case 0xE2:
+			case 0x04: case 0x44: case 0x64:
+			case 0x14: case 0x34: case 0x54: case 0x74: case 0xD4: case 0xF4:
+				m_pc++;
+				break;
+			READ(0x0C, AM_ABS, OP_NOP)
+			READ(0x1C, AM_ABX_R, OP_NOP)
+			READ(0x3C, AM_ABX_R, OP_NOP)
+			READ(0x5C, AM_ABX_R, OP_NOP)
+			READ(0x7C, AM_ABX_R, OP_NOP)
+			READ(0xDC, AM_ABX_R, OP_NOP)
+			READ(0xFC, AM_ABX_R, OP_NOP)
+
+			default:
+				// Other unofficial opcodes are not used by drivers
+				m_pc--;
+				m_jammed = true;
+				return;
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef _CPU6502_HPP_
+#define _CPU6502_HPP_
+
+#include "core/types.hpp"
+#include "common.hpp"
+
+/*
+ * Cycle counted 6502 interpreter, as found in the 2A03. Decimal mode and
+ * interrupts are not emulated, which is all an NSF driver needs.
+ *
+ * Memory is a flat 64k array. Each 256 byte page is flagged as writable or
+ * as I/O; reads and writes of I/O pages go to the handlers instead. Zero
+ * page and stack accesses never leave the array.
+ */
+class FAMICOREAPI CPU6502
+{
+public:
+	typedef core::u8 (*read_f)(core::u16 addr, void *data);
+	// cycle counts from the last setCycles()
+	typedef void (*write_f)(core::u16 addr, core::u8 value, core::u32 cycle, void *data);
+
+	enum
+	{
+		PAGE_WRITE = 1,		// writes go to memory
+		PAGE_READ_IO = 2,	// reads go to the read handler
+		PAGE_WRITE_IO = 4	// writes go to the write handler
+	};
+
+	CPU6502();
+
+	void setHandlers(read_f r, write_f w, void *data);
+	void setPages(unsigned int first, unsigned int count, core::u8 flags);
+
+	core::u8 * memory(){ return m_mem; }
+	const core::u8 * memory() const{ return m_mem; }
+
+	core::u32 cycles() const{ return m_cycles; }
+	void setCycles(core::u32 cycles){ m_cycles = cycles; }
+
+	// Runs the subroutine at addr until it returns. Returns false if it
+	// didn't return within maxCycles, or if the CPU jammed
+	bool call(core::u16 addr, core::u8 a, core::u8 x, core::u8 y, core::u32 maxCycles);
+
+	bool jammed() const{ return m_jammed; }
+private:
+	inline core::u8 read(core::u16 addr);
+	inline void write(core::u16 addr, core::u8 value);
+	inline void push(core::u8 value);
+	inline core::u8 pop();
+
+	void run(core::u32 endCycle);
+
+	core::u8 m_mem[0x10000];
+	core::u8 m_pages[0x100];
+
+	read_f m_read;
+	write_f m_write;
+	void *m_data;
+
+	core::u32 m_cycles;
+	core::u16 m_pc;
+	core::u8 m_a, m_x, m_y, m_sp, m_p;
+	bool m_jammed;
+
+	core::u8 m_callSP;		// stack pointer that ends call()
+	bool m_returned;
+
+	static const core::u8 CYCLES[0x100];
+};
+
+#endif
@@ -69,6 +69,39 @@ void CChannelHandler::InitChannel(CAPU *pAPU, int *pVibTable, FtmDocument *pDoc)
 	m_iVibratoStyle = VIBRATO_NEW;
 }
 
+void CChannelHandler::SetDocument(FtmDocument *pDoc)
+{
+	// Called from the player thread, must not touch the old document
+	m_pDocument = pDoc;
+}
+
+void CChannelHandler::RestoreState(const CChannelHandler *pState, bool bChipWritten)
+{
+	// Keep what ties the channel to this sound generator
+	SoundGen *pSoundGen = m_pSoundGen;
+	CAPU *pAPU = m_pAPU;
+	FtmDocument *pDoc = m_pDocument;
+	unsigned int *pNoteLookupTable = m_pNoteLookupTable;
+	int *pVibratoTable = m_pVibratoTable;
+
+	CopyState(pState);
+
+	m_pSoundGen = pSoundGen;
+	m_pAPU = pAPU;
+	m_pDocument = pDoc;
+	m_pNoteLookupTable = pNoteLookupTable;
+	m_pVibratoTable = pVibratoTable;
+
+	RestoreDocument();
+
+	if (bChipWritten)
+		return;
+
+	// The chip didn't see the writes the state was played with
+	m_iLastPeriod = 0xFFFF;
+	RestoreChip();
+}
+
 int CChannelHandler::LimitPeriod(int Period) const
 {
 	if (Period > m_iMaxPeriod)
@@ -72,10 +72,21 @@ public:
 
 	virtual void SetChannelID(int ID) { m_iChannelID = ID; }
 
+	virtual void SetDocument(FtmDocument *pDoc);				// Switch to another snapshot while playing
+
+	// Frame checkpoints
+	virtual CChannelHandler *Clone() const = 0;					// Copy of the channel's state
+	// Take the state of a copy, made by any sound generator. bChipWritten if
+	// the writes the copy was played with were made to this channel's chip
+	void RestoreState(const CChannelHandler *pState, bool bChipWritten = false);
+
 	// 
 	// Internal virtual functions
 	//
 protected:
+	virtual void CopyState(const CChannelHandler *pState) = 0;		// Copy a Clone() of the same class
+	virtual void RestoreDocument() {}										// Point into this channel's document again, after RestoreState()
+	virtual void RestoreChip() {}											// Rewrite registers earlier frames set, after RestoreState()
 	virtual void PlayChannelNote(stChanNote *NoteData, int EffColumns) = 0; // Plays a note
 	virtual void ClearRegisters() = 0;										// Clear channel registers
 	virtual	unsigned int TriggerNote(int Note);
@@ -436,6 +436,14 @@ CDPCMChan::CDPCMChan(SoundGen *gen, CSampleMem *pSampleMem)
 {
 }
 
+void CDPCMChan::CopyState(const CChannelHandler *pState)
+{
+	// The sample memory belongs to the sound generator
+	CSampleMem *pSampleMem = m_pSampleMem;
+	*this = *static_cast<const CDPCMChan*>(pState);
+	m_pSampleMem = pSampleMem;
+}
+
 void CDPCMChan::PlayChannelNote(stChanNote *pNoteData, int EffColumns)
 {
 	unsigned int Note, Octave, SampleIndex, LastInstrument;
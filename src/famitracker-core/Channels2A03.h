@@ -49,7 +49,9 @@ class CSquare1Chan : public CChannelHandler2A03 {
 public:
 	CSquare1Chan(SoundGen *gen) : CChannelHandler2A03(gen) { m_iDefaultDuty = 0; m_bEnabled = false; }
 	virtual void RefreshChannel();
+	CChannelHandler *Clone() const { return new CSquare1Chan(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CSquare1Chan*>(pState); }
 	virtual void ClearRegisters();
 };
 
@@ -58,7 +60,9 @@ class CSquare2Chan : public CChannelHandler2A03 {
 public:
 	CSquare2Chan(SoundGen *gen) : CChannelHandler2A03(gen) { m_iDefaultDuty = 0; m_bEnabled = false; }
 	virtual void RefreshChannel();
+	CChannelHandler *Clone() const { return new CSquare2Chan(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CSquare2Chan*>(pState); }
 	virtual void ClearRegisters();
 };
 
@@ -67,7 +71,9 @@ class CTriangleChan : public CChannelHandler2A03 {
 public:
 	CTriangleChan(SoundGen *gen) : CChannelHandler2A03(gen) { m_bEnabled = false; }
 	virtual void RefreshChannel();
+	CChannelHandler *Clone() const { return new CTriangleChan(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CTriangleChan*>(pState); }
 	virtual void ClearRegisters();
 };
 
@@ -76,7 +82,9 @@ class CNoiseChan : public CChannelHandler2A03 {
 public:
 	CNoiseChan(SoundGen *gen) : CChannelHandler2A03(gen) { m_iDefaultDuty = 0; m_bEnabled = false; }
 	virtual void RefreshChannel();
+	CChannelHandler *Clone() const { return new CNoiseChan(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CNoiseChan*>(pState); }
 	virtual void ClearRegisters();
 	unsigned int TriggerNote(int Note);
 };
@@ -86,7 +94,9 @@ class CDPCMChan : public CChannelHandler2A03 {
 public:
 	CDPCMChan(SoundGen *gen, CSampleMem *pSampleMem);
 	virtual void RefreshChannel();
+	CChannelHandler *Clone() const { return new CDPCMChan(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState);
 	virtual void PlayChannelNote(stChanNote *NoteData, int EffColumns);
 	virtual void ClearRegisters();
 private:
@@ -34,6 +34,10 @@ CChannelHandlerFDS::CChannelHandlerFDS(SoundGen *gen) : CChannelHandler(gen)
 	m_iSeqEnabled[SEQ_ARPEGGIO] = 0;
 	m_iSeqEnabled[SEQ_PITCH] = 0;
 
+	m_pVolumeSeq = NULL;
+	m_pArpeggioSeq = NULL;
+	m_pPitchSeq = NULL;
+
 	memset(m_iModTable, 0, 32);
 
 	m_bResetMod = false;
@@ -129,9 +133,12 @@ void CChannelHandlerFDS::PlayChannelNote(stChanNote *pNoteData, int EffColumns)
 	{
 		ReleaseNote();
 
-		CChannelHandler::ReleaseSequence(SEQ_VOLUME, m_pVolumeSeq);
-		CChannelHandler::ReleaseSequence(SEQ_ARPEGGIO, m_pArpeggioSeq);
-		CChannelHandler::ReleaseSequence(SEQ_PITCH, m_pPitchSeq);
+		if (m_pVolumeSeq != NULL)
+		{
+			CChannelHandler::ReleaseSequence(SEQ_VOLUME, m_pVolumeSeq);
+			CChannelHandler::ReleaseSequence(SEQ_ARPEGGIO, m_pArpeggioSeq);
+			CChannelHandler::ReleaseSequence(SEQ_PITCH, m_pPitchSeq);
+		}
 	}
 	else if (Note != NONE)
 	{
@@ -206,6 +213,13 @@ void CChannelHandlerFDS::ProcessChannel()
 		CChannelHandler::RunSequence(SEQ_PITCH, m_pPitchSeq);
 }
 
+void CChannelHandlerFDS::SetDocument(FtmDocument *pDoc)
+{
+	CChannelHandler::SetDocument(pDoc);
+	// The sequences live in the instrument, pick them up from the new snapshot
+	RestoreDocument();
+}
+
 void CChannelHandlerFDS::RefreshChannel()
 {
 	CheckWaveUpdate();
@@ -280,6 +294,44 @@ void CChannelHandlerFDS::ClearRegisters()
 //	m_iInstrument = 0;
 }
 
+void CChannelHandlerFDS::RestoreDocument()
+{
+	// The sequences point into the document the state was played from
+	CInstrumentFDS *pInstrument = NULL;
+	if (m_iLastInstrument != MAX_INSTRUMENTS)
+		pInstrument = dynamic_cast<CInstrumentFDS*>(m_pDocument->GetInstrument(m_iLastInstrument));
+
+	if (pInstrument == NULL)
+	{
+		m_pVolumeSeq = NULL;
+		m_pArpeggioSeq = NULL;
+		m_pPitchSeq = NULL;
+
+		m_iSeqEnabled[SEQ_VOLUME] = 0;
+		m_iSeqEnabled[SEQ_ARPEGGIO] = 0;
+		m_iSeqEnabled[SEQ_PITCH] = 0;
+		return;
+	}
+
+	m_pVolumeSeq = pInstrument->GetVolumeSeq();
+	m_pArpeggioSeq = pInstrument->GetArpSeq();
+	m_pPitchSeq = pInstrument->GetPitchSeq();
+}
+
+void CChannelHandlerFDS::RestoreChip()
+{
+	// The wave and modulation tables are only written on new instruments
+	CInstrumentFDS *pInstrument = NULL;
+	if (m_iLastInstrument != MAX_INSTRUMENTS)
+		pInstrument = dynamic_cast<CInstrumentFDS*>(m_pDocument->GetInstrument(m_iLastInstrument));
+
+	if (pInstrument == NULL)
+		return;
+
+	FillWaveRAM(pInstrument);
+	FillModulationTable(pInstrument);
+}
+
 void CChannelHandlerFDS::FillWaveRAM(CInstrumentFDS *pInst)
 {
 	// Fills the 64 byte waveform table
@@ -27,7 +27,12 @@ public:
 	CChannelHandlerFDS(SoundGen *gen);
 	virtual void ProcessChannel();
 	virtual void RefreshChannel();
+	CChannelHandler *Clone() const { return new CChannelHandlerFDS(*this); }
+	virtual void SetDocument(FtmDocument *pDoc);
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CChannelHandlerFDS*>(pState); }
+	virtual void RestoreDocument();
+	virtual void RestoreChip();
 	virtual void PlayChannelNote(stChanNote *NoteData, int EffColumns);
 	virtual void ClearRegisters();
 protected:
@@ -43,7 +43,9 @@ class CMMC5Square1Chan : public CChannelHandlerMMC5 {
 public:
 	CMMC5Square1Chan(SoundGen *gen) : CChannelHandlerMMC5(gen) {}
 	void RefreshChannel();
+	CChannelHandler *Clone() const { return new CMMC5Square1Chan(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CMMC5Square1Chan*>(pState); }
 	void ClearRegisters();
 };
 
@@ -52,6 +54,8 @@ class CMMC5Square2Chan : public CChannelHandlerMMC5 {
 public:
 	CMMC5Square2Chan(SoundGen *gen) : CChannelHandlerMMC5(gen) {}
 	void RefreshChannel();
+	CChannelHandler *Clone() const { return new CMMC5Square2Chan(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CMMC5Square2Chan*>(pState); }
 	void ClearRegisters();
 };
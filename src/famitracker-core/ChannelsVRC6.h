@@ -39,7 +39,9 @@ class CVRC6Square1 : public CChannelHandlerVRC6 {
 public:
 	CVRC6Square1(SoundGen *gen) : CChannelHandlerVRC6(gen) { m_iDefaultDuty = 0; m_bEnabled = false; }
 	void RefreshChannel();
+	CChannelHandler *Clone() const { return new CVRC6Square1(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CVRC6Square1*>(pState); }
 	void ClearRegisters();
 private:
 };
@@ -48,7 +50,9 @@ class CVRC6Square2 : public CChannelHandlerVRC6 {
 public:
 	CVRC6Square2(SoundGen *gen) : CChannelHandlerVRC6(gen) { m_iDefaultDuty = 0;  m_bEnabled = false; }
 	void RefreshChannel();
+	CChannelHandler *Clone() const { return new CVRC6Square2(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CVRC6Square2*>(pState); }
 	void ClearRegisters();
 private:
 };
@@ -57,7 +61,9 @@ class CVRC6Sawtooth : public CChannelHandlerVRC6 {
 public:
 	CVRC6Sawtooth(SoundGen *gen) : CChannelHandlerVRC6(gen) { m_iDefaultDuty = 0;  m_bEnabled = false; };
 	void RefreshChannel();
+	CChannelHandler *Clone() const { return new CVRC6Sawtooth(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CVRC6Sawtooth*>(pState); }
 	void ClearRegisters();
 private:
 };
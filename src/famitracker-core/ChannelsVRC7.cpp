@@ -376,6 +376,16 @@ void CVRC7Channel::RefreshChannel()
 	RegWrite(0x20 + m_iChannel, ((Fnum >> 8) & 1) | (Bnum << 1) | Cmd);
 }
 
+void CVRC7Channel::RestoreChip()
+{
+	// The custom instrument is only written when a note is triggered
+	if (m_iPatch == 0)
+	{
+		for (int i = 0; i < 8; ++i)
+			RegWrite(i, m_iRegs[i]);
+	}
+}
+
 void CVRC7Channel::ClearRegisters()
 {
 	for (int i = 0x10; i < 0x30; i += 0x10)
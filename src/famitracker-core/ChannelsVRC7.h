@@ -55,7 +55,10 @@ class CVRC7Channel : public CChannelHandlerVRC7 {
 public:
 	CVRC7Channel(SoundGen *gen) : CChannelHandlerVRC7(gen) {}
 	void RefreshChannel();
+	CChannelHandler *Clone() const { return new CVRC7Channel(*this); }
 protected:
+	void CopyState(const CChannelHandler *pState) { *this = *static_cast<const CVRC7Channel*>(pState); }
+	void RestoreChip();
 	void ClearRegisters();
 private:
 	void RegWrite(unsigned char Reg, unsigned char Value);
@@ -65,23 +65,45 @@ public:
 class CSampleMem 
 {
 	public:
+		// Called when the memory is set
+		typedef void (*callback_t)(const uint8 *Mem, int Size, void *data);
+
+		CSampleMem() : m_iMemSize(0), m_pCallback(NULL), m_pCallbackData(NULL) {}
+
+		void SetCallback(callback_t callback, void *data) {
+			m_pCallback = callback;
+			m_pCallbackData = data;
+		}
+
 		uint8 Read(uint16 Address) {
-			if (!m_pMemory)
-				return 0;
 			uint16 Addr = (Address - 0xC000);// % m_iMemSize;
 			if (Addr >= m_iMemSize)
 				return 0;
-			return m_pMemory[Addr];
+			return m_iMemory[Addr];
 		}
 
-		void SetMem(char *Ptr, int Size) {
-			m_pMemory = (uint8*)Ptr;
+		// The sample is copied, the document it belongs to may be replaced
+		// while it plays
+		void SetMem(const char *Ptr, int Size) {
+			if (Ptr == NULL || Size < 0)
+				Size = 0;
+			if (Size > MEM_SIZE)
+				Size = MEM_SIZE;
+			if (Size > 0)
+				memcpy(m_iMemory, Ptr, Size);
 			m_iMemSize = Size;
+			if (m_pCallback != NULL)
+				(*m_pCallback)(m_iMemory, Size, m_pCallbackData);
 		}
 
 	private:
-		uint8  *m_pMemory;
+		static const int MEM_SIZE = 0x4000;		// $C000-$FFFF, where NSFs keep their samples
+
+		uint8	m_iMemory[MEM_SIZE];
 		uint16	m_iMemSize;
+
+		callback_t m_pCallback;
+		void	*m_pCallbackData;
 };
 
 // Safe string copy, always null terminates.
@@ -0,0 +1,1001 @@
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include "Compiler.h"
+#include "FtmDocument.hpp"
+#include "PatternData.h"
+#include "Instrument.h"
+#include "Sequence.h"
+#include "APU/Mixer.h"
+#include "core/io.hpp"
+#include "exceptions.hpp"
+
+#include "drivers/drv_2a03.h"
+#include "drivers/drv_vrc6.h"
+#include "drivers/drv_vrc7.h"
+#include "drivers/drv_mmc5.h"
+#include "drivers/drv_fds.h"
+
+struct stDriver
+{
+	unsigned char			Chip;
+	const unsigned char		*Data;
+	int						Size;
+	const int				*RelocWord;		// Offsets of words
+	int						RelocWordCount;
+	const int				*RelocLow;		// Pairs of offset and value
+	int						RelocLowCount;
+	const int				*RelocHigh;
+	int						RelocHighCount;
+};
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof(a[0])))
+#define DRIVER(chip, name) \
+	{ chip, DRIVER_##name, COUNT(DRIVER_##name), \
+	  DRIVER_RELOC_WORD_##name, COUNT(DRIVER_RELOC_WORD_##name), \
+	  DRIVER_RELOC_LOW_##name, COUNT(DRIVER_RELOC_LOW_##name), \
+	  DRIVER_RELOC_HIGH_##name, COUNT(DRIVER_RELOC_HIGH_##name) }
+
+static const stDriver DRIVERS[] = {
+	DRIVER(SNDCHIP_NONE, 2A03),
+	DRIVER(SNDCHIP_VRC6, VRC6),
+	DRIVER(SNDCHIP_VRC7, VRC7),
+	DRIVER(SNDCHIP_MMC5, MMC5),
+	DRIVER(SNDCHIP_FDS, FDS)
+};
+
+static const unsigned int PAGE_START = 0x8000;	// Driver and music data
+static const unsigned int DPCM_START = 0xC000;
+static const unsigned int DPCM_ALIGN = 0x40;
+static const unsigned int DPCM_SPACE = 0x10000 - DPCM_START;
+
+// The driver entry points are jumps at the start of the driver
+static const unsigned int INIT_OFFSET = 0;
+static const unsigned int PLAY_OFFSET = 3;
+
+static const int NSF_HEADER_SIZE = 0x80;
+static const unsigned int NSF_STRING_SIZE = 32;		// Name, artist and copyright fields
+
+// Zero pads a fixed width header field, cutting the string so it stays terminated
+static void write_header_string(unsigned char *field, const char *str)
+{
+	memset(field, 0, NSF_STRING_SIZE);
+	memcpy(field, str, std::min<size_t>(strlen(str), NSF_STRING_SIZE - 1));
+}
+
+// Row commands
+enum
+{
+	CMD_INSTRUMENT		= 0x80,
+	CMD_SPEED			= 0x82,
+	CMD_JUMP			= 0x84,
+	CMD_SKIP			= 0x86,
+	CMD_HALT			= 0x88,
+	CMD_VOLUME			= 0x8A,
+	CMD_PORTAMENTO		= 0x8C,
+	CMD_PORTA_UP		= 0x8E,
+	CMD_PORTA_DOWN		= 0x90,
+	CMD_SWEEP			= 0x92,
+	CMD_ARPEGGIO		= 0x94,
+	CMD_VIBRATO			= 0x96,
+	CMD_TREMOLO			= 0x98,
+	CMD_PITCH			= 0x9A,
+	CMD_DELAY			= 0x9C,
+	CMD_DAC				= 0x9E,
+	CMD_DUTY			= 0xA0,
+	CMD_SAMPLE_OFFSET	= 0xA2,
+	CMD_SLIDE_UP		= 0xA4,
+	CMD_SLIDE_DOWN		= 0xA6,
+	CMD_VOLUME_SLIDE	= 0xA8,
+	CMD_NOTE_CUT		= 0xAA,
+	CMD_RETRIGGER		= 0xAC,
+	CMD_DPCM_PITCH		= 0xAE,
+	// Expansion chip commands
+	CMD_VRC7_PATCH		= 0xB4,
+	CMD_FDS_MOD_DEPTH	= 0xB4,
+	CMD_FDS_MOD_SPEED_HI= 0xB6,
+	CMD_FDS_MOD_SPEED_LO= 0xB8,
+
+	CMD_QUICK_INST		= 0xE0,
+	CMD_QUICK_VOLUME	= 0xF0
+};
+
+// Note bytes
+static const unsigned char NOTE_NONE = 0x00;
+static const unsigned char NOTE_RELEASE = 0x7E;
+static const unsigned char NOTE_HALT = 0x7F;
+
+// The FDS frequency table of the driver starts two octaves below the
+// tracker's, FDS notes are moved up to play at the same pitch
+static const int FDS_NOTE_OFFSET = 24;
+static const int FDS_NOTE_LAST = 12*8 - 1;
+
+// DPCM notes are 2 * entry + 3 and must stay below the release note
+static const unsigned int MAX_SAMPLE_LIST = (NOTE_RELEASE - 3) / 2 + 1;
+
+static int GetInstrumentType(int ChanID)
+{
+	switch (ChanID)
+	{
+	case CHANID_VRC6_PULSE1:
+	case CHANID_VRC6_PULSE2:
+	case CHANID_VRC6_SAWTOOTH:
+		return INST_VRC6;
+	case CHANID_VRC7_CH1:
+	case CHANID_VRC7_CH2:
+	case CHANID_VRC7_CH3:
+	case CHANID_VRC7_CH4:
+	case CHANID_VRC7_CH5:
+	case CHANID_VRC7_CH6:
+		return INST_VRC7;
+	case CHANID_FDS:
+		return INST_FDS;
+	default:
+		return INST_2A03;
+	}
+}
+
+static bool IsVRC7Channel(int ChanID)
+{
+	return ChanID >= CHANID_VRC7_CH1 && ChanID <= CHANID_VRC7_CH6;
+}
+
+static inline unsigned char SwapNibbles(unsigned char Value)
+{
+	return ((Value & 0x0F) << 4) | (Value >> 4);
+}
+
+static inline void StoreShortTo(std::vector<unsigned char> &Data, unsigned int Value)
+{
+	Data.push_back(Value & 0xFF);
+	Data.push_back((Value >> 8) & 0xFF);
+}
+
+CCompiler::CCompiler(FtmDocument *pDocument)
+	: m_pDocument(pDocument)
+{
+	Clear();
+}
+
+CCompiler::~CCompiler()
+{
+}
+
+void CCompiler::Clear()
+{
+	m_iChip = SNDCHIP_NONE;
+	m_vChannels.clear();
+	m_vChanIDs.clear();
+	m_vData.clear();
+
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+		m_vFramePatterns[i].clear();
+
+	m_vInstruments.clear();
+	for (int i = 0; i < MAX_INSTRUMENTS; i++)
+		m_iInstrumentIndex[i] = -1;
+
+	m_mSequenceAddress.clear();
+	m_mSequences.clear();
+	m_iSequenceDuplicates = 0;
+	m_vWavetables.clear();
+
+	m_vSampleList.clear();
+	m_vSamples.clear();
+	m_vSampleAddress.clear();
+	m_iSampleSize = 0;
+
+	m_vFrameListAddress.clear();
+
+	m_iSongListAddress = 0;
+	m_iInstrumentListAddress = 0;
+	m_iSampleListAddress = 0;
+	m_iSamplesAddress = 0;
+	m_iWavetableAddress = 0;
+
+	m_vBlocks.clear();
+	m_pBlockName = NULL;
+	m_iBlockStart = 0;
+	m_iTotalSize = 0;
+	m_iTotalTime = 0;
+}
+
+void CCompiler::ExportNSF(core::IO *io)
+{
+	core::timestamp_t Start;
+	Start.gettime();
+
+	Clear();
+
+	const stDriver *pDriver = SelectDriver();
+	m_iChip = pDriver->Chip;
+
+	SetupChannels();
+
+	// Header is filled in when everything else is placed
+	m_vData.resize(m_iChip == SNDCHIP_FDS ? 15 : 13, 0);
+
+	CompilePatterns();
+	CompileSequences();
+	CompileInstruments();
+	CompileWavetables();
+	CompileSamples();
+	CompileFrames();
+	CompileSongs();
+	CompileHeader();
+
+	WriteNSF(io, pDriver);
+
+	core::timestamp_t End;
+	End.gettime();
+	m_iTotalTime = End.diff_us(Start);
+}
+
+const stDriver *CCompiler::SelectDriver() const
+{
+	unsigned char Chip = m_pDocument->GetExpansionChip();
+
+	for (int i = 0; i < COUNT(DRIVERS); i++)
+	{
+		if (DRIVERS[i].Chip == Chip)
+			return &DRIVERS[i];
+	}
+
+	throw CompilerException("The expansion chip setting of this module is not supported by the NSF export");
+}
+
+void CCompiler::SetupChannels()
+{
+	const std::vector<int> &Chans = m_pDocument->getChannelsFromChip();
+	int DPCM = -1;
+
+	// The drivers play the DPCM channel last
+	for (unsigned int i = 0; i < Chans.size(); i++)
+	{
+		if (Chans[i] == CHANID_DPCM)
+		{
+			DPCM = i;
+			continue;
+		}
+		// Not supported by the driver
+		if (Chans[i] == CHANID_MMC5_VOICE)
+			continue;
+
+		m_vChannels.push_back(i);
+		m_vChanIDs.push_back(Chans[i]);
+	}
+
+	m_vChannels.push_back(DPCM);
+	m_vChanIDs.push_back(CHANID_DPCM);
+}
+
+void CCompiler::CompilePatterns()
+{
+	std::map<bytes_t, unsigned int> Stored;
+	unsigned int Duplicates = 0;
+	bytes_t Data;
+
+	BeginBlock("Patterns");
+
+	for (unsigned int Track = 0; Track < m_pDocument->GetTrackCount(); Track++)
+	{
+		unsigned int Frames = m_pDocument->GetFrameCount(Track);
+		std::vector<unsigned int> &Patterns = m_vFramePatterns[Track];
+		Patterns.resize(Frames * m_vChannels.size());
+
+		// Channels remember their instrument across patterns
+		std::vector<int> Instruments(m_vChannels.size(), 0);
+
+		for (unsigned int Frame = 0; Frame < Frames; Frame++)
+		{
+			for (unsigned int Channel = 0; Channel < m_vChannels.size(); Channel++)
+			{
+				unsigned int Pattern = m_pDocument->GetPatternAtFrame(Track, Frame, m_vChannels[Channel]);
+				CompilePattern(Track, Channel, Pattern, Instruments[Channel], Data);
+				Patterns[Frame * m_vChannels.size() + Channel] = StoreUnique(Data, Stored, Duplicates);
+			}
+		}
+	}
+
+	EndBlock(Stored.size(), Duplicates);
+}
+
+void CCompiler::CompilePattern(unsigned int Track, unsigned int Channel, unsigned int Pattern, int &Instrument, bytes_t &Data)
+{
+	int ChanID = m_vChanIDs[Channel];
+	unsigned int DocChannel = m_vChannels[Channel];
+	unsigned int Rows = m_pDocument->GetPatternLength(Track);
+	unsigned int EffColumns = m_pDocument->GetEffColumns(Track, DocChannel) + 1;
+	int LastInstrument = -1;
+	int Duration = -1;		// Position of the last duration byte
+
+	Data.clear();
+
+	for (unsigned int Row = 0; Row < Rows; Row++)
+	{
+		stChanNote Note;
+		m_pDocument->GetDataAtPattern(Track, Pattern, DocChannel, Row, &Note);
+
+		unsigned int RowStart = Data.size();
+		bool IsNote = (Note.Note != NONE && Note.Note != RELEASE && Note.Note != HALT);
+
+		if (IsNote && Note.Instrument < MAX_INSTRUMENTS)
+			Instrument = Note.Instrument;
+
+		// The tracker skips the whole row when the instrument doesn't fit the channel
+		if (ChanID != CHANID_DPCM && IsNote && GetInstrumentIndex(Instrument, ChanID) < 0)
+		{
+			if (Duration >= 0)
+				Data[Duration]++;
+			else
+			{
+				Data.push_back(NOTE_NONE);
+				Duration = Data.size();
+				Data.push_back(0);
+			}
+			continue;
+		}
+
+		// The driver waits for the delay before it reads the rest of the row
+		for (unsigned int i = 0; i < EffColumns; i++)
+		{
+			if (Note.EffNumber[i] == EF_DELAY && Note.EffParam[i] > 0)
+			{
+				Data.push_back(CMD_DELAY);
+				Data.push_back(Note.EffParam[i]);
+				break;
+			}
+		}
+
+		// The pattern can be entered from anywhere, so its first note always sets the instrument
+		if (ChanID != CHANID_DPCM && IsNote && Instrument != LastInstrument)
+		{
+			int Index = GetInstrumentIndex(Instrument, ChanID);
+			if (Index < 0x10)
+				Data.push_back(CMD_QUICK_INST | Index);
+			else
+			{
+				Data.push_back(CMD_INSTRUMENT);
+				Data.push_back(Index << 1);
+			}
+			LastInstrument = Instrument;
+		}
+
+		if (ChanID != CHANID_DPCM && Note.Vol < VOLUME_EMPTY)
+			Data.push_back(CMD_QUICK_VOLUME | Note.Vol);
+
+		for (unsigned int i = 0; i < EffColumns; i++)
+		{
+			if (Note.EffNumber[i] != EF_NONE && Note.EffNumber[i] != EF_DELAY)
+				CompileEffect(ChanID, Note.EffNumber[i], Note.EffParam[i], Data);
+		}
+
+		unsigned char NoteByte = CompileNote(ChanID, Note, Instrument);
+
+		// Empty rows only extend the duration of the previous one
+		if (Data.size() == RowStart && NoteByte == NOTE_NONE && Duration >= 0)
+		{
+			Data[Duration]++;
+			continue;
+		}
+
+		Data.push_back(NoteByte);
+		Duration = Data.size();
+		Data.push_back(0);
+	}
+}
+
+void CCompiler::CompileEffect(int ChanID, unsigned char Effect, unsigned char Param, bytes_t &Data) const
+{
+	bool Square = (ChanID == CHANID_SQUARE1 || ChanID == CHANID_SQUARE2);
+	bool DPCM = (ChanID == CHANID_DPCM);
+	// FDS and VRC7 take a frequency where the others take a period, the
+	// driver slides them the other way
+	bool Frequency = (ChanID == CHANID_FDS || IsVRC7Channel(ChanID));
+	unsigned char Cmd = 0;
+
+	switch (Effect)
+	{
+		case EF_SPEED:
+			Cmd = CMD_SPEED;
+			Param = (Param == 0) ? 1 : Param;
+			break;
+		case EF_JUMP:
+			Cmd = CMD_JUMP;
+			Param++;
+			break;
+		case EF_SKIP:
+			Cmd = CMD_SKIP;
+			Param++;
+			break;
+		case EF_HALT:
+			Cmd = CMD_HALT;
+			break;
+		case EF_NOTE_CUT:
+			Cmd = CMD_NOTE_CUT;
+			break;
+		case EF_VOLUME:
+			if (Square || ChanID == CHANID_NOISE)
+				Cmd = CMD_VOLUME;
+			break;
+		case EF_SWEEPUP:
+			if (Square)
+			{
+				Cmd = CMD_SWEEP;
+				Param = 0x88 | (Param & 0x77);
+			}
+			break;
+		case EF_SWEEPDOWN:
+			if (Square)
+			{
+				Cmd = CMD_SWEEP;
+				Param = 0x80 | (Param & 0x77);
+			}
+			break;
+		case EF_DUTY_CYCLE:
+			if (IsVRC7Channel(ChanID))
+			{
+				Cmd = CMD_VRC7_PATCH;
+				Param <<= 4;
+			}
+			else if (!DPCM)
+				Cmd = CMD_DUTY;
+			break;
+		case EF_FDS_MOD_DEPTH:
+			if (ChanID == CHANID_FDS)
+			{
+				Cmd = CMD_FDS_MOD_DEPTH;
+				Param &= 0x3F;
+			}
+			break;
+		case EF_FDS_MOD_SPEED_HI:
+			if (ChanID == CHANID_FDS)
+			{
+				Cmd = CMD_FDS_MOD_SPEED_HI;
+				Param &= 0x0F;
+			}
+			break;
+		case EF_FDS_MOD_SPEED_LO:
+			if (ChanID == CHANID_FDS)
+				Cmd = CMD_FDS_MOD_SPEED_LO;
+			break;
+	}
+
+	if (!DPCM)
+	{
+		switch (Effect)
+		{
+			case EF_PORTAMENTO:		Cmd = CMD_PORTAMENTO;	break;
+			case EF_PORTA_UP:		Cmd = Frequency ? CMD_PORTA_DOWN : CMD_PORTA_UP;	break;
+			case EF_PORTA_DOWN:		Cmd = Frequency ? CMD_PORTA_UP : CMD_PORTA_DOWN;	break;
+			case EF_ARPEGGIO:		Cmd = CMD_ARPEGGIO;		break;
+			case EF_PITCH:			Cmd = CMD_PITCH;		break;
+			case EF_SLIDE_UP:		Cmd = CMD_SLIDE_UP;		break;
+			case EF_SLIDE_DOWN:		Cmd = CMD_SLIDE_DOWN;	break;
+			case EF_VOLUME_SLIDE:	Cmd = CMD_VOLUME_SLIDE;	break;
+			case EF_VIBRATO:
+				Cmd = CMD_VIBRATO;
+				Param = SwapNibbles(Param);
+				break;
+			case EF_TREMOLO:
+				Cmd = CMD_TREMOLO;
+				Param = SwapNibbles(Param);
+				break;
+		}
+	}
+	else
+	{
+		switch (Effect)
+		{
+			case EF_DAC:
+				Cmd = CMD_DAC;
+				Param &= 0x7F;
+				break;
+			case EF_SAMPLE_OFFSET:	Cmd = CMD_SAMPLE_OFFSET;	break;
+			case EF_DPCM_PITCH:		Cmd = CMD_DPCM_PITCH;		break;
+			case EF_RETRIGGER:
+				Cmd = CMD_RETRIGGER;
+				Param++;
+				break;
+		}
+	}
+
+	// Effects the driver has no use for on this channel are dropped
+	if (Cmd == 0)
+		return;
+
+	Data.push_back(Cmd);
+	Data.push_back(Param);
+}
+
+unsigned char CCompiler::CompileNote(int ChanID, const stChanNote &Note, int Instrument)
+{
+	switch (Note.Note)
+	{
+		case NONE:
+			return NOTE_NONE;
+		case RELEASE:
+			return NOTE_RELEASE;
+		case HALT:
+			return NOTE_HALT;
+	}
+
+	if (ChanID == CHANID_DPCM)
+	{
+		// DPCM notes select an entry in the sample list
+		CInstrument *pInst = m_pDocument->GetInstrument(Instrument);
+		if (pInst == NULL || pInst->GetType() != INST_2A03)
+			return NOTE_NONE;
+
+		CInstrument2A03 *pInst2A03 = static_cast<CInstrument2A03*>(pInst);
+		int Sample = pInst2A03->GetSample(Note.Octave, Note.Note - 1);
+		if (Sample <= 0 || m_pDocument->GetDSample(Sample - 1)->SampleSize == 0)
+			return NOTE_NONE;
+
+		int Index = GetSampleIndex(pInst2A03->GetSamplePitch(Note.Octave, Note.Note - 1), Sample - 1);
+		return Index * 2 + 3;
+	}
+
+	int Midi = MIDI_NOTE(Note.Octave, Note.Note);
+
+	// the top two octaves of the tracker are above the driver's table
+	if (ChanID == CHANID_FDS)
+		Midi = std::min(Midi + FDS_NOTE_OFFSET, FDS_NOTE_LAST);
+
+	if (ChanID == CHANID_NOISE)
+		return ((Midi & 0x0F) | 0x10) + 1;
+
+	return Midi + 1;
+}
+
+int CCompiler::GetInstrumentIndex(int Instrument, int ChanID)
+{
+	CInstrument *pInst = m_pDocument->GetInstrument(Instrument);
+
+	// The tracker ignores instruments of other chips as well
+	if (pInst == NULL || pInst->GetType() != GetInstrumentType(ChanID))
+		return -1;
+
+	if (m_iInstrumentIndex[Instrument] == -1)
+	{
+		m_iInstrumentIndex[Instrument] = m_vInstruments.size();
+		m_vInstruments.push_back(Instrument);
+	}
+
+	return m_iInstrumentIndex[Instrument];
+}
+
+int CCompiler::GetSampleIndex(unsigned char Pitch, int Sample)
+{
+	unsigned char PitchByte = (Pitch & 0x0F) | ((Pitch & 0x80) ? 0x40 : 0);
+	int Table = -1;
+
+	for (unsigned int i = 0; i < m_vSamples.size(); i++)
+	{
+		if (m_vSamples[i] == Sample)
+			Table = i;
+	}
+
+	if (Table == -1)
+	{
+		Table = m_vSamples.size();
+		m_vSamples.push_back(Sample);
+	}
+
+	std::pair<unsigned char, int> Entry(PitchByte, Table);
+
+	for (unsigned int i = 0; i < m_vSampleList.size(); i++)
+	{
+		if (m_vSampleList[i] == Entry)
+			return i;
+	}
+
+	if (m_vSampleList.size() >= MAX_SAMPLE_LIST)
+		throw CompilerException("Too many DPCM sample and pitch combinations");
+
+	m_vSampleList.push_back(Entry);
+	return m_vSampleList.size() - 1;
+}
+
+void CCompiler::CompileSequences()
+{
+	BeginBlock("Sequences");
+
+	for (unsigned int i = 0; i < m_vInstruments.size(); i++)
+	{
+		CInstrument *pInst = m_pDocument->GetInstrument(m_vInstruments[i]);
+
+		switch (pInst->GetType())
+		{
+			case INST_2A03:
+			{
+				CInstrument2A03 *pInst2A03 = static_cast<CInstrument2A03*>(pInst);
+				for (int j = 0; j < CInstrument2A03::SEQUENCE_COUNT; j++)
+				{
+					if (pInst2A03->GetSeqEnable(j))
+						AddSequence(m_pDocument->GetSequence_readonly(SNDCHIP_NONE, pInst2A03->GetSeqIndex(j), j));
+				}
+				break;
+			}
+			case INST_VRC6:
+			{
+				CInstrumentVRC6 *pInstVRC6 = static_cast<CInstrumentVRC6*>(pInst);
+				for (int j = 0; j < CInstrumentVRC6::SEQUENCE_COUNT; j++)
+				{
+					if (pInstVRC6->GetSeqEnable(j))
+						AddSequence(m_pDocument->GetSequence_readonly(SNDCHIP_VRC6, pInstVRC6->GetSeqIndex(j), j));
+				}
+				break;
+			}
+			case INST_FDS:
+			{
+				CInstrumentFDS *pInstFDS = static_cast<CInstrumentFDS*>(pInst);
+				AddSequence(pInstFDS->GetVolumeSeq());
+				AddSequence(pInstFDS->GetArpSeq());
+				AddSequence(pInstFDS->GetPitchSeq());
+				break;
+			}
+		}
+	}
+
+	EndBlock(m_mSequences.size(), m_iSequenceDuplicates);
+}
+
+void CCompiler::AddSequence(const CSequence *pSeq)
+{
+	if (pSeq == NULL || pSeq->GetItemCount() == 0 || m_mSequenceAddress.count(pSeq) != 0)
+		return;
+
+	unsigned int Count = pSeq->GetItemCount();
+	unsigned int Loop = pSeq->GetLoopPoint();
+	unsigned int Release = pSeq->GetReleasePoint();
+
+	bytes_t Data;
+	Data.push_back(Count);
+	Data.push_back(Loop < Count ? Loop : 0xFF);
+	Data.push_back(Release < Count ? Release + 1 : 0);
+	Data.push_back(pSeq->GetSetting());
+	for (unsigned int i = 0; i < Count; i++)
+		Data.push_back(pSeq->GetItem(i));
+
+	m_mSequenceAddress[pSeq] = StoreUnique(Data, m_mSequences, m_iSequenceDuplicates);
+}
+
+void CCompiler::CompileInstruments()
+{
+	BeginBlock("Instruments");
+
+	// List of instrument addresses, then the instruments
+	m_iInstrumentListAddress = m_vData.size();
+
+	unsigned int Address = m_iInstrumentListAddress + m_vInstruments.size() * 2;
+	for (unsigned int i = 0; i < m_vInstruments.size(); i++)
+	{
+		StoreShort(Address);
+		Address += m_pDocument->GetInstrument(m_vInstruments[i])->CompileSize(this);
+	}
+
+	for (unsigned int i = 0; i < m_vInstruments.size(); i++)
+		m_pDocument->GetInstrument(m_vInstruments[i])->Compile(this, m_vInstruments[i]);
+
+	ftkr_Assert(m_vData.size() == Address);
+
+	EndBlock(m_vInstruments.size(), 0);
+}
+
+void CCompiler::CompileWavetables()
+{
+	if (m_iChip != SNDCHIP_FDS)
+		return;
+
+	BeginBlock("Wavetables");
+
+	m_iWavetableAddress = m_vData.size();
+	for (unsigned int i = 0; i < m_vWavetables.size(); i++)
+		Store(m_vWavetables[i]);
+
+	EndBlock(m_vWavetables.size(), 0);
+}
+
+void CCompiler::CompileSamples()
+{
+	BeginBlock("DPCM");
+
+	// Sample list, pitch and sample table offset
+	m_iSampleListAddress = m_vData.size();
+	for (unsigned int i = 0; i < m_vSampleList.size(); i++)
+	{
+		StoreByte(m_vSampleList[i].first);
+		StoreByte(m_vSampleList[i].second * 3);
+	}
+
+	// Sample table, address, length and bank
+	m_iSamplesAddress = m_vData.size();
+	m_iSampleSize = 0;
+
+	for (unsigned int i = 0; i < m_vSamples.size(); i++)
+	{
+		const CDSample *pSample = m_pDocument->GetDSample(m_vSamples[i]);
+		unsigned int Size = pSample->SampleSize;
+
+		m_vSampleAddress.push_back(m_iSampleSize);
+		StoreByte(m_iSampleSize / DPCM_ALIGN);
+		StoreByte(Size >> 4);
+		StoreByte(0);
+
+		m_iSampleSize += Size;
+		if (m_iSampleSize % DPCM_ALIGN)
+			m_iSampleSize += DPCM_ALIGN - (m_iSampleSize % DPCM_ALIGN);
+	}
+
+	if (m_iSampleSize > DPCM_SPACE)
+		throw CompilerException("The DPCM samples do not fit in the NSF without bankswitching");
+
+	EndBlock(m_vSamples.size(), 0);
+
+	// Samples are placed at $C000, not in the music data
+	m_vBlocks.back().Size += m_iSampleSize;
+}
+
+void CCompiler::CompileFrames()
+{
+	std::map<bytes_t, unsigned int> Stored;
+	unsigned int Duplicates = 0;
+	unsigned int Channels = m_vChannels.size();
+	bytes_t Data;
+
+	BeginBlock("Frames");
+
+	for (unsigned int Track = 0; Track < m_pDocument->GetTrackCount(); Track++)
+	{
+		const std::vector<unsigned int> &Patterns = m_vFramePatterns[Track];
+		unsigned int Frames = m_pDocument->GetFrameCount(Track);
+		bytes_t List;
+
+		for (unsigned int Frame = 0; Frame < Frames; Frame++)
+		{
+			Data.clear();
+			for (unsigned int Channel = 0; Channel < Channels; Channel++)
+				StoreShortTo(Data, Patterns[Frame * Channels + Channel]);
+
+			StoreShortTo(List, StoreUnique(Data, Stored, Duplicates));
+		}
+
+		m_vFrameListAddress.push_back(Store(List));
+	}
+
+	EndBlock(Stored.size(), Duplicates);
+}
+
+void CCompiler::CompileSongs()
+{
+	unsigned int Tracks = m_pDocument->GetTrackCount();
+	std::vector<unsigned int> Songs;
+
+	BeginBlock("Songs");
+
+	for (unsigned int Track = 0; Track < Tracks; Track++)
+	{
+		Songs.push_back(m_vData.size());
+		StoreShort(m_vFrameListAddress[Track]);
+		StoreByte(m_pDocument->GetFrameCount(Track));
+		StoreByte(m_pDocument->GetPatternLength(Track) & 0xFF);
+		StoreByte(m_pDocument->GetSongSpeed(Track));
+		StoreByte(m_pDocument->GetSongTempo(Track));
+		StoreByte(0);		// Bank
+		StoreByte(0);
+	}
+
+	m_iSongListAddress = m_vData.size();
+	for (unsigned int Track = 0; Track < Tracks; Track++)
+		StoreShort(Songs[Track]);
+
+	EndBlock(Tracks, 0);
+}
+
+void CCompiler::CompileHeader()
+{
+	unsigned int Speed = m_pDocument->GetEngineSpeed();
+	unsigned char Flags = 0;
+	unsigned int Address = 0;
+
+	if (m_pDocument->GetVibratoStyle() == VIBRATO_OLD)
+		Flags |= 0x02;
+
+	PatchShort(Address, m_iSongListAddress);		Address += 2;
+	PatchShort(Address, m_iInstrumentListAddress);	Address += 2;
+	PatchShort(Address, m_iSampleListAddress);		Address += 2;
+	PatchShort(Address, m_iSamplesAddress);			Address += 2;
+	m_vData[Address++] = Flags;
+
+	if (m_iChip == SNDCHIP_FDS)
+	{
+		PatchShort(Address, m_iWavetableAddress);
+		Address += 2;
+	}
+
+	// Tempo dividers
+	PatchShort(Address, (Speed == 0 ? 60 : Speed) * 60);	Address += 2;
+	PatchShort(Address, (Speed == 0 ? 50 : Speed) * 60);
+}
+
+void CCompiler::WriteNSF(core::IO *io, const stDriver *pDriver)
+{
+	unsigned int Start = PAGE_START;
+	unsigned int Limit = m_vSamples.empty() ? 0x10000 : DPCM_START;
+
+	if (Start + pDriver->Size + m_vData.size() > Limit)
+		throw CompilerException("The module is too large for an NSF without bankswitching");
+
+	// Relocate the driver, it points to the music data after itself
+	bytes_t Driver(pDriver->Data, pDriver->Data + pDriver->Size);
+
+	for (int i = 0; i < pDriver->RelocWordCount; i++)
+	{
+		int Offset = pDriver->RelocWord[i];
+		unsigned int Value = Driver[Offset] | (Driver[Offset + 1] << 8);
+		Value += Start;
+		Driver[Offset] = Value & 0xFF;
+		Driver[Offset + 1] = (Value >> 8) & 0xFF;
+	}
+	for (int i = 0; i < pDriver->RelocLowCount; i += 2)
+		Driver[pDriver->RelocLow[i]] = (pDriver->RelocLow[i + 1] + Start) & 0xFF;
+	for (int i = 0; i < pDriver->RelocHighCount; i += 2)
+		Driver[pDriver->RelocHigh[i]] = ((pDriver->RelocHigh[i + 1] + Start) >> 8) & 0xFF;
+
+	// NSF header
+	unsigned char Header[NSF_HEADER_SIZE];
+	unsigned int Rate = m_pDocument->GetEngineSpeed();
+	unsigned int SpeedNTSC = Rate ? 1000000 / Rate : 16666;
+	unsigned int SpeedPAL = Rate ? 1000000 / Rate : 20000;
+
+	memset(Header, 0, sizeof(Header));
+	memcpy(Header, "NESM\x1A", 5);
+	Header[0x05] = 1;
+	Header[0x06] = m_pDocument->GetTrackCount();
+	Header[0x07] = 1;
+	Header[0x08] = Start & 0xFF;
+	Header[0x09] = Start >> 8;
+	Header[0x0A] = (Start + INIT_OFFSET) & 0xFF;
+	Header[0x0B] = (Start + INIT_OFFSET) >> 8;
+	Header[0x0C] = (Start + PLAY_OFFSET) & 0xFF;
+	Header[0x0D] = (Start + PLAY_OFFSET) >> 8;
+	write_header_string(Header + 0x0E, m_pDocument->GetSongName());
+	write_header_string(Header + 0x2E, m_pDocument->GetSongArtist());
+	write_header_string(Header + 0x4E, m_pDocument->GetSongCopyright());
+	Header[0x6E] = SpeedNTSC & 0xFF;
+	Header[0x6F] = SpeedNTSC >> 8;
+	Header[0x78] = SpeedPAL & 0xFF;
+	Header[0x79] = SpeedPAL >> 8;
+	Header[0x7A] = (m_pDocument->GetMachine() == PAL) ? 0x01 : 0x00;
+	Header[0x7B] = m_iChip;
+
+	io->write(Header, NSF_HEADER_SIZE);
+	io->write(&Driver[0], Driver.size());
+	io->write(&m_vData[0], m_vData.size());
+
+	m_iTotalSize = NSF_HEADER_SIZE + Driver.size() + m_vData.size();
+
+	if (m_vSamples.empty())
+		return;
+
+	// Samples at $C000, 64-byte aligned
+	bytes_t Samples(m_iSampleSize, 0);
+	for (unsigned int i = 0; i < m_vSamples.size(); i++)
+	{
+		const CDSample *pSample = m_pDocument->GetDSample(m_vSamples[i]);
+		memcpy(&Samples[m_vSampleAddress[i]], pSample->SampleData, pSample->SampleSize);
+	}
+
+	bytes_t Padding(DPCM_START - (Start + Driver.size() + m_vData.size()), 0);
+	if (!Padding.empty())
+		io->write(&Padding[0], Padding.size());
+	io->write(&Samples[0], Samples.size());
+
+	m_iTotalSize += Padding.size() + Samples.size();
+}
+
+void CCompiler::StoreByte(unsigned char Value)
+{
+	m_vData.push_back(Value);
+}
+
+void CCompiler::StoreShort(unsigned short Value)
+{
+	StoreShortTo(m_vData, Value);
+}
+
+unsigned int CCompiler::Store(const bytes_t &Data)
+{
+	unsigned int Address = m_vData.size();
+	m_vData.insert(m_vData.end(), Data.begin(), Data.end());
+	return Address;
+}
+
+unsigned int CCompiler::StoreUnique(const bytes_t &Data, std::map<bytes_t, unsigned int> &Stored, unsigned int &Duplicates)
+{
+	std::map<bytes_t, unsigned int>::const_iterator it = Stored.find(Data);
+	if (it != Stored.end())
+	{
+		Duplicates++;
+		return it->second;
+	}
+
+	unsigned int Address = Store(Data);
+	Stored[Data] = Address;
+	return Address;
+}
+
+void CCompiler::PatchShort(unsigned int Address, unsigned short Value)
+{
+	m_vData[Address] = Value & 0xFF;
+	m_vData[Address + 1] = Value >> 8;
+}
+
+unsigned int CCompiler::GetSequenceAddress2A03(int Index, int Type) const
+{
+	const CSequence *pSeq = m_pDocument->GetSequence_readonly(SNDCHIP_NONE, Index, Type);
+	std::map<const CSequence*, unsigned int>::const_iterator it = m_mSequenceAddress.find(pSeq);
+	ftkr_Assert(it != m_mSequenceAddress.end());
+	return it->second;
+}
+
+unsigned int CCompiler::GetSequenceAddressVRC6(int Index, int Type) const
+{
+	const CSequence *pSeq = m_pDocument->GetSequence_readonly(SNDCHIP_VRC6, Index, Type);
+	std::map<const CSequence*, unsigned int>::const_iterator it = m_mSequenceAddress.find(pSeq);
+	ftkr_Assert(it != m_mSequenceAddress.end());
+	return it->second;
+}
+
+unsigned int CCompiler::GetSequenceAddressFDS(int Index, int Type) const
+{
+	CInstrumentFDS *pInst = static_cast<CInstrumentFDS*>(m_pDocument->GetInstrument(Index));
+	const CSequence *pSeq = NULL;
+
+	switch (Type)
+	{
+		case SEQ_VOLUME:	pSeq = pInst->GetVolumeSeq();	break;
+		case SEQ_ARPEGGIO:	pSeq = pInst->GetArpSeq();		break;
+		case SEQ_PITCH:		pSeq = pInst->GetPitchSeq();	break;
+	}
+
+	std::map<const CSequence*, unsigned int>::const_iterator it = m_mSequenceAddress.find(pSeq);
+	ftkr_Assert(it != m_mSequenceAddress.end());
+	return it->second;
+}
+
+int CCompiler::AddWavetable(const unsigned char *pWave)
+{
+	bytes_t Wave(pWave, pWave + CInstrumentFDS::WAVE_SIZE);
+
+	for (unsigned int i = 0; i < m_vWavetables.size(); i++)
+	{
+		if (m_vWavetables[i] == Wave)
+			return i;
+	}
+
+	m_vWavetables.push_back(Wave);
+	return m_vWavetables.size() - 1;
+}
+
+void CCompiler::BeginBlock(const char *Name)
+{
+	m_pBlockName = Name;
+	m_iBlockStart = m_vData.size();
+	m_BlockTime.gettime();
+}
+
+void CCompiler::EndBlock(unsigned int Items, unsigned int Duplicates)
+{
+	core::timestamp_t Now;
+	Now.gettime();
+
+	stCompileBlock Block;
+	Block.Name = m_pBlockName;
+	Block.Items = Items;
+	Block.Duplicates = Duplicates;
+	Block.Size = m_vData.size() - m_iBlockStart;
+	Block.Time_us = Now.diff_us(m_BlockTime);
+	m_vBlocks.push_back(Block);
+}
@@ -0,0 +1,150 @@
+#ifndef _COMPILER_H_
+#define _COMPILER_H_
+
+#include "core/time.hpp"
+#include "FamiTrackerTypes.h"
+#include "common.hpp"
+#include <exception>
+#include <string>
+#include <vector>
+#include <map>
+
+class FtmDocument;
+class CSequence;
+struct stChanNote;
+struct stDriver;
+namespace core
+{
+	class IO;
+}
+
+class FAMICOREAPI CompilerException : public std::exception
+{
+public:
+	explicit CompilerException(const std::string &msg)
+		: m_msg(msg)
+	{
+	}
+	~CompilerException() throw(){}
+
+	const char * what() const throw(){ return m_msg.c_str(); }
+private:
+	std::string m_msg;
+};
+
+// Size and time spent on one kind of data in the last compile
+struct stCompileBlock
+{
+	const char *	Name;
+	unsigned int	Items;			// Items stored
+	unsigned int	Duplicates;		// Items that were equal to a stored one
+	unsigned int	Size;			// Bytes
+	int				Time_us;
+};
+
+/*
+ * Compiles a module into the data format of the NSF drivers in drivers/
+ * and writes an NSF file. Patterns, frames and sequences with equal
+ * contents are stored only once.
+ *
+ * All addresses in the music data are relative to its start, the driver
+ * adds the load address. Only one expansion chip can be used, and the
+ * music data must fit without bankswitching.
+ */
+class FAMICOREAPI CCompiler
+{
+public:
+	CCompiler(FtmDocument *pDocument);
+	~CCompiler();
+
+	// Throws CompilerException if the module cannot be exported
+	void			ExportNSF(core::IO *io);
+
+	const std::vector<stCompileBlock> & GetBlocks() const{ return m_vBlocks; }
+	unsigned int	GetTotalSize() const{ return m_iTotalSize; }
+	int				GetTotalTime() const{ return m_iTotalTime; }
+
+	// Used by the instruments
+	FtmDocument *	GetDocument() const{ return m_pDocument; }
+	void			StoreByte(unsigned char Value);
+	void			StoreShort(unsigned short Value);
+	unsigned int	GetSequenceAddress2A03(int Index, int Type) const;
+	unsigned int	GetSequenceAddressVRC6(int Index, int Type) const;
+	unsigned int	GetSequenceAddressFDS(int Index, int Type) const;
+	int				AddWavetable(const unsigned char *pWave);
+
+private:
+	typedef std::vector<unsigned char> bytes_t;
+
+	void			Clear();
+	const stDriver *SelectDriver() const;
+	void			SetupChannels();
+
+	void			CompilePatterns();
+	void			CompilePattern(unsigned int Track, unsigned int Channel, unsigned int Pattern, int &Instrument, bytes_t &Data);
+	void			CompileEffect(int ChanID, unsigned char Effect, unsigned char Param, bytes_t &Data) const;
+	unsigned char	CompileNote(int ChanID, const stChanNote &Note, int Instrument);
+	int				GetInstrumentIndex(int Instrument, int ChanID);
+	int				GetSampleIndex(unsigned char Pitch, int Sample);
+
+	void			CompileSequences();
+	void			AddSequence(const CSequence *pSeq);
+	void			CompileInstruments();
+	void			CompileWavetables();
+	void			CompileSamples();
+	void			CompileFrames();
+	void			CompileSongs();
+	void			CompileHeader();
+
+	void			WriteNSF(core::IO *io, const stDriver *pDriver);
+
+	unsigned int	Store(const bytes_t &Data);
+	unsigned int	StoreUnique(const bytes_t &Data, std::map<bytes_t, unsigned int> &Stored, unsigned int &Duplicates);
+	void			PatchShort(unsigned int Address, unsigned short Value);
+	void			BeginBlock(const char *Name);
+	void			EndBlock(unsigned int Items, unsigned int Duplicates);
+
+private:
+	FtmDocument		*m_pDocument;
+
+	unsigned char	m_iChip;
+	std::vector<int> m_vChannels;		// Document channel of each driver channel
+	std::vector<int> m_vChanIDs;
+
+	bytes_t			m_vData;			// Music data
+
+	// Address of the pattern played in each frame and driver channel
+	std::vector<unsigned int> m_vFramePatterns[MAX_TRACKS];
+
+	std::vector<int> m_vInstruments;	// Document instrument of each compiled instrument
+	int				m_iInstrumentIndex[MAX_INSTRUMENTS];
+
+	std::map<const CSequence*, unsigned int> m_mSequenceAddress;
+	std::map<bytes_t, unsigned int> m_mSequences;
+	unsigned int	m_iSequenceDuplicates;
+
+	std::vector<bytes_t> m_vWavetables;
+
+	// DPCM sample list entries (pitch, sample table index) and the samples
+	std::vector<std::pair<unsigned char, int> > m_vSampleList;
+	std::vector<int> m_vSamples;
+	std::vector<unsigned int> m_vSampleAddress;	// From $C000
+	unsigned int	m_iSampleSize;
+
+	std::vector<unsigned int> m_vFrameListAddress;
+
+	unsigned int	m_iSongListAddress;
+	unsigned int	m_iInstrumentListAddress;
+	unsigned int	m_iSampleListAddress;
+	unsigned int	m_iSamplesAddress;
+	unsigned int	m_iWavetableAddress;
+
+	std::vector<stCompileBlock> m_vBlocks;
+	const char		*m_pBlockName;
+	unsigned int	m_iBlockStart;
+	core::timestamp_t m_BlockTime;
+	unsigned int	m_iTotalSize;
+	int				m_iTotalTime;
+};
+
+#endif /* _COMPILER_H_ */
@@ -8,7 +8,7 @@ const char FILE_HEADER_ID[] = "FamiTracker Module";
 const char FILE_END_ID[] = "END";
 
 Document::Document()
-	: m_pBlockData(NULL), m_bFileDone(false), m_io(NULL)
+	: m_pBlockData(NULL), m_pBlockView(NULL), m_bFileDone(false), m_io(NULL)
 {
 }
 
@@ -16,6 +16,9 @@ Document::~Document()
 {
 	if (m_pBlockData != NULL)
 		delete[] m_pBlockData;
+
+	for (unsigned int i = 0; i < m_readBlocks.size(); i++)
+		delete[] m_readBlocks[i];
 }
 
 bool Document::checkValidity()
@@ -66,10 +69,16 @@ bool Document::readBlock()
 		return false;
 	}
 
-	init_pBlockData(m_iBlockSize);
-	if (!m_io->read_e(m_pBlockData, m_iBlockSize))
+	// parse the block where it is when the IO allows it
+	m_pBlockView = (const char*)m_io->view(m_iBlockSize);
+	if (m_pBlockView == NULL)
 	{
-		return false;
+		init_pBlockData(m_iBlockSize);
+		if (!m_io->read_e(m_pBlockData, m_iBlockSize))
+		{
+			return false;
+		}
+		m_pBlockView = m_pBlockData;
 	}
 
 	if (bytesRead == 0)
@@ -78,10 +87,58 @@ bool Document::readBlock()
 	return true;
 }
 
+bool Document::readBlocks(std::vector<stDocumentBlock> &blocks)
+{
+	while (!m_bFileDone)
+	{
+		if (!readBlock())
+			return false;
+
+		if (m_bFileDone)
+			break;
+
+		stDocumentBlock b;
+		memcpy(b.id, m_cBlockID, sizeof(b.id));
+		b.version = m_iBlockVersion;
+		b.size = m_iBlockSize;
+		b.data = m_pBlockView;
+
+		// the next block reuses m_pBlockData, keep this one
+		if (m_pBlockView == m_pBlockData)
+		{
+			m_readBlocks.push_back(m_pBlockData);
+			m_pBlockData = NULL;
+		}
+
+		blocks.push_back(b);
+	}
+
+	return true;
+}
+
+void Document::openBlock(const stDocumentBlock &block)
+{
+	memcpy(m_cBlockID, block.id, sizeof(m_cBlockID));
+	m_iBlockVersion = block.version;
+	m_iBlockSize = block.size;
+	m_pBlockView = block.data;
+	m_iBlockPointer = 0;
+}
+
 void Document::getBlock(void *buf, unsigned int size)
 {
-	memcpy(buf, m_pBlockData + m_iBlockPointer, size);
+	memcpy(buf, m_pBlockView + m_iBlockPointer, size);
+	m_iBlockPointer += size;
+}
+
+const unsigned char * Document::getBlockData(unsigned int size)
+{
+	if (m_iBlockPointer > m_iBlockSize || size > m_iBlockSize - m_iBlockPointer)
+		return NULL;
+
+	const unsigned char *buf = (const unsigned char*)m_pBlockView + m_iBlockPointer;
 	m_iBlockPointer += size;
+	return buf;
 }
 
 void Document::writeBlock(const void *data, unsigned int size)
@@ -214,7 +271,7 @@ void Document::reallocateBlock()
 
 int Document::getBlockInt()
 {
-	const unsigned char *buf = (const unsigned char*)m_pBlockData + m_iBlockPointer;
+	const unsigned char *buf = (const unsigned char*)m_pBlockView + m_iBlockPointer;
 	int Value = (buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8) | buf[0];
 	m_iBlockPointer += 4;
 	return Value;
@@ -222,7 +279,7 @@ int Document::getBlockInt()
 
 char Document::getBlockChar()
 {
-	const char *buf = m_pBlockData + m_iBlockPointer;
+	const char *buf = m_pBlockView + m_iBlockPointer;
 	char Value = buf[0];
 	m_iBlockPointer += 1;
 	return Value;
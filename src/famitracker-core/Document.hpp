@@ -2,9 +2,19 @@
 #define _DOCUMENT_HPP_
 
 #include <string>
+#include <vector>
 #include "types.hpp"
 #include "core/io.hpp"
 
+// A block read ahead with Document::readBlocks()
+struct stDocumentBlock
+{
+	char id[16];
+	unsigned int version;
+	unsigned int size;
+	const char *data;		// in the IO, or owned by the Document
+};
+
 class Document
 {
 public:
@@ -31,7 +41,14 @@ public:
 
 	const char *blockID() const{ return m_cBlockID; }
 	bool readBlock();
+	// Reads all blocks up to the end of the file. The blocks stay valid
+	// while the Document exists, any of them can be read by openBlock()
+	bool readBlocks(std::vector<stDocumentBlock> &blocks);
+	void openBlock(const stDocumentBlock &block);
 	void getBlock(void *buf, unsigned int size);
+	// Returns the next size bytes of the block in place and skips them, or
+	// NULL if the block is shorter. Valid until the next readBlock()
+	const unsigned char * getBlockData(unsigned int size);
 	void writeBlock(const void *data, unsigned int size);
 	bool flushBlock();
 	void createBlock(const char *id, int version);
@@ -50,12 +67,16 @@ private:
 	unsigned int m_iBlockSize;
 	unsigned int m_iBlockVersion;
 	char *m_pBlockData;
+	const char *m_pBlockView;		// block being read, in the IO or m_pBlockData
 
 	unsigned int m_iMaxBlockSize;
 
 	unsigned int m_iBlockPointer;
 	bool m_bFileDone;
 
+	// blocks copied by readBlocks()
+	std::vector<char*> m_readBlocks;
+
 	void init_pBlockData(Quantity size);
 	void reallocateBlock();
 };
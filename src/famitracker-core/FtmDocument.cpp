@@ -1,6 +1,11 @@
 #include <string.h>
 #include <stdio.h>
+#include <algorithm>
+#include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/atomic.hpp>
+#include "core/spscringbuffer.hpp"
+#include "core/threadpool.hpp"
 #include "App.hpp"
 #include "FtmDocument.hpp"
 #include "Document.hpp"
@@ -31,6 +36,12 @@ const int	DEFAULT_SECOND_HIGHLIGHT = 16;
 
 const char FILE_HEADER_ID[] = "FamiTracker Module";
 
+// Snapshots the player can retire before it has to keep its current one
+const core::Quantity RETIRED_SNAPSHOTS = 16;
+
+// Pattern edits remembered for views, enough for a few inserted rows
+const std::deque<stDirtyRows>::size_type MAX_DIRTY_ROWS = 1024;
+
 const char FILE_BLOCK_PARAMS[]		= "PARAMS";
 const char FILE_BLOCK_INFO[]		= "INFO";
 const char FILE_BLOCK_INSTRUMENTS[]	= "INSTRUMENTS";
@@ -171,9 +182,43 @@ void CDSample::Allocate(int iSize, char *pData)
 }
 
 
+struct _ftmdocument_snapshots_t
+{
+	_ftmdocument_snapshots_t()
+		: publish(false), publishedRevision(0), retired(sizeof(FtmDocument*))
+	{
+		pending = NULL;
+		retired.resize(RETIRED_SNAPSHOTS);
+	}
+
+	bool publish;
+	unsigned int publishedRevision;
+
+	// the newest snapshot, until the player takes it
+	boost::atomic<FtmDocument*> pending;
+
+	// snapshots the player is done with. the editor frees them, so the
+	// player never frees memory
+	core::SPSCRingBuffer retired;
+};
+
+// The rows of one pattern in a PATTERNS block
+struct _ftmdocument_patternchunk_t
+{
+	unsigned int track, channel, pattern;
+	unsigned int items;
+	unsigned int blockVersion;
+	unsigned int rowSize;			// bytes of the row number
+	unsigned int effects;			// effect columns stored
+	unsigned int itemSize;
+	const unsigned char *data;
+};
+
 FtmDocument::FtmDocument()
+	: m_iRevision(0)
 {
 	m_modifyLock = new boost::mutex;
+	m_snapshots = new _ftmdocument_snapshots_t;
 
 	for (int i = 0; i < MAX_DSAMPLES; i++)
 	{
@@ -238,6 +283,11 @@ FtmDocument::~FtmDocument()
 		}
 	}
 
+	// Snapshots
+	freeRetiredSnapshots();
+	delete m_snapshots->pending.load(boost::memory_order_acquire);
+	delete m_snapshots;
+
 	delete m_modifyLock;
 }
 
@@ -248,9 +298,145 @@ void FtmDocument::lock() const
 
 void FtmDocument::unlock() const
 {
+	if (m_snapshots->publish)
+	{
+		freeRetiredSnapshots();
+
+		if (m_snapshots->publishedRevision != m_iRevision)
+		{
+			m_snapshots->publishedRevision = m_iRevision;
+
+			// pool the edited patterns, so the snapshot shares them
+			if (m_pSelectedTune != NULL)
+				m_pSelectedTune->Compact();
+
+			// If the player didn't take the previous snapshot, it's unused
+			delete m_snapshots->pending.exchange(snapshot(), boost::memory_order_acq_rel);
+		}
+	}
+
 	m_modifyLock->unlock();
 }
 
+FtmDocument * FtmDocument::snapshot() const
+{
+	return snapshot(m_iTrack);
+}
+
+FtmDocument * FtmDocument::snapshot(unsigned int Track) const
+{
+	// Copy everything the player reads. Of the tracks, only the given one
+	// is copied.
+
+	ftkr_Assert(Track < MAX_TRACKS);
+
+	FtmDocument *s = new FtmDocument;
+
+	s->bForceBackup = bForceBackup;
+	s->m_iFileVersion = m_iFileVersion;
+	s->m_iTrack = Track;
+	s->m_iTracks = m_iTracks;
+	s->m_iChannelsAvailable = m_iChannelsAvailable;
+
+	s->m_pSelectedTune = NULL;
+	const CPatternData *source = m_pTunes[Track];
+	if (source != NULL)
+	{
+		CPatternData *tune = new CPatternData(source->GetPatternLength(),
+			source->GetSongSpeed(), source->GetSongTempo());
+		tune->Copy(source);
+		s->m_pTunes[Track] = tune;
+		s->m_pSelectedTune = tune;
+	}
+
+	s->m_iExpansionChip = m_iExpansionChip;
+	s->m_iVibratoStyle = m_iVibratoStyle;
+	s->m_bLinearPitch = m_bLinearPitch;
+
+	for (int i = 0; i < MAX_INSTRUMENTS; i++)
+	{
+		if (m_pInstruments[i] != NULL)
+			s->m_pInstruments[i] = m_pInstruments[i]->Clone();
+	}
+
+	for (int i = 0; i < MAX_DSAMPLES; i++)
+	{
+		if (m_DSamples[i].SampleSize > 0)
+			s->m_DSamples[i].Copy(&m_DSamples[i]);
+	}
+
+	for (int i = 0; i < MAX_SEQUENCES; i++)
+	{
+		for (int j = 0; j < SEQ_COUNT; j++)
+		{
+			if (m_pSequences2A03[i][j] != NULL)
+			{
+				s->m_pSequences2A03[i][j] = new CSequence();
+				s->m_pSequences2A03[i][j]->Copy(m_pSequences2A03[i][j]);
+			}
+			if (m_pSequencesVRC6[i][j] != NULL)
+			{
+				s->m_pSequencesVRC6[i][j] = new CSequence();
+				s->m_pSequencesVRC6[i][j]->Copy(m_pSequencesVRC6[i][j]);
+			}
+			if (m_pSequencesN106[i][j] != NULL)
+			{
+				s->m_pSequencesN106[i][j] = new CSequence();
+				s->m_pSequencesN106[i][j]->Copy(m_pSequencesN106[i][j]);
+			}
+		}
+	}
+
+	memcpy(s->m_strName, m_strName, sizeof(m_strName));
+	memcpy(s->m_strArtist, m_strArtist, sizeof(m_strArtist));
+	memcpy(s->m_strCopyright, m_strCopyright, sizeof(m_strCopyright));
+
+	s->m_iMachine = m_iMachine;
+	s->m_iEngineSpeed = m_iEngineSpeed;
+	s->m_iSpeedSplitPoint = m_iSpeedSplitPoint;
+
+	s->m_bModified = m_bModified;
+	s->m_highlight = m_highlight;
+	s->m_secondHighlight = m_secondHighlight;
+
+	s->m_channelsFromChip = m_channelsFromChip;
+
+	return s;
+}
+
+void FtmDocument::setPublishSnapshots(bool publish)
+{
+	m_snapshots->publish = publish;
+	m_snapshots->publishedRevision = m_iRevision;
+
+	// A snapshot left for an earlier player is stale
+	delete m_snapshots->pending.exchange(NULL, boost::memory_order_acq_rel);
+	freeRetiredSnapshots();
+}
+
+FtmDocument * FtmDocument::swapSnapshot(FtmDocument *current)
+{
+	// Keep the current snapshot if it can't be handed back yet
+	if (current != NULL && m_snapshots->retired.availWrite() == 0)
+		return current;
+
+	FtmDocument *s = m_snapshots->pending.exchange(NULL, boost::memory_order_acq_rel);
+	if (s == NULL)
+		return current;
+
+	if (current != NULL)
+		m_snapshots->retired.write(&current, 1);
+
+	return s;
+}
+
+void FtmDocument::freeRetiredSnapshots() const
+{
+	FtmDocument *s;
+	while (m_snapshots->retired.read(&s, 1) == 1)
+		delete s;
+}
+
 void FtmDocument::createEmpty()
 {
 	m_iMachine = DEFAULT_MACHINE_TYPE;
@@ -273,7 +459,7 @@ void FtmDocument::createEmpty()
 	SetModifiedFlag(0);
 }
 
-void FtmDocument::read(core::IO *io)
+void FtmDocument::read(core::IO *io, unsigned int threads)
 {
 	try
 	{
@@ -322,7 +508,7 @@ void FtmDocument::read(core::IO *io)
 				throw FtmDocumentException::TOONEW;
 			}
 
-			if (!readNew(&doc))
+			if (!readNew(&doc, threads))
 			{
 				throw FtmDocumentException::GENERALREADFAILURE;
 			}
@@ -337,6 +523,37 @@ void FtmDocument::read(core::IO *io)
 	}
 }
 
+unsigned int FtmDocument::readTrackCount(core::IO *io)
+{
+	Document doc;
+	doc.setIO(io);
+
+	if (!doc.checkValidity())
+		throw FtmDocumentException(FtmDocumentException::INVALIDFILETYPE);
+
+	unsigned int ver = doc.getFileVersion();
+	if (ver < 0x0200)
+		throw FtmDocumentException(FtmDocumentException::TOOOLD);
+	if (ver > FILE_VER)
+		throw FtmDocumentException(FtmDocumentException::TOONEW);
+
+	while (!doc.isFileDone())
+	{
+		if (!doc.readBlock())
+			break;
+
+		if (!doc.isFileDone() && strcmp(doc.blockID(), FILE_BLOCK_HEADER) == 0)
+		{
+			// a single track before version 2 of the block
+			if (doc.getBlockVersion() < 2)
+				return 1;
+			return (unsigned char)doc.getBlockChar() + 1;
+		}
+	}
+
+	throw FtmDocumentException(FtmDocumentException::GENERALREADFAILURE);
+}
+
 bool FtmDocument::readOld(Document *doc)
 {
 	// TODO
@@ -344,66 +561,28 @@ bool FtmDocument::readOld(Document *doc)
 	return false;
 }
 
-bool FtmDocument::readNew(Document *doc)
+bool FtmDocument::readNew(Document *doc, unsigned int threads)
 {
-	while (!doc->isFileDone())
+	if (threads > 1)
 	{
-		if (!doc->readBlock())
+		if (!readNew_parallel(doc, threads))
 			return false;
+	}
+	else
+	{
+		while (!doc->isFileDone())
+		{
+			if (!doc->readBlock())
+				return false;
 
-		if (doc->isFileDone())
-			break;
-
-		const char *id = doc->blockID();
-
-#define CMP(token) (strcmp(id, token) == 0)
+			if (doc->isFileDone())
+				break;
 
-		if (CMP(FILE_BLOCK_INFO))
-		{
-			doc->getBlock(m_strName, 32);
-			doc->getBlock(m_strArtist, 32);
-			doc->getBlock(m_strCopyright, 32);
-		}
-		else if (CMP(FILE_BLOCK_PARAMS))
-		{
-			if (!readNew_params(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_HEADER))
-		{
-			if (!readNew_header(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_INSTRUMENTS))
-		{
-			if (!readNew_instruments(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_SEQUENCES))
-		{
-			if (!readNew_sequences(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_FRAMES))
-		{
-			if (!readNew_frames(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_PATTERNS))
-		{
-			if (!readNew_patterns(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_DSAMPLES))
-		{
-			if (!readNew_dsamples(doc)) return false;
-		}
-		else if (CMP(FILE_BLOCK_SEQUENCES_VRC6))
-		{
-			if (!readNew_sequences_vrc6(doc)) return false;
-		}
-		else
-		{
-			return false;
+			if (!readNew_block(doc))
+				return false;
 		}
 	}
 
-#undef CMP
-
 	if (m_iFileVersion <= 0x0201)
 	{
 		reorderSequences();
@@ -414,6 +593,67 @@ bool FtmDocument::readNew(Document *doc)
 		convertSequences();
 	}
 
+	// share the loaded patterns with other songs and documents
+	for (unsigned int i = 0; i < MAX_TRACKS; i++)
+	{
+		if (m_pTunes[i] != NULL)
+			m_pTunes[i]->Compact();
+	}
+
+	return true;
+}
+
+bool FtmDocument::readNew_block(Document *doc)
+{
+	const char *id = doc->blockID();
+
+#define CMP(token) (strcmp(id, token) == 0)
+
+	if (CMP(FILE_BLOCK_INFO))
+	{
+		doc->getBlock(m_strName, 32);
+		doc->getBlock(m_strArtist, 32);
+		doc->getBlock(m_strCopyright, 32);
+	}
+	else if (CMP(FILE_BLOCK_PARAMS))
+	{
+		if (!readNew_params(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_HEADER))
+	{
+		if (!readNew_header(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_INSTRUMENTS))
+	{
+		if (!readNew_instruments(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_SEQUENCES))
+	{
+		if (!readNew_sequences(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_FRAMES))
+	{
+		if (!readNew_frames(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_PATTERNS))
+	{
+		if (!readNew_patterns(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_DSAMPLES))
+	{
+		if (!readNew_dsamples(doc)) return false;
+	}
+	else if (CMP(FILE_BLOCK_SEQUENCES_VRC6))
+	{
+		if (!readNew_sequences_vrc6(doc)) return false;
+	}
+	else
+	{
+		return false;
+	}
+
+#undef CMP
+
 	return true;
 }
 
@@ -805,176 +1045,204 @@ bool FtmDocument::readNew_frames(Document *doc)
 	return true;
 }
 
-bool FtmDocument::readNew_patterns(Document *doc)
+static void decode_pattern_chunk(const _ftmdocument_patternchunk_t &c, CPatternData *tune,
+								 unsigned int fileVersion, unsigned char chip)
 {
-	unsigned int block_ver = doc->getBlockVersion();
-
-	if (block_ver == 1)
-	{
-		int patternLen = doc->getBlockInt();
-		ftm_Assert(patternLen <= MAX_PATTERN_LENGTH);
-		m_pSelectedTune->SetPatternLength(patternLen);
-	}
-
-	while (!doc->blockDone())
+	const unsigned char *p = c.data;
+	for (unsigned int i = 0; i < c.items; i++, p += c.itemSize)
 	{
-		unsigned int track;
-		if (block_ver > 1)
-			track = doc->getBlockInt();
-		else if (block_ver == 1)
-			track = 0;
+		unsigned row;
+		if (c.rowSize == 1)
+			row = p[0];
+		else
+			row = (p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
 
-		unsigned int channel = doc->getBlockInt();
-		unsigned int pattern = doc->getBlockInt();
-		unsigned int items	= doc->getBlockInt();
+		ftm_Assert(row < MAX_PATTERN_LENGTH);
 
-		if (channel > MAX_CHANNELS)
-			return true;
+		const unsigned char *item = p + c.rowSize;
 
-		ftm_Assert(track < MAX_TRACKS);
-		ftm_Assert(channel < MAX_CHANNELS);
-		ftm_Assert(pattern < MAX_PATTERN);
-		ftm_Assert((items - 1) < MAX_PATTERN_LENGTH);
+		stChanNote note;
+		memset(&note, 0, sizeof(stChanNote));
 
-		SwitchToTrack(track);
+		note.Note		 = item[0];
+		note.Octave	 = item[1];
+		note.Instrument = item[2];
+		note.Vol		 = item[3];
 
-		for (unsigned int i = 0; i < items; i++)
+		for (unsigned int n = 0; n < c.effects && n < MAX_EFFECT_COLUMNS; n++)
 		{
-			unsigned row;
-			if (m_iFileVersion == 0x0200)
-				row = doc->getBlockChar();
-			else
-				row = doc->getBlockInt();
-
-			ftm_Assert(row < MAX_PATTERN_LENGTH);
-
-			stChanNote note;
-			memset(&note, 0, sizeof(stChanNote));
+			unsigned char EffectNumber, EffectParam;
+			EffectNumber = item[4 + n * 2];
+			EffectParam = item[5 + n * 2];
 
-			note.Note		 = doc->getBlockChar();
-			note.Octave	 = doc->getBlockChar();
-			note.Instrument = doc->getBlockChar();
-			note.Vol		 = doc->getBlockChar();
-
-			if (m_iFileVersion == 0x0200)
+			if (c.blockVersion < 3)
 			{
-				unsigned char EffectNumber, EffectParam;
-				EffectNumber = doc->getBlockChar();
-				EffectParam = doc->getBlockChar();
-				if (block_ver < 3)
+				if (EffectNumber == EF_PORTAOFF)
 				{
-					if (EffectNumber == EF_PORTAOFF)
-					{
-						EffectNumber = EF_PORTAMENTO;
-						EffectParam = 0;
-					}
-					else if (EffectNumber == EF_PORTAMENTO)
-					{
-						if (EffectParam < 0xFF)
-							EffectParam++;
-					}
+					EffectNumber = EF_PORTAMENTO;
+					EffectParam = 0;
 				}
-
-				note.EffNumber[0]	= EffectNumber;
-				note.EffParam[0]	= EffectParam;
-			}
-			else
-			{
-				for (int n = 0; n < (m_pSelectedTune->GetEffectColumnCount(channel) + 1); n++)
+				else if (EffectNumber == EF_PORTAMENTO)
 				{
-					unsigned char EffectNumber, EffectParam;
-					EffectNumber = doc->getBlockChar();
-					EffectParam = doc->getBlockChar();
-
-					if (block_ver < 3)
-					{
-						if (EffectNumber == EF_PORTAOFF)
-						{
-							EffectNumber = EF_PORTAMENTO;
-							EffectParam = 0;
-						}
-						else if (EffectNumber == EF_PORTAMENTO)
-						{
-							if (EffectParam < 0xFF)
-								EffectParam++;
-						}
-					}
-
-					note.EffNumber[n]	= EffectNumber;
-					note.EffParam[n] 	= EffectParam;
+					if (EffectParam < 0xFF)
+						EffectParam++;
 				}
 			}
 
-			if (note.Vol > 0x10)
-				note.Vol &= 0x0F;
+			note.EffNumber[n]	= EffectNumber;
+			note.EffParam[n] 	= EffectParam;
+		}
 
-			// Specific for version 2.0
-			if (m_iFileVersion == 0x0200)
-			{
+		if (note.Vol > 0x10)
+			note.Vol &= 0x0F;
 
-				if (note.EffNumber[0] == EF_SPEED && note.EffParam[0] < 20)
-					note.EffParam[0]++;
+		// Specific for version 2.0
+		if (fileVersion == 0x0200)
+		{
 
-				if (note.Vol == 0)
-				{
-					note.Vol = 0x10;
-				}
-				else
-				{
-					note.Vol--;
-					note.Vol &= 0x0F;
-				}
+			if (note.EffNumber[0] == EF_SPEED && note.EffParam[0] < 20)
+				note.EffParam[0]++;
 
-				if (note.Note == 0)
-					note.Instrument = MAX_INSTRUMENTS;
+			if (note.Vol == 0)
+			{
+				note.Vol = 0x10;
+			}
+			else
+			{
+				note.Vol--;
+				note.Vol &= 0x0F;
 			}
 
-			if (block_ver == 3)
+			if (note.Note == 0)
+				note.Instrument = MAX_INSTRUMENTS;
+		}
+
+		if (c.blockVersion == 3)
+		{
+			// Fix for VRC7 portamento
+			if (chip == SNDCHIP_VRC7 && c.channel > 4)
 			{
-				// Fix for VRC7 portamento
-				if (GetExpansionChip() == SNDCHIP_VRC7 && channel > 4)
+				for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
 				{
-					for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
+					switch (note.EffNumber[n])
 					{
-						switch (note.EffNumber[n])
-						{
-							case EF_PORTA_DOWN:
-								note.EffNumber[n] = EF_PORTA_UP;
-								break;
-							case EF_PORTA_UP:
-								note.EffNumber[n] = EF_PORTA_DOWN;
-								break;
-						}
+						case EF_PORTA_DOWN:
+							note.EffNumber[n] = EF_PORTA_UP;
+							break;
+						case EF_PORTA_UP:
+							note.EffNumber[n] = EF_PORTA_DOWN;
+							break;
 					}
 				}
-				// FDS pitch effect fix
-				else if (GetExpansionChip() == SNDCHIP_FDS && channel == 5)
+			}
+			// FDS pitch effect fix
+			else if (chip == SNDCHIP_FDS && c.channel == 5)
+			{
+				for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
 				{
-					for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
+					switch (note.EffNumber[n])
 					{
-						switch (note.EffNumber[n])
-						{
-							case EF_PITCH:
-								if (note.EffParam[n] != 0x80)
-									note.EffParam[n] = (0x100 - note.EffParam[n]) & 0xFF;
-								break;
-						}
+						case EF_PITCH:
+							if (note.EffParam[n] != 0x80)
+								note.EffParam[n] = (0x100 - note.EffParam[n]) & 0xFF;
+							break;
 					}
 				}
 			}
+		}
 #ifdef TRANSPOSE_FDS
-			if (version < 5)
+		if (version < 5)
+		{
+			// FDS octave
+			if (chip == SNDCHIP_FDS && c.channel > 4 && note.Octave < 7)
 			{
-				// FDS octave
-				if (GetExpansionChip() == SNDCHIP_FDS && channel > 4 && note.Octave < 7)
-				{
-					note.Octave++;
-				}
+				note.Octave++;
 			}
+		}
 #endif
 
-			SetDataAtPattern(m_iTrack, pattern, channel, row, &note);
+		tune->SetPatternData(c.channel, c.pattern, row, &note);
+	}
+}
+
+bool FtmDocument::readNew_patterns(Document *doc)
+{
+	std::vector<_ftmdocument_patternchunk_t> chunks;
+	if (!readNew_patternChunks(doc, chunks))
+		return false;
+
+	for (unsigned int i = 0; i < chunks.size(); i++)
+	{
+		decode_pattern_chunk(chunks[i], m_pTunes[chunks[i].track], m_iFileVersion, GetExpansionChip());
+	}
+
+	// the decoded rows don't go through SetDataAtPattern(), but a loaded
+	// document is flagged the same
+	if (!chunks.empty())
+		SetModifiedFlag();
+
+	return true;
+}
+
+bool FtmDocument::readNew_patternChunks(Document *doc, std::vector<_ftmdocument_patternchunk_t> &chunks)
+{
+	unsigned int block_ver = doc->getBlockVersion();
+
+	if (block_ver == 1)
+	{
+		int patternLen = doc->getBlockInt();
+		ftm_Assert(patternLen <= MAX_PATTERN_LENGTH);
+		m_pSelectedTune->SetPatternLength(patternLen);
+	}
+
+	while (!doc->blockDone())
+	{
+		unsigned int track;
+		if (block_ver > 1)
+			track = doc->getBlockInt();
+		else if (block_ver == 1)
+			track = 0;
+
+		unsigned int channel = doc->getBlockInt();
+		unsigned int pattern = doc->getBlockInt();
+		unsigned int items	= doc->getBlockInt();
+
+		if (channel > MAX_CHANNELS)
+			return true;
+
+		ftm_Assert(track < MAX_TRACKS);
+		ftm_Assert(channel < MAX_CHANNELS);
+		ftm_Assert(pattern < MAX_PATTERN);
+		ftm_Assert((items - 1) < MAX_PATTERN_LENGTH);
+
+		SwitchToTrack(track);
+
+		_ftmdocument_patternchunk_t c;
+		c.track = track;
+		c.channel = channel;
+		c.pattern = pattern;
+		c.items = items;
+		c.blockVersion = block_ver;
+
+		// Rows are fixed size, check and fetch them all at once
+		if (m_iFileVersion == 0x0200)
+		{
+			c.rowSize = 1;
+			c.effects = 1;
+		}
+		else
+		{
+			c.rowSize = 4;
+			c.effects = m_pSelectedTune->GetEffectColumnCount(channel) + 1;
 		}
+		ftm_Assert(c.effects <= MAX_EFFECT_COLUMNS);
+
+		c.itemSize = c.rowSize + 4 + c.effects * 2;
+		c.data = doc->getBlockData(items * c.itemSize);
+		if (c.data == NULL)
+			return false;
+
+		chunks.push_back(c);
 	}
 
 	return true;
@@ -1007,6 +1275,248 @@ bool FtmDocument::readNew_dsamples(Document *doc)
 	return true;
 }
 
+// Work for one thread while loading. A job that fails is run again on the
+// loading thread, which then fails the same way the loader does in order
+struct _ftmdocument_loadjob_t
+{
+	FtmDocument *doc;
+
+	// PATTERNS: the chunks of one channel of one song, in file order
+	const std::vector<_ftmdocument_patternchunk_t> *chunks;
+	std::vector<unsigned int> items;
+	CPatternData *tune;
+	unsigned int fileVersion;
+	unsigned char chip;
+
+	// DPCM SAMPLES
+	const stDocumentBlock *block;
+
+	bool failed;
+	unsigned int failedItem;
+};
+
+namespace
+{
+	class LoadEvent : public core::threadpool::Event
+	{
+	public:
+		typedef void (*job_f)(void *job);
+		LoadEvent(job_f f, void *job) : m_f(f), m_job(job){}
+		void run(void *data) const
+		{
+			m_f(m_job);
+		}
+	private:
+		job_f m_f;
+		void *m_job;
+	};
+
+	// orders chunks by song and channel
+	class ChunkOrder
+	{
+	public:
+		ChunkOrder(const std::vector<_ftmdocument_patternchunk_t> &chunks) : m_chunks(chunks){}
+		bool operator()(unsigned int a, unsigned int b) const
+		{
+			return key(m_chunks[a]) < key(m_chunks[b]);
+		}
+	private:
+		static unsigned int key(const _ftmdocument_patternchunk_t &c)
+		{
+			return c.track * MAX_CHANNELS + c.channel;
+		}
+		const std::vector<_ftmdocument_patternchunk_t> &m_chunks;
+	};
+}
+
+static void decode_patterns_job(void *data)
+{
+	_ftmdocument_loadjob_t *job = (_ftmdocument_loadjob_t*)data;
+	unsigned int i = 0;
+	try
+	{
+		for (; i < job->items.size(); i++)
+		{
+			const _ftmdocument_patternchunk_t &c = (*job->chunks)[job->items[i]];
+			decode_pattern_chunk(c, job->tune, job->fileVersion, job->chip);
+		}
+		job->tune->CompactChannel((*job->chunks)[job->items[0]].channel);
+	}
+	catch (...)
+	{
+		job->failed = true;
+		job->failedItem = i < job->items.size() ? job->items[i] : 0;
+	}
+}
+
+static void run_load_queue(core::threadpool::Queue *queue)
+{
+	queue->run(NULL);
+}
+
+void FtmDocument::readNew_dsamplesJob(void *data)
+{
+	_ftmdocument_loadjob_t *job = (_ftmdocument_loadjob_t*)data;
+	try
+	{
+		Document doc;
+		doc.openBlock(*job->block);
+		job->doc->readNew_dsamples(&doc);
+	}
+	catch (...)
+	{
+		job->failed = true;
+	}
+}
+
+bool FtmDocument::readNew_parallel(Document *doc, unsigned int threads)
+{
+	std::vector<stDocumentBlock> blocks;
+	if (!doc->readBlocks(blocks))
+		return false;
+
+	// The patterns and DPCM samples only fill in their own data, so they are
+	// decoded after the other blocks. A block after the patterns could
+	// change how they decode, such files are decoded in order
+	int patternsBlock = -1, dsamplesBlock = -1;
+	bool ordered = false;
+	for (unsigned int i = 0; i < blocks.size(); i++)
+	{
+		if (strcmp(blocks[i].id, FILE_BLOCK_PATTERNS) == 0)
+		{
+			ordered |= patternsBlock >= 0;
+			patternsBlock = i;
+		}
+		else if (strcmp(blocks[i].id, FILE_BLOCK_DSAMPLES) == 0)
+		{
+			ordered |= dsamplesBlock >= 0;
+			dsamplesBlock = i;
+		}
+		else
+		{
+			ordered |= patternsBlock >= 0;
+		}
+	}
+	if (ordered)
+	{
+		patternsBlock = -1;
+		dsamplesBlock = -1;
+	}
+
+	// Everything but the rows is read here
+	std::vector<_ftmdocument_patternchunk_t> chunks;
+	for (unsigned int i = 0; i < blocks.size(); i++)
+	{
+		doc->openBlock(blocks[i]);
+		if ((int)i == patternsBlock)
+		{
+			if (!readNew_patternChunks(doc, chunks))
+				return false;
+		}
+		else if ((int)i != dsamplesBlock)
+		{
+			if (!readNew_block(doc))
+				return false;
+		}
+	}
+
+	// One job for each channel of each song, the channels of a song are
+	// stored apart. The chunks of a job keep their file order, so a row
+	// written twice ends up the same
+	std::vector<unsigned int> order(chunks.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), ChunkOrder(chunks));
+
+	std::vector<_ftmdocument_loadjob_t> jobs;
+	_ftmdocument_loadjob_t job;
+	job.doc = this;
+	job.chunks = &chunks;
+	job.tune = NULL;
+	job.fileVersion = m_iFileVersion;
+	job.chip = GetExpansionChip();
+	job.block = NULL;
+	job.failed = false;
+	job.failedItem = 0;
+
+	for (unsigned int i = 0; i < order.size(); i++)
+	{
+		const _ftmdocument_patternchunk_t &c = chunks[order[i]];
+		if (i == 0 || c.track != chunks[order[i-1]].track || c.channel != chunks[order[i-1]].channel)
+		{
+			jobs.push_back(job);
+			jobs.back().tune = m_pTunes[c.track];
+		}
+		jobs.back().items.push_back(order[i]);
+	}
+	unsigned int patternJobs = jobs.size();
+
+	if (dsamplesBlock >= 0)
+	{
+		jobs.push_back(job);
+		jobs.back().tune = NULL;
+		jobs.back().block = &blocks[dsamplesBlock];
+	}
+
+	if (jobs.empty())
+		return true;
+
+	core::threadpool::Queue queue;
+	std::vector<core::threadpool::BlockHandle*> handles;
+	for (unsigned int i = 0; i < jobs.size(); i++)
+	{
+		LoadEvent *e;
+		if (i < patternJobs)
+			e = new LoadEvent(decode_patterns_job, &jobs[i]);
+		else
+			e = new LoadEvent(readNew_dsamplesJob, &jobs[i]);
+		handles.push_back(queue.postEventWithBlockHandle(e));
+	}
+
+	std::vector<boost::thread*> workers;
+	for (unsigned int i = 0; i < threads && i < jobs.size(); i++)
+		workers.push_back(new boost::thread(run_load_queue, &queue));
+
+	for (unsigned int i = 0; i < handles.size(); i++)
+		core::threadpool::blockOnHandle(handles[i]);
+
+	queue.setDoKeepRunning(false);
+	for (unsigned int i = 0; i < workers.size(); i++)
+	{
+		workers[i]->join();
+		delete workers[i];
+	}
+
+	// Fail with the first failing block, and its first failing chunk
+	int failedPatterns = -1;
+	for (unsigned int i = 0; i < patternJobs; i++)
+	{
+		if (jobs[i].failed && (failedPatterns < 0 || jobs[i].failedItem < (unsigned int)failedPatterns))
+			failedPatterns = jobs[i].failedItem;
+	}
+	bool failedSamples = dsamplesBlock >= 0 && jobs.back().failed;
+
+	if (failedSamples && (failedPatterns < 0 || dsamplesBlock < patternsBlock))
+	{
+		doc->openBlock(blocks[dsamplesBlock]);
+		readNew_dsamples(doc);
+		throw FtmDocumentException::GENERALREADFAILURE;
+	}
+	if (failedPatterns >= 0)
+	{
+		const _ftmdocument_patternchunk_t &c = chunks[failedPatterns];
+		decode_pattern_chunk(c, m_pTunes[c.track], m_iFileVersion, GetExpansionChip());
+		throw FtmDocumentException::GENERALREADFAILURE;
+	}
+
+	// the decoded rows don't go through SetDataAtPattern(), but a loaded
+	// document is flagged the same
+	if (!chunks.empty())
+		SetModifiedFlag();
+
+	return true;
+}
+
 bool FtmDocument::readNew_sequences_vrc6(Document *doc)
 {
 	unsigned int count = 0, index, type;
@@ -1609,6 +2119,14 @@ unsigned int FtmDocument::getFramePlayLength(unsigned int frame) const
 	return m_pSelectedTune->getFramePlayLength(frame, GetAvailableChannels());
 }
 
+unsigned int FtmDocument::getFramePlayLength(unsigned int Track, unsigned int frame) const
+{
+	ftkr_Assert(Track < MAX_TRACKS);
+	ftkr_Assert(frame < GetFrameCount(Track));
+
+	return m_pTunes[Track]->getFramePlayLength(frame, GetAvailableChannels());
+}
+
 unsigned int FtmDocument::GetEffColumns(int Track, unsigned int Channel) const
 {
 	ftkr_Assert(Channel < MAX_CHANNELS);
@@ -1650,6 +2168,7 @@ void FtmDocument::SetPatternAtFrame(unsigned int Frame, unsigned int Channel, un
 	ftkr_Assert(Frame < MAX_FRAMES && Channel < MAX_CHANNELS && Pattern < MAX_PATTERN);
 	m_pSelectedTune->SetFramePattern(Frame, Channel, Pattern);
 //	SetModifiedFlag();
+	m_iRevision++;
 }
 
 int FtmDocument::GetFirstFreePattern(int Channel)
@@ -1728,7 +2247,6 @@ void FtmDocument::IncreaseInstrument(unsigned int Frame, unsigned int Channel, u
 	{
 		note.Instrument++;
 		SetNoteData(Frame, Channel, Row, &note);
-		SetModifiedFlag();
 		UpdateViews();
 	}
 }
@@ -1747,7 +2265,6 @@ void FtmDocument::DecreaseInstrument(unsigned int Frame, unsigned int Channel, u
 	{
 		note.Instrument--;
 		SetNoteData(Frame, Channel, Row, &note);
-		SetModifiedFlag();
 		UpdateViews();
 	}
 }
@@ -1766,7 +2283,6 @@ void FtmDocument::IncreaseVolume(unsigned int Frame, unsigned int Channel, unsig
 	{
 		note.Vol++;
 		SetNoteData(Frame, Channel, Row, &note);
-		SetModifiedFlag();
 		UpdateViews();
 	}
 }
@@ -1785,7 +2301,6 @@ void FtmDocument::DecreaseVolume(unsigned int Frame, unsigned int Channel, unsig
 	{
 		note.Vol--;
 		SetNoteData(Frame, Channel, Row, &note);
-		SetModifiedFlag();
 		UpdateViews();
 	}
 }
@@ -1805,7 +2320,6 @@ void FtmDocument::IncreaseEffect(unsigned int Frame, unsigned int Channel, unsig
 	{
 		note.EffParam[Index]++;
 		SetNoteData(Frame, Channel, Row, &note);
-		SetModifiedFlag();
 		UpdateViews();
 	}
 }
@@ -1825,7 +2339,6 @@ void FtmDocument::DecreaseEffect(unsigned int Frame, unsigned int Channel, unsig
 	{
 		note.EffParam[Index]--;
 		SetNoteData(Frame, Channel, Row, &note);
-		SetModifiedFlag();
 		UpdateViews();
 	}
 }
@@ -1855,7 +2368,7 @@ void FtmDocument::SetNoteData(unsigned int Frame, unsigned int Channel, unsigned
 
 	// Get notes from the pattern
 	m_pSelectedTune->SetPatternData(Channel, GET_PATTERN(Frame, Channel), Row, Data);
-	SetModifiedFlag();
+	SetRowsModified(m_iTrack, GET_PATTERN(Frame, Channel), Channel, Row, Row);
 }
 
 void FtmDocument::GetNoteData(unsigned int Frame, unsigned int Channel, unsigned int Row, stChanNote *Data) const
@@ -1877,7 +2390,7 @@ void FtmDocument::SetDataAtPattern(unsigned int Track, unsigned int Pattern, uns
 
 	// Set a note to a direct pattern
 	m_pTunes[Track]->SetPatternData(Channel, Pattern, Row, Data);
-	SetModifiedFlag();
+	SetRowsModified(Track, Pattern, Channel, Row, Row);
 }
 
 void FtmDocument::GetDataAtPattern(unsigned int Track, unsigned int Pattern, unsigned int Channel, unsigned int Row, stChanNote *Data) const
@@ -1891,6 +2404,42 @@ void FtmDocument::GetDataAtPattern(unsigned int Track, unsigned int Pattern, uns
 	m_pTunes[Track]->GetPatternData(Channel,Pattern, Row, Data);
 }
 
+void FtmDocument::SetRowsModified(unsigned int Track, unsigned int Pattern, unsigned int Channel, unsigned int FirstRow, unsigned int LastRow)
+{
+	SetModifiedFlag();
+
+	stDirtyRows rows;
+	rows.Revision = m_iRevision;
+	rows.Track = Track;
+	rows.Pattern = Pattern;
+	rows.Channel = Channel;
+	rows.FirstRow = FirstRow;
+	rows.LastRow = LastRow;
+
+	if (m_dirtyRows.size() == MAX_DIRTY_ROWS)
+		m_dirtyRows.pop_front();
+	m_dirtyRows.push_back(rows);
+}
+
+bool FtmDocument::GetDirtyRows(unsigned int Revision, std::vector<stDirtyRows> &Rows) const
+{
+	unsigned int changes = m_iRevision - Revision;
+	if (changes == 0)
+		return true;
+	if (changes > m_dirtyRows.size())
+		return false;
+
+	// Every revision since must have been bumped by a pattern edit. The
+	// revisions in the list only grow, so the newest entries must run from
+	// Revision+1 to the current one.
+	std::deque<stDirtyRows>::const_iterator first = m_dirtyRows.end() - changes;
+	if (first->Revision != Revision + 1 || m_dirtyRows.back().Revision != m_iRevision)
+		return false;
+
+	Rows.insert(Rows.end(), first, m_dirtyRows.end());
+	return true;
+}
+
 unsigned int FtmDocument::GetNoteEffectType(unsigned int Frame, unsigned int Channel, unsigned int Row, int Index) const
 {
 	ftkr_Assert(Frame < MAX_FRAMES);
@@ -1943,8 +2492,6 @@ bool FtmDocument::InsertNote(unsigned int Frame, unsigned int Channel, unsigned
 
 	SetNoteData(Frame, Channel, Row, &Note);
 
-	SetModifiedFlag();
-
 	return true;
 }
 
@@ -1984,8 +2531,6 @@ bool FtmDocument::DeleteNote(unsigned int Frame, unsigned int Channel, unsigned
 
 	SetNoteData(Frame, Channel, Row, &note);
 
-	SetModifiedFlag();
-
 	return true;
 }
 
@@ -2007,8 +2552,6 @@ bool FtmDocument::ClearRow(unsigned int Frame, unsigned int Channel, unsigned in
 
 	SetNoteData(Frame, Channel, Row, &note);
 
-	SetModifiedFlag();
-
 	return true;
 }
 
@@ -2043,8 +2586,6 @@ bool FtmDocument::RemoveNote(unsigned int Frame, unsigned int Channel, unsigned
 
 	SetNoteData(Frame, Channel, m_pSelectedTune->GetPatternLength() - 1, &Note);
 
-	SetModifiedFlag();
-
 	return true;
 }
 
@@ -2211,6 +2752,7 @@ int FtmDocument::GetVibratoStyle() const
 void FtmDocument::SetVibratoStyle(int Style)
 {
 	m_iVibratoStyle = Style;
+	m_iRevision++;
 	// TODO - dan
 //	theApp.GetSoundGenerator()->GenerateVibratoTable(Style);
 }
@@ -2223,6 +2765,7 @@ bool FtmDocument::GetLinearPitch() const
 void FtmDocument::SetLinearPitch(bool enable)
 {
 	m_bLinearPitch = enable;
+	m_iRevision++;
 }
 
 const std::string & FtmDocument::GetComment() const
@@ -2243,6 +2786,7 @@ int FtmDocument::GetSpeedSplitPoint() const
 void FtmDocument::SetSpeedSplitPoint(int splitPoint)
 {
 	m_iSpeedSplitPoint = splitPoint;
+	m_iRevision++;
 }
 
 // Track functions
@@ -2251,6 +2795,7 @@ void FtmDocument::SelectTrack(unsigned int Track)
 {
 	ftkr_Assert(Track < MAX_TRACKS);
 	SwitchToTrack(Track);
+	m_iRevision++;
 	UpdateViews();
 }
 
@@ -2357,6 +2902,8 @@ CInstrument *FtmDocument::GetInstrument(int Index)
 {
 	// This may return a NULL pointer
 	ftkr_Assert(Index >= 0 && Index < MAX_INSTRUMENTS);
+	// The caller may change it
+	m_iRevision++;
 	return m_pInstruments[Index];
 }
 
@@ -2664,6 +3211,8 @@ CSequence * FtmDocument::GetSequence2A03(int Index, int Type)
 	if (m_pSequences2A03[Index][Type] == NULL)
 		m_pSequences2A03[Index][Type] = new CSequence();
 
+	// The caller may change it
+	m_iRevision++;
 	return m_pSequences2A03[Index][Type];
 }
 
@@ -2725,6 +3274,8 @@ CSequence *FtmDocument::GetSequenceVRC6(int Index, int Type)
 	if (m_pSequencesVRC6[Index][Type] == NULL)
 		m_pSequencesVRC6[Index][Type] = new CSequence();
 
+	// The caller may change it
+	m_iRevision++;
 	return m_pSequencesVRC6[Index][Type];
 }
 
@@ -2759,6 +3310,8 @@ int FtmDocument::GetFreeSequenceVRC6(int Type) const
 CDSample * FtmDocument::GetDSample(unsigned int Index)
 {
 	ftkr_Assert(Index < MAX_DSAMPLES);
+	// The caller may change it
+	m_iRevision++;
 	return &m_DSamples[Index];
 }
 
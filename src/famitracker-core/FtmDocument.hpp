@@ -10,6 +10,7 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 
 class CPatternData;
 class Document;
@@ -18,6 +19,8 @@ namespace core
 	class IO;
 }
 class CTrackerChannel;
+struct _ftmdocument_snapshots_t;
+struct _ftmdocument_patternchunk_t;
 
 namespace boost
 {
@@ -48,6 +51,15 @@ enum
 	C_EFF_PARAM_COUNT=2
 };
 
+// Rows of a pattern changed by an edit
+struct stDirtyRows {
+	unsigned int Revision;		// Document revision after the edit
+	unsigned int Track;
+	unsigned int Pattern;
+	unsigned int Channel;
+	unsigned int FirstRow, LastRow;
+};
+
 // Old sequence list, kept for compability
 struct stSequence {
 	unsigned int Count;
@@ -108,9 +120,25 @@ public:
 	void lock() const;
 	void unlock() const;
 
+	// Player snapshots
+	// The player reads an immutable copy of the document, so it never waits
+	// for the editor. While publishing is on, unlock() publishes a new copy
+	// if the document was changed under the lock.
+	// Only one player may take snapshots from a document.
+	FtmDocument *	snapshot() const;							// Call while locked
+	// Copy of another track, with it selected. Only reads, so a document
+	// nobody edits can be copied from several threads without locking it
+	FtmDocument *	snapshot(unsigned int Track) const;
+	void			setPublishSnapshots(bool publish);			// Call while locked
+	FtmDocument *	swapSnapshot(FtmDocument *current);			// Lock-free, player only
+
 	void createEmpty();
 
-	void read(core::IO *io);
+	// With threads > 1, the patterns and DPCM samples are decoded on that
+	// many threads. The document is the same either way
+	void read(core::IO *io, unsigned int threads = 1);
+	// Number of tracks in a module, read from its header without loading it
+	static unsigned int readTrackCount(core::IO *io);
 	void write(core::IO *io) const;
 
 	bool doForceBackup() const{ return bForceBackup; }
@@ -143,6 +171,7 @@ public:
 	unsigned int	GetSongTempo(int Track)		const { return m_pTunes[Track]->GetSongTempo(); }
 
 	unsigned int	getFramePlayLength(unsigned int frame) const;
+	unsigned int	getFramePlayLength(unsigned int Track, unsigned int frame) const;
 
 	unsigned int	GetEffColumns(int Track, unsigned int Channel) const;
 	unsigned int	GetEffColumns(unsigned int Channel) const;
@@ -278,7 +307,13 @@ public:
 
 	void			AllocateSong(unsigned int Song);
 
-	void SetModifiedFlag(bool modified=true){ m_bModified = modified; }
+	void SetModifiedFlag(bool modified=true){ m_bModified = modified; m_iRevision++; }
+	unsigned int GetRevision() const{ return m_iRevision; }
+
+	// Appends the pattern rows edited since Revision, so views can redraw
+	// only those. Returns false if anything else changed since, or if
+	// Revision is too old to tell
+	bool			GetDirtyRows(unsigned int Revision, std::vector<stDirtyRows> &Rows) const;
 	void UpdateViews(){ /* TODO - dan */ }
 
 	int				GetHighlight() const{ return m_highlight; }
@@ -288,7 +323,9 @@ public:
 private:
 	bool bForceBackup;
 	bool readOld(Document *doc);
-	bool readNew(Document *doc);
+	bool readNew(Document *doc, unsigned int threads);
+	bool readNew_block(Document *doc);
+	bool readNew_parallel(Document *doc, unsigned int threads);
 
 	bool readNew_params(Document *doc);
 	bool readNew_header(Document *doc);
@@ -296,9 +333,13 @@ private:
 	bool readNew_sequences(Document *doc);
 	bool readNew_frames(Document *doc);
 	bool readNew_patterns(Document *doc);
+	bool readNew_patternChunks(Document *doc, std::vector<_ftmdocument_patternchunk_t> &chunks);
 	bool readNew_dsamples(Document *doc);
+	static void readNew_dsamplesJob(void *data);
 	bool readNew_sequences_vrc6(Document *doc);
 
+	void SetRowsModified(unsigned int Track, unsigned int Pattern, unsigned int Channel, unsigned int FirstRow, unsigned int LastRow);
+
 	bool writeBlocks(Document *doc) const;
 	bool write_params(Document *doc) const;
 	bool write_songinfo(Document *doc) const;
@@ -361,6 +402,15 @@ private:
 	std::vector<int> m_channelsFromChip;
 
 	boost::mutex *	m_modifyLock;
+
+	// Bumped on every change, tells unlock() to publish a snapshot
+	unsigned int	m_iRevision;
+	_ftmdocument_snapshots_t * m_snapshots;
+
+	// The latest pattern edits, one per revision they bumped
+	std::deque<stDirtyRows>	m_dirtyRows;
+
+	void freeRetiredSnapshots() const;
 };
 
 class FtmDocument_lock_guard
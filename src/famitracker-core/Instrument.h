@@ -53,7 +53,7 @@ static inline bool fami_isInstrumentImplemented(int type)
 const unsigned int MAX_INSTRUMENT_NAME_LENGTH = 127;	// not including null char
 
 // External classes
-//class CCompiler;
+class CCompiler;
 class Document;
 class CSequence;
 class FtmDocument;
@@ -62,8 +62,6 @@ namespace core
 	class IO;
 }
 
-// TODO - dan: CCompiler
-
 // Instrument base class
 class FAMICOREAPI CInstrument {
 public:
@@ -80,8 +78,8 @@ public:
 	virtual bool Load(Document *doc) = 0;											// Loads the instrument from a module
 	virtual void SaveFile(core::IO *file, FtmDocument *pDoc) = 0;							// Saves to an FTI file
 	virtual bool LoadFile(core::IO *file, int iVersion, FtmDocument *pDoc) = 0;			// Loads from an FTI file
-//	virtual int CompileSize(CCompiler *pCompiler) = 0;								// Gets the compiled size
-//	virtual int Compile(CCompiler *pCompiler, int Index) = 0;						// Compiles the instrument for NSF generation
+	virtual int CompileSize(CCompiler *pCompiler) = 0;								// Gets the compiled size
+	virtual int Compile(CCompiler *pCompiler, int Index) = 0;						// Compiles the instrument for NSF generation
 	virtual bool CanRelease(FtmDocument *doc) const = 0;
 protected:
 	void InstrumentChanged() const;
@@ -100,8 +98,8 @@ public:
 	virtual bool Load(Document *doc);
 	virtual void SaveFile(core::IO *file, FtmDocument *pDoc);
 	virtual bool LoadFile(core::IO *file, int iVersion, FtmDocument *pDoc);
-//	virtual int CompileSize(CCompiler *pCompiler);
-//	virtual int Compile(CCompiler *pCompiler, int Index);
+	virtual int CompileSize(CCompiler *pCompiler);
+	virtual int Compile(CCompiler *pCompiler, int Index);
 	virtual bool CanRelease(FtmDocument *doc) const;
 
 public:
@@ -150,8 +148,8 @@ public:
 	virtual bool Load(Document *pDocFile);
 	virtual void SaveFile(core::IO *file, FtmDocument *doc);
 	virtual bool LoadFile(core::IO *pFile, int iVersion, FtmDocument *pDoc);
-//	virtual int CompileSize(CCompiler *pCompiler);
-//	virtual int Compile(CCompiler *pCompiler, int Index);
+	virtual int CompileSize(CCompiler *pCompiler);
+	virtual int Compile(CCompiler *pCompiler, int Index);
 	virtual bool CanRelease(FtmDocument *doc) const;
 public:
 	int		GetSeqEnable(int Index) const;
@@ -176,8 +174,8 @@ public:
 	virtual bool Load(Document *doc);
 	virtual void SaveFile(core::IO *file, FtmDocument *doc);
 	virtual bool LoadFile(core::IO *file, int iVersion, FtmDocument *doc);
-//	virtual int CompileSize(CCompiler *pCompiler);
-//	virtual int Compile(CCompiler *pCompiler, int Index);
+	virtual int CompileSize(CCompiler *pCompiler);
+	virtual int Compile(CCompiler *pCompiler, int Index);
 	virtual bool CanRelease(FtmDocument *doc) const;
 public:
 	void		 SetPatch(unsigned int Patch);
@@ -200,8 +198,8 @@ public:
 	virtual bool Load(Document *pDocFile);
 	virtual void SaveFile(core::IO *file, FtmDocument *pDoc);
 	virtual bool LoadFile(core::IO *file, int iVersion, FtmDocument *pDoc);
-//	virtual int CompileSize(CCompiler *pCompiler);
-//	virtual int Compile(CCompiler *pCompiler, int Index);
+	virtual int CompileSize(CCompiler *pCompiler);
+	virtual int Compile(CCompiler *pCompiler, int Index);
 	virtual bool CanRelease(FtmDocument *doc) const;
 public:
 	unsigned char GetSample(int Index) const;
@@ -23,7 +23,7 @@
 #include "Document.hpp"
 #include "FtmDocument.hpp"
 #include "Sequence.h"
-//#include "Compiler.h"
+#include "Compiler.h"
 
 // 2A03 instruments
 
@@ -420,19 +420,18 @@ bool CInstrument2A03::LoadFile(core::IO *file, int iVersion, FtmDocument *pDoc)
 
 	return true;
 }
-// TODO - dan
-/*
+
 int CInstrument2A03::CompileSize(CCompiler *pCompiler)
 {
 	int Size = 1;
-	CFamiTrackerDoc *pDoc = pCompiler->GetDocument();
+	const FtmDocument *pDoc = pCompiler->GetDocument();
 
 	for (int i = 0; i < SEQUENCE_COUNT; i++)
 	{
 		if (GetSeqEnable(i))
 		{
-			CSequence *pSeq = pDoc->GetSequence(GetSeqIndex(i), i);
-			if (pSeq->GetItemCount() > 0)
+			const CSequence *pSeq = pDoc->GetSequence_readonly(SNDCHIP_NONE, GetSeqIndex(i), i);
+			if (pSeq != NULL && pSeq->GetItemCount() > 0)
 				Size += 2;
 		}
 	}
@@ -442,39 +441,35 @@ int CInstrument2A03::CompileSize(CCompiler *pCompiler)
 
 int CInstrument2A03::Compile(CCompiler *pCompiler, int Index)
 {
-	int ModSwitch;
+	int ModSwitch = 0;
 	int StoredBytes = 0;
-	int iAddress;
+	bool Used[SEQUENCE_COUNT];
 	int i;
 
-	CFamiTrackerDoc *pDoc = pCompiler->GetDocument();
+	const FtmDocument *pDoc = pCompiler->GetDocument();
 
-	pCompiler->WriteLog("2A03 {");
-	ModSwitch = 0;
-	
 	for (i = 0; i < SEQUENCE_COUNT; i++)
 	{
-		ModSwitch = (ModSwitch >> 1) | ((GetSeqEnable(i) && (pDoc->GetSequence(GetSeqIndex(i), i)->GetItemCount() > 0)) ? 0x10 : 0);
+		const CSequence *pSeq = GetSeqEnable(i) ? pDoc->GetSequence_readonly(SNDCHIP_NONE, GetSeqIndex(i), i) : NULL;
+		Used[i] = (pSeq != NULL && pSeq->GetItemCount() > 0);
+		ModSwitch = (ModSwitch >> 1) | (Used[i] ? 0x10 : 0);
 	}
-	
+
 	pCompiler->StoreByte(ModSwitch);
-	pCompiler->WriteLog("%02X ", ModSwitch);
 	StoredBytes++;
 
 	for (i = 0; i < SEQUENCE_COUNT; i++)
 	{
-		iAddress = (GetSeqEnable(i) == 0 || (pDoc->GetSequence(GetSeqIndex(i), i)->GetItemCount() == 0)) ? 0 : pCompiler->GetSequenceAddress2A03(GetSeqIndex(i), i);
-		if (iAddress > 0)
+		if (Used[i])
 		{
-			pCompiler->StoreShort(iAddress);
-			pCompiler->WriteLog("%04X ", iAddress);
+			pCompiler->StoreShort(pCompiler->GetSequenceAddress2A03(GetSeqIndex(i), i));
 			StoredBytes += 2;
 		}
 	}
 
 	return StoredBytes;
 }
-*/
+
 bool CInstrument2A03::CanRelease(FtmDocument *doc) const
 {
 	if (GetSeqEnable(0) != 0)
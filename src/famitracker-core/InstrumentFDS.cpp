@@ -24,7 +24,7 @@
 #include "Document.hpp"
 #include "Instrument.h"
 #include "Sequence.h"
-//#include "Compiler.h"
+#include "Compiler.h"
 //#include "DocumentFile.h"
 
 const char TEST_WAVE[] = {
@@ -328,7 +328,7 @@ bool CInstrumentFDS::LoadFile(core::IO *file, int iVersion, FtmDocument *pDoc)
 
 	return true;
 }
-/*
+
 int CInstrumentFDS::CompileSize(CCompiler *pCompiler)
 {
 	int size = FIXED_FDS_INST_SIZE;
@@ -340,14 +340,10 @@ int CInstrumentFDS::CompileSize(CCompiler *pCompiler)
 
 int CInstrumentFDS::Compile(CCompiler *pCompiler, int Index)
 {
-	pCompiler->writeLog("FDS {");
-
 	// Store wave
 	int Table = pCompiler->AddWavetable(m_iSamples);
 	pCompiler->StoreByte(Table);	// waveform
 
-	pCompiler->writeLog("%i", Table);
-
 	// Store modulation table, two entries/byte
 	for (int i = 0; i < 16; i++)
 	{
@@ -366,19 +362,19 @@ int CInstrumentFDS::Compile(CCompiler *pCompiler, int Index)
 
 	// Volume
 	if (Switch & 1)
-		pCompiler->StoreShort(pCompiler->GetSequenceAddressFDS(Index, 0));
+		pCompiler->StoreShort(pCompiler->GetSequenceAddressFDS(Index, SEQ_VOLUME));
 
 	// Arpeggio
 	if (Switch & 2)
-		pCompiler->StoreShort(pCompiler->GetSequenceAddressFDS(Index, 1));
+		pCompiler->StoreShort(pCompiler->GetSequenceAddressFDS(Index, SEQ_ARPEGGIO));
 	
 	// Pitch
 	if (Switch & 4)
-		pCompiler->StoreShort(pCompiler->GetSequenceAddressFDS(Index, 2));
+		pCompiler->StoreShort(pCompiler->GetSequenceAddressFDS(Index, SEQ_PITCH));
 
 	return CompileSize(pCompiler);
 }
-*/
+
 bool CInstrumentFDS::CanRelease(FtmDocument *doc) const
 {
 	if (m_pVolume->GetItemCount() > 0)
@@ -22,7 +22,7 @@
 #include "Document.hpp"
 #include "FtmDocument.hpp"
 #include "Sequence.h"
-//#include "Compiler.h"
+#include "Compiler.h"
 
 /*
  * class CInstrumentVRC6
@@ -190,54 +190,56 @@ bool CInstrumentVRC6::LoadFile(core::IO *file, int iVersion, FtmDocument *doc)
 
 	return true;
 }
-/*
+
 int CInstrumentVRC6::CompileSize(CCompiler *pCompiler)
 {
 	int Size = 1;
-	CFamiTrackerDoc *pDoc = pCompiler->GetDocument();
+	const FtmDocument *pDoc = pCompiler->GetDocument();
 
 	for (int i = 0; i < SEQUENCE_COUNT; i++)
-		if (GetSeqEnable(i) && pDoc->GetSequence(SNDCHIP_VRC6, GetSeqIndex(i), i)->GetItemCount() > 0)
-			Size += 2;
+	{
+		if (GetSeqEnable(i))
+		{
+			const CSequence *pSeq = pDoc->GetSequence_readonly(SNDCHIP_VRC6, GetSeqIndex(i), i);
+			if (pSeq != NULL && pSeq->GetItemCount() > 0)
+				Size += 2;
+		}
+	}
 
 	return Size;
 }
 
 int CInstrumentVRC6::Compile(CCompiler *pCompiler, int Index)
 {
-	int ModSwitch;
+	int ModSwitch = 0;
 	int StoredBytes = 0;
-	int iAddress;
+	bool Used[SEQUENCE_COUNT];
 	int i;
 
-	CFamiTrackerDoc *pDoc = pCompiler->GetDocument();
-
-	pCompiler->writeLog("VRC6 {");
-	ModSwitch = 0;
+	const FtmDocument *pDoc = pCompiler->GetDocument();
 
 	for (i = 0; i < SEQUENCE_COUNT; i++)
 	{
-		ModSwitch = (ModSwitch >> 1) | (GetSeqEnable(i) && (pDoc->GetSequence(SNDCHIP_VRC6, GetSeqIndex(i), i)->GetItemCount() > 0) ? 0x10 : 0);
+		const CSequence *pSeq = GetSeqEnable(i) ? pDoc->GetSequence_readonly(SNDCHIP_VRC6, GetSeqIndex(i), i) : NULL;
+		Used[i] = (pSeq != NULL && pSeq->GetItemCount() > 0);
+		ModSwitch = (ModSwitch >> 1) | (Used[i] ? 0x10 : 0);
 	}
 
 	pCompiler->StoreByte(ModSwitch);
-	pCompiler->writeLog("%02X ", ModSwitch);
 	StoredBytes++;
 
 	for (i = 0; i < SEQUENCE_COUNT; i++)
 	{
-		iAddress = (GetSeqEnable(i) == 0 || (pDoc->GetSequence(SNDCHIP_VRC6, GetSeqIndex(i), i)->GetItemCount() == 0)) ? 0 : pCompiler->GetSequenceAddressVRC6(GetSeqIndex(i), i);
-		if (iAddress > 0)
+		if (Used[i])
 		{
-			pCompiler->StoreShort(iAddress);
-			pCompiler->writeLog("%04X ", iAddress);
+			pCompiler->StoreShort(pCompiler->GetSequenceAddressVRC6(GetSeqIndex(i), i));
 			StoredBytes += 2;
 		}
 	}
-	
+
 	return StoredBytes;
 }
-*/
+
 bool CInstrumentVRC6::CanRelease(FtmDocument *doc) const
 {
 	if (GetSeqEnable(0) != 0)
@@ -23,6 +23,7 @@
 #include "Document.hpp"
 #include "FtmDocument.hpp"
 #include "Sequence.h"
+#include "Compiler.h"
 
 /*
  * class CInstrumentVRC7
@@ -103,6 +104,25 @@ bool CInstrumentVRC7::LoadFile(core::IO *file, int iVersion, FtmDocument *doc)
 	return true;
 }
 
+int CInstrumentVRC7::CompileSize(CCompiler *pCompiler)
+{
+	// Custom patches store their registers
+	return (m_iPatch == 0) ? 9 : 1;
+}
+
+int CInstrumentVRC7::Compile(CCompiler *pCompiler, int Index)
+{
+	pCompiler->StoreByte(m_iPatch << 4);
+
+	if (m_iPatch == 0)
+	{
+		for (int i = 0; i < 8; i++)
+			pCompiler->StoreByte(GetCustomReg(i));
+	}
+
+	return CompileSize(pCompiler);
+}
+
 bool CInstrumentVRC7::CanRelease(FtmDocument *doc) const
 {
 	return false;	// This can use release but disable it when previewing notes
@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <string.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include "NSFPlayer.hpp"
+#include "CPU6502.hpp"
+#include "APU/APU.h"
+#include "core/io.hpp"
+#include "core/spscringbuffer.hpp"
+
+static const unsigned int HEADER_SIZE = 0x80;
+static const unsigned int BANK_SIZE = 0x1000;
+
+// Used when the header has no speed
+static const unsigned int DEFAULT_SPEED_NTSC = 16639;
+static const unsigned int DEFAULT_SPEED_PAL = 19997;
+
+// Chips CAPU can emulate
+static const unsigned char SUPPORTED_CHIPS = SNDCHIP_VRC6 | SNDCHIP_VRC7 | SNDCHIP_FDS | SNDCHIP_MMC5 | SNDCHIP_N106;
+
+struct _nsfplayer_threading_t
+{
+	boost::mutex mtx_running;
+};
+
+static unsigned int read_short(const core::u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void read_string(char *dst, const core::u8 *src)
+{
+	memcpy(dst, src, 32);
+	dst[32] = 0;
+}
+
+NSFPlayer::NSFPlayer()
+	: m_sink(NULL),
+	  m_updateCallback(NULL), m_updateData(NULL),
+	  m_writeCallback(NULL), m_writeData(NULL),
+	  m_songCount(0), m_startSong(0),
+	  m_loadAddress(0), m_initAddress(0), m_playAddress(0),
+	  m_speedNTSC(0), m_speedPAL(0), m_pal(false), m_chip(0), m_bankswitched(false),
+	  m_playing(false), m_inFrame(false), m_frame(0), m_timerFrame(0),
+	  m_frameCycles(0), m_frameFraction(0), m_frameFractionAccum(0),
+	  m_lastWriteCycle(0), m_playCycles(0),
+	  m_sinkStopSamples(-1),
+	  m_renderEnd(false), m_renderEndFrames(0)
+{
+	m_title[0] = m_artist[0] = m_copyright[0] = 0;
+	memset(m_initBanks, 0, sizeof(m_initBanks));
+
+	m_cpu = new CPU6502;
+	m_cpu->setHandlers(readCallback, writeCallback, this);
+	m_samplemem = new CSampleMem;
+	m_apu = new CAPU(m_samplemem);
+	m_apu->SetCallback(apuCallback, this);
+	m_queued_sound = new core::SPSCRingBuffer(sizeof(core::s16));
+	m_queued_sound->resize(16384);
+	m_threading = new _nsfplayer_threading_t;
+}
+
+NSFPlayer::~NSFPlayer()
+{
+	delete m_threading;
+	delete m_queued_sound;
+	delete m_apu;
+	delete m_samplemem;
+	delete m_cpu;
+}
+
+void NSFPlayer::load(core::IO *io)
+{
+	core::Quantity size = io->size();
+	if (size <= HEADER_SIZE)
+		throw NSFException("File is too small to be an NSF");
+
+	std::vector<core::u8> file(size);
+	if (!io->read_e(&file[0], size))
+		throw NSFException("Could not read the file");
+
+	const core::u8 *h = &file[0];
+	if (memcmp(h, "NESM\x1A", 5) != 0)
+		throw NSFException("Not an NSF file");
+
+	m_songCount = h[0x06];
+	m_startSong = h[0x07] > 0 ? h[0x07] - 1 : 0;
+	m_loadAddress = read_short(h + 0x08);
+	m_initAddress = read_short(h + 0x0A);
+	m_playAddress = read_short(h + 0x0C);
+	read_string(m_title, h + 0x0E);
+	read_string(m_artist, h + 0x2E);
+	read_string(m_copyright, h + 0x4E);
+	m_speedNTSC = read_short(h + 0x6E);
+	memcpy(m_initBanks, h + 0x70, 8);
+	m_speedPAL = read_short(h + 0x78);
+	// Dual region files play as NTSC
+	m_pal = (h[0x7A] & 0x03) == 0x01;
+	m_chip = h[0x7B];
+
+	if (m_songCount == 0)
+		throw NSFException("The file has no songs");
+
+	bool fds = (m_chip & SNDCHIP_FDS) != 0;
+	if (m_loadAddress < (fds ? 0x6000 : 0x8000))
+		throw NSFException("Invalid load address");
+
+	if (m_chip & ~SUPPORTED_CHIPS)
+		fprintf(stderr, "NSFPlayer: expansion chips 0x%02X are not emulated\n", m_chip & ~SUPPORTED_CHIPS);
+
+	m_bankswitched = false;
+	for (int i = 0; i < 8; i++)
+	{
+		if (m_initBanks[i] != 0)
+			m_bankswitched = true;
+	}
+
+	const core::u8 *data = h + HEADER_SIZE;
+	core::Quantity dataSize = size - HEADER_SIZE;
+
+	if (m_bankswitched)
+	{
+		// The data is padded to the load address within the first bank
+		unsigned int padding = m_loadAddress & (BANK_SIZE - 1);
+		unsigned int banks = (padding + dataSize + BANK_SIZE - 1) / BANK_SIZE;
+		m_rom.assign(banks * BANK_SIZE, 0);
+		memcpy(&m_rom[padding], data, dataSize);
+	}
+	else
+	{
+		// m_loadAddress is 16 bits, so this doesn't wrap
+		unsigned int room = 0x10000u - (unsigned int)m_loadAddress;
+		if ((unsigned int)dataSize > room)
+			dataSize = room;
+		m_rom.assign(data, data + dataSize);
+	}
+}
+
+double NSFPlayer::frameRate() const
+{
+	unsigned int speed = m_pal ? m_speedPAL : m_speedNTSC;
+	if (speed == 0)
+		speed = m_pal ? DEFAULT_SPEED_PAL : DEFAULT_SPEED_NTSC;
+
+	return 1000000.0 / speed;
+}
+
+double NSFPlayer::playLoad() const
+{
+	if (m_frame == 0)
+		return 0.0;
+
+	return (double)m_playCycles / ((double)m_frame * m_frameCycles);
+}
+
+void NSFPlayer::setSoundSink(core::SoundSink *s)
+{
+	if (m_sink != NULL)
+	{
+		m_sink->setPlaying(false);
+		m_sink->blockUntilTimerEmpty();
+	}
+	m_sink = s;
+
+	// a NULL sink detaches the current one
+	if (m_sink == NULL)
+	{
+		m_queued_sound->clear();
+		return;
+	}
+
+	// the sound queue holds whole sample frames of the sink
+	unsigned int sample_size = m_sink->sampleFormat() == core::SAMPLE_FLOAT ? sizeof(float) : sizeof(core::s16);
+	delete m_queued_sound;
+	m_queued_sound = new core::SPSCRingBuffer(sample_size*m_sink->channels());
+	m_queued_sound->resize(16384);
+
+	m_sink->setCallbackData(this);
+	m_sink->setSoundCallback(soundCallback);
+	m_sink->setTimeCallback(timeCallback);
+}
+
+void NSFPlayer::setRenderEnd(unsigned int frames)
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	m_renderEnd = true;
+	m_renderEndFrames = frames;
+}
+
+void NSFPlayer::clearRenderEnd()
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	m_renderEnd = false;
+}
+
+void NSFPlayer::start(unsigned int song)
+{
+	m_threading->mtx_running.lock();
+
+	if (m_playing)
+	{
+		m_threading->mtx_running.unlock();
+		return;
+	}
+
+	m_sink->blockUntilTimerEmpty();
+
+	initSong(song);
+
+	m_playing = true;
+	m_sinkStopSamples = -1;
+
+	m_threading->mtx_running.unlock();
+
+	m_sink->setPlaying(true);
+}
+
+void NSFPlayer::stop()
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	if (m_playing)
+	{
+		m_playing = false;
+		m_sinkStopSamples = m_sink->sampleRate() * 1/2;
+	}
+}
+
+bool NSFPlayer::isPlaying()
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	return m_playing;
+}
+
+void NSFPlayer::initSong(unsigned int song)
+{
+	// Call with mtx_running held
+	core::u8 *mem = m_cpu->memory();
+	bool fds = (m_chip & SNDCHIP_FDS) != 0;
+
+	memset(mem, 0, 0x800);
+	memset(mem + 0x6000, 0, 0x2000);
+	memset(mem + 0x8000, 0, 0x8000);
+
+	m_cpu->setPages(0x40, 0x20, CPU6502::PAGE_READ_IO | CPU6502::PAGE_WRITE_IO);
+	m_cpu->setPages(0x60, 0x20, CPU6502::PAGE_WRITE);
+	// Expansion chips have their registers in the ROM area, the FDS has RAM there
+	m_cpu->setPages(0x80, 0x80, CPU6502::PAGE_WRITE_IO);
+	if (fds)
+		m_cpu->setPages(0x80, 0x60, CPU6502::PAGE_WRITE);
+
+	if (m_bankswitched)
+	{
+		for (int i = 0; i < 8; i++)
+			switchBank(i + 2, m_initBanks[i]);
+		// The FDS also switches $6000-$7FFF, with the banks of $E000-$FFFF
+		if (fds)
+		{
+			switchBank(0, m_initBanks[6]);
+			switchBank(1, m_initBanks[7]);
+		}
+	}
+	else
+	{
+		memcpy(mem + m_loadAddress, &m_rom[0], m_rom.size());
+		m_samplemem->SetMem((const char*)mem + 0xC000, 0x4000);
+	}
+
+	int machine = m_pal ? MACHINE_PAL : MACHINE_NTSC;
+	m_apu->SetupSound(m_sink->sampleRate(), m_sink->channels(), machine,
+					  m_sink->sampleFormat() == core::SAMPLE_FLOAT);
+	m_apu->SetupMixer(16, 12000, 24, 100);
+	m_apu->SetExternalSound(m_chip & SUPPORTED_CHIPS);
+	m_apu->Reset();
+	m_queued_sound->clear();
+
+	// Cycles per PLAY call, the fraction is carried between frames
+	unsigned int speed = m_pal ? m_speedPAL : m_speedNTSC;
+	if (speed == 0)
+		speed = m_pal ? DEFAULT_SPEED_PAL : DEFAULT_SPEED_NTSC;
+	core::u64 cycles = (core::u64)(m_pal ? CAPU::BASE_FREQ_PAL : CAPU::BASE_FREQ_NTSC) * speed;
+	m_frameCycles = (core::u32)(cycles / 1000000);
+	m_frameFraction = (core::u32)(cycles % 1000000);
+	m_frameFractionAccum = 0;
+
+	m_frame = 0;
+	m_timerFrame = 0;
+	m_playCycles = 0;
+	m_inFrame = false;
+
+	for (core::u16 addr = 0x4000; addr < 0x4014; addr++)
+		writeIO(addr, 0, 0);
+	writeIO(0x4015, 0x0F, 0);
+	writeIO(0x4017, 0x40, 0);
+
+	// INIT is given a second. Its writes all happen before the first frame
+	m_cpu->setCycles(0);
+	if (!m_cpu->call(m_initAddress, song, m_pal ? 1 : 0, 0, m_pal ? CAPU::BASE_FREQ_PAL : CAPU::BASE_FREQ_NTSC))
+		fprintf(stderr, "NSFPlayer: INIT of song %u did not return\n", song + 1);
+}
+
+void NSFPlayer::switchBank(unsigned int slot, unsigned int bank)
+{
+	// Slot 0 is $6000, slot 2 is $8000
+	core::u8 *dst = m_cpu->memory() + 0x6000 + slot * BANK_SIZE;
+	unsigned int offset = bank * BANK_SIZE;
+
+	if (offset + BANK_SIZE <= m_rom.size())
+		memcpy(dst, &m_rom[offset], BANK_SIZE);
+	else
+		memset(dst, 0, BANK_SIZE);
+
+	// DPCM samples are read from $C000-$FFFF
+	if (slot >= 6)
+		m_samplemem->SetMem((const char*)m_cpu->memory() + 0xC000, 0x4000);
+}
+
+void NSFPlayer::runFrame()
+{
+	m_frame++;
+
+	m_cpu->setCycles(0);
+	m_lastWriteCycle = 0;
+	m_inFrame = true;
+
+	// A PLAY that doesn't return in a frame is called again on the next one
+	m_cpu->call(m_playAddress, 0, 0, 0, m_frameCycles);
+	m_playCycles += m_cpu->cycles();
+
+	m_inFrame = false;
+
+	core::u32 cycles = m_frameCycles;
+	m_frameFractionAccum += m_frameFraction;
+	if (m_frameFractionAccum >= 1000000)
+	{
+		m_frameFractionAccum -= 1000000;
+		cycles++;
+	}
+
+	// Finish the frame
+	if (cycles > m_lastWriteCycle)
+		m_apu->AddTime(cycles - m_lastWriteCycle);
+	m_apu->Process();
+}
+
+core::u8 NSFPlayer::readCallback(core::u16 addr, void *data)
+{
+	return ((NSFPlayer*)data)->readIO(addr);
+}
+
+void NSFPlayer::writeCallback(core::u16 addr, core::u8 value, core::u32 cycle, void *data)
+{
+	((NSFPlayer*)data)->writeIO(addr, value, cycle);
+}
+
+core::u8 NSFPlayer::readIO(core::u16 addr)
+{
+	if (addr == 0x4015)
+		return m_apu->Read4015();
+
+	// FDS, N106 and MMC5 registers
+	if (addr >= 0x4040)
+		return m_apu->ExternalRead(addr);
+
+	// Open bus
+	return addr >> 8;
+}
+
+void NSFPlayer::writeIO(core::u16 addr, core::u8 value, core::u32 cycle)
+{
+	if (addr >= 0x5FF6 && addr <= 0x5FFF)
+	{
+		if (m_bankswitched && (addr >= 0x5FF8 || (m_chip & SNDCHIP_FDS)))
+			switchBank(addr - 0x5FF6, value);
+		return;
+	}
+
+	// Let the APU catch up with the CPU
+	if (m_inFrame && cycle > m_lastWriteCycle)
+	{
+		m_apu->AddTime(cycle - m_lastWriteCycle);
+		m_lastWriteCycle = cycle;
+	}
+
+	if (addr < 0x4018)
+	{
+		// OAM DMA and the controller port
+		if (addr == 0x4014 || addr == 0x4016)
+			return;
+		m_apu->Write(addr, value);
+	}
+	else
+		m_apu->ExternalWrite(addr, value);
+
+	if (m_writeCallback != NULL)
+		(*m_writeCallback)(m_frame, cycle, addr, value, m_writeData);
+}
+
+void NSFPlayer::apuCallback(const void *buf, uint32 sz, void *data)
+{
+	NSFPlayer *p = (NSFPlayer*)data;
+	p->m_queued_sound->write(buf, sz);
+}
+
+core::u32 NSFPlayer::soundCallback(void *buf, core::u32 sz, void *data, core::u32 *idx)
+{
+	NSFPlayer *p = (NSFPlayer*)data;
+	return p->requestSound(buf, sz, idx);
+}
+
+core::u32 NSFPlayer::requestSound(void *buffer, core::u32 sz, core::u32 *idx)
+{
+	// sz and the time indices count sample frames
+	const core::u32 original_sz = sz;
+	const unsigned int frame_size = m_sink->channels() *
+			(m_sink->sampleFormat() == core::SAMPLE_FLOAT ? sizeof(float) : sizeof(core::s16));
+	core::u8 *buf = (core::u8*)buffer;
+	core::u32 c = 0;
+
+	// read remaining sound buffer data from the last callback
+	if (!m_queued_sound->isEmpty())
+	{
+		core::Quantity read = m_queued_sound->read(buf, sz);
+		buf += read*frame_size;
+		sz -= read;
+	}
+
+	m_threading->mtx_running.lock();
+	while (sz != 0)
+	{
+		if (!m_playing)
+		{
+			// silence while the sink drains
+			memset(buf, 0, sz*frame_size);
+			break;
+		}
+
+		runFrame();
+		idx[c++] = original_sz - sz;
+
+		if (m_renderEnd && m_frame >= m_renderEndFrames)
+		{
+			m_playing = false;
+			m_sinkStopSamples = m_sink->sampleRate() * 1/2;
+		}
+
+		core::Quantity read = m_queued_sound->read(buf, sz);
+		buf += read*frame_size;
+		sz -= read;
+	}
+
+	if (m_sinkStopSamples >= 0)
+	{
+		bool stop_playing = m_sinkStopSamples <= (int)original_sz;
+		m_sinkStopSamples = stop_playing ? 0 : (m_sinkStopSamples - original_sz);
+		m_threading->mtx_running.unlock();
+
+		if (stop_playing)
+			m_sink->setPlaying(false);
+	}
+	else
+	{
+		m_threading->mtx_running.unlock();
+	}
+
+	return c;
+}
+
+void NSFPlayer::timeCallback(core::u32 skip, void *data)
+{
+	NSFPlayer *p = (NSFPlayer*)data;
+
+	// the sound callback doesn't touch the timer frame
+	p->m_timerFrame += skip;
+
+	if (p->m_updateCallback != NULL)
+		(*p->m_updateCallback)(p->m_timerFrame, p->m_updateData);
+}
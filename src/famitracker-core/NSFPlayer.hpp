@@ -0,0 +1,139 @@
+#ifndef _NSFPLAYER_HPP_
+#define _NSFPLAYER_HPP_
+
+#include <exception>
+#include <string>
+#include <vector>
+#include "core/soundsink.hpp"
+#include "common.hpp"
+
+namespace core
+{
+	class IO;
+	class SPSCRingBuffer;
+}
+
+class CAPU;
+class CSampleMem;
+class CPU6502;
+
+class FAMICOREAPI NSFException : public std::exception
+{
+public:
+	explicit NSFException(const std::string &msg)
+		: m_msg(msg)
+	{
+	}
+	~NSFException() throw(){}
+
+	const char * what() const throw(){ return m_msg.c_str(); }
+private:
+	std::string m_msg;
+};
+
+struct _nsfplayer_threading_t;
+
+/*
+ * Plays NSF files by running their INIT and PLAY routines on CPU6502 and
+ * feeding the register writes to CAPU, at the cycle they happen. It feeds
+ * a sound sink the same way SoundGen does, so files can be played back or
+ * rendered with any sink.
+ */
+class FAMICOREAPI NSFPlayer
+{
+public:
+	// frame is the number of PLAY calls since the song started
+	typedef void (*playerupdate_f)(unsigned int frame, void *data);
+	// called from the sound thread for each register write. cycle counts
+	// from the start of the frame
+	typedef void (*registerwrite_f)(unsigned int frame, core::u32 cycle, core::u16 addr, core::u8 value, void *data);
+
+	NSFPlayer();
+	~NSFPlayer();
+
+	// Throws NSFException if the file is not a valid NSF
+	void load(core::IO *io);
+
+	unsigned int songCount() const{ return m_songCount; }
+	// 0 is the first song
+	unsigned int startSong() const{ return m_startSong; }
+	const char * title() const{ return m_title; }
+	const char * artist() const{ return m_artist; }
+	const char * copyright() const{ return m_copyright; }
+	unsigned char expansionChip() const{ return m_chip; }
+	bool isPAL() const{ return m_pal; }
+	// PLAY calls per second
+	double frameRate() const;
+
+	void setSoundSink(core::SoundSink *s);
+	void setPlayerUpdate(playerupdate_f f, void *data=NULL){ m_updateCallback = f; m_updateData = data; }
+	void setRegisterWrite(registerwrite_f f, void *data=NULL){ m_writeCallback = f; m_writeData = data; }
+
+	// Stop after the given number of PLAY calls. NSFs don't tell when a
+	// song ends, without this it plays until stop() is called
+	void setRenderEnd(unsigned int frames);
+	void clearRenderEnd();
+
+	void start(unsigned int song);
+	void stop();
+	bool isPlaying();
+
+	// CPU cycles spent in PLAY since start(), to see how busy the driver is
+	core::u64 playCycles() const{ return m_playCycles; }
+	// playCycles() as a fraction of all cycles since start()
+	double playLoad() const;
+private:
+	static core::u8 readCallback(core::u16 addr, void *data);
+	static void writeCallback(core::u16 addr, core::u8 value, core::u32 cycle, void *data);
+	static void apuCallback(const void *buf, uint32 sz, void *data);
+	static core::u32 soundCallback(void *buf, core::u32 sz, void *data, core::u32 *idx);
+	static void timeCallback(core::u32 skip, void *data);
+
+	core::u8 readIO(core::u16 addr);
+	void writeIO(core::u16 addr, core::u8 value, core::u32 cycle);
+	void switchBank(unsigned int slot, unsigned int bank);
+
+	void initSong(unsigned int song);
+	void runFrame();
+	core::u32 requestSound(void *buf, core::u32 sz, core::u32 *idx);
+
+private:
+	CPU6502 *m_cpu;
+	CAPU *m_apu;
+	CSampleMem *m_samplemem;
+	core::SoundSink *m_sink;
+	core::SPSCRingBuffer *m_queued_sound;
+	_nsfplayer_threading_t *m_threading;
+
+	playerupdate_f m_updateCallback;
+	void *m_updateData;
+	registerwrite_f m_writeCallback;
+	void *m_writeData;
+
+	// File
+	char m_title[33], m_artist[33], m_copyright[33];
+	unsigned int m_songCount, m_startSong;
+	core::u16 m_loadAddress, m_initAddress, m_playAddress;
+	unsigned int m_speedNTSC, m_speedPAL;		// Microseconds per PLAY call
+	bool m_pal;
+	unsigned char m_chip;
+	bool m_bankswitched;
+	unsigned char m_initBanks[8];
+	std::vector<core::u8> m_rom;				// 4k banks when bankswitched
+
+	// Playing
+	bool m_playing;
+	bool m_inFrame;
+	unsigned int m_frame;
+	unsigned int m_timerFrame;
+	core::u32 m_frameCycles;					// Whole cycles per PLAY call
+	core::u32 m_frameFraction, m_frameFractionAccum;	// In millionths of a cycle
+	core::u32 m_lastWriteCycle;
+	core::u64 m_playCycles;
+	int m_sinkStopSamples;
+
+	bool m_renderEnd;
+	unsigned int m_renderEndFrames;
+};
+
+#endif
@@ -19,17 +19,195 @@
 */
 
 #include <string.h>
+#include <map>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
 #include "PatternData.h"
 #include "types.hpp"
+#include "core/types.hpp"
 
 // This class contains pattern data
 // A list of these objects exists inside the document one for each song
 
+struct stPatternBlock
+{
+	boost::atomic<unsigned int> refs;
+	bool pooled;					// in the pool, and must not be changed
+	core::u32 hash;
+	unsigned int rows;				// rows past the end are empty
+	stChanNote *notes;
+	// play length by effect column count
+	int playLengths[MAX_EFFECT_COLUMNS];
+};
+
+typedef std::multimap<core::u32, stPatternBlock*> PatternPool;
+
+// Pooled patterns of all documents. Pooled patterns are only released, and
+// looked up, with the mutex held. Never freed, documents may outlive the
+// static objects
+static PatternPool & pattern_pool()
+{
+	static PatternPool *pool = new PatternPool;
+	return *pool;
+}
+static boost::mutex & mtx_pattern_pool()
+{
+	static boost::mutex *mtx = new boost::mutex;
+	return *mtx;
+}
+
+static const stChanNote EMPTY_NOTE = { 0, 0, 0x10, MAX_INSTRUMENTS, {0, 0, 0, 0}, {0, 0, 0, 0} };
+
+static bool IsNoteEmpty(const stChanNote *Note)
+{
+	return memcmp(Note, &EMPTY_NOTE, sizeof(stChanNote)) == 0;
+}
+
+static stPatternBlock * NewPattern(unsigned int Rows)
+{
+	stPatternBlock *b = new stPatternBlock;
+	b->refs = 1;
+	b->pooled = false;
+	b->hash = 0;
+	b->rows = Rows;
+	b->notes = new stChanNote[Rows];
+	for (unsigned int i = 0; i < Rows; i++)
+		b->notes[i] = EMPTY_NOTE;
+	for (int i = 0; i < MAX_EFFECT_COLUMNS; i++)
+		b->playLengths[i] = MAX_PATTERN_LENGTH;
+	return b;
+}
+
+static void ReleasePattern(stPatternBlock *b)
+{
+	if (b == NULL)
+		return;
+
+	if (b->pooled)
+	{
+		boost::unique_lock<boost::mutex> lock(mtx_pattern_pool());
+		if (b->refs.fetch_sub(1, boost::memory_order_acq_rel) != 1)
+			return;
+
+		PatternPool &pool = pattern_pool();
+		std::pair<PatternPool::iterator, PatternPool::iterator> r = pool.equal_range(b->hash);
+		for (PatternPool::iterator it = r.first; it != r.second; ++it)
+		{
+			if (it->second == b)
+			{
+				pool.erase(it);
+				break;
+			}
+		}
+	}
+	else if (b->refs.fetch_sub(1, boost::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+
+	delete[] b->notes;
+	delete b;
+}
+
+static bool IsJump(const stChanNote *Note)
+{
+	for (int i = 0; i < MAX_EFFECT_COLUMNS; i++)
+	{
+		char en = Note->EffNumber[i];
+		if (en == EF_JUMP || en == EF_SKIP || en == EF_HALT)
+			return true;
+	}
+	return false;
+}
+
+static void FindPlayLengths(stPatternBlock *b)
+{
+	// a Bxx, Cxx or Dxx ends the pattern at its row, if its column is shown
+	for (int i = 0; i < MAX_EFFECT_COLUMNS; i++)
+		b->playLengths[i] = MAX_PATTERN_LENGTH;
+
+	for (unsigned int i = 0; i < b->rows; i++)
+	{
+		const stChanNote *n = b->notes + i;
+		for (int j = 0; j < MAX_EFFECT_COLUMNS; j++)
+		{
+			char en = n->EffNumber[j];
+			if (en == EF_JUMP || en == EF_SKIP || en == EF_HALT)
+			{
+				for (int k = j; k < MAX_EFFECT_COLUMNS; k++)
+				{
+					if (b->playLengths[k] == MAX_PATTERN_LENGTH)
+						b->playLengths[k] = i+1;
+				}
+				break;
+			}
+		}
+	}
+}
+
+// Returns the pooled pattern with the rows of b, NULL if b is empty. Takes
+// the reference to b
+static stPatternBlock * PoolPattern(stPatternBlock *b)
+{
+	if (b == NULL || b->pooled)
+		return b;
+
+	// trailing empty rows aren't stored
+	unsigned int rows = b->rows;
+	while (rows > 0 && IsNoteEmpty(b->notes + rows - 1))
+		rows--;
+
+	if (rows == 0)
+	{
+		ReleasePattern(b);
+		return NULL;
+	}
+
+	// FNV-1a
+	core::u32 hash = 2166136261u;
+	const unsigned char *data = (const unsigned char*)b->notes;
+	for (unsigned int i = 0; i < rows * sizeof(stChanNote); i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	boost::unique_lock<boost::mutex> lock(mtx_pattern_pool());
+	PatternPool &pool = pattern_pool();
+
+	std::pair<PatternPool::iterator, PatternPool::iterator> r = pool.equal_range(hash);
+	for (PatternPool::iterator it = r.first; it != r.second; ++it)
+	{
+		stPatternBlock *p = it->second;
+		if (p->rows == rows && memcmp(p->notes, b->notes, sizeof(stChanNote) * rows) == 0)
+		{
+			p->refs.fetch_add(1, boost::memory_order_relaxed);
+			delete[] b->notes;
+			delete b;
+			return p;
+		}
+	}
+
+	if (rows != b->rows)
+	{
+		stChanNote *notes = new stChanNote[rows];
+		memcpy(notes, b->notes, sizeof(stChanNote) * rows);
+		delete[] b->notes;
+		b->notes = notes;
+		b->rows = rows;
+	}
+
+	b->hash = hash;
+	b->pooled = true;
+
+	pool.insert(std::make_pair(hash, b));
+
+	return b;
+}
+
 CPatternData::CPatternData(unsigned int PatternLength, unsigned int Speed, unsigned int Tempo)
 {
 	// Clear memory
-	memset(m_iFrameList, 0, sizeof(short) * MAX_FRAMES * MAX_CHANNELS);
-	memset(m_pPatternData, 0, sizeof(stChanNote*) * MAX_CHANNELS * MAX_PATTERN);
 	memset(m_iEffectColumns, 0, sizeof(int) * MAX_CHANNELS);
 
 	m_iPatternLength = PatternLength;
@@ -37,27 +215,18 @@ CPatternData::CPatternData(unsigned int PatternLength, unsigned int Speed, unsig
 	m_iSongSpeed	 = Speed;
 	m_iSongTempo	 = Tempo;
 
-	// Pre-allocate pattern 0 for all channels
-	for (int i = 0; i < MAX_CHANNELS; i++)
-		AllocatePattern(i, 0);
+	m_iFrameList.resize(MAX_CHANNELS, 0);
 }
 
 CPatternData::~CPatternData()
 {
 	// Deallocate memory
-	for (int i = 0; i < MAX_CHANNELS; i++)
-	{
-		for (int j = 0; j < MAX_PATTERN; j++)
-		{
-			if (m_pPatternData[i][j] != NULL)
-				delete[] m_pPatternData[i][j];
-		}
-	}
+	ClearEverything();
 }
 
-bool CPatternData::IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row)
+bool CPatternData::IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row) const
 {
-	stChanNote *Note = GetPatternData(Channel, Pattern, Row);
+	const stChanNote *Note = GetPatternData(Channel, Pattern, Row);
 
 	bool IsFree = Note->Note == NONE &&
 		Note->EffNumber[0] == 0 && Note->EffNumber[1] == 0 &&
@@ -67,8 +236,11 @@ bool CPatternData::IsCellFree(unsigned int Channel, unsigned int Pattern, unsign
 	return IsFree;
 }
 
-bool CPatternData::IsPatternEmpty(unsigned int Channel, unsigned int Pattern)
+bool CPatternData::IsPatternEmpty(unsigned int Channel, unsigned int Pattern) const
 {
+	if (GetPattern(Channel, Pattern) == NULL)
+		return true;
+
 	// Check if pattern is empty
 	for (unsigned int i = 0; i < m_iPatternLength; i++)
 	{
@@ -78,33 +250,76 @@ bool CPatternData::IsPatternEmpty(unsigned int Channel, unsigned int Pattern)
 	return true;
 }
 
-bool CPatternData::IsPatternInUse(unsigned int Channel, unsigned int Pattern)
+bool CPatternData::IsPatternInUse(unsigned int Channel, unsigned int Pattern) const
 {
 	// Check if pattern is addressed in frame list
 	for (unsigned i = 0; i < m_iFrameCount; i++)
 	{
-		if (m_iFrameList[i][Channel] == Pattern)
+		if (GetFramePattern(i, Channel) == Pattern)
 			return true;
 	}
 	return false;
 }
 
-stChanNote *CPatternData::GetPatternData(int Channel, int Pattern, int Row)
+stPatternBlock *CPatternData::GetPattern(int Channel, int Pattern) const
 {
-	if (!m_pPatternData[Channel][Pattern])		// Allocate pattern if accessed for the first time
-		AllocatePattern(Channel, Pattern);
+	const std::vector<stPatternBlock*> &patterns = m_pPatternData[Channel];
+	if ((unsigned int)Pattern >= patterns.size())
+		return NULL;
 
-	return m_pPatternData[Channel][Pattern] + Row;
+	return patterns[Pattern];
 }
-void CPatternData::GetPatternData(int Channel, int Pattern, int Row, stChanNote *note)
+
+stPatternBlock *CPatternData::WritablePattern(int Channel, int Pattern, unsigned int Rows)
 {
-	stChanNote *n = GetPatternData(Channel, Pattern, Row);
+	std::vector<stPatternBlock*> &patterns = m_pPatternData[Channel];
+	if ((unsigned int)Pattern >= patterns.size())
+		patterns.resize(Pattern + 1, NULL);
+
+	stPatternBlock *b = patterns[Pattern];
+	if (b != NULL && !b->pooled && b->rows >= Rows)
+		return b;
+
+	// Allocate the pattern if written for the first time, copy it if it's
+	// shared
+	if (Rows < m_iPatternLength)
+		Rows = m_iPatternLength;
+
+	stPatternBlock *n;
+	if (b == NULL)
+	{
+		n = NewPattern(Rows);
+	}
+	else
+	{
+		if (Rows < b->rows)
+			Rows = b->rows;
+		n = NewPattern(Rows);
+		memcpy(n->notes, b->notes, sizeof(stChanNote) * b->rows);
+		memcpy(n->playLengths, b->playLengths, sizeof(n->playLengths));
+		ReleasePattern(b);
+	}
+
+	patterns[Pattern] = n;
+	return n;
+}
+
+const stChanNote *CPatternData::GetPatternData(int Channel, int Pattern, int Row) const
+{
+	const stPatternBlock *b = GetPattern(Channel, Pattern);
+	if (b == NULL || (unsigned int)Row >= b->rows)
+		return &EMPTY_NOTE;
+
+	return b->notes + Row;
+}
+void CPatternData::GetPatternData(int Channel, int Pattern, int Row, stChanNote *note) const
+{
+	const stChanNote *n = GetPatternData(Channel, Pattern, Row);
 	memcpy(note, n, sizeof(stChanNote));
 }
 void CPatternData::SetPatternData(int Channel, int Pattern, int Row, const stChanNote *note)
 {
-	if (!m_pPatternData[Channel][Pattern])		// Allocate pattern if accessed for the first time
-		AllocatePattern(Channel, Pattern);
+	stPatternBlock *b = WritablePattern(Channel, Pattern, Row + 1);
 
 	stChanNote n = *note;
 
@@ -120,8 +335,13 @@ void CPatternData::SetPatternData(int Channel, int Pattern, int Row, const stCha
 		}
 	}
 
-	*(m_pPatternData[Channel][Pattern] + Row) = n;
-	m_patternPlayLengths[Channel][Pattern] = -1;
+	// only rows with a jump change the play length
+	bool jump = IsJump(b->notes + Row) || IsJump(&n);
+
+	b->notes[Row] = n;
+
+	if (jump)
+		FindPlayLengths(b);
 }
 
 void CPatternData::SetPatternLength(unsigned int Length)
@@ -129,114 +349,143 @@ void CPatternData::SetPatternLength(unsigned int Length)
 	m_iPatternLength = Length;
 }
 
-unsigned int CPatternData::getPatternPlayLength(int channel, int pattern)
+void CPatternData::SetFrameCount(unsigned int Count)
 {
-	if (m_pPatternData[channel][pattern] == NULL)
+	m_iFrameCount = Count;
+	if (m_iFrameList.size() < Count * MAX_CHANNELS)
+		m_iFrameList.resize(Count * MAX_CHANNELS, 0);
+}
+
+unsigned int CPatternData::getPatternPlayLength(int channel, int pattern) const
+{
+	const stPatternBlock *b = GetPattern(channel, pattern);
+	if (b == NULL)
 	{
 		// pattern not used, and therefore no length
-		return MAX_PATTERN_LENGTH;
+		return m_iPatternLength;
 	}
 
-	int &l = m_patternPlayLengths[channel][pattern];
-	if (l == -1)
-	{
-		for (unsigned int i = 0; i < MAX_PATTERN_LENGTH; i++)
-		{
-			const stChanNote *n = GetPatternData(channel, pattern, i);
-			for (unsigned int j = 0; j <= GetEffectColumnCount(channel); j++)
-			{
-				char en = n->EffNumber[j];
-				if (en == EF_JUMP || en == EF_SKIP || en == EF_HALT)
-				{
-					l = i+1;
-					if (l > m_iPatternLength)
-						return m_iPatternLength;
-					return l;
-				}
-			}
-		}
-		l = MAX_PATTERN_LENGTH;
-	}
+	unsigned int l = b->playLengths[GetEffectColumnCount(channel)];
 	if (l > m_iPatternLength)
 		return m_iPatternLength;
 	return l;
 }
 
-unsigned int CPatternData::getFramePlayLength(int frame, int channels)
+unsigned int CPatternData::getFramePlayLength(int frame, int channels) const
 {
 	unsigned int l = MAX_PATTERN_LENGTH;
-	for (unsigned int i = 0; i < channels; i++)
+	for (int i = 0; i < channels; i++)
 	{
-		unsigned int cl = getPatternPlayLength(i, m_iFrameList[frame][i]);
+		unsigned int cl = getPatternPlayLength(i, GetFramePattern(frame, i));
 		if (cl < l)
 			l = cl;
 	}
 	return l;
 }
 
-void CPatternData::AllocatePattern(int Channel, int Pattern)
+void CPatternData::ClearEverything()
 {
-	// Allocate memory
-	m_pPatternData[Channel][Pattern] = new stChanNote[MAX_PATTERN_LENGTH];
-	m_patternPlayLengths[Channel][Pattern] = MAX_PATTERN_LENGTH;
+	// Resets everything
 
-	// Clear memory
-	for (int i = 0; i < MAX_PATTERN_LENGTH; i++)
-	{
-		stChanNote *pNote = m_pPatternData[Channel][Pattern] + i;
-		pNote->Note		  = 0;
-		pNote->Octave	  = 0;
-		pNote->Instrument = MAX_INSTRUMENTS;
-		pNote->Vol		  = 0x10;
-		for (int n = 0; n < MAX_EFFECT_COLUMNS; n++)
+	// Frame list
+	m_iFrameList.assign(MAX_CHANNELS, 0);
+
+	// Patterns, release everything
+	for (int i = 0; i < MAX_CHANNELS; i++)
+	{
+		std::vector<stPatternBlock*> &patterns = m_pPatternData[i];
+		for (unsigned int j = 0; j < patterns.size(); j++)
 		{
-			pNote->EffNumber[n] = 0;
-			pNote->EffParam[n] = 0;
+			ReleasePattern(patterns[j]);
 		}
+		patterns.clear();
 	}
+
+	m_iFrameCount = 1;
 }
 
-void CPatternData::ClearEverything()
+void CPatternData::Compact()
 {
-	// Resets everything
+	for (int i = 0; i < MAX_CHANNELS; i++)
+	{
+		CompactChannel(i);
+	}
+}
+
+void CPatternData::CompactChannel(int Channel)
+{
+	std::vector<stPatternBlock*> &patterns = m_pPatternData[Channel];
+	for (unsigned int j = 0; j < patterns.size(); j++)
+	{
+		// a compacted song is left untouched, others may be reading it
+		if (patterns[j] != NULL && !patterns[j]->pooled)
+			patterns[j] = PoolPattern(patterns[j]);
+	}
+	while (!patterns.empty() && patterns.back() == NULL)
+		patterns.pop_back();
+}
+
+void CPatternData::Copy(const CPatternData *pData)
+{
+	ClearEverything();
+
+	m_iFrameList = pData->m_iFrameList;
+	memcpy(m_iEffectColumns, pData->m_iEffectColumns, sizeof(m_iEffectColumns));
+
+	m_iPatternLength = pData->m_iPatternLength;
+	m_iFrameCount	 = pData->m_iFrameCount;
+	m_iSongSpeed	 = pData->m_iSongSpeed;
+	m_iSongTempo	 = pData->m_iSongTempo;
 
-	// Frame list
-	memset(m_iFrameList, 0, sizeof(short) * MAX_FRAMES * MAX_CHANNELS);
-	
-	// Patterns, deallocate everything
 	for (int i = 0; i < MAX_CHANNELS; i++)
 	{
-		for (int j = 0; j < MAX_PATTERN; j++)
+		m_pPatternData[i] = pData->m_pPatternData[i];
+		for (unsigned int j = 0; j < m_pPatternData[i].size(); j++)
 		{
-			if (m_pPatternData[i][j])
+			stPatternBlock *b = m_pPatternData[i][j];
+			if (b == NULL)
+				continue;
+
+			if (b->pooled)
+			{
+				b->refs.fetch_add(1, boost::memory_order_relaxed);
+			}
+			else
 			{
-				delete [] m_pPatternData[i][j];
-				m_pPatternData[i][j] = NULL;
+				stPatternBlock *n = NewPattern(b->rows);
+				memcpy(n->notes, b->notes, sizeof(stChanNote) * b->rows);
+				memcpy(n->playLengths, b->playLengths, sizeof(n->playLengths));
+				m_pPatternData[i][j] = n;
 			}
-			m_patternPlayLengths[i][j] = -1;
 		}
 	}
-
-	m_iFrameCount = 1;
 }
 
 void CPatternData::ClearPattern(int Channel, int Pattern)
 {
 	// Deletes a specified pattern in a channel
-	if (m_pPatternData[Channel][Pattern] != NULL)
+	std::vector<stPatternBlock*> &patterns = m_pPatternData[Channel];
+	if ((unsigned int)Pattern < patterns.size())
 	{
-		delete[] m_pPatternData[Channel][Pattern];
-		m_pPatternData[Channel][Pattern] = NULL;
+		ReleasePattern(patterns[Pattern]);
+		patterns[Pattern] = NULL;
 	}
-	m_patternPlayLengths[Channel][Pattern] = -1;
 }
 
 unsigned short CPatternData::GetFramePattern(int Frame, int Channel) const
 { 
-	return m_iFrameList[Frame][Channel]; 
+	unsigned int i = Frame * MAX_CHANNELS + Channel;
+	if (i >= m_iFrameList.size())
+		return 0;
+
+	return m_iFrameList[i];
 }
 
 void CPatternData::SetFramePattern(int Frame, int Channel, int Pattern)
 {
-	m_iFrameList[Frame][Channel] = Pattern;
+	unsigned int i = Frame * MAX_CHANNELS + Channel;
+	if (i >= m_iFrameList.size())
+		m_iFrameList.resize((Frame + 1) * MAX_CHANNELS, 0);
+
+	m_iFrameList[i] = Pattern;
 }
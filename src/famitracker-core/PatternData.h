@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <vector>
 #include "FamiTrackerTypes.h"
 
 // Channel note struct, holds the data for each row in patterns
@@ -33,17 +34,26 @@ struct stChanNote {
 	unsigned char EffParam[MAX_EFFECT_COLUMNS];
 };
 
+// Rows of a pattern, see PatternData.cpp
+struct stPatternBlock;
+
 // CPatternData holds all notes in the patterns
+//
+// Patterns that were never written are the shared empty pattern and take no
+// memory. Compact() moves the patterns into a pool shared by all songs and
+// documents, where patterns with the same rows are stored once. Pooled
+// patterns are copied when they are written to.
+//
+// The const functions only read, so several threads may read one
+// CPatternData as long as nothing writes to it.
 class CPatternData {
 public:
 	CPatternData(unsigned int PatternLength, unsigned int Speed, unsigned int Tempo);
 	~CPatternData();
 
-	// None of these are const because accessing an unallocated pattern will allocate it
-
-	bool IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row);
-	bool IsPatternEmpty(unsigned int Channel, unsigned int Pattern);
-	bool IsPatternInUse(unsigned int Channel, unsigned int Pattern);
+	bool IsCellFree(unsigned int Channel, unsigned int Pattern, unsigned int Row) const;
+	bool IsPatternEmpty(unsigned int Channel, unsigned int Pattern) const;
+	bool IsPatternInUse(unsigned int Channel, unsigned int Pattern) const;
 
 	int GetEffectColumnCount(int Channel) const
 		{ return m_iEffectColumns[Channel]; }
@@ -54,7 +64,18 @@ public:
 	void ClearEverything();
 	void ClearPattern(int Channel, int Pattern);
 
-	void GetPatternData(int Channel, int Pattern, int Row, stChanNote *note);
+	// Copy from existing pattern data, frame list and song settings.
+	// Pooled patterns are shared, the others are copied
+	void Copy(const CPatternData *pData);
+
+	// Move the patterns written since the last call into the shared pool
+	void Compact();
+	// Compact() for one channel. Channels are separate, so several threads
+	// may write and compact one channel each
+	void CompactChannel(int Channel);
+
+	// Patterns that were never written read as empty notes
+	void GetPatternData(int Channel, int Pattern, int Row, stChanNote *note) const;
 	void SetPatternData(int Channel, int Pattern, int Row, const stChanNote *note);
 
 	unsigned int GetPatternLength() const		{ return m_iPatternLength;	 }
@@ -63,26 +84,29 @@ public:
 	unsigned int GetSongTempo() const			{ return m_iSongTempo;		 }
 
 	void SetPatternLength(unsigned int Length);
-	void SetFrameCount(unsigned int Count)		{ m_iFrameCount = Count;	 }
+	void SetFrameCount(unsigned int Count);
 	void SetSongSpeed(unsigned int Speed)		{ m_iSongSpeed = Speed;		 }
 	void SetSongTempo(unsigned int Tempo)		{ m_iSongTempo = Tempo;		 }
 
-	unsigned int getPatternPlayLength(int channel, int pattern);
-	unsigned int getFramePlayLength(int frame, int channels);
+	// Play lengths are kept up to date as the patterns are written
+	unsigned int getPatternPlayLength(int channel, int pattern) const;
+	unsigned int getFramePlayLength(int frame, int channels) const;
 
 	unsigned short GetFramePattern(int Frame, int Channel) const;
 	void SetFramePattern(int Frame, int Channel, int Pattern);
 
 private:
-	void AllocatePattern(int Channel, int Patterns);
-	stChanNote *GetPatternData(int Channel, int Pattern, int Row);
+	stPatternBlock *GetPattern(int Channel, int Pattern) const;
+	// Makes the pattern writable, with at least Rows rows
+	stPatternBlock *WritablePattern(int Channel, int Pattern, unsigned int Rows);
+	const stChanNote *GetPatternData(int Channel, int Pattern, int Row) const;
 
 	// Pattern data
 private:
 
-	// List of the patterns assigned to frames
-	unsigned short m_iFrameList[MAX_FRAMES][MAX_CHANNELS];
-	int m_patternPlayLengths[MAX_CHANNELS][MAX_PATTERN];
+	// List of the patterns assigned to frames, MAX_CHANNELS per frame.
+	// Frames past the end use pattern 0
+	std::vector<unsigned char> m_iFrameList;
 
 	unsigned int m_iPatternLength;			// Amount of rows in one pattern
 	unsigned int m_iFrameCount;				// Number of frames
@@ -92,6 +116,7 @@ private:
 	// Number of visible effect columns for each channel
 	unsigned int m_iEffectColumns[MAX_CHANNELS];
 
-	// All accesses to m_pPatternData must go through GetPatternData()
-	stChanNote *m_pPatternData[MAX_CHANNELS][MAX_PATTERN];
+	// Patterns of each channel, NULL or past the end is the empty pattern.
+	// All accesses to m_pPatternData must go through GetPattern()
+	std::vector<stPatternBlock*> m_pPatternData[MAX_CHANNELS];
 };
@@ -0,0 +1,280 @@
+#include <string.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include "RegisterPlayer.hpp"
+#include "APU/APU.h"
+#include "core/io.hpp"
+#include "core/spscringbuffer.hpp"
+
+struct _registerplayer_threading_t
+{
+	boost::mutex mtx_running;
+};
+
+RegisterPlayer::RegisterPlayer()
+	: m_sink(NULL), m_reader(NULL),
+	  m_updateCallback(NULL), m_updateData(NULL),
+	  m_lowCut(16), m_highCut(12000), m_highDamp(24), m_volume(100),
+	  m_playing(false), m_pending(false), m_cycle(0), m_timerFrame(0),
+	  m_sinkStopSamples(-1)
+{
+	m_header.machine = MACHINE_NTSC;
+	m_header.chip = SNDCHIP_NONE;
+	m_header.frameCycles = CAPU::BASE_FREQ_NTSC / CAPU::FRAME_RATE_NTSC;
+
+	m_samplemem = new CSampleMem;
+	m_apu = new CAPU(m_samplemem);
+	m_apu->SetCallback(apuCallback, this);
+	m_queued_sound = new core::SPSCRingBuffer(sizeof(core::s16));
+	m_queued_sound->resize(16384);
+	m_threading = new _registerplayer_threading_t;
+}
+
+RegisterPlayer::~RegisterPlayer()
+{
+	delete m_reader;
+	delete m_threading;
+	delete m_queued_sound;
+	delete m_apu;
+	delete m_samplemem;
+}
+
+void RegisterPlayer::load(core::IO *io)
+{
+	RegisterStreamReader *reader = new RegisterStreamReader(io);
+	try
+	{
+		reader->readHeader(m_header);
+	}
+	catch (...)
+	{
+		delete reader;
+		throw;
+	}
+
+	delete m_reader;
+	m_reader = reader;
+}
+
+double RegisterPlayer::frameRate() const
+{
+	double clock = m_header.machine == MACHINE_PAL ? CAPU::BASE_FREQ_PAL : CAPU::BASE_FREQ_NTSC;
+	return clock / m_header.frameCycles;
+}
+
+void RegisterPlayer::setSoundSink(core::SoundSink *s)
+{
+	if (m_sink != NULL)
+	{
+		m_sink->setPlaying(false);
+		m_sink->blockUntilTimerEmpty();
+	}
+	m_sink = s;
+
+	// a NULL sink detaches the current one
+	if (m_sink == NULL)
+	{
+		m_queued_sound->clear();
+		return;
+	}
+
+	// the sound queue holds whole sample frames of the sink
+	unsigned int sample_size = m_sink->sampleFormat() == core::SAMPLE_FLOAT ? sizeof(float) : sizeof(core::s16);
+	delete m_queued_sound;
+	m_queued_sound = new core::SPSCRingBuffer(sample_size*m_sink->channels());
+	m_queued_sound->resize(16384);
+
+	m_sink->setCallbackData(this);
+	m_sink->setSoundCallback(soundCallback);
+	m_sink->setTimeCallback(timeCallback);
+}
+
+void RegisterPlayer::setupMixer(int lowCut, int highCut, int highDamp, int volume)
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	m_lowCut = lowCut;
+	m_highCut = highCut;
+	m_highDamp = highDamp;
+	m_volume = volume;
+	m_apu->SetupMixer(lowCut, highCut, highDamp, volume);
+}
+
+void RegisterPlayer::start()
+{
+	m_threading->mtx_running.lock();
+
+	if (m_playing || m_reader == NULL)
+	{
+		m_threading->mtx_running.unlock();
+		return;
+	}
+
+	m_sink->blockUntilTimerEmpty();
+
+	// Set up the APU the way SoundGen does before the stream starts
+	m_apu->SetupSound(m_sink->sampleRate(), m_sink->channels(), m_header.machine,
+					  m_sink->sampleFormat() == core::SAMPLE_FLOAT);
+	m_apu->SetupMixer(m_lowCut, m_highCut, m_highDamp, m_volume);
+	m_apu->ChangeMachine(m_header.machine);
+	m_apu->SetExternalSound(m_header.chip);
+	m_apu->Reset();
+	m_apu->Write(0x4015, 0x0F);
+	m_apu->Write(0x4017, 0x00);
+	m_apu->ExternalWrite(0x5015, 0x03);
+	m_samplemem->SetMem(NULL, 0);
+	m_queued_sound->clear();
+
+	m_cycle = 0;
+	m_timerFrame = 0;
+	m_pending = m_reader->next(m_event);
+
+	m_playing = true;
+	m_sinkStopSamples = -1;
+
+	m_threading->mtx_running.unlock();
+
+	m_sink->setPlaying(true);
+}
+
+void RegisterPlayer::stop()
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	if (m_playing)
+	{
+		m_playing = false;
+		m_sinkStopSamples = m_sink->sampleRate() * 1/2;
+	}
+}
+
+bool RegisterPlayer::isPlaying()
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+	return m_playing;
+}
+
+void RegisterPlayer::runFrame()
+{
+	// Each write happens at its cycle, CAPU runs up to it first. The
+	// frame ends where the captured one did
+	while (m_pending)
+	{
+		if (m_event.cycle > m_cycle)
+		{
+			m_apu->AddTime((int32)(m_event.cycle - m_cycle));
+			m_cycle = m_event.cycle;
+		}
+
+		bool frame_end = false;
+		switch (m_event.type)
+		{
+		case regstream_event_t::WRITE:
+			m_apu->Write(m_event.address, m_event.value);
+			break;
+		case regstream_event_t::EXTERNAL_WRITE:
+			m_apu->ExternalWrite(m_event.address, m_event.value);
+			break;
+		case regstream_event_t::SAMPLE:
+			m_samplemem->SetMem((const char*)m_event.sample, m_event.sampleSize);
+			break;
+		case regstream_event_t::SYNC:
+			m_apu->Process();
+			break;
+		case regstream_event_t::FRAME:
+			m_apu->Process();
+			frame_end = true;
+			break;
+		}
+
+		m_pending = m_reader->next(m_event);
+
+		if (frame_end)
+			return;
+	}
+
+	// The stream ended in the middle of a frame
+	m_apu->Process();
+}
+
+void RegisterPlayer::apuCallback(const void *buf, uint32 sz, void *data)
+{
+	RegisterPlayer *p = (RegisterPlayer*)data;
+	p->m_queued_sound->write(buf, sz);
+}
+
+core::u32 RegisterPlayer::soundCallback(void *buf, core::u32 sz, void *data, core::u32 *idx)
+{
+	RegisterPlayer *p = (RegisterPlayer*)data;
+	return p->requestSound(buf, sz, idx);
+}
+
+core::u32 RegisterPlayer::requestSound(void *buffer, core::u32 sz, core::u32 *idx)
+{
+	// sz and the time indices count sample frames
+	const core::u32 original_sz = sz;
+	const unsigned int frame_size = m_sink->channels() *
+			(m_sink->sampleFormat() == core::SAMPLE_FLOAT ? sizeof(float) : sizeof(core::s16));
+	core::u8 *buf = (core::u8*)buffer;
+	core::u32 c = 0;
+
+	// read remaining sound buffer data from the last callback
+	if (!m_queued_sound->isEmpty())
+	{
+		core::Quantity read = m_queued_sound->read(buf, sz);
+		buf += read*frame_size;
+		sz -= read;
+	}
+
+	m_threading->mtx_running.lock();
+	while (sz != 0)
+	{
+		if (!m_playing)
+		{
+			// silence while the sink drains
+			memset(buf, 0, sz*frame_size);
+			break;
+		}
+
+		runFrame();
+		idx[c++] = original_sz - sz;
+
+		if (!m_pending)
+		{
+			// the stream ended
+			m_playing = false;
+			m_sinkStopSamples = m_sink->sampleRate() * 1/2;
+		}
+
+		core::Quantity read = m_queued_sound->read(buf, sz);
+		buf += read*frame_size;
+		sz -= read;
+	}
+
+	if (m_sinkStopSamples >= 0)
+	{
+		bool stop_playing = m_sinkStopSamples <= (int)original_sz;
+		m_sinkStopSamples = stop_playing ? 0 : (m_sinkStopSamples - original_sz);
+		m_threading->mtx_running.unlock();
+
+		if (stop_playing)
+			m_sink->setPlaying(false);
+	}
+	else
+	{
+		m_threading->mtx_running.unlock();
+	}
+
+	return c;
+}
+
+void RegisterPlayer::timeCallback(core::u32 skip, void *data)
+{
+	RegisterPlayer *p = (RegisterPlayer*)data;
+
+	// the sound callback doesn't touch the timer frame
+	p->m_timerFrame += skip;
+
+	if (p->m_updateCallback != NULL)
+		(*p->m_updateCallback)(p->m_timerFrame, p->m_updateData);
+}
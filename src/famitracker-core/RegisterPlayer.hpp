@@ -0,0 +1,81 @@
+#ifndef _REGISTERPLAYER_HPP_
+#define _REGISTERPLAYER_HPP_
+
+#include "core/soundsink.hpp"
+#include "RegisterStream.hpp"
+#include "common.hpp"
+
+namespace core
+{
+	class IO;
+	class SPSCRingBuffer;
+}
+
+class CAPU;
+class CSampleMem;
+
+struct _registerplayer_threading_t;
+
+/*
+ * Plays a register write stream on CAPU, with no tracker in between. The
+ * sample rate and the mixer can differ from the ones the stream was
+ * captured with. It feeds a sound sink the same way SoundGen does.
+ */
+class FAMICOREAPI RegisterPlayer
+{
+public:
+	// frame counts the stream's frames since start()
+	typedef void (*playerupdate_f)(unsigned int frame, void *data);
+
+	RegisterPlayer();
+	~RegisterPlayer();
+
+	// Throws RegisterStreamException if io doesn't hold a stream. The
+	// stream is read while it plays, io must stay open until then
+	void load(core::IO *io);
+
+	unsigned char machine() const{ return m_header.machine; }
+	unsigned char expansionChip() const{ return m_header.chip; }
+	double frameRate() const;
+
+	void setSoundSink(core::SoundSink *s);
+	void setPlayerUpdate(playerupdate_f f, void *data=NULL){ m_updateCallback = f; m_updateData = data; }
+	// As CAPU::SetupMixer(), SoundGen's settings are used otherwise
+	void setupMixer(int lowCut, int highCut, int highDamp, int volume);
+
+	// Plays the stream from where it was loaded, until it ends
+	void start();
+	void stop();
+	bool isPlaying();
+private:
+	static void apuCallback(const void *buf, uint32 sz, void *data);
+	static core::u32 soundCallback(void *buf, core::u32 sz, void *data, core::u32 *idx);
+	static void timeCallback(core::u32 skip, void *data);
+
+	void runFrame();
+	core::u32 requestSound(void *buf, core::u32 sz, core::u32 *idx);
+
+private:
+	CAPU *m_apu;
+	CSampleMem *m_samplemem;
+	core::SoundSink *m_sink;
+	core::SPSCRingBuffer *m_queued_sound;
+	_registerplayer_threading_t *m_threading;
+	RegisterStreamReader *m_reader;
+
+	playerupdate_f m_updateCallback;
+	void *m_updateData;
+
+	regstream_header_t m_header;
+	int m_lowCut, m_highCut, m_highDamp, m_volume;
+
+	// Playing
+	bool m_playing;
+	bool m_pending;				// m_event is read and not played yet
+	regstream_event_t m_event;
+	core::u64 m_cycle;
+	unsigned int m_timerFrame;
+	int m_sinkStopSamples;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include <string.h>
+#include "RegisterStream.hpp"
+#include "core/io.hpp"
+
+static const char MAGIC[4] = {'F', 'T', 'R', 'S'};
+static const unsigned char VERSION = 1;
+
+static const unsigned int HEADER_SIZE = 12;
+static const unsigned int CHUNK_HEADER_SIZE = 16;
+
+static const core::u8 TAG_EXTERNAL = 0x20;
+static const core::u8 TAG_SAMPLE = 0x21;
+static const core::u8 TAG_SYNC = 0x22;
+static const core::u8 TAG_FRAME = 0x23;
+
+static void put_u32(core::u8 *p, core::u32 v)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (v >> (i*8)) & 0xFF;
+}
+
+static core::u32 get_u32(const core::u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((core::u32)p[3] << 24);
+}
+
+RegisterStreamWriter::RegisterStreamWriter(core::IO *io, unsigned int chunkSize)
+	: m_io(io), m_chunkSize(chunkSize), m_events(0),
+	  m_origin(0), m_chunkStart(0), m_lastCycle(0), m_ok(true)
+{
+	m_chunk.reserve(chunkSize + 32);
+}
+
+RegisterStreamWriter::~RegisterStreamWriter()
+{
+	flush();
+}
+
+void RegisterStreamWriter::begin(const regstream_header_t &header, core::u64 cycle)
+{
+	core::u8 h[HEADER_SIZE];
+	memcpy(h, MAGIC, 4);
+	h[4] = VERSION;
+	h[5] = header.machine;
+	h[6] = header.chip;
+	h[7] = 0;
+	put_u32(h + 8, header.frameCycles);
+
+	m_ok = m_io->write_e(h, HEADER_SIZE);
+
+	m_chunk.clear();
+	m_events = 0;
+	m_origin = cycle;
+	m_chunkStart = 0;
+	m_lastCycle = 0;
+}
+
+void RegisterStreamWriter::write(core::u64 cycle, core::u16 address, core::u8 value, bool external)
+{
+	if (!external && address >= 0x4000 && address < 0x4020)
+	{
+		event(cycle, address - 0x4000);
+	}
+	else
+	{
+		event(cycle, TAG_EXTERNAL);
+		m_chunk.push_back(address & 0xFF);
+		m_chunk.push_back(address >> 8);
+	}
+	m_chunk.push_back(value);
+
+	if (m_chunk.size() >= m_chunkSize)
+		flush();
+}
+
+void RegisterStreamWriter::sample(core::u64 cycle, const core::u8 *mem, unsigned int size)
+{
+	event(cycle, TAG_SAMPLE);
+	putVarint(size);
+	m_chunk.insert(m_chunk.end(), mem, mem + size);
+
+	if (m_chunk.size() >= m_chunkSize)
+		flush();
+}
+
+void RegisterStreamWriter::sync(core::u64 cycle)
+{
+	// the APU has nothing to run since the last event
+	if (cycle < m_origin || cycle - m_origin <= m_lastCycle)
+		return;
+
+	event(cycle, TAG_SYNC);
+
+	if (m_chunk.size() >= m_chunkSize)
+		flush();
+}
+
+void RegisterStreamWriter::endFrame(core::u64 cycle)
+{
+	event(cycle, TAG_FRAME);
+
+	if (m_chunk.size() >= m_chunkSize)
+		flush();
+}
+
+void RegisterStreamWriter::flush()
+{
+	if (m_events == 0)
+		return;
+
+	core::u8 h[CHUNK_HEADER_SIZE];
+	put_u32(h, m_chunk.size());
+	put_u32(h + 4, m_events);
+	put_u32(h + 8, (core::u32)m_chunkStart);
+	put_u32(h + 12, (core::u32)(m_chunkStart >> 32));
+
+	if (m_ok)
+		m_ok = m_io->write_e(h, CHUNK_HEADER_SIZE) && m_io->write_e(&m_chunk[0], m_chunk.size());
+
+	m_chunk.clear();
+	m_events = 0;
+}
+
+void RegisterStreamWriter::event(core::u64 cycle, core::u8 tag)
+{
+	// a chunk starts where the last one ended
+	if (m_events == 0)
+		m_chunkStart = m_lastCycle;
+
+	// the APU's cycles start over when it's reset, time doesn't go back
+	cycle = cycle >= m_origin ? cycle - m_origin : 0;
+	if (cycle < m_lastCycle)
+		cycle = m_lastCycle;
+
+	putVarint(cycle - m_lastCycle);
+	m_chunk.push_back(tag);
+
+	m_lastCycle = cycle;
+	m_events++;
+}
+
+void RegisterStreamWriter::putVarint(core::u64 v)
+{
+	while (v >= 0x80)
+	{
+		m_chunk.push_back((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	m_chunk.push_back(v);
+}
+
+RegisterStreamReader::RegisterStreamReader(core::IO *io)
+	: m_io(io), m_chunk(NULL), m_size(0), m_pos(0), m_eventsLeft(0), m_cycle(0)
+{
+}
+
+void RegisterStreamReader::readHeader(regstream_header_t &header)
+{
+	core::u8 h[HEADER_SIZE];
+	if (!m_io->read_e(h, HEADER_SIZE) || memcmp(h, MAGIC, 4) != 0)
+		throw RegisterStreamException("Not a register write stream");
+	if (h[4] != VERSION)
+		throw RegisterStreamException("Unsupported register write stream version");
+
+	header.machine = h[5];
+	header.chip = h[6];
+	header.frameCycles = get_u32(h + 8);
+	if (header.frameCycles == 0)
+		throw RegisterStreamException("Register write stream has no frame length");
+}
+
+bool RegisterStreamReader::readChunk()
+{
+	core::u8 h[CHUNK_HEADER_SIZE];
+	if (!m_io->read_e(h, CHUNK_HEADER_SIZE))
+		return false;
+
+	m_size = get_u32(h);
+	m_eventsLeft = get_u32(h + 4);
+	m_cycle = get_u32(h + 8) | ((core::u64)get_u32(h + 12) << 32);
+	m_pos = 0;
+
+	// mapped files are read in place
+	m_chunk = (const core::u8*)m_io->view(m_size);
+	if (m_chunk == NULL)
+	{
+		m_buffer.resize(m_size);
+		if (m_size > 0 && !m_io->read_e(&m_buffer[0], m_size))
+			return false;
+		m_chunk = m_buffer.empty() ? NULL : &m_buffer[0];
+	}
+
+	return true;
+}
+
+bool RegisterStreamReader::getVarint(core::u64 &v)
+{
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (m_pos >= m_size)
+			return false;
+
+		core::u8 b = m_chunk[m_pos++];
+		v |= (core::u64)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+bool RegisterStreamReader::next(regstream_event_t &e)
+{
+	while (m_eventsLeft == 0)
+	{
+		if (!readChunk())
+			return false;
+	}
+
+	core::u64 delta;
+	if (!getVarint(delta) || m_pos >= m_size)
+		return false;
+
+	m_cycle += delta;
+	e.cycle = m_cycle;
+
+	core::u8 tag = m_chunk[m_pos++];
+	if (tag < 0x20)
+	{
+		if (m_pos + 1 > m_size)
+			return false;
+		e.type = regstream_event_t::WRITE;
+		e.address = 0x4000 + tag;
+		e.value = m_chunk[m_pos++];
+	}
+	else if (tag == TAG_EXTERNAL)
+	{
+		if (m_pos + 3 > m_size)
+			return false;
+		e.type = regstream_event_t::EXTERNAL_WRITE;
+		e.address = m_chunk[m_pos] | (m_chunk[m_pos+1] << 8);
+		e.value = m_chunk[m_pos+2];
+		m_pos += 3;
+	}
+	else if (tag == TAG_SAMPLE)
+	{
+		core::u64 size;
+		if (!getVarint(size) || size > m_size - m_pos)
+			return false;
+		e.type = regstream_event_t::SAMPLE;
+		e.sample = m_chunk + m_pos;
+		e.sampleSize = (unsigned int)size;
+		m_pos += (unsigned int)size;
+	}
+	else if (tag == TAG_SYNC)
+	{
+		e.type = regstream_event_t::SYNC;
+	}
+	else if (tag == TAG_FRAME)
+	{
+		e.type = regstream_event_t::FRAME;
+	}
+	else
+	{
+		return false;
+	}
+
+	m_eventsLeft--;
+	return true;
+}
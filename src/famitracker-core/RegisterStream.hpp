@@ -0,0 +1,129 @@
+#ifndef _REGISTERSTREAM_HPP_
+#define _REGISTERSTREAM_HPP_
+
+#include <exception>
+#include <string>
+#include <vector>
+#include "core/types.hpp"
+#include "common.hpp"
+
+namespace core
+{
+	class IO;
+}
+
+class FAMICOREAPI RegisterStreamException : public std::exception
+{
+public:
+	explicit RegisterStreamException(const std::string &msg)
+		: m_msg(msg)
+	{
+	}
+	~RegisterStreamException() throw(){}
+
+	const char * what() const throw(){ return m_msg.c_str(); }
+private:
+	std::string m_msg;
+};
+
+/*
+ * Register write streams hold the writes to the APU and the expansion
+ * chips, and the DPCM sample memory, timed in CPU cycles. A CAPU can be
+ * driven from one without the tracker or the channel handlers.
+ *
+ * A stream starts with a 12 byte header:
+ *   "FTRS", version, machine (MACHINE_NTSC or MACHINE_PAL), expansion
+ *   chips, 0, cycles per frame (u32)
+ * followed by chunks:
+ *   payload size (u32), event count (u32), start cycle (u64), payload
+ * Cycles count from the start of the stream.
+ *
+ * An event is a varint of the cycles since the previous event (since the
+ * start cycle for the first one of a chunk), a tag byte, and
+ *   tag $00-$1F:  the value written to $4000+tag
+ *   tag $20:      address (u16) and value written to the expansion chips
+ *   tag $21:      size (varint) and bytes of the new DPCM sample memory
+ *   tag $22:      nothing, the APU ran up to here. CAPU's output depends
+ *                 on how its time is split, this keeps it the same
+ *   tag $23:      nothing, a player frame ends here and the APU ran up to it
+ * Numbers are little endian, varints have 7 bits per byte, lowest first.
+ *
+ * Chunks are written whole and don't depend on each other, so a stream
+ * can be read while it's captured, up to its last whole chunk.
+ */
+
+struct regstream_header_t
+{
+	unsigned char machine;
+	unsigned char chip;
+	core::u32 frameCycles;		// CPU cycles per player frame, frames may be longer
+};
+
+struct regstream_event_t
+{
+	enum { WRITE, EXTERNAL_WRITE, SAMPLE, SYNC, FRAME } type;
+	core::u64 cycle;
+	core::u16 address;
+	core::u8 value;
+	const core::u8 *sample;		// valid until the next event is read
+	unsigned int sampleSize;
+};
+
+class FAMICOREAPI RegisterStreamWriter
+{
+public:
+	// A chunk is written once its payload reaches chunkSize bytes
+	explicit RegisterStreamWriter(core::IO *io, unsigned int chunkSize=4096);
+	~RegisterStreamWriter();
+
+	// Writes the header. Events are timed from cycle, in the clock they
+	// are given in
+	void begin(const regstream_header_t &header, core::u64 cycle);
+	void write(core::u64 cycle, core::u16 address, core::u8 value, bool external);
+	void sample(core::u64 cycle, const core::u8 *mem, unsigned int size);
+	// CAPU::Process() was called without a write
+	void sync(core::u64 cycle);
+	// The player finished a frame, after CAPU::Process()
+	void endFrame(core::u64 cycle);
+	// Writes the events that don't fill a chunk yet
+	void flush();
+
+	// false once writing to the IO failed
+	bool ok() const{ return m_ok; }
+private:
+	void event(core::u64 cycle, core::u8 tag);
+	void putVarint(core::u64 v);
+
+	core::IO *m_io;
+	unsigned int m_chunkSize;
+	std::vector<core::u8> m_chunk;
+	unsigned int m_events;
+	core::u64 m_origin;
+	core::u64 m_chunkStart;
+	core::u64 m_lastCycle;
+	bool m_ok;
+};
+
+class FAMICOREAPI RegisterStreamReader
+{
+public:
+	explicit RegisterStreamReader(core::IO *io);
+
+	// Throws RegisterStreamException if the stream doesn't start with a header
+	void readHeader(regstream_header_t &header);
+	// Returns false at the end of the stream, at a partly written chunk,
+	// or at an event that doesn't fit its chunk
+	bool next(regstream_event_t &e);
+private:
+	bool readChunk();
+	bool getVarint(core::u64 &v);
+
+	core::IO *m_io;
+	std::vector<core::u8> m_buffer;
+	const core::u8 *m_chunk;
+	unsigned int m_size, m_pos;
+	unsigned int m_eventsLeft;
+	core::u64 m_cycle;
+};
+
+#endif
@@ -1,14 +1,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <cmath>
+#include <vector>
+#include <map>
+#include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/atomic.hpp>
 #include "SoundGen.hpp"
-#include "core/ringbuffer.hpp"
+#include "core/spscringbuffer.hpp"
+#include "core/io.hpp"
 #include "FtmDocument.hpp"
 #include "FamiTrackerTypes.h"
 #include "TrackerChannel.h"
 #include "TrackerController.hpp"
+#include "RegisterStream.hpp"
 
 #include "ChannelHandler.h"
 #include "Channels2A03.h"
@@ -19,6 +25,7 @@
 
 #include "App.hpp"
 #include "core/time.hpp"
+#include "core/profile.hpp"
 
 // The depth of each vibrato level
 static const double NEW_VIBRATO_DEPTH[] = {
@@ -31,28 +38,159 @@ static const double OLD_VIBRATO_DEPTH[] = {
 
 static const int rowframes_size = 60*8;
 
+PROFILE_COUNTER(prof_sound_fill, "soundgen/sound queue fill (samples)", PROFILE_LEVEL);
+PROFILE_COUNTER(prof_rowframe_fill, "soundgen/rowframe queue fill", PROFILE_LEVEL);
+PROFILE_COUNTER(prof_underruns, "soundgen/rowframe queue underruns", PROFILE_EVENT);
+PROFILE_COUNTER(prof_skips, "soundgen/rowframes skipped by the timer", PROFILE_LEVEL);
+
+#ifdef FAMI_PROFILING
+// Counters of the frame stages, by channel ID for the channels. Silent
+// sound generators count apart, their frames don't make sound
+struct _soundgen_profile_t
+{
+	core::ProfileCounter *frame, *tick, *apu;
+	core::ProfileCounter *process[CHANNELS];
+	core::ProfileCounter *refresh[CHANNELS];
+
+	explicit _soundgen_profile_t(const std::string &prefix)
+	{
+		frame = core::ProfileCounter::named(prefix, core::PROFILE_TIME);
+		tick = core::ProfileCounter::named(prefix + "/TrackerController::tick", core::PROFILE_TIME);
+		apu = core::ProfileCounter::named(prefix + "/CAPU::Process", core::PROFILE_TIME);
+
+		const CChannelMap *map = app::channelMap();
+		for (int i = 0; i < CHANNELS; i++)
+		{
+			std::string channel = prefix + "/channels/" + chipName(map->GetChipFromChannel(i)) + " " +
+					map->GetChannelName(i);
+			process[i] = core::ProfileCounter::named(channel + "/ProcessChannel", core::PROFILE_TIME);
+			refresh[i] = core::ProfileCounter::named(channel + "/RefreshChannel", core::PROFILE_TIME);
+		}
+	}
+
+	static const char * chipName(int chip)
+	{
+		switch (chip)
+		{
+		case SNDCHIP_VRC6: return "VRC6";
+		case SNDCHIP_VRC7: return "VRC7";
+		case SNDCHIP_FDS: return "FDS";
+		case SNDCHIP_MMC5: return "MMC5";
+		case SNDCHIP_N106: return "N106";
+		case SNDCHIP_S5B: return "S5B";
+		default: return "2A03";
+		}
+	}
+};
+
+static const _soundgen_profile_t & soundgen_profile(bool silent)
+{
+	static const _soundgen_profile_t profile("frame");
+	static const _soundgen_profile_t silent_profile("silent frame");
+	return silent ? silent_profile : profile;
+}
+#endif
+
 struct _soundgen_threading_t
 {
 	boost::mutex mtx_running;
 	boost::mutex mtx_sink;
 	boost::mutex mtx_tracker;
-	boost::mutex mtx_rowframes;
 	boost::condition cond_trackerhalt;
 };
 
+// Sample rate of the chips of a sound generator without a sink
+static const int silent_sample_rate = 44100;
+// Songs that don't end are simulated for an hour at most
+static const unsigned int checkpoint_ticks = 60*60*60;
+// Ticks to reach a row from the start of its frame, at speed 255
+static const unsigned int seek_ticks = MAX_PATTERN_LENGTH*255;
+
+// The tracker and channel state at the start of a frame
+struct checkpoint_t
+{
+	TrackerController::state_t tracker;
+	CChannelHandler *channels[CHANNELS];	// NULL for channels not in the song
+};
+
+// The state to start playing at a row, after playing the rows above it
+struct _soundgen_seek_t
+{
+	unsigned int documentId;		// m_playDocumentId it was played of
+	unsigned int frame, row;
+	checkpoint_t state;
+	core::MemoryIO writes;			// Register stream of the rows above the row
+
+	_soundgen_seek_t()
+	{
+		for (int i = 0; i < CHANNELS; i++)
+			state.channels[i] = NULL;
+	}
+	~_soundgen_seek_t()
+	{
+		for (int i = 0; i < CHANNELS; i++)
+			delete state.channels[i];
+	}
+};
+
+struct _soundgen_checkpointframes_t
+{
+	// NULL for frames that weren't reached at their first row
+	std::vector<checkpoint_t*> frames;
+
+	~_soundgen_checkpointframes_t()
+	{
+		clear();
+	}
+	void clear()
+	{
+		for (unsigned int i = 0; i < frames.size(); i++)
+		{
+			if (frames[i] == NULL)
+				continue;
+			for (int j = 0; j < CHANNELS; j++)
+				delete frames[i]->channels[j];
+			delete frames[i];
+		}
+		frames.clear();
+	}
+};
+
+struct _soundgen_checkpoints_t
+{
+	// locked by buildCheckpoints()
+	boost::mutex mtx_build;
+	boost::thread *thread;
+	unsigned int buildingId;
+	boost::atomic<bool> cancel;
+
+	boost::mutex mtx_frames;
+	bool ready;
+	unsigned int documentId;		// m_playDocumentId the frames were built of
+	_soundgen_checkpointframes_t frames;
+};
+
 SoundGen::SoundGen()
-	: m_iConsumedCycles(0), m_pDocument(NULL),
+	: m_iConsumedCycles(0), m_pDocument(NULL), m_pPlayDocument(NULL), m_followDocument(false),
+	  m_playDocumentId(0), m_silent(false), m_capture(NULL),
 	  m_trackerUpdateCallback(NULL), m_sink(NULL),
 	  m_volumes_ring(NULL),
 	  m_trackerActive(false),
 	  m_timer_trackerActive(false),
-	  m_iMachineType(NTSC)
+	  m_iMachineType(NTSC),
+	  m_bRenderEnd(false), m_iRenderEndWhen(SONG_TIME_LIMIT), m_iRenderEndParam(0)
 {
 	m_samplemem = new CSampleMem;
 	m_apu = new CAPU(m_samplemem);
-	m_queued_rowframes = new core::RingBuffer(sizeof(rowframe_t));
-	m_queued_sound = new core::RingBuffer(sizeof(core::s16));
+	m_queued_rowframes = new core::SPSCRingBuffer(sizeof(rowframe_t));
+	m_queued_sound = new core::SPSCRingBuffer(sizeof(core::s16));
 	m_threading = new _soundgen_threading_t;
+	m_checkpoints = new _soundgen_checkpoints_t;
+	m_checkpoints->thread = NULL;
+	m_checkpoints->buildingId = 0;
+	m_checkpoints->cancel = false;
+	m_checkpoints->ready = false;
+	m_checkpoints->documentId = 0;
 	// Create all kinds of channels
 	createChannels();
 
@@ -61,14 +199,19 @@ SoundGen::SoundGen()
 	m_queued_rowframes->resize(rowframes_size);
 	m_queued_sound->resize(16384);
 	m_apu->SetCallback(apuCallback, this);
+	m_iFrames = 0;
 }
 
 SoundGen::~SoundGen()
 {
+	stopCheckpoints();
+	delete m_checkpoints;
+
 	if (m_volumes_ring != NULL)
 		delete[] m_volumes_ring;
 
 	delete m_trackerctlr;
+	delete m_pPlayDocument;
 
 	// Remove channels
 	for (int i=0; i < CHANNELS; i++)
@@ -93,9 +236,22 @@ void SoundGen::setSoundSink(core::SoundSink *s)
 		m_sink->setPlaying(false);
 		m_sink->blockUntilTimerEmpty();
 	}
-	m_queued_sound->clear();
 	m_queued_rowframes->clear();
 	m_sink = s;
+
+	// a NULL sink detaches the current one
+	if (m_sink == NULL)
+	{
+		m_queued_sound->clear();
+		return;
+	}
+
+	// the sound queue holds whole sample frames of the sink
+	unsigned int sample_size = m_sink->sampleFormat() == core::SAMPLE_FLOAT ? sizeof(float) : sizeof(core::s16);
+	delete m_queued_sound;
+	m_queued_sound = new core::SPSCRingBuffer(sample_size*m_sink->channels());
+	m_queued_sound->resize(16384);
+
 	m_sink->setCallbackData(this);
 	m_sink->setSoundCallback(soundCallback);
 	m_sink->setTimeCallback(timeCallback);
@@ -106,11 +262,48 @@ void SoundGen::setDocument(FtmDocument *doc)
 	m_threading->mtx_running.lock();
 
 	m_pDocument = doc;
+	m_followDocument = true;
+
+	// The player reads its own copy, so it never waits for the editor
+	doc->lock();
+	FtmDocument *snapshot = doc->snapshot();
+	doc->setPublishSnapshots(true);
+	doc->unlock();
+
+	setPlayDocument(snapshot);
+
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::setDocument(const FtmDocument *doc, unsigned int track)
+{
+	m_threading->mtx_running.lock();
+
+	// the tracker update callback gets the document, but mustn't change it
+	m_pDocument = const_cast<FtmDocument*>(doc);
+	m_followDocument = false;
+
+	setPlayDocument(doc->snapshot(track));
+
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::setPlayDocument(FtmDocument *doc)
+{
+	// Call with mtx_running held
+	delete m_pPlayDocument;
+	m_pPlayDocument = doc;
+	m_playDocumentId++;
 
 	generateVibratoTable(doc->GetVibratoStyle());
 
 	// TODO - dan: load settings
-	m_apu->SetupSound(m_sink->sampleRate(), 1, doc->GetMachine());
+	// without a sink the chips are still set up, they take register writes
+	if (m_sink != NULL)
+		m_apu->SetupSound(m_sink->sampleRate(), m_sink->channels(), doc->GetMachine(),
+						  m_sink->sampleFormat() == core::SAMPLE_FLOAT);
+	else
+		m_apu->SetupSound(silent_sample_rate, 1, doc->GetMachine(), false);
 	m_apu->SetupMixer(16, 12000, 24, 100);
 
 	loadMachineSettings(doc->GetMachine(), doc->GetEngineSpeed());
@@ -128,11 +321,9 @@ void SoundGen::setDocument(FtmDocument *doc)
 		m_pActiveTrackerChannels[i] = m_pTrackerChannels[chans[i]];
 	}
 
-	m_trackerctlr->initialize(doc, m_pActiveTrackerChannels);
+	m_trackerctlr->initialize(m_pPlayDocument, m_pActiveTrackerChannels);
 
 	setupChannels();
-
-	m_threading->mtx_running.unlock();
 }
 
 void SoundGen::loadMachineSettings(int machine, int rate)
@@ -264,11 +455,11 @@ void SoundGen::generateVibratoTable(int type)
 
 void SoundGen::resetTempo()
 {
-	if (m_pDocument == NULL)
+	if (m_pPlayDocument == NULL)
 		return;
 
-	unsigned int speed = m_pDocument->GetSongSpeed();
-	unsigned int tempo = m_pDocument->GetSongTempo();
+	unsigned int speed = m_pPlayDocument->GetSongSpeed();
+	unsigned int tempo = m_pPlayDocument->GetSongTempo();
 
 	m_trackerctlr->setTempo(tempo, speed);
 }
@@ -277,7 +468,10 @@ void SoundGen::addCycles(int count)
 {
 	// Add APU cycles
 	m_iConsumedCycles += count;
-	m_apu->AddTime(count);
+	if (!m_silent)
+		m_apu->AddTime(count);
+	else
+		m_apu->SkipTime(count);
 }
 
 void SoundGen::createChannels()
@@ -333,6 +527,14 @@ void SoundGen::createChannels()
 	assignChannel(new CTrackerChannel("Square 2", SNDCHIP_S5B, CHANID_S5B_CH2), new CS5BChannel2(this));
 	assignChannel(new CTrackerChannel("Square 3", SNDCHIP_S5B, CHANID_S5B_CH3), new CS5BChannel3(this));
 */
+
+	// Channels of a chip that nothing plays yet (the MMC5 voice) still
+	// take the notes of their patterns, they just don't make a sound
+	for (int i = 0; i < CHANNELS; i++)
+	{
+		if (m_pTrackerChannels[i] == NULL)
+			m_pTrackerChannels[i] = new CTrackerChannel;
+	}
 }
 
 void SoundGen::setupChannels()
@@ -342,8 +544,8 @@ void SoundGen::setupChannels()
 	{
 		if (m_pChannels[i] != NULL)
 		{
-			m_pChannels[i]->InitChannel(m_apu, m_iVibratoTable, m_pDocument);
-			m_pChannels[i]->SetVibratoStyle(m_pDocument->GetVibratoStyle());
+			m_pChannels[i]->InitChannel(m_apu, m_iVibratoTable, m_pPlayDocument);
+			m_pChannels[i]->SetVibratoStyle(m_pPlayDocument->GetVibratoStyle());
 			m_pChannels[i]->MakeSilent();
 		}
 	}
@@ -363,6 +565,7 @@ void SoundGen::resetAPU()
 {
 	// Reset the APU
 	m_apu->Reset();
+	m_iFrames = 0;
 
 	// Enable all channels
 	m_apu->Write(0x4015, 0x0F);
@@ -418,14 +621,44 @@ void SoundGen::haltSounds()
 	}
 }
 
+bool SoundGen::renderEndReached() const
+{
+	if (!m_bRenderEnd)
+		return false;
+
+	if (m_iRenderEndWhen == SONG_LOOP_LIMIT)
+	{
+		return m_trackerctlr->loops() >= (unsigned int)m_iRenderEndParam;
+	}
+	else
+	{
+		return m_iPlayTime >= (unsigned int)(m_iRenderEndParam * m_pPlayDocument->GetFrameRate());
+	}
+}
+
 void SoundGen::requestFrame()
 {
-	runFrame();
+	PROFILE_ONLY(const _soundgen_profile_t &profile = soundgen_profile(m_silent));
+	PROFILE_SCOPE(*profile.frame);
+
+	{
+		PROFILE_SCOPE(*profile.tick);
+		runFrame();
+	}
 
 	if (m_trackerActive)
 	{
 		m_bPlayerHalted = m_trackerctlr->isHalted();
+
+		if (!m_bPlayerHalted && renderEndReached())
+		{
+			// don't let the row that starts the next loop sound
+			haltSounds();
+			m_bPlayerHalted = true;
+		}
+		m_iPlayTime++;
 	}
+	m_iFrames++;
 
 	for (int i = 0; i < CHANNELS; i++)
 	{
@@ -436,7 +669,7 @@ void SoundGen::requestFrame()
 		{
 			stChanNote note = m_pTrackerChannels[i]->GetNote();
 
-			playNote(i, &note, m_pDocument->GetEffColumns(i) + 1);
+			playNote(i, &note, m_pPlayDocument->GetEffColumns(i) + 1);
 		}
 
 		// Pitch wheel
@@ -451,61 +684,85 @@ void SoundGen::requestFrame()
 
 	m_iConsumedCycles = 0;
 
-	int frameRate = m_pDocument->GetFrameRate();
+	int frameRate = m_pPlayDocument->GetFrameRate();
 
 	// Update channels and channel registers
 	for (int i = 0; i < CHANNELS; i++)
 	{
 		if (m_pChannels[i] != NULL)
 		{
-			m_pChannels[i]->ProcessChannel();
-			m_pChannels[i]->RefreshChannel();
-			m_apu->Process();
+			{
+				PROFILE_SCOPE(*profile.process[i]);
+				m_pChannels[i]->ProcessChannel();
+			}
+			{
+				PROFILE_SCOPE(*profile.refresh[i]);
+				m_pChannels[i]->RefreshChannel();
+			}
+			m_apu->Sync();
+			if (m_capture != NULL)
+				m_capture->sync(m_apu->GetCycles());
 			// Add some delay between each channel update
 			if (frameRate == CAPU::FRAME_RATE_NTSC || frameRate == CAPU::FRAME_RATE_PAL)
 				addCycles(CHANNEL_DELAY);
 		}
 	}
 
-	// Finish the audio frame
-	m_apu->AddTime(m_iUpdateCycles - m_iConsumedCycles);
-	m_apu->Process();
+	// Finish the audio frame, making the queued writes
+	if (!m_silent)
+		m_apu->AddTime(m_iUpdateCycles - m_iConsumedCycles);
+	else
+		m_apu->SkipTime(m_iUpdateCycles - m_iConsumedCycles);
+	{
+		PROFILE_SCOPE(*profile.apu);
+		m_apu->Process();
+	}
+
+	if (m_capture != NULL)
+		m_capture->endFrame(m_apu->GetCycles());
 }
 
-void SoundGen::apuCallback(const int16 *buf, uint32 sz, void *data)
+void SoundGen::apuCallback(const void *buf, uint32 sz, void *data)
 {
 	SoundGen *sg = (SoundGen*)data;
 	sg->m_queued_sound->write(buf, sz);
 }
 
-core::u32 SoundGen::soundCallback(core::s16 *buf, core::u32 sz, void *data, core::u32 *idx)
+core::u32 SoundGen::soundCallback(void *buf, core::u32 sz, void *data, core::u32 *idx)
 {
 	SoundGen *sg = (SoundGen*)data;
 	return sg->requestSound(buf, sz, idx);
 }
 
-core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
+core::u32 SoundGen::requestSound(void *buffer, core::u32 sz, core::u32 *idx)
 {
+	// sz and the time indices count sample frames
 	const core::u32 original_sz = sz;
+	const unsigned int frame_size = m_sink->channels() *
+			(m_sink->sampleFormat() == core::SAMPLE_FLOAT ? sizeof(float) : sizeof(core::s16));
+	core::u8 *buf = (core::u8*)buffer;
 	core::u32 c = 0;
 	core::u32 off = 0;
+	PROFILE_ADD(prof_sound_fill, m_queued_sound->availRead());
+	PROFILE_ADD(prof_rowframe_fill, m_queued_rowframes->capacity() - m_queued_rowframes->availWrite());
+
 	// read remaining sound buffer data from the last callback
 	if (!m_queued_sound->isEmpty())
 	{
 		core::Quantity read = m_queued_sound->read(buf, sz);
-		buf += read;
+		buf += read*frame_size;
 		sz -= read;
 		off += read;
 	}
 
 	m_threading->mtx_running.lock();
-	m_pDocument->lock();
+	updateSnapshot();
 	while (sz != 0)
 	{
 	/*	if (!m_bRunning)
 		{
 			// silence the rest of the buffer
-			memset(buf, 0, sz*sizeof(core::s16));
+			memset(buf, 0, sz*frame_size);
 		}*/
 		requestFrame();
 		bool haltsignal = m_bPlayerHalted && m_trackerActive;
@@ -527,9 +784,7 @@ core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
 			}
 			rf.volumes = writeVolume(vols);
 
-			m_threading->mtx_rowframes.lock();
 			m_queued_rowframes->write(&rf, 1);
-			m_threading->mtx_rowframes.unlock();
 		}
 
 		if (haltsignal)
@@ -538,11 +793,10 @@ core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
 		}
 
 		core::Quantity read = m_queued_sound->read(buf, sz);
-		buf += read;
+		buf += read*frame_size;
 		sz -= read;
 		off += read;
 	}
-	m_pDocument->unlock();
 
 	if (m_sinkStopSamples > 0)
 	{
@@ -564,6 +818,83 @@ core::u32 SoundGen::requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx)
 	return c;
 }
 
+void SoundGen::setChannelPan(unsigned int channel, int pan)
+{
+	// channel is the track channel, in the order of the document
+	m_threading->mtx_running.lock();
+	if (m_pPlayDocument != NULL)
+	{
+		const std::vector<int> & chans = m_pPlayDocument->getChannelsFromChip();
+		if (channel < chans.size())
+			m_apu->SetChannelPan(chans[channel], pan);
+	}
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::setChipPan(int chip, int pan)
+{
+	m_threading->mtx_running.lock();
+	m_apu->SetChipPan(chip, pan);
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::setQueueWrites(bool queue)
+{
+	m_threading->mtx_running.lock();
+	m_apu->SetQueueWrites(queue);
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::frameStats(framestats_t &s)
+{
+	m_threading->mtx_running.lock();
+	s.frames = m_iFrames;
+	s.processCalls = m_apu->GetProcessCalls();
+	s.apuRuns = m_apu->GetRuns();
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::setRegisterCapture(RegisterStreamWriter *w)
+{
+	m_threading->mtx_running.lock();
+
+	if (m_capture != NULL)
+		m_capture->flush();
+
+	m_capture = w;
+
+	if (w != NULL)
+	{
+		regstream_header_t header;
+		header.machine = m_iMachineType == NTSC ? MACHINE_NTSC : MACHINE_PAL;
+		header.chip = m_pPlayDocument != NULL ? m_pPlayDocument->GetExpansionChip() : SNDCHIP_NONE;
+		header.frameCycles = m_iUpdateCycles;
+		w->begin(header, m_apu->GetCycles());
+
+		m_apu->SetWriteCallback(captureWriteCallback, this);
+		m_samplemem->SetCallback(captureSampleCallback, this);
+	}
+	else
+	{
+		m_apu->SetWriteCallback(NULL, NULL);
+		m_samplemem->SetCallback(NULL, NULL);
+	}
+
+	m_threading->mtx_running.unlock();
+}
+
+void SoundGen::captureWriteCallback(uint64 cycle, uint16 address, uint8 value, bool external, void *data)
+{
+	SoundGen *sg = (SoundGen*)data;
+	sg->m_capture->write(cycle, address, value, external);
+}
+
+void SoundGen::captureSampleCallback(const uint8 *mem, int size, void *data)
+{
+	SoundGen *sg = (SoundGen*)data;
+	sg->m_capture->sample(sg->m_apu->GetCycles(), mem, size);
+}
+
 const core::u8 *SoundGen::readVolume()
 {
 	const core::u8 *ptr = m_volumes_ring + m_volumes_read_offset * m_channels;
@@ -589,20 +920,20 @@ void SoundGen::timeCallback(core::u32 skip, void *data)
 {
 	SoundGen *sg = (SoundGen*)data;
 
-	sg->m_threading->mtx_rowframes.lock();
+	// the sound callback is the only writer, so no lock is needed
 	if (skip > 1)
 	{
+		PROFILE_ADD(prof_skips, skip-1);
 		sg->m_queued_rowframes->skipRead(skip-1);
 	}
 	rowframe_t rf;
 	if (sg->m_queued_rowframes->read(&rf, 1) != 1)
 	{
-		sg->m_threading->mtx_rowframes.unlock();
+		PROFILE_ADD(prof_underruns, 1);
 		fprintf(stderr, "SoundGen::timeCallback(): ringbuffer underrun\n");
 		// uh oh
 		return;
 	}
-	sg->m_threading->mtx_rowframes.unlock();
 
 	unsigned int row = rf.row;
 	unsigned int frame = rf.frame;
@@ -613,7 +944,7 @@ void SoundGen::timeCallback(core::u32 skip, void *data)
 	sg->m_lastFrame = frame;
 
 	if (sg->m_trackerUpdateCallback != NULL)
-		(*sg->m_trackerUpdateCallback)(rf, sg->trackerController()->document(), sg->m_trackerUpdateData);
+		(*sg->m_trackerUpdateCallback)(rf, sg->m_pDocument, sg->m_trackerUpdateData);
 
 	boost::unique_lock<boost::mutex> lock(sg->m_threading->mtx_tracker);
 	if (sg->m_timer_trackerActive != rf.tracker_running)
@@ -623,8 +954,32 @@ void SoundGen::timeCallback(core::u32 skip, void *data)
 	}
 }
 
+void SoundGen::updateSnapshot()
+{
+	// Call with mtx_running held. Picks up the document's newest snapshot,
+	// if there is one.
+	if (!m_followDocument)
+		return;
+
+	FtmDocument *doc = m_pDocument->swapSnapshot(m_pPlayDocument);
+	if (doc == m_pPlayDocument)
+		return;
+
+	m_pPlayDocument = doc;
+	m_playDocumentId++;
+
+	m_trackerctlr->setDocument(doc);
+	for (int i = 0; i < CHANNELS; i++)
+	{
+		if (m_pChannels[i] != NULL)
+			m_pChannels[i]->SetDocument(doc);
+	}
+}
+
 void SoundGen::startPlayback()
 {
+	updateSnapshot();
+
 	m_sinkStopSamples = -1;
 
 	m_lastRow = ~0;
@@ -632,19 +987,19 @@ void SoundGen::startPlayback()
 
 	m_bPlayerHalted = false;
 	m_iFrameCounter = 0;
+	m_iPlayTime = 0;
 
-	m_pDocument->lock();
-	m_channels = m_pDocument->GetAvailableChannels();
+	m_channels = m_pPlayDocument->GetAvailableChannels();
 
-	m_volumes_size = rowframes_size;
+	// a queued rowframe points into the volume ring, so it must hold as
+	// many entries as the rowframe ring buffer
+	m_volumes_size = m_queued_rowframes->capacity();
 	m_volumes_read_offset = 0;
 	m_volumes_write_offset = 0;
 	if (m_volumes_ring != NULL)
 		delete[] m_volumes_ring;
 	m_volumes_ring = new core::u8[m_volumes_size * m_channels];
 
-	m_pDocument->unlock();
-
 	setupChannels();
 	resetTempo();
 
@@ -659,6 +1014,8 @@ void SoundGen::stopPlayback()
 
 void SoundGen::startTracker()
 {
+	_soundgen_seek_t *seek = prerollCheckpoint();
+
 	m_threading->mtx_running.lock();
 
 	if (!m_trackerActive)
@@ -666,6 +1023,7 @@ void SoundGen::startTracker()
 		m_trackerActive = true;
 
 		startPlayback();
+		seekCheckpoint(seek);
 
 		m_threading->mtx_running.unlock();
 
@@ -677,6 +1035,8 @@ void SoundGen::startTracker()
 	{
 		m_threading->mtx_running.unlock();
 	}
+
+	delete seek;
 }
 void SoundGen::stopTracker()
 {
@@ -687,6 +1047,425 @@ void SoundGen::stopTracker()
 		stopPlayback();
 	}
 }
+
+void SoundGen::buildCheckpoints(bool wait)
+{
+	_soundgen_checkpoints_t *c = m_checkpoints;
+	boost::lock_guard<boost::mutex> lock(c->mtx_build);
+
+	FtmDocument *doc = NULL;
+	unsigned int id = 0;
+
+	m_threading->mtx_running.lock();
+	if (m_pPlayDocument != NULL)
+	{
+		updateSnapshot();
+		id = m_playDocumentId;
+
+		c->mtx_frames.lock();
+		bool current = c->ready && c->documentId == id;
+		c->mtx_frames.unlock();
+
+		if (!current && !(c->thread != NULL && c->buildingId == id))
+			doc = m_pPlayDocument->snapshot(m_pPlayDocument->GetSelectedTrack());
+	}
+	m_threading->mtx_running.unlock();
+
+	if (doc != NULL)
+	{
+		stopCheckpoints();
+
+		c->cancel = false;
+		c->buildingId = id;
+		c->thread = new boost::thread(checkpointsBootstrap, this, doc, id);
+	}
+
+	if (wait && c->thread != NULL)
+	{
+		c->thread->join();
+		delete c->thread;
+		c->thread = NULL;
+	}
+}
+
+void SoundGen::stopCheckpoints()
+{
+	// Call with mtx_build held, or from the destructor
+	_soundgen_checkpoints_t *c = m_checkpoints;
+	if (c->thread == NULL)
+		return;
+
+	c->cancel = true;
+	c->thread->join();
+	delete c->thread;
+	c->thread = NULL;
+}
+
+void SoundGen::checkpointsBootstrap(SoundGen *sg, FtmDocument *doc, unsigned int documentId)
+{
+	_soundgen_checkpoints_t *c = sg->m_checkpoints;
+	_soundgen_checkpointframes_t frames;
+
+	SoundGen *shadow = new SoundGen;
+	shadow->m_silent = true;
+	shadow->setPlayDocument(doc);
+	bool done = shadow->simulateCheckpoints(c, &frames);
+	delete shadow;
+
+	if (!done)
+		return;
+
+	// the old frames are freed with the local list
+	boost::lock_guard<boost::mutex> lock(c->mtx_frames);
+	c->frames.frames.swap(frames.frames);
+	c->documentId = documentId;
+	c->ready = true;
+}
+
+bool SoundGen::simulateCheckpoints(const _soundgen_checkpoints_t *c, _soundgen_checkpointframes_t *frames)
+{
+	const std::vector<int> & chans = m_pPlayDocument->getChannelsFromChip();
+	const unsigned int frameCount = m_pPlayDocument->GetFrameCount();
+	unsigned int found = 0;
+
+	frames->frames.assign(frameCount, NULL);
+
+	m_trackerctlr->startAt(0, 0);
+	m_trackerActive = true;
+	m_iPlayTime = 0;
+
+	for (unsigned int tick = 0; tick < checkpoint_ticks; tick++)
+	{
+		if (c->cancel)
+			return false;
+
+		if (m_trackerctlr->isHalted() || m_trackerctlr->loops() > 0)
+			break;
+
+		// the next tick plays the first row of a frame
+		if (m_trackerctlr->rowDue() && m_trackerctlr->nextRow() == 0)
+		{
+			unsigned int frame = m_trackerctlr->nextFrame();
+			if (frame < frameCount && frames->frames[frame] == NULL)
+			{
+				checkpoint_t *cp = new checkpoint_t;
+				m_trackerctlr->saveState(cp->tracker);
+				for (int i = 0; i < CHANNELS; i++)
+					cp->channels[i] = NULL;
+				for (unsigned int i = 0; i < chans.size(); i++)
+				{
+					if (m_pChannels[chans[i]] != NULL)
+						cp->channels[chans[i]] = m_pChannels[chans[i]]->Clone();
+				}
+
+				frames->frames[frame] = cp;
+				if (++found == frameCount)
+					break;
+			}
+		}
+
+		requestFrame();
+	}
+
+	return true;
+}
+
+// Where analyzeSong() was when a frame changed
+struct seen_t
+{
+	TrackerController::state_t state;
+	core::u64 tick;
+};
+
+// The tracker state that decides which rows play from here on. The tempo
+// accumulator is left out, with uneven ticks per row it takes several
+// passes to come back to the same phase
+static bool same_course(const TrackerController::state_t &a, const TrackerController::state_t &b)
+{
+	return a.jumpFrame == b.jumpFrame && a.jumpRow == b.jumpRow
+		&& a.tempo == b.tempo && a.speed == b.speed
+		&& a.tempoDecrement == b.tempoDecrement;
+}
+
+static core::u32 hash_course(const TrackerController::state_t &s)
+{
+	const unsigned int fields[] = {
+		s.jumpFrame, s.jumpRow, s.tempo, s.speed, (unsigned int)s.tempoDecrement
+	};
+
+	// FNV-1a
+	core::u32 hash = 2166136261u;
+	for (unsigned int i = 0; i < sizeof(fields)/sizeof(fields[0]); i++)
+	{
+		for (int j = 0; j < 32; j += 8)
+		{
+			hash ^= (fields[i] >> j) & 0xFF;
+			hash *= 16777619u;
+		}
+	}
+	return hash;
+}
+
+void SoundGen::analyzeSong(const FtmDocument *doc, unsigned int track, songinfo_t &info)
+{
+	typedef std::multimap<core::u32, seen_t> seen_map;
+
+	SoundGen *sg = new SoundGen;
+	sg->m_silent = true;
+	sg->setPlayDocument(doc->snapshot(track));
+
+	FtmDocument *play = sg->m_pPlayDocument;
+	TrackerController *tc = sg->m_trackerctlr;
+
+	info.end = songinfo_t::END_LIMIT;
+	info.loopFrame = 0;
+	info.loopRow = 0;
+	info.loopTicks = 0;
+	info.channels = play->GetAvailableChannels();
+	for (int i = 0; i < MAX_CHANNELS; i++)
+		info.notes[i] = 0;
+
+	tc->startAt(0, 0);
+	sg->m_trackerActive = true;
+	sg->m_iPlayTime = 0;
+
+	seen_map seen;
+	core::u64 tick;
+	for (tick = 0; tick < checkpoint_ticks; tick++)
+	{
+		if (tc->isHalted())
+		{
+			info.end = songinfo_t::END_HALT;
+			break;
+		}
+
+		if (tc->rowDue())
+		{
+			unsigned int frame = tc->nextFrame();
+			unsigned int row = tc->nextRow();
+
+			// the frame changes, or a jump stays in the frame
+			if (tick == 0 || frame != tc->frame() || row != tc->row()+1)
+			{
+				seen_t s;
+				tc->saveState(s.state);
+				s.tick = tick;
+
+				core::u32 hash = hash_course(s.state);
+				std::pair<seen_map::iterator, seen_map::iterator> range = seen.equal_range(hash);
+				seen_map::iterator it;
+				for (it = range.first; it != range.second; ++it)
+				{
+					if (same_course(it->second.state, s.state))
+						break;
+				}
+
+				if (it != range.second)
+				{
+					info.end = songinfo_t::END_LOOP;
+					info.loopFrame = frame;
+					info.loopRow = row;
+					info.loopTicks = it->second.tick;
+					break;
+				}
+				seen.insert(std::make_pair(hash, s));
+			}
+
+			// the notes the row plays
+			for (unsigned int i = 0; i < info.channels; i++)
+			{
+				stChanNote note;
+				play->GetDataAtPattern(play->GetSelectedTrack(), play->GetPatternAtFrame(frame, i), i, row, &note);
+				if (note.Note != NONE && note.Note != RELEASE && note.Note != HALT)
+					info.notes[i]++;
+			}
+		}
+
+		sg->requestFrame();
+	}
+
+	info.ticks = tick;
+	info.seconds = (double)tick / play->GetFrameRate();
+
+	delete sg;
+}
+
+void SoundGen::captureSong(const FtmDocument *doc, unsigned int track, core::u64 ticks, RegisterStreamWriter *w)
+{
+	SoundGen *sg = new SoundGen;
+	sg->m_silent = true;
+	sg->setPlayDocument(doc->snapshot(track));
+	sg->setRegisterCapture(w);
+
+	// what startPlayback() writes
+	sg->setupChannels();
+	sg->resetTempo();
+
+	sg->m_trackerctlr->startAt(0, 0);
+	sg->m_trackerActive = true;
+	sg->m_iPlayTime = 0;
+
+	for (core::u64 tick = 0; tick < ticks; tick++)
+		sg->requestFrame();
+
+	sg->setRegisterCapture(NULL);
+	delete sg;
+}
+
+_soundgen_seek_t * SoundGen::prerollCheckpoint()
+{
+	// The rows above the starting row are played on a shadow sound
+	// generator, so the audio callback doesn't wait for them
+	_soundgen_checkpoints_t *c = m_checkpoints;
+	_soundgen_seek_t *seek = NULL;
+	FtmDocument *doc = NULL;
+
+	m_threading->mtx_running.lock();
+	if (!m_trackerActive && m_pPlayDocument != NULL)
+	{
+		updateSnapshot();
+		unsigned int frame = m_trackerctlr->frame();
+		unsigned int row = m_trackerctlr->row();
+
+		c->mtx_frames.lock();
+		bool found = c->ready && c->documentId == m_playDocumentId
+			&& frame < c->frames.frames.size() && c->frames.frames[frame] != NULL;
+		c->mtx_frames.unlock();
+
+		// starting at the top is what playing from the start does anyway
+		if (found && (frame != 0 || row != 0))
+		{
+			seek = new _soundgen_seek_t;
+			seek->documentId = m_playDocumentId;
+			seek->frame = frame;
+			seek->row = row;
+			doc = m_pPlayDocument->snapshot(m_pPlayDocument->GetSelectedTrack());
+		}
+	}
+	m_threading->mtx_running.unlock();
+
+	if (seek == NULL)
+		return NULL;
+
+	SoundGen *shadow = new SoundGen;
+	shadow->m_silent = true;
+	shadow->setPlayDocument(doc);
+
+	// what startPlayback() writes
+	shadow->setupChannels();
+	shadow->resetTempo();
+
+	// seekCheckpoint() makes the shadow's writes again on this one's chips
+	RegisterStreamWriter writer(&seek->writes);
+	shadow->setRegisterCapture(&writer);
+
+	{
+		boost::lock_guard<boost::mutex> lock(c->mtx_frames);
+
+		// the checkpoints were rebuilt of a newer document in the meantime
+		if (!c->ready || c->documentId != seek->documentId
+			|| seek->frame >= c->frames.frames.size() || c->frames.frames[seek->frame] == NULL)
+		{
+			shadow->setRegisterCapture(NULL);
+			delete shadow;
+			delete seek;
+			return NULL;
+		}
+
+		const checkpoint_t *cp = c->frames.frames[seek->frame];
+		shadow->m_trackerctlr->startAt(cp->tracker);
+		for (int i = 0; i < CHANNELS; i++)
+		{
+			if (cp->channels[i] != NULL && shadow->m_pChannels[i] != NULL)
+				shadow->m_pChannels[i]->RestoreState(cp->channels[i]);
+		}
+	}
+
+	// Play the rows above the starting row without sound
+	TrackerController *ctlr = shadow->m_trackerctlr;
+	shadow->m_trackerActive = true;
+	for (unsigned int tick = 0; tick < seek_ticks; tick++)
+	{
+		if (ctlr->isHalted() || ctlr->loops() > 0
+			|| ctlr->nextFrame() != seek->frame || ctlr->nextRow() > seek->row)
+			break;
+		if (ctlr->rowDue() && ctlr->nextRow() == seek->row)
+			break;
+
+		shadow->requestFrame();
+	}
+
+	shadow->setRegisterCapture(NULL);
+
+	ctlr->startAt(seek->frame, seek->row);
+	ctlr->saveState(seek->state.tracker);
+	const std::vector<int> & chans = doc->getChannelsFromChip();
+	for (unsigned int i = 0; i < chans.size(); i++)
+	{
+		if (shadow->m_pChannels[chans[i]] != NULL)
+			seek->state.channels[chans[i]] = shadow->m_pChannels[chans[i]]->Clone();
+	}
+
+	delete shadow;
+	return seek;
+}
+
+void SoundGen::seekCheckpoint(_soundgen_seek_t *seek)
+{
+	// Call with mtx_running held, after startPlayback()
+	if (seek == NULL || seek->documentId != m_playDocumentId
+		|| seek->frame != m_trackerctlr->frame() || seek->row != m_trackerctlr->row())
+		return;
+
+	// The chips get the writes of the rows above the row, without sound,
+	// so the channels' state matches what the chips were last written
+	seek->writes.seek(0, core::IO_SEEK_SET);
+	RegisterStreamReader reader(&seek->writes);
+	regstream_header_t header;
+	reader.readHeader(header);
+
+	core::u64 cycle = 0;
+	regstream_event_t e;
+	while (reader.next(e))
+	{
+		m_apu->SkipTime((int32)(e.cycle - cycle));
+		cycle = e.cycle;
+
+		switch (e.type)
+		{
+		case regstream_event_t::WRITE:
+			m_apu->Write(e.address, e.value);
+			break;
+		case regstream_event_t::EXTERNAL_WRITE:
+			m_apu->ExternalWrite(e.address, e.value);
+			break;
+		case regstream_event_t::SAMPLE:
+			m_samplemem->SetMem((const char*)e.sample, e.sampleSize);
+			break;
+		case regstream_event_t::SYNC:
+			m_apu->Sync();
+			if (m_capture != NULL)
+				m_capture->sync(m_apu->GetCycles());
+			break;
+		case regstream_event_t::FRAME:
+			m_apu->Process();
+			if (m_capture != NULL)
+				m_capture->endFrame(m_apu->GetCycles());
+			break;
+		}
+	}
+
+	m_trackerctlr->startAt(seek->state.tracker);
+	for (int i = 0; i < CHANNELS; i++)
+	{
+		if (seek->state.channels[i] != NULL && m_pChannels[i] != NULL)
+			m_pChannels[i]->RestoreState(seek->state.channels[i], true);
+	}
+
+	m_bPlayerHalted = false;
+	m_iPlayTime = 0;
+}
+
 bool SoundGen::isTrackerActive()
 {
 	m_threading->mtx_running.lock();
@@ -707,6 +1486,21 @@ void SoundGen::blockUntilTrackerStopped()
 	}
 }
 
+void SoundGen::setRenderEnd(RENDER_END when, int param)
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	m_bRenderEnd = true;
+	m_iRenderEndWhen = when;
+	m_iRenderEndParam = param;
+}
+void SoundGen::clearRenderEnd()
+{
+	boost::lock_guard<boost::mutex> lock(m_threading->mtx_running);
+
+	m_bRenderEnd = false;
+}
+
 void SoundGen::auditionNote(int note, int octave, int instrument, int channel)
 {
 	// note = 0..11
@@ -752,10 +1546,8 @@ void SoundGen::auditionRow(unsigned int frame, unsigned int row)
 	{
 		startPlayback();
 
-		m_pDocument->lock();
 		trackerController()->startAt(frame, row);
 		trackerController()->playRow();
-		m_pDocument->unlock();
 
 		play = true;
 	}
@@ -8,7 +8,7 @@
 
 namespace core
 {
-	class RingBuffer;
+	class SPSCRingBuffer;
 }
 
 class CAPU;
@@ -19,6 +19,7 @@ class CTrackerChannel;
 class CChannelHandler;
 class FtmDocument;
 class TrackerController;
+class RegisterStreamWriter;
 
 const int VIBRATO_LENGTH = 256;
 const int TREMOLO_LENGTH = 256;
@@ -28,6 +29,9 @@ const int NOTE_COUNT = 12*8;	// 96 available notes
 typedef enum { SONG_TIME_LIMIT, SONG_LOOP_LIMIT } RENDER_END;
 
 struct _soundgen_threading_t;
+struct _soundgen_checkpoints_t;
+struct _soundgen_checkpointframes_t;
+struct _soundgen_seek_t;
 
 class FAMICOREAPI SoundGen
 {
@@ -41,12 +45,32 @@ public:
 		const core::u8 * volumes;
 	};
 	typedef void (*trackerupdate_f)(rowframe_t rf, FtmDocument *doc, void *data);
+	struct songinfo_t
+	{
+		enum { END_LOOP, END_HALT, END_LIMIT } end;
+		core::u64 ticks;					// Length of the first pass, until it loops or halts
+		double seconds;
+		unsigned int loopFrame, loopRow;	// Where the song continues with END_LOOP
+		core::u64 loopTicks;				// Ticks before the loop point is first played
+		unsigned int channels;
+		unsigned int notes[MAX_CHANNELS];	// Notes played in the first pass, by channel of the track
+	};
+	struct framestats_t
+	{
+		core::u64 frames;					// Frames played since the APU was reset
+		core::u64 processCalls;				// CAPU::Process() calls in them
+		core::u64 apuRuns;					// The steps of those that emulated any time
+	};
 	SoundGen();
 	~SoundGen();
 
 	void setSoundSink(core::SoundSink *s);
 
 	void setDocument(FtmDocument *doc);
+	// Plays a track of a document that isn't edited while it's used. The
+	// document is only read, without locking it, so sound generators on
+	// several threads can share it
+	void setDocument(const FtmDocument *doc, unsigned int track);
 	TrackerController * trackerController() const{ return m_trackerctlr; }
 	void setTrackerUpdate(trackerupdate_f f, void *data=NULL){ m_trackerUpdateCallback = f; m_trackerUpdateData = data; }
 
@@ -72,21 +96,76 @@ public:
 	bool isTrackerActive();
 	void blockUntilTrackerStopped();
 
+	// Frame checkpoints
+	// Plays the song without sound on a thread, keeping the tracker and
+	// channel state at the start of each frame. startTracker() restores
+	// the state of the frame set with startAt(), and plays the rows above
+	// the row without sound before the audio callback is held up, so
+	// playing starts the way it would have if the song had played from
+	// the start. Nothing is done if they are already of the document
+	// being played. With wait, returns once they are built
+	void buildCheckpoints(bool wait=false);
+
+	// Song analysis
+	// Plays a track without sound until it halts or gets back to a
+	// position and tempo it was at when a frame changed. Songs that do
+	// neither stop after an hour of ticks. The document is only read
+	static void analyzeSong(const FtmDocument *doc, unsigned int track, songinfo_t &info);
+	// Plays ticks ticks of a track without sound, writing its register
+	// writes to w. The cycles count as if it was heard. The document is
+	// only read
+	static void captureSong(const FtmDocument *doc, unsigned int track, core::u64 ticks, RegisterStreamWriter *w);
+
+	// Rendering
+	// param is in seconds for SONG_TIME_LIMIT, or loops for SONG_LOOP_LIMIT
+	void setRenderEnd(RENDER_END when, int param);
+	void clearRenderEnd();
+
+	// Stereo panning from -100 (left) to 100 (right). Only heard on sinks
+	// with two channels
+	void setChannelPan(unsigned int channel, int pan);
+	void setChipPan(int chip, int pan);
+
+	// Register writes
+	// Queued, the channels' writes of a frame are made in one pass at its
+	// end, instead of processing the APU up to each one as it's made. The
+	// sound is the same. Off by default, writes are made directly
+	void setQueueWrites(bool queue);
+	void frameStats(framestats_t &s);
+
+	// Register capture
+	// Writes every register write and DPCM sample memory change to w,
+	// until it's called with NULL. The stream starts at the current APU
+	// cycle, so attach it before startTracker() to capture a whole song
+	void setRegisterCapture(RegisterStreamWriter *w);
+
 private:
-	static void apuCallback(const int16 *buf, uint32 sz, void *data);
-	static core::u32 soundCallback(core::s16 *buf, core::u32 sz, void *data, core::u32 *idx);
+	static void apuCallback(const void *buf, uint32 sz, void *data);
+	static void captureWriteCallback(uint64 cycle, uint16 address, uint8 value, bool external, void *data);
+	static void captureSampleCallback(const uint8 *mem, int size, void *data);
+	static core::u32 soundCallback(void *buf, core::u32 sz, void *data, core::u32 *idx);
 	static void timeCallback(core::u32 skip, void *data);
+	static void checkpointsBootstrap(SoundGen *sg, FtmDocument *doc, unsigned int documentId);
 
+	void updateSnapshot();
+	void setPlayDocument(FtmDocument *snapshot);
 	void startPlayback();
 	void stopPlayback();
 	void haltSounds();
+	bool renderEndReached() const;
 	void requestFrame();
+	// Call on a silent sound generator. Returns false if cancelled
+	bool simulateCheckpoints(const _soundgen_checkpoints_t *c, _soundgen_checkpointframes_t *frames);
+	// Call without mtx_running held. NULL if there's nothing to seek
+	_soundgen_seek_t * prerollCheckpoint();
+	void seekCheckpoint(_soundgen_seek_t *seek);
+	void stopCheckpoints();
 	// requestSound is not guaranteed to be (and typically isn't) called at a constant rate.
 	// for example, just because the engine speed may be 60Hz doesn't mean this gets called at 60Hz.
-	core::u32 requestSound(core::s16 *buf, core::u32 sz, core::u32 *idx);
+	core::u32 requestSound(void *buf, core::u32 sz, core::u32 *idx);
 
-	core::RingBuffer *m_queued_rowframes;
-	core::RingBuffer *m_queued_sound;
+	core::SPSCRingBuffer *m_queued_rowframes;
+	core::SPSCRingBuffer *m_queued_sound;
 	core::u8 * m_volumes_ring;
 	unsigned int m_volumes_read_offset, m_volumes_write_offset;
 	unsigned int m_volumes_size;
@@ -109,6 +188,12 @@ private:
 
 private:
 	FtmDocument *m_pDocument;
+	FtmDocument *m_pPlayDocument;		// Snapshot of m_pDocument that is played
+	bool m_followDocument;				// m_pDocument publishes snapshots
+	unsigned int m_playDocumentId;		// Changes with m_pPlayDocument
+	bool m_silent;						// Runs frames without emulating the APU
+	_soundgen_checkpoints_t * m_checkpoints;
+	RegisterStreamWriter * m_capture;
 	TrackerController *m_trackerctlr;
 	trackerupdate_f m_trackerUpdateCallback;
 	void *m_trackerUpdateData;
@@ -135,6 +220,7 @@ private:
 	unsigned int		m_lastRow, m_lastFrame;
 	unsigned int		m_iPlayTime;
 	int					m_iFrameCounter;
+	core::u64			m_iFrames;							// Since resetAPU()
 
 	unsigned int		m_channels;
 
@@ -154,6 +240,7 @@ private:
 	unsigned int		m_iMachineType;						// NTSC/PAL
 
 	// Rendering
+	bool				m_bRenderEnd;
 	RENDER_END			m_iRenderEndWhen;
 	int					m_iRenderEndParam;
 
@@ -5,7 +5,7 @@
 
 TrackerController::TrackerController()
 	: m_frame(0), m_row(0), m_elapsedFrames(0), m_halted(true),
-	  m_jumpFrame(0), m_jumpRow(0)
+	  m_jumpFrame(0), m_jumpRow(0), m_loops(0), m_loopPending(false)
 {
 }
 TrackerController::~TrackerController()
@@ -46,6 +46,13 @@ void TrackerController::playRow()
 	m_jumped = false;
 	m_didJump = false;
 
+	if (m_loopPending)
+	{
+		// the row we're about to play was already played before
+		m_loops++;
+		m_loopPending = false;
+	}
+
 	m_frame = m_jumpFrame;
 	m_row = m_jumpRow;
 
@@ -63,6 +70,9 @@ void TrackerController::playRow()
 
 	if (m_jumped)
 	{
+		// jumping backwards loops the song
+		if (m_jumpFrame < m_frame || (m_jumpFrame == m_frame && m_jumpRow <= m_row))
+			m_loopPending = true;
 	}
 	else
 	{
@@ -75,6 +85,7 @@ void TrackerController::playRow()
 			if (m_jumpFrame >= m_document->GetFrameCount())
 			{
 				m_jumpFrame = 0;
+				m_loopPending = true;
 			}
 		}
 	}
@@ -91,10 +102,49 @@ void TrackerController::startAt(unsigned int frame, unsigned int row)
 	m_jumpRow = m_row;
 
 	m_elapsedFrames = 0;
+	m_loops = 0;
+	m_loopPending = false;
 	m_jumped = false;
 	m_halted = false;
 }
 
+void TrackerController::startAt(const state_t &state)
+{
+	m_frame = state.frame;
+	m_row = state.row;
+	m_jumpFrame = state.jumpFrame;
+	m_jumpRow = state.jumpRow;
+
+	m_lastDocTempo = state.lastDocTempo;
+	m_lastDocSpeed = state.lastDocSpeed;
+	m_tempo = state.tempo;
+	m_speed = state.speed;
+	m_tempoAccum = state.tempoAccum;
+	m_tempoDecrement = state.tempoDecrement;
+
+	m_elapsedFrames = 0;
+	m_loops = 0;
+	m_loopPending = false;
+	m_jumped = false;
+	m_halted = state.halted;
+}
+
+void TrackerController::saveState(state_t &state) const
+{
+	state.halted = m_halted;
+	state.frame = m_frame;
+	state.row = m_row;
+	state.jumpFrame = m_jumpFrame;
+	state.jumpRow = m_jumpRow;
+
+	state.lastDocTempo = m_lastDocTempo;
+	state.lastDocSpeed = m_lastDocSpeed;
+	state.tempo = m_tempo;
+	state.speed = m_speed;
+	state.tempoAccum = m_tempoAccum;
+	state.tempoDecrement = m_tempoDecrement;
+}
+
 void TrackerController::setFrame(unsigned int frame)
 {
 	if (m_jumpFrame == frame && m_jumpRow == 0)
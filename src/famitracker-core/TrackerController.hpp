@@ -11,21 +11,43 @@ struct stChanNote;
 class FAMICOREAPI TrackerController
 {
 public:
+	// What playing the earlier rows left behind, for frame checkpoints
+	struct state_t
+	{
+		bool halted;
+		unsigned int frame, row;
+		unsigned int jumpFrame, jumpRow;
+		unsigned int lastDocTempo, lastDocSpeed;
+		unsigned int tempo, speed;
+		int tempoAccum, tempoDecrement;
+	};
+
 	TrackerController();
 	~TrackerController();
 	void tick();
 	void playRow();
 	void startAt(unsigned int frame, unsigned int row);
+	// startAt() the row the state plays next, with its tempo and speed
+	void startAt(const state_t &state);
+	void saveState(state_t &state) const;
 	void setFrame(unsigned int frame);
 	void skip(unsigned int row);
 
 	void setTempo(unsigned int tempo, unsigned int speed);
 
 	void initialize(FtmDocument *doc, CTrackerChannel * const * trackerChannels);
+	// switch to another snapshot of the same document while playing
+	void setDocument(FtmDocument *doc){ m_document = doc; }
 
 	unsigned int frame() const{ return m_frame; }
 	unsigned int row() const{ return m_row; }
+	// the row the next playRow() plays, and whether the next tick() plays it
+	unsigned int nextFrame() const{ return m_jumpFrame; }
+	unsigned int nextRow() const{ return m_jumpRow; }
+	bool rowDue() const{ return !m_halted && m_tempoAccum <= 0; }
 	bool isHalted() const{ return m_halted; }
+	// number of times the song has looped since startAt()
+	unsigned int loops() const{ return m_loops; }
 	FtmDocument * document() const{ return m_document; }
 
 	void setMuted(int channel_offset, bool mute);
@@ -48,6 +70,9 @@ private:
 
 	unsigned int m_elapsedFrames;
 
+	unsigned int m_loops;
+	bool m_loopPending;
+
 	bool m_muted[MAX_CHANNELS];
 };
 
@@ -0,0 +1,371 @@
+#include <string.h>
+#include "VGMExport.hpp"
+#include "RegisterStream.hpp"
+#include "SoundGen.hpp"
+#include "FtmDocument.hpp"
+#include "APU/APU.h"
+#include "core/io.hpp"
+
+static const core::u32 VGM_VERSION = 0x171;
+static const core::u32 VGM_RATE = 44100;
+static const unsigned int VGM_HEADER_SIZE = 0x100;
+static const core::u32 YM2413_CLOCK = 3579545;
+static const core::u32 YM2413_VRC7 = 0x80000000;	// in the YM2413 clock
+static const core::u32 NES_FDS = 0x80000000;		// in the NES APU clock
+
+static const core::u8 CMD_YM2413 = 0x51;
+static const core::u8 CMD_WAIT = 0x61;
+static const core::u8 CMD_WAIT_NTSC = 0x62;
+static const core::u8 CMD_WAIT_PAL = 0x63;
+static const core::u8 CMD_END = 0x66;
+static const core::u8 CMD_DATA_BLOCK = 0x67;
+static const core::u8 CMD_WAIT_SHORT = 0x70;		// waits 1-16 samples
+static const core::u8 CMD_NES_APU = 0xB4;
+static const core::u8 BLOCK_NES_RAM = 0xC2;
+
+static const core::u8 REG_FDS = 0x20;				// $4080
+static const core::u8 REG_FDS_WAVE = 0x40;			// $4040
+static const core::u8 REG_FDS_WAVE_WRITE = REG_FDS + 0x09;
+
+static const core::u16 SAMPLE_ADDRESS = 0xC000;
+
+// NES APU registers that only hold a value, writing it again does nothing.
+// $4001/$4005 reload the sweep, $4003/$4007/$400B/$400F restart the
+// channel, $4011 and $4015/$4017 act on the write
+static const bool APU_PLAIN[0x20] = {
+	true,  false, true,  false,		// $4000
+	true,  false, true,  false,		// $4004
+	true,  false, true,  false,		// $4008
+	true,  false, true,  false,		// $400C
+	true,  false, true,  true,		// $4010
+	false, false, false, false,
+	false, false, false, false,
+	false, false, false, false
+};
+
+static void put_u32(core::u8 *p, core::u32 v)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (v >> (i*8)) & 0xFF;
+}
+
+static bool plain_register(core::u8 reg, core::u8 value, bool waveWritable)
+{
+	if (reg < REG_FDS)
+		return APU_PLAIN[reg];
+	if (reg >= REG_FDS_WAVE)
+		return waveWritable;
+
+	switch (reg - REG_FDS)
+	{
+	case 0x00:		// volume and modulation envelopes, unless they run
+	case 0x04:
+		return (value & 0x80) != 0;
+	case 0x02:		// frequency and modulation frequency, low bits
+	case 0x06:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// The expansion chip an address belongs to, SNDCHIP_NONE for the 2A03
+static unsigned char chip_of(core::u16 address)
+{
+	if (address == 0x9010 || address == 0x9030)
+		return SNDCHIP_VRC7;
+	if (address >= 0x9000 && address <= 0xB002)
+		return SNDCHIP_VRC6;
+	if (address >= 0x4040 && address <= 0x409F)
+		return SNDCHIP_FDS;
+	if (address >= 0x5000 && address <= 0x5015)
+		return SNDCHIP_MMC5;
+	if (address == 0x4800 || address == 0xF800)
+		return SNDCHIP_N106;
+	return SNDCHIP_NONE;
+}
+
+VGMExporter::VGMExporter()
+{
+	reset();
+}
+
+void VGMExporter::reset()
+{
+	m_commands.clear();
+	memset(&m_info, 0, sizeof(m_info));
+	m_clock = CAPU::BASE_FREQ_NTSC;
+	m_sample = 0;
+	m_loops = false;
+	m_loopOffset = 0;
+	m_loopSample = 0;
+
+	for (int i = 0; i < 0x80; i++)
+		m_apu[i] = -1;
+	for (int i = 0; i < 0x40; i++)
+		m_opll[i] = -1;
+	m_opllLatch = 0;
+	m_samples.clear();
+}
+
+void VGMExporter::exportTrack(const FtmDocument *doc, unsigned int track, core::IO *io)
+{
+	reset();
+
+	// Where the song loops, and where the export ends
+	SoundGen::songinfo_t song;
+	SoundGen::analyzeSong(doc, track, song);
+	m_loops = song.end == SoundGen::songinfo_t::END_LOOP;
+
+	core::MemoryIO stream;
+	{
+		RegisterStreamWriter writer(&stream);
+		SoundGen::captureSong(doc, track, song.ticks, &writer);
+	}
+	stream.seek(0, core::IO_SEEK_SET);
+
+	RegisterStreamReader reader(&stream);
+	regstream_header_t header;
+	reader.readHeader(header);
+	m_clock = header.machine == MACHINE_PAL ? CAPU::BASE_FREQ_PAL : CAPU::BASE_FREQ_NTSC;
+
+	// what SoundGen writes when it resets the APU, before the stream
+	apuWrite(0x15, 0x0F, true);
+	apuWrite(0x17, 0x00, true);
+
+	if (m_loops && song.loopTicks == 0)
+		writeState();
+
+	core::u64 frames = 0;
+	core::u64 end = 0;
+	regstream_event_t e;
+	while (reader.next(e))
+	{
+		waitUntil(e.cycle);
+		end = e.cycle;
+
+		if (e.type == regstream_event_t::FRAME)
+		{
+			frames++;
+			if (m_loops && frames == song.loopTicks)
+				writeState();
+		}
+		else
+		{
+			event(e, header.chip);
+		}
+	}
+	waitUntil(end);
+	m_commands.push_back(CMD_END);
+
+	m_info.samples = m_sample;
+	m_info.loopSamples = m_loops ? m_sample - m_loopSample : 0;
+
+	std::vector<core::u8> file;
+	writeHeader(file, header.chip, header.frameCycles);
+	file.insert(file.end(), m_commands.begin(), m_commands.end());
+	m_info.size = file.size();
+
+	if (!io->write_e(&file[0], file.size()))
+		throw VGMException("Could not write the VGM file");
+}
+
+void VGMExporter::event(const regstream_event_t &e, unsigned char chip)
+{
+	switch (e.type)
+	{
+	case regstream_event_t::WRITE:
+		if (e.address >= 0x4000 && e.address < 0x4020)
+			apuWrite(e.address - 0x4000, e.value, false);
+		break;
+	case regstream_event_t::EXTERNAL_WRITE:
+	{
+		// the channels of every chip write, only the document's are heard
+		unsigned char owner = chip_of(e.address);
+		if ((owner & chip) == 0)
+			break;
+
+		if (owner == SNDCHIP_FDS)
+		{
+			if (e.address >= 0x4080)
+				apuWrite(REG_FDS + (e.address - 0x4080), e.value, false);
+			else
+				apuWrite(REG_FDS_WAVE + (e.address - 0x4040), e.value, false);
+		}
+		else if (owner == SNDCHIP_VRC7)
+		{
+			if (e.address == 0x9010)
+				m_opllLatch = e.value & 0x3F;
+			else
+				opllWrite(m_opllLatch, e.value, false);
+		}
+		else
+		{
+			m_info.unsupported++;
+		}
+		break;
+	}
+	case regstream_event_t::SAMPLE:
+		if (e.sampleSize > 0)
+			sampleBlock(e.sample, e.sampleSize, false);
+		break;
+	default:
+		break;
+	}
+}
+
+void VGMExporter::apuWrite(core::u8 reg, core::u8 value, bool force)
+{
+	bool waveWritable = m_apu[REG_FDS_WAVE_WRITE] >= 0 && (m_apu[REG_FDS_WAVE_WRITE] & 0x80) != 0;
+	if (!force && m_apu[reg] == value && plain_register(reg, value, waveWritable))
+	{
+		m_info.coalesced++;
+		return;
+	}
+
+	// the wave RAM only takes writes while it's writable
+	if (reg < REG_FDS_WAVE || waveWritable)
+		m_apu[reg] = value;
+
+	m_commands.push_back(CMD_NES_APU);
+	m_commands.push_back(reg);
+	m_commands.push_back(value);
+	m_info.writes++;
+}
+
+void VGMExporter::opllWrite(core::u8 reg, core::u8 value, bool force)
+{
+	// the YM2413 registers only hold values, key on acts on changes
+	if (!force && m_opll[reg] == value)
+	{
+		m_info.coalesced++;
+		return;
+	}
+
+	m_opll[reg] = value;
+
+	m_commands.push_back(CMD_YM2413);
+	m_commands.push_back(reg);
+	m_commands.push_back(value);
+	m_info.writes++;
+}
+
+void VGMExporter::sampleBlock(const core::u8 *mem, unsigned int size, bool force)
+{
+	// triggering a sample sets the same memory again
+	if (!force && size == m_samples.size() && memcmp(mem, &m_samples[0], size) == 0)
+		return;
+
+	m_samples.assign(mem, mem + size);
+
+	core::u8 h[7];
+	h[0] = CMD_DATA_BLOCK;
+	h[1] = CMD_END;			// compatibility byte
+	h[2] = BLOCK_NES_RAM;
+	put_u32(h + 3, size + 2);
+	m_commands.insert(m_commands.end(), h, h + 7);
+	m_commands.push_back(SAMPLE_ADDRESS & 0xFF);
+	m_commands.push_back(SAMPLE_ADDRESS >> 8);
+	m_commands.insert(m_commands.end(), mem, mem + size);
+}
+
+void VGMExporter::writeState()
+{
+	m_loopOffset = m_commands.size();
+	m_loopSample = m_sample;
+
+	// The end of the song doesn't leave the registers the way the loop
+	// point found them. Write what is known again, without side effects
+	for (core::u8 reg = 0; reg < REG_FDS_WAVE; reg++)
+	{
+		if (m_apu[reg] >= 0 && plain_register(reg, m_apu[reg], false))
+			apuWrite(reg, m_apu[reg], true);
+	}
+
+	bool wave = false;
+	for (int i = REG_FDS_WAVE; i < 0x80; i++)
+		wave = wave || m_apu[i] >= 0;
+	if (wave)
+	{
+		int writable = m_apu[REG_FDS_WAVE_WRITE];
+		apuWrite(REG_FDS_WAVE_WRITE, 0x80, true);
+		for (core::u8 reg = REG_FDS_WAVE; reg < 0x80; reg++)
+		{
+			if (m_apu[reg] >= 0)
+				apuWrite(reg, m_apu[reg], true);
+		}
+		apuWrite(REG_FDS_WAVE_WRITE, writable >= 0 ? writable : 0x00, true);
+	}
+
+	for (core::u8 reg = 0; reg < 0x40; reg++)
+	{
+		if (m_opll[reg] >= 0)
+			opllWrite(reg, m_opll[reg], true);
+	}
+
+	if (!m_samples.empty())
+	{
+		std::vector<core::u8> samples = m_samples;
+		sampleBlock(&samples[0], samples.size(), true);
+	}
+}
+
+void VGMExporter::waitUntil(core::u64 cycle)
+{
+	// rounded down from the start, so the waits don't drift
+	core::u64 target = cycle * VGM_RATE / m_clock;
+	if (target <= m_sample)
+		return;
+
+	core::u64 n = target - m_sample;
+	m_sample = target;
+
+	while (n > 0)
+	{
+		if (n == 735)
+		{
+			m_commands.push_back(CMD_WAIT_NTSC);
+			n = 0;
+		}
+		else if (n == 882)
+		{
+			m_commands.push_back(CMD_WAIT_PAL);
+			n = 0;
+		}
+		else if (n <= 16)
+		{
+			m_commands.push_back(CMD_WAIT_SHORT + (n - 1));
+			n = 0;
+		}
+		else
+		{
+			core::u32 wait = n > 0xFFFF ? 0xFFFF : (core::u32)n;
+			m_commands.push_back(CMD_WAIT);
+			m_commands.push_back(wait & 0xFF);
+			m_commands.push_back(wait >> 8);
+			n -= wait;
+		}
+	}
+}
+
+void VGMExporter::writeHeader(std::vector<core::u8> &file, unsigned char chip, core::u32 frameCycles) const
+{
+	file.assign(VGM_HEADER_SIZE, 0);
+	core::u8 *h = &file[0];
+	core::u32 size = VGM_HEADER_SIZE + m_commands.size();
+
+	memcpy(h, "Vgm ", 4);
+	put_u32(h + 0x04, size - 0x04);
+	put_u32(h + 0x08, VGM_VERSION);
+	if (chip & SNDCHIP_VRC7)
+		put_u32(h + 0x10, YM2413_CLOCK | YM2413_VRC7);
+	put_u32(h + 0x18, (core::u32)m_sample);
+	if (m_loops)
+	{
+		put_u32(h + 0x1C, VGM_HEADER_SIZE + m_loopOffset - 0x1C);
+		put_u32(h + 0x20, (core::u32)(m_sample - m_loopSample));
+	}
+	put_u32(h + 0x24, (core::u32)((m_clock + frameCycles/2) / frameCycles));
+	put_u32(h + 0x34, VGM_HEADER_SIZE - 0x34);
+	put_u32(h + 0x84, (core::u32)m_clock | ((chip & SNDCHIP_FDS) ? NES_FDS : 0));
+}
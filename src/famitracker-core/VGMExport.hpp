@@ -0,0 +1,89 @@
+#ifndef _VGMEXPORT_HPP_
+#define _VGMEXPORT_HPP_
+
+#include <exception>
+#include <string>
+#include <vector>
+#include "core/types.hpp"
+#include "common.hpp"
+
+namespace core
+{
+	class IO;
+}
+
+class FtmDocument;
+struct regstream_event_t;
+
+class FAMICOREAPI VGMException : public std::exception
+{
+public:
+	explicit VGMException(const std::string &msg)
+		: m_msg(msg)
+	{
+	}
+	~VGMException() throw(){}
+
+	const char * what() const throw(){ return m_msg.c_str(); }
+private:
+	std::string m_msg;
+};
+
+/*
+ * Exports tracks to VGM 1.71 files. The track is played without sound to
+ * capture its register writes (see RegisterStream), which become
+ *   2A03 and FDS:  NES APU writes, DPCM samples as NES RAM data blocks
+ *   VRC7:          YM2413 writes, with the VRC7 instruments
+ * VGM has no VRC6, MMC5 or N106, their writes are left out and counted.
+ *
+ * Writes that don't change a register are left out. A song that loops
+ * ends where it would loop, and the registers are written again at the
+ * loop point so every pass starts the same.
+ */
+struct vgminfo_t
+{
+	core::u64 samples;			// at 44100 Hz
+	core::u64 loopSamples;		// 0 if the song doesn't loop
+	unsigned int writes;		// register writes in the file
+	unsigned int coalesced;		// writes left out, they didn't change anything
+	unsigned int unsupported;	// writes to chips VGM doesn't have
+	core::u32 size;				// bytes
+};
+
+class FAMICOREAPI VGMExporter
+{
+public:
+	VGMExporter();
+
+	// Throws VGMException if io can't be written
+	void exportTrack(const FtmDocument *doc, unsigned int track, core::IO *io);
+	// Of the last export
+	const vgminfo_t & info() const{ return m_info; }
+private:
+	void reset();
+	void event(const regstream_event_t &e, unsigned char chip);
+	void apuWrite(core::u8 reg, core::u8 value, bool force);
+	void opllWrite(core::u8 reg, core::u8 value, bool force);
+	void sampleBlock(const core::u8 *mem, unsigned int size, bool force);
+	// Writes the registers as they are, at the loop point
+	void writeState();
+	void waitUntil(core::u64 cycle);
+	void writeHeader(std::vector<core::u8> &file, unsigned char chip, core::u32 frameCycles) const;
+
+	std::vector<core::u8> m_commands;
+	vgminfo_t m_info;
+	core::u64 m_clock;
+	core::u64 m_sample;
+	bool m_loops;
+	core::u32 m_loopOffset;		// in m_commands
+	core::u64 m_loopSample;
+
+	// Last values written, -1 if unknown
+	int m_apu[0x80];			// NES APU register space of VGM, $4000-$401F,
+								// FDS $4080-$409E at $20, wave RAM at $40
+	int m_opll[0x40];
+	core::u8 m_opllLatch;
+	std::vector<core::u8> m_samples;
+};
+
+#endif
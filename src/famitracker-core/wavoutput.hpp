@@ -1,10 +1,12 @@
 #ifndef _WAVOUTPUT_HPP_
 #define _WAVOUTPUT_HPP_
 
-#include "Document.hpp"
+#include "common.hpp"
+#include "types.hpp"
+#include "core/io.hpp"
 #include "core/soundsink.hpp"
 
-class WavOutput : public core::SoundSinkExport
+class FAMICOREAPI WavOutput : public core::SoundSinkExport
 {
 public:
 	WavOutput(core::IO *io, int channels, int sampleRate);
@@ -13,13 +15,8 @@ public:
 	void flush(){}
 
 	void finalize();
-
-	int sampleRate() const{ return m_sampleRate; }
 private:
-	core::IO *m_io;
 	Quantity m_size;
-
-	int m_sampleRate;
 };
 
 #endif
@@ -18,6 +18,7 @@ public:
 
 	int integer(int offset);
 	const std::string & string(int offset);
+	int argumentCount() const{ return m_arguments.size(); }
 private:
 	typedef std::map<std::string, std::string> Map;
 
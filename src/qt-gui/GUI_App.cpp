@@ -1,4 +1,7 @@
 #include <QMessageBox>
+#include <QThread>
+#include <string.h>
+#include <boost/atomic.hpp>
 #include "GUI_App.hpp"
 #include "GUI_ThreadPool.hpp"
 #include "MainWindow.hpp"
@@ -6,11 +9,54 @@
 #include "famitracker-core/TrackerController.hpp"
 #include "famitracker-core/FtmDocument.hpp"
 
+// Latest tracker position, handed from the sound sink's timer thread to the
+// main thread without either waiting on the other. Positions the main thread
+// doesn't get to in time are replaced by newer ones.
+struct _app_trackerupdate_t
+{
+	struct snapshot_t
+	{
+		unsigned int row, frame;
+		unsigned int position;		// counts the updates of a running tracker
+		core::u8 volumes[MAX_CHANNELS];
+	};
+
+	_app_trackerupdate_t()
+		: write(0), read(2), row(0), frame(0), position(0), shownPosition(0)
+	{
+		memset(snapshots, 0, sizeof(snapshots));
+		middle = 1;
+		pending = false;
+		posted = 0;
+		coalesced = 0;
+		dropped = 0;
+	}
+
+	// triple buffer. the timer thread fills snapshots[write] and swaps it
+	// with the middle one, the main thread swaps snapshots[read] with the
+	// middle one when it's FRESH
+	enum { FRESH = 4 };
+	snapshot_t snapshots[3];
+	unsigned int write, read;
+	boost::atomic<unsigned int> middle;
+
+	// timer thread only, the last position of a running tracker
+	unsigned int row, frame, position;
+	// main thread only
+	unsigned int shownPosition;
+
+	// an UpdateEvent is on its way to the main thread
+	boost::atomic<bool> pending;
+
+	boost::atomic<unsigned int> posted, coalesced, dropped;
+};
+
 namespace gui
 {
 	App::App(QApplication *a)
 		: app(a), edit_mode(false), is_playing(false), mw(NULL)
 	{
+		m_trackerUpdate = new _app_trackerupdate_t;
 		init_settings();
 	}
 
@@ -50,6 +96,7 @@ namespace gui
 		delete threadPool;
 	//	delete sink;
 		delete sgen;
+		delete m_trackerUpdate;
 
 		delete mw;
 	}
@@ -68,15 +115,40 @@ namespace gui
 
 	void App::trackerUpdate(const SoundGen::rowframe_t &rf, FtmDocument *doc)
 	{
-		// happens on non-gui thread
-		DocInfo *dinfo = activeDocInfo();
+		// happens on non-gui thread, the position is applied by
+		// receiveUpdateEvent() on the gui thread
+		_app_trackerupdate_t &u = *m_trackerUpdate;
 
 		if (rf.tracker_running)
 		{
-			dinfo->setCurrentFrame(rf.frame);
-			dinfo->setCurrentRow(rf.row);
+			u.row = rf.row;
+			u.frame = rf.frame;
+			u.position++;
+		}
+
+		_app_trackerupdate_t::snapshot_t &s = u.snapshots[u.write];
+		s.row = u.row;
+		s.frame = u.frame;
+		s.position = u.position;
+
+		// the document's channels are what the sound generator plays
+		unsigned int channels = doc->GetAvailableChannels();
+		if (channels > MAX_CHANNELS)
+			channels = MAX_CHANNELS;
+		memcpy(s.volumes, rf.volumes, sizeof(core::u8)*channels);
+
+		unsigned int old = u.middle.exchange(u.write | _app_trackerupdate_t::FRESH, boost::memory_order_acq_rel);
+		u.write = old & ~_app_trackerupdate_t::FRESH;
+
+		if (old & _app_trackerupdate_t::FRESH)
+		{
+			// the gui never saw the snapshot that was replaced
+			const _app_trackerupdate_t::snapshot_t &o = u.snapshots[u.write];
+			if (o.position != s.position && (o.row != s.row || o.frame != s.frame))
+			{
+				u.dropped.fetch_add(1, boost::memory_order_relaxed);
+			}
 		}
-		dinfo->setVolumes(rf.volumes);
 
 		sendUpdateEvent();
 
@@ -107,6 +179,7 @@ namespace gui
 			return;
 
 		sgen->setDocument(activeDocument());
+		sgen->buildCheckpoints();
 		if (mw != NULL)
 		{
 			mw->setDocInfo(activeDocInfo());
@@ -148,7 +221,7 @@ namespace gui
 		try
 		{
 			FtmDocument *d = new FtmDocument;
-			d->read(io);
+			d->read(io, QThread::idealThreadCount());
 			d->SelectTrack(0);
 
 			if (close_active)
@@ -188,6 +261,7 @@ namespace gui
 	void App::reloadAudio()
 	{
 		sgen->setDocument(activeDocument());
+		sgen->buildCheckpoints();
 	}
 
 	bool App::isPlaying()
@@ -224,16 +298,53 @@ namespace gui
 		if (mw == NULL)
 			return;
 
-		boost::unique_lock<boost::mutex> lock(m_mtx_updateEvent);
+		_app_trackerupdate_t &u = *m_trackerUpdate;
+
+		// the event still on its way shows this update too
+		if (u.pending.exchange(true, boost::memory_order_acq_rel))
+		{
+			u.coalesced.fetch_add(1, boost::memory_order_relaxed);
+			return;
+		}
+
+		u.posted.fetch_add(1, boost::memory_order_relaxed);
 
 		// post an event to the main thread
 		UpdateEvent *event = new UpdateEvent;
-		event->mtx_updateEvent = &m_mtx_updateEvent;
-		event->cond_updateEvent = &m_cond_updateEvent;
 		QApplication::postEvent(mw, event);
+	}
+
+	void App::receiveUpdateEvent()
+	{
+		_app_trackerupdate_t &u = *m_trackerUpdate;
 
-		// wait until the gui is finished updating before resuming
-		m_cond_updateEvent.wait(lock);
+		// updates from now on post a new event
+		u.pending.store(false, boost::memory_order_release);
+
+		if (!(u.middle.load(boost::memory_order_acquire) & _app_trackerupdate_t::FRESH))
+			return;
+
+		unsigned int old = u.middle.exchange(u.read, boost::memory_order_acq_rel);
+		u.read = old & ~_app_trackerupdate_t::FRESH;
+
+		const _app_trackerupdate_t::snapshot_t &s = u.snapshots[u.read];
+		DocInfo *dinfo = activeDocInfo();
+
+		// only move the cursor if the tracker played since the last update
+		if (s.position != u.shownPosition)
+		{
+			u.shownPosition = s.position;
+			dinfo->setCurrentFrame(s.frame);
+			dinfo->setCurrentRow(s.row);
+		}
+		dinfo->setVolumes(s.volumes);
+	}
+
+	void App::updateEventStats(unsigned int &posted, unsigned int &coalesced, unsigned int &dropped) const
+	{
+		posted = m_trackerUpdate->posted.load(boost::memory_order_relaxed);
+		coalesced = m_trackerUpdate->coalesced.load(boost::memory_order_relaxed);
+		dropped = m_trackerUpdate->dropped.load(boost::memory_order_relaxed);
 	}
 
 	void App::sendCallbackEvent(mainthread_callback_t cb, void *data)
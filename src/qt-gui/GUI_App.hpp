@@ -3,7 +3,6 @@
 
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
-#include <boost/thread/condition.hpp>
 #include <vector>
 #include "DocInfo.hpp"
 #include "famitracker-core/SoundGen.hpp"
@@ -17,6 +16,8 @@ namespace boost
 	class thread;
 }
 
+struct _app_trackerupdate_t;
+
 namespace gui
 {
 	class MainWindow;
@@ -51,6 +52,11 @@ namespace gui
 		void setIsPlaying(bool playing);
 
 		void sendUpdateEvent();
+		// on the main thread, shows the newest tracker position
+		void receiveUpdateEvent();
+		// tracker updates posted to the main thread, merged into an update
+		// already pending, and positions replaced before they were shown
+		void updateEventStats(unsigned int &posted, unsigned int &coalesced, unsigned int &dropped) const;
 		void sendCallbackEvent(mainthread_callback_t cb, void *data);
 
 		void playSongConcurrent(mainthread_callback_t, void *data=NULL);
@@ -118,8 +124,7 @@ namespace gui
 		core::threadpool::Queue m_tpq;
 		boost::thread * m_tpoolThread;
 
-		boost::mutex m_mtx_updateEvent;
-		boost::condition m_cond_updateEvent;
+		_app_trackerupdate_t * m_trackerUpdate;
 	};
 }
 
@@ -37,6 +37,9 @@ namespace gui
 
 		int row = startatrow0?0:dinfo->currentRow();
 
+		// edits since the last play make the song simulate again
+		m_app->sgen->buildCheckpoints(true);
+
 		m_app->sgen->trackerController()->startAt(dinfo->currentFrame(), row);
 
 		m_app->sgen->startTracker();
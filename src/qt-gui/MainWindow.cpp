@@ -5,6 +5,7 @@
 #include "CreateWAV.hpp"
 #include "ModuleProperties.hpp"
 #include "AboutDialog.hpp"
+#include "ProfilePanel.hpp"
 #include "GUI.hpp"
 #include "Settings.hpp"
 #include "styles.hpp"
@@ -152,6 +153,15 @@ namespace gui
 			connect(style_monochrome, SIGNAL(triggered()), this, SLOT(selectMonochromeStyle()));
 		}
 
+		m_profilepanel = NULL;
+#ifdef FAMI_PROFILING
+		{
+			menu_View->addSeparator();
+			QAction *stats = menu_View->addAction(tr("Render Statistics"));
+			connect(stats, SIGNAL(triggered()), this, SLOT(profileStats()));
+		}
+#endif
+
 		QMenu *m = new QMenu;
 		m->addAction(tr("New 2A03 instrument"));
 
@@ -250,13 +260,8 @@ namespace gui
 	{
 		if (event->type() == UPDATEEVENT)
 		{
-			UpdateEvent *e = (UpdateEvent*)event;
-
-			e->mtx_updateEvent->lock();
+			m_app->receiveUpdateEvent();
 			updateFrameChannel();
-
-			e->cond_updateEvent->notify_all();
-			e->mtx_updateEvent->unlock();
 			return true;
 		}
 		else if (event->type() == CALLBACKEVENT)
@@ -467,7 +472,7 @@ namespace gui
 		QString ftmpath = QFileInfo(path).absoluteDir().absolutePath();
 		settings()->setValue(SETTINGS_FTMPATH, ftmpath);
 
-		core::FileIO *io = new core::FileIO(path.toLocal8Bit(), core::IO_READ);
+		core::MappedFileIO *io = new core::MappedFileIO(path.toLocal8Bit());
 
 		gui::stopSongConcurrent(open_cb, io);
 		gui::addRecentFile(path);
@@ -604,6 +609,14 @@ namespace gui
 		d->exec();
 		delete d;
 	}
+	void MainWindow::profileStats()
+	{
+		// not modal, it's watched while the song plays
+		if (m_profilepanel == NULL)
+			m_profilepanel = new ProfilePanel(this);
+		m_profilepanel->show();
+		m_profilepanel->raise();
+	}
 
 	void MainWindow::setSong_mw_cb()
 	{
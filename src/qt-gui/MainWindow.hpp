@@ -3,8 +3,6 @@
 
 #include <QMainWindow>
 #include <QEvent>
-#include <boost/thread/mutex.hpp>
-#include <boost/thread/condition.hpp>
 #include "ui_mainwindow.h"
 
 namespace gui
@@ -16,15 +14,15 @@ namespace gui
 	class App;
 	class MainWindow;
 	class InstrumentEditor;
+	class ProfilePanel;
 
 	typedef void(*stopsong_callback)(MainWindow*, void*);
 
+	// the position itself is taken from App::receiveUpdateEvent()
 	class UpdateEvent : public QEvent
 	{
 	public:
 		UpdateEvent() : QEvent(UPDATEEVENT){}
-		boost::mutex * mtx_updateEvent;
-		boost::condition * cond_updateEvent;
 	};
 	class CallbackEvent : public QEvent
 	{
@@ -102,6 +100,7 @@ namespace gui
 		void controlPanelVisibilityChanged();
 
 		void about();
+		void profileStats();
 
 		void setSong(int i);
 		void incrementPattern();
@@ -140,6 +139,7 @@ namespace gui
 		App * m_app;
 		DocInfo * m_dinfo;
 		InstrumentEditor *m_instrumenteditor;
+		ProfilePanel *m_profilepanel;
 		QComboBox *octave;
 		QAction ** m_recentFiles;
 
@@ -3,10 +3,12 @@
 #include <QScrollBar>
 #include <QPainter>
 #include <QWheelEvent>
-#include <QBitmap>
 #include <QDebug>
+#include <QFontDatabase>
+#include <QCoreApplication>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
 #include "PatternView.hpp"
 #include "GUI.hpp"
 #include "styles.hpp"
@@ -15,10 +17,16 @@
 #include "RowPages.hpp"
 #include "pixelfonts/vincent/vincent.h"
 
+// after the events in MainWindow.hpp
+#define ROWPAGESEVENT (QEvent::Type)((int)QEvent::User+3)
+
 namespace gui
 {
 	const int header_height = 40;
 
+	// most threads that draw row pages
+	const unsigned int max_rowpage_threads = 4;
+
 	static const float vertical_factor = 1.25f;
 	static const float horizontal_factor = 2.00f;
 
@@ -106,6 +114,30 @@ namespace gui
 	}
 
 
+	// The rows of a page and what drawing them needs from the document,
+	// copied on the GUI thread so a worker can draw them while the document
+	// is edited
+	struct pagesource_t
+	{
+		unsigned int frame;
+		unsigned int first_row, row_count;
+		unsigned int image_rows;
+		bool selected;
+
+		unsigned int channels;
+		unsigned int effColumns[MAX_CHANNELS];
+		int highlight, secondHighlight;
+		bool instruments[MAX_INSTRUMENTS];	// which instruments exist
+		int width;
+
+		std::vector<stChanNote> notes;		// row by row, every channel
+
+		const stChanNote & note(unsigned int row, unsigned int channel) const
+		{
+			return notes[(row - first_row)*channels + channel];
+		}
+	};
+
 	class PatternView_Body : public QWidget
 	{
 	public:
@@ -114,7 +146,7 @@ namespace gui
 		int px_pixfont_w, px_pixfont_h;
 		int colspace;
 		QTextOption opt;
-		QBitmap *m_pixelfont_bitmap;
+		QPolygon m_pixelfont_glyphs[128];
 		bool m_usesystemfont;
 
 		QFont m_systemfont;
@@ -126,6 +158,9 @@ namespace gui
 		QPixmap *m_secondaryHighlightPixmap;
 
 		bool m_modified;
+		// only the pattern rows edited since m_revision have to be redrawn
+		bool m_edited;
+		unsigned int m_revision;
 
 		RowPages m_rowpages;
 
@@ -138,7 +173,8 @@ namespace gui
 			  m_primaryHighlightPixmap(NULL),
 			  m_secondaryHighlightPixmap(NULL),
 			  m_modified(true),
-			  m_pixelfont_bitmap(NULL)
+			  m_edited(false),
+			  m_revision(0)
 		{
 			QFont font;
 			font.setPointSize(11);
@@ -147,10 +183,24 @@ namespace gui
 
 			redrawHighlightPixmaps();
 
-			m_rowpages.setRequestCallback(requestCallback);
+			m_rowpages.setRequestCallbacks(prepareCallback, renderCallback, discardCallback);
+			m_rowpages.setReadyCallback(readyCallback);
+			m_rowpages.setRedrawCallback(redrawCallback);
+
+			// text can only be drawn off the GUI thread where Qt supports it
+			if (!m_usesystemfont || QFontDatabase::supportsThreadedFontRendering())
+			{
+				unsigned int threads = boost::thread::hardware_concurrency();
+				threads = threads > 1 ? threads-1 : 1;
+				threads = threads > max_rowpage_threads ? max_rowpage_threads : threads;
+				m_rowpages.startThreads(threads);
+			}
 		}
 		~PatternView_Body()
 		{
+			// wait for the workers, they draw with the fonts
+			m_rowpages.clear();
+
 			if (m_currentRowHighlightPixmap != NULL)
 				delete m_currentRowHighlightPixmap;
 			if (m_currentRowNoFocusHighlightPixmap != NULL)
@@ -161,9 +211,6 @@ namespace gui
 				delete m_primaryHighlightPixmap;
 			if (m_secondaryHighlightPixmap != NULL)
 				delete m_secondaryHighlightPixmap;
-
-			if (m_pixelfont_bitmap != NULL)
-				delete m_pixelfont_bitmap;
 		}
 		void setDocInfo(DocInfo *dinfo)
 		{
@@ -177,24 +224,15 @@ namespace gui
 		}
 		void setPixelFont()
 		{
-			if (m_pixelfont_bitmap != NULL)
-				delete m_pixelfont_bitmap;
-
-			int scale = 1;
-
+			// glyphs are drawn point by point, pixmaps can't be drawn on
+			// the row page threads
 			px_pixfont_w = 8;
 			px_pixfont_h = 8;
 
-			m_pixelfont_bitmap = new QBitmap;
-
-			QImage img(px_pixfont_w, px_pixfont_h*128, QImage::Format_ARGB32_Premultiplied);
-			img.fill(Qt::white);
-
-			const QRgb solid = qRgba(0,0,0,0);
 			for (int i = 0; i < 128; i++)
 			{
-				int cx = 0;
-				int cy = i * px_pixfont_h;
+				QPolygon &glyph = m_pixelfont_glyphs[i];
+				glyph.clear();
 				for (int y = 0; y < px_pixfont_h; y++)
 				{
 					int mask = vincent_data[i][y];
@@ -203,13 +241,12 @@ namespace gui
 						bool f = (mask & (1<<(px_pixfont_w-x))) != 0;
 						if (f)
 						{
-							img.setPixel(cx+x, cy+y, solid);
+							glyph.append(QPoint(x, y));
 						}
 					}
 				}
 			}
 
-			*m_pixelfont_bitmap = QPixmap::fromImage(img);
 			px_unit = px_pixfont_w;
 			px_vspace = px_pixfont_h;
 			colspace = px_unit/2;
@@ -327,10 +364,7 @@ namespace gui
 			}
 			else
 			{
-				QPixmap *pixmap = m_pixelfont_bitmap;
-				int cx = 0;
-				int cy = int(c) * px_pixfont_h;
-				p.drawPixmap(x, y, *pixmap, cx, cy, px_pixfont_w, px_pixfont_h);
+				p.drawPoints(m_pixelfont_glyphs[c & 0x7F].translated(x, y));
 			}
 		}
 
@@ -340,7 +374,7 @@ namespace gui
 		}
 
 		// returns true if note terminates frame
-		bool drawNote(QPainter &p, int x, int y, const stChanNote &n, int effColumns, const QColor &primary, bool selected, int channel) const
+		bool drawNote(QPainter &p, int x, int y, const stChanNote &n, int effColumns, const QColor &primary, bool selected, int channel, const bool *instruments) const
 		{
 			const QColor volcol = stylecolor(styles::PATTERN_VOL, selected);
 			const QColor effcol = stylecolor(styles::PATTERN_EFFNUM, selected);
@@ -422,7 +456,7 @@ namespace gui
 			}
 			else
 			{
-				if (m_dinfo->doc()->GetInstrument(n.Instrument) == NULL)
+				if (!instruments[n.Instrument])
 				{
 					// instrument does not exist
 					use_instcol = &noinstcol;
@@ -473,30 +507,23 @@ namespace gui
 			return terminate;
 		}
 
-		// returns last row drawn ("to")
-		int drawFrame(QPainter &p, unsigned int frame, int from, int to, bool selected) const
+		// returns last row drawn
+		// only_channel draws a single channel and no row numbers
+		int drawFrame(QPainter &p, const pagesource_t &s, int only_channel=-1) const
 		{
-			FtmDocument *d = m_dinfo->doc();
-			unsigned int patternLength = d->GetPatternLength();
+			int to = s.first_row + s.row_count - 1;
 
-			unsigned int track = d->GetSelectedTrack();
-
-			unsigned int channels = d->GetAvailableChannels();
-
-			from = from < 0 ? 0 : from;
-			to = to > (int)patternLength-1 ? (int)patternLength-1 : to;
-
-			for (int i = from; i <= to; i++)
+			for (int i = s.first_row; i <= to; i++)
 			{
 				int y = px_vspace*i;
 
-				const QColor rownumcol = color_fg(i, selected, d->GetHighlight(), d->GetSecondHighlight());
+				const QColor rownumcol = color_fg(i, s.selected, s.highlight, s.secondHighlight);
 
 				char buf[6];
 				p.setPen(rownumcol);
 				sprintf(buf, "%02X", i);
 
-				if (m_usesystemfont)
+				if (m_usesystemfont && only_channel < 0)
 				{
 					p.drawText(QRect(0,y,px_unit*3-colspace/2,px_vspace), buf, opt);
 				}
@@ -505,15 +532,12 @@ namespace gui
 
 				bool terminateFrame = false;
 
-				for (unsigned int j = 0; j < channels; j++)
+				for (unsigned int j = 0; j < s.channels; j++)
 				{
-					stChanNote note;
-
-					d->GetDataAtPattern(track, d->GetPatternAtFrame(frame, j), j, i, &note);
-
-					unsigned int effcolumns = d->GetEffColumns(j);
+					unsigned int effcolumns = s.effColumns[j];
 
-					terminateFrame |= drawNote(p, x, y, note, effcolumns, rownumcol, selected, j);
+					if (only_channel < 0 || (int)j == only_channel)
+						terminateFrame |= drawNote(p, x, y, s.note(i, j), effcolumns, rownumcol, s.selected, j, s.instruments);
 
 					x += columnWidth(effcolumns) + colspace;
 				}
@@ -526,6 +550,49 @@ namespace gui
 			return to;
 		}
 
+		// copies rows first_row..first_row+row_count-1 of a frame
+		pagesource_t * makeSource(unsigned int frame, unsigned int first_row, unsigned int row_count, bool selected) const
+		{
+			FtmDocument *d = m_dinfo->doc();
+			pagesource_t *s = new pagesource_t;
+
+			unsigned int patternLength = d->GetPatternLength();
+
+			s->frame = frame;
+			s->first_row = first_row;
+			s->image_rows = row_count;
+			if (first_row + row_count > patternLength)
+				row_count = first_row < patternLength ? patternLength - first_row : 0;
+			s->row_count = row_count;
+			s->selected = selected;
+
+			s->channels = d->GetAvailableChannels();
+			s->highlight = d->GetHighlight();
+			s->secondHighlight = d->GetSecondHighlight();
+			s->width = xAtChannel(s->channels);
+
+			for (unsigned int j = 0; j < s->channels; j++)
+			{
+				s->effColumns[j] = d->GetEffColumns(j);
+			}
+			for (unsigned int i = 0; i < MAX_INSTRUMENTS; i++)
+			{
+				s->instruments[i] = d->IsInstrumentUsed(i);
+			}
+
+			unsigned int track = d->GetSelectedTrack();
+			s->notes.resize(row_count * s->channels);
+			for (unsigned int i = 0; i < row_count; i++)
+			{
+				for (unsigned int j = 0; j < s->channels; j++)
+				{
+					d->GetDataAtPattern(track, d->GetPatternAtFrame(frame, j), j, first_row+i, &s->notes[i*s->channels + j]);
+				}
+			}
+
+			return s;
+		}
+
 		int yOffset() const
 		{
 			return height()/2 - px_vspace/2;
@@ -653,10 +720,19 @@ namespace gui
 				}
 			}
 
+			if (m_edited && !m_modified)
+			{
+				if (!redrawEditedRows(d))
+					m_modified = true;
+			}
 			if (m_modified)
 			{
-				// pixmaps are invalidated
-				m_rowpages.clear();
+				// pixmaps are redrawn, the old ones are shown meanwhile
+				m_rowpages.invalidate(d);
+			}
+			if (m_edited || m_modified)
+			{
+				m_revision = d->GetRevision();
 			}
 			m_rowpages.requestRowPages(d, this, from, to, frame);
 			m_rowpages.render(p, frame, from, px_vspace);
@@ -673,16 +749,76 @@ namespace gui
 			p.end();
 
 			m_modified = false;
+			m_edited = false;
 		}
 
-		static void requestCallback(rowpage_t *r, unsigned int rowpagesize, void *data)
+		// Redraws the rows edited since m_revision in the cached pages.
+		// Returns false if the pages have to be cleared instead
+		bool redrawEditedRows(FtmDocument *d)
+		{
+			std::vector<stDirtyRows> rows;
+
+			d->lock();
+			bool known = d->GetRevision() != m_revision && d->GetDirtyRows(m_revision, rows);
+			d->unlock();
+
+			if (!known)
+				return false;
+
+			// pages are only kept around the current frame, anything else
+			// clears them
+			unsigned int track = d->GetSelectedTrack();
+			unsigned int frame = m_dinfo->currentFrame();
+			unsigned int first_frame = frame > 0 ? frame-1 : 0;
+			unsigned int last_frame = frame+1 < d->GetFrameCount() ? frame+1 : frame;
+
+			for (unsigned int i = 0; i < rows.size(); i++)
+			{
+				stDirtyRows r = rows[i];
+				if (r.Track != track)
+					continue;
+
+				// inserting or removing a note edits every row below it one
+				// at a time, redraw those together
+				while (i+1 < rows.size())
+				{
+					const stDirtyRows &n = rows[i+1];
+					if (n.Track != r.Track || n.Pattern != r.Pattern || n.Channel != r.Channel
+							|| n.FirstRow > r.LastRow+1 || n.LastRow+1 < r.FirstRow)
+						break;
+
+					r.FirstRow = n.FirstRow < r.FirstRow ? n.FirstRow : r.FirstRow;
+					r.LastRow = n.LastRow > r.LastRow ? n.LastRow : r.LastRow;
+					i++;
+				}
+
+				for (unsigned int f = first_frame; f <= last_frame; f++)
+				{
+					if (d->GetPatternAtFrame(f, r.Channel) != r.Pattern)
+						continue;
+
+					if (!m_rowpages.redrawRows(this, f, d->getFramePlayLength(f), r.FirstRow, r.LastRow, r.Channel))
+						return false;
+				}
+			}
+
+			return true;
+		}
+
+		static void * prepareCallback(const rowpage_t *r, unsigned int rowpagesize, void *data)
+		{
+			const PatternView_Body *pb = (const PatternView_Body*)data;
+
+			return pb->makeSource(r->frame, r->row_index*rowpagesize, r->row_count, r->selected);
+		}
+
+		static QImage * renderCallback(void *source, void *data)
 		{
 			const PatternView_Body *pb = (const PatternView_Body*)data;
+			const pagesource_t *s = (const pagesource_t*)source;
 
-			FtmDocument *d = pb->m_dinfo->doc();
-			int width = pb->xAtChannel(d->GetAvailableChannels());
-			int height = pb->px_vspace * r->row_count;
-			QImage *img = new QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+			int height = pb->px_vspace * s->image_rows;
+			QImage *img = new QImage(s->width, height, QImage::Format_ARGB32_Premultiplied);
 			img->fill(Qt::NoAlpha);
 
 			QPainter p;
@@ -693,14 +829,73 @@ namespace gui
 				p.setFont(pb->m_systemfont);
 			}
 
-			unsigned int from = r->row_index*rowpagesize;
-			int off_y = -from*pb->px_vspace;
+			int off_y = -s->first_row*pb->px_vspace;
 			p.translate(0, off_y);
-			pb->drawFrame(p, r->frame, from, from+r->row_count, r->selected);
+			pb->drawFrame(p, *s);
 
 			p.end();
 
-			r->image = img;
+			delete s;
+
+			return img;
+		}
+
+		static void discardCallback(void *source)
+		{
+			delete (pagesource_t*)source;
+		}
+
+		static void readyCallback(void *data)
+		{
+			PatternView_Body *pb = (PatternView_Body*)data;
+
+			// from a worker thread, paint once the GUI gets to it
+			QCoreApplication::postEvent(pb, new QEvent(ROWPAGESEVENT));
+		}
+
+		static void redrawCallback(rowpage_t *r, unsigned int rowpagesize,
+								   unsigned int from, unsigned int to, unsigned int channel, void *data)
+		{
+			const PatternView_Body *pb = (const PatternView_Body*)data;
+
+			unsigned int first = r->row_index*rowpagesize;
+			int x = pb->xAtChannel(channel);
+			QRect strip(x, (from-first)*pb->px_vspace,
+						pb->xAtChannel(channel+1) - x, (to-from+1)*pb->px_vspace);
+
+			pagesource_t *s = pb->makeSource(r->frame, from, to-from+1, r->selected);
+
+			QPainter p;
+			p.begin(r->image);
+
+			// clear the strip to the blank page it was drawn on
+			p.setCompositionMode(QPainter::CompositionMode_Source);
+			p.fillRect(strip, Qt::transparent);
+			p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+			p.setClipRect(strip);
+
+			if (pb->m_usesystemfont)
+			{
+				p.setFont(pb->m_systemfont);
+			}
+
+			int off_y = -first*pb->px_vspace;
+			p.translate(0, off_y);
+			pb->drawFrame(p, *s, channel);
+
+			p.end();
+
+			delete s;
+		}
+
+		bool event(QEvent *e)
+		{
+			if (e->type() == ROWPAGESEVENT)
+			{
+				update();
+				return true;
+			}
+			return QWidget::event(e);
 		}
 
 		void mouseReleaseEvent(QMouseEvent *e)
@@ -776,6 +971,10 @@ namespace gui
 		{
 			m_modified = true;
 		}
+		void setEdited()
+		{
+			m_edited = true;
+		}
 
 		// return -1 if none
 		int channelAtX(int x)
@@ -1470,9 +1669,11 @@ namespace gui
 
 		doc->lock();
 
-		if (modified || m_currentFrame != m_dinfo->currentFrame())
+		// pages that change selection with the frame are redrawn by the
+		// row pages themselves
+		if (modified)
 		{
-			m_body->setModified();
+			m_body->setEdited();
 		}
 
 		unsigned int oldframe = m_currentFrame;
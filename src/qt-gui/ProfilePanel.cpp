@@ -0,0 +1,124 @@
+#include <vector>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QTableWidget>
+#include <QHeaderView>
+#include <QPushButton>
+#include <QLabel>
+#include <QTimer>
+#include "ProfilePanel.hpp"
+#include "core/profile.hpp"
+
+namespace gui
+{
+	static const int REFRESH_MS = 500;
+
+	enum
+	{
+		COLUMN_NAME,
+		COLUMN_COUNT,
+		COLUMN_AVERAGE,
+		COLUMN_P50,
+		COLUMN_P99,
+		COLUMN_MAX,
+		COLUMNS
+	};
+
+	ProfilePanel::ProfilePanel(QWidget *parent)
+		: QDialog(parent)
+	{
+		setWindowTitle(tr("Render Statistics"));
+
+		QVBoxLayout *layout = new QVBoxLayout(this);
+
+		if (!core::profileEnabled())
+		{
+			layout->addWidget(new QLabel(tr("The counters were compiled out. Build with cmake -DPROFILING=ON")));
+		}
+
+		m_table = new QTableWidget(0, COLUMNS, this);
+		QStringList headers;
+		headers << tr("Counter") << tr("Count") << tr("Average") << tr("50%") << tr("99%") << tr("Max");
+		m_table->setHorizontalHeaderLabels(headers);
+		m_table->verticalHeader()->hide();
+		m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+		m_table->setSelectionMode(QAbstractItemView::NoSelection);
+		layout->addWidget(m_table);
+
+		QHBoxLayout *buttons = new QHBoxLayout;
+		QLabel *units = new QLabel(tr("Times are in microseconds"));
+		QPushButton *reset = new QPushButton(tr("Reset"));
+		QPushButton *close = new QPushButton(tr("Close"));
+		buttons->addWidget(units);
+		buttons->addStretch();
+		buttons->addWidget(reset);
+		buttons->addWidget(close);
+		layout->addLayout(buttons);
+
+		m_timer = new QTimer(this);
+		m_timer->setInterval(REFRESH_MS);
+
+		QObject::connect(m_timer, SIGNAL(timeout()), this, SLOT(refresh()));
+		QObject::connect(reset, SIGNAL(clicked()), this, SLOT(reset()));
+		QObject::connect(close, SIGNAL(clicked()), this, SLOT(close()));
+
+		resize(640, 480);
+	}
+	ProfilePanel::~ProfilePanel()
+	{
+
+	}
+
+	void ProfilePanel::showEvent(QShowEvent *)
+	{
+		refresh();
+		m_timer->start();
+	}
+	void ProfilePanel::hideEvent(QHideEvent *)
+	{
+		m_timer->stop();
+	}
+
+	static QTableWidgetItem * number(double v, int decimals)
+	{
+		QTableWidgetItem *item = new QTableWidgetItem(QString::number(v, 'f', decimals));
+		item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+		return item;
+	}
+
+	void ProfilePanel::refresh()
+	{
+		std::vector<core::profile_snapshot_t> s;
+		core::profileSnapshot(s);
+
+		m_table->setRowCount(s.size());
+		for (unsigned int i = 0; i < s.size(); i++)
+		{
+			const core::profile_snapshot_t &c = s[i];
+
+			m_table->setItem(i, COLUMN_NAME, new QTableWidgetItem(QString::fromStdString(c.name)));
+			m_table->setItem(i, COLUMN_COUNT, number(c.count, 0));
+
+			// times are in us, levels as they are, events only count
+			double scale = c.kind == core::PROFILE_TIME ? 1.0/1000 : 1.0;
+			int decimals = c.kind == core::PROFILE_TIME ? 1 : 0;
+			if (c.kind == core::PROFILE_EVENT || c.count == 0)
+			{
+				for (int col = COLUMN_AVERAGE; col < COLUMNS; col++)
+					m_table->setItem(i, col, new QTableWidgetItem);
+				continue;
+			}
+			m_table->setItem(i, COLUMN_AVERAGE, number(c.average() * scale, 1));
+			m_table->setItem(i, COLUMN_P50, number(c.percentile(0.5) * scale, decimals));
+			m_table->setItem(i, COLUMN_P99, number(c.percentile(0.99) * scale, decimals));
+			m_table->setItem(i, COLUMN_MAX, number(c.max * scale, decimals));
+		}
+		m_table->resizeColumnToContents(COLUMN_NAME);
+	}
+
+	void ProfilePanel::reset()
+	{
+		core::profileReset();
+		refresh();
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef _PROFILEPANEL_HPP_
+#define _PROFILEPANEL_HPP_
+
+#include <QDialog>
+
+class QTableWidget;
+class QTimer;
+
+namespace gui
+{
+	// Shows the profiling counters of the render pipeline (core/profile.hpp)
+	// while it's open, refreshed twice a second
+	class ProfilePanel : public QDialog
+	{
+		Q_OBJECT
+	public:
+		ProfilePanel(QWidget *parent);
+		~ProfilePanel();
+	public slots:
+		void refresh();
+		void reset();
+	protected:
+		void showEvent(QShowEvent *);
+		void hideEvent(QHideEvent *);
+	private:
+		QTableWidget *m_table;
+		QTimer *m_timer;
+	};
+}
+
+#endif
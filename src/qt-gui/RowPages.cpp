@@ -6,23 +6,130 @@
 namespace gui
 {
 	const int pixmap_rows = 1<<4;
+	// rows requested above and below the visible ones
+	const int prefetch_rows = pixmap_rows;
 
 	RowPages::RowPages()
 	{
-		m_requestCallback = NULL;
+		m_prepareCallback = NULL;
+		m_renderCallback = NULL;
+		m_discardCallback = NULL;
+		m_readyCallback = NULL;
+		m_redrawCallback = NULL;
+		m_lastRequest = 0;
+		m_busy = 0;
+		m_readyPosted = false;
+		m_terminate = false;
 	}
 	RowPages::~RowPages()
 	{
 		clear();
+
+		mtx_jobs.lock();
+		m_terminate = true;
+		cond_jobs.notify_all();
+		mtx_jobs.unlock();
+
+		for (unsigned int i = 0; i < m_threads.size(); i++)
+		{
+			m_threads[i]->join();
+			delete m_threads[i];
+		}
+	}
+
+	void RowPages::setRequestCallbacks(prepareCallback_f prepare, renderCallback_f render, discardCallback_f discard)
+	{
+		m_prepareCallback = prepare;
+		m_renderCallback = render;
+		m_discardCallback = discard;
+	}
+
+	void RowPages::setReadyCallback(readyCallback_f f)
+	{
+		m_readyCallback = f;
+	}
+
+	void RowPages::setRedrawCallback(redrawCallback_f f)
+	{
+		m_redrawCallback = f;
+	}
+
+	void RowPages::startThreads(unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			m_threads.push_back(new boost::thread(worker_bootstrap, this));
+		}
 	}
 
-	void RowPages::setRequestCallback(requestCallback_f f)
+	void RowPages::worker_bootstrap(RowPages *rp)
 	{
-		m_requestCallback = f;
+		rp->worker();
+	}
+
+	void RowPages::worker()
+	{
+		boost::unique_lock<boost::mutex> lock(mtx_jobs);
+		for (;;)
+		{
+			while (m_jobs.empty() && !m_terminate)
+			{
+				cond_jobs.wait(lock);
+			}
+			if (m_terminate)
+				return;
+
+			job_t job = m_jobs.front();
+			m_jobs.pop_front();
+			m_busy++;
+
+			lock.unlock();
+			job.image = (*m_renderCallback)(job.source, job.data);
+			lock.lock();
+
+			m_done.push_back(job);
+
+			// one notification until the pages are collected. still busy
+			// meanwhile, so clear() waits for it
+			if (!m_readyPosted && m_readyCallback != NULL)
+			{
+				m_readyPosted = true;
+				lock.unlock();
+				(*m_readyCallback)(job.data);
+				lock.lock();
+			}
+
+			m_busy--;
+			if (m_busy == 0)
+			{
+				cond_idle.notify_all();
+			}
+		}
 	}
 
 	void RowPages::clear()
 	{
+		{
+			boost::unique_lock<boost::mutex> lock(mtx_jobs);
+
+			for (unsigned int i = 0; i < m_jobs.size(); i++)
+			{
+				(*m_discardCallback)(m_jobs[i].source);
+			}
+			m_jobs.clear();
+
+			while (m_busy > 0)
+			{
+				cond_idle.wait(lock);
+			}
+
+			for (unsigned int i = 0; i < m_done.size(); i++)
+			{
+				delete m_done[i].image;
+			}
+			m_done.clear();
+		}
+
 		RowPagesList::iterator it;
 		for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
 		{
@@ -32,6 +139,152 @@ namespace gui
 		m_rowPages.clear();
 	}
 
+	void RowPages::invalidate(const FtmDocument *d)
+	{
+		RowPagesList::iterator it;
+		for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
+		{
+			const rowpage_t &r = *it;
+			// the pages of the frame wouldn't line up any more
+			if (r.frame >= d->GetFrameCount() || d->getFramePlayLength(r.frame) != r.frame_length)
+			{
+				clear();
+				return;
+			}
+		}
+
+		for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
+		{
+			rowpage_t &r = *it;
+			r.current = false;
+		}
+	}
+
+	void RowPages::collectPages()
+	{
+		std::vector<job_t> done;
+
+		mtx_jobs.lock();
+		done.swap(m_done);
+		m_readyPosted = false;
+		mtx_jobs.unlock();
+
+		for (unsigned int i = 0; i < done.size(); i++)
+		{
+			job_t &job = done[i];
+
+			RowPagesList::iterator it;
+			for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
+			{
+				rowpage_t &r = *it;
+				if (r.pending && r.request == job.request)
+				{
+					delete r.image;
+					r.image = job.image;
+					r.pending = false;
+					job.image = NULL;
+					break;
+				}
+			}
+
+			// the page was dropped or requested again meanwhile
+			delete job.image;
+		}
+	}
+
+	void RowPages::requestPage(rowpage_t &r, void *data)
+	{
+		job_t job;
+		job.request = ++m_lastRequest;
+		job.source = (*m_prepareCallback)(&r, pixmap_rows, data);
+		job.data = data;
+		job.image = NULL;
+
+		r.current = true;
+		r.request = job.request;
+
+		if (m_threads.empty())
+		{
+			delete r.image;
+			r.image = (*m_renderCallback)(job.source, job.data);
+			r.pending = false;
+			return;
+		}
+
+		r.pending = true;
+
+		mtx_jobs.lock();
+		m_jobs.push_back(job);
+		cond_jobs.notify_one();
+		mtx_jobs.unlock();
+	}
+
+	void RowPages::pruneJobs()
+	{
+		boost::lock_guard<boost::mutex> lock(mtx_jobs);
+
+		std::deque<job_t>::iterator it;
+		for (it = m_jobs.begin(); it != m_jobs.end(); )
+		{
+			bool wanted = false;
+			RowPagesList::const_iterator pit;
+			for (pit = m_rowPages.begin(); pit != m_rowPages.end(); ++pit)
+			{
+				if (pit->pending && pit->request == it->request)
+				{
+					wanted = true;
+					break;
+				}
+			}
+
+			if (wanted)
+			{
+				++it;
+			}
+			else
+			{
+				(*m_discardCallback)(it->source);
+				it = m_jobs.erase(it);
+			}
+		}
+	}
+
+	bool RowPages::redrawRows(void *data, unsigned int frame, unsigned int frame_length,
+							  unsigned int from, unsigned int to, unsigned int channel)
+	{
+		RowPagesList::iterator it;
+		for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
+		{
+			const rowpage_t &r = *it;
+			// rows after a Bxx, Cxx or Dxx aren't drawn
+			if (r.frame == frame && r.frame_length != frame_length)
+				return false;
+		}
+
+		for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
+		{
+			rowpage_t &r = *it;
+			if (r.frame != frame)
+				continue;
+
+			unsigned int first = r.row_index*pixmap_rows;
+			unsigned int last = first + r.row_count - 1;
+			if (to < first || from > last)
+				continue;
+
+			// a page still being drawn may have missed the edit
+			if (r.image == NULL || r.pending || !r.current)
+			{
+				r.current = false;
+				continue;
+			}
+
+			(*m_redrawCallback)(&r, pixmap_rows, from > first ? from : first, to < last ? to : last, channel, data);
+		}
+
+		return true;
+	}
+
 	void RowPages::cullPages(unsigned int frame,
 							 unsigned int min_frame, unsigned int min_row_index,
 							 unsigned int max_frame, unsigned int max_row_index)
@@ -42,10 +295,17 @@ namespace gui
 			rowpage_t &r = *it;
 			bool onSelected = (r.frame == frame);
 			bool keepPage;
-			keepPage = r.selected == onSelected && r.isWithin(min_frame, min_row_index, max_frame, max_row_index);
+			keepPage = r.isWithin(min_frame, min_row_index, max_frame, max_row_index);
 
 			if (keepPage)
 			{
+				// the frame was (de)selected, keep showing the page until
+				// it's drawn again
+				if (r.selected != onSelected)
+				{
+					r.selected = onSelected;
+					r.current = false;
+				}
 				++it;
 			}
 			else
@@ -58,9 +318,7 @@ namespace gui
 
 	struct addRowPage_t
 	{
-		RowPages::requestCallback_f requestCallback;
 		RowPagesList *rowPages;
-		void *data;
 		bool cull;
 		unsigned int min_frame, min_row_index,
 					 max_frame, max_row_index;
@@ -79,13 +337,21 @@ namespace gui
 		if (request)
 		{
 		//	fprintf(stderr, "request: frame %2d, rowindex %2d, length %2d\n", rp.frame, rp.row_index, rp.row_count);
-			(*t.requestCallback)(&rp, pixmap_rows, t.data);
+			rp.image = NULL;
+			rp.current = false;
+			rp.pending = false;
+			rp.request = 0;
 			t.rowPages->push_back(rp);
 		}
 	}
 
 	void RowPages::requestRowPages(const FtmDocument *d, void *data, int from, int to, unsigned int frame)
 	{
+		collectPages();
+
+		from -= prefetch_rows;
+		to += prefetch_rows;
+
 		// min_row_index is the first visible row page index of min
 		// ***_frame_row_remainder is
 		// ***_row_end_index is the  last logical row page index of ***
@@ -200,8 +466,6 @@ namespace gui
 		oldlist.swap(m_rowPages);
 
 		addRowPage_t arp;
-		arp.data = data;
-		arp.requestCallback = m_requestCallback;
 		arp.rowPages = &m_rowPages;
 		arp.cull = !oldlist.empty();
 
@@ -221,6 +485,7 @@ namespace gui
 		if (request_frame_before)
 		{
 			rp.frame = min_frame;
+			rp.frame_length = min_frame_pl;
 			rp.selected = false;
 			rp.row_count = pixmap_rows;
 			for (i = min_row_index; i < min_row_max_index; i++)
@@ -245,6 +510,7 @@ namespace gui
 		if (true)	// always request the current frame's rows
 		{
 			rp.frame = frame;
+			rp.frame_length = cur_frame_pl;
 			rp.selected = true;
 			rp.row_count = pixmap_rows;
 			for (i = cur_begin; i < cur_row_max_index; i++)
@@ -263,6 +529,7 @@ namespace gui
 		if (request_frame_after)
 		{
 			rp.frame = max_frame;
+			rp.frame_length = max_frame_pl;
 			rp.selected = false;
 			rp.row_count = pixmap_rows;
 			for (i = 0; i < max_row_max_index; i++)
@@ -302,10 +569,33 @@ namespace gui
 			m_rowPages.insert(it, oldlist.begin(), oldlist.end());
 			// 'it' is after the oldlist elements
 		}
+
+		// the current frame first, its rows are in the middle of the view
+		RowPagesList::iterator it;
+		for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
+		{
+			rowpage_t &r = *it;
+			if (!r.current && r.frame == frame)
+			{
+				requestPage(r, data);
+			}
+		}
+		for (it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
+		{
+			rowpage_t &r = *it;
+			if (!r.current)
+			{
+				requestPage(r, data);
+			}
+		}
+
+		pruneJobs();
 	}
 
 	void RowPages::render(QPainter &p, unsigned int frame, int from, int row_height)
 	{
+		from -= prefetch_rows;
+
 		int y = 0;
 		if (from > 0)
 		{
@@ -318,14 +608,16 @@ namespace gui
 			const rowpage_t &rp = *it;
 			if (rp.frame == frame)
 				break;
-			y -= rp.image->height();
+			y -= rp.row_count*row_height;
 		}
 
 		for (RowPagesList::const_iterator it = m_rowPages.begin(); it != m_rowPages.end(); ++it)
 		{
 			const rowpage_t &rp = *it;
-			p.drawImage(0, y, *rp.image);
-			y += rp.image->height();
+			// pages that were never drawn are left blank
+			if (rp.image != NULL)
+				p.drawImage(0, y, *rp.image);
+			y += rp.row_count*row_height;
 		}
 	}
 }
@@ -2,6 +2,11 @@
 #define _ROWPAGES_HPP_
 
 #include <list>
+#include <deque>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
 #include <QImage>
 
 class FtmDocument;
@@ -13,16 +18,25 @@ namespace gui
 	Responsible for managing and requesting rendered pixmaps
 	NOT responsible for solving geometry problems
 	A row page includes a pixmap of a fixed amount of rows
+
+	Pages are drawn on worker threads. Requesting a page copies what it
+	shows on the calling thread, and a worker draws the copy. Until the
+	image is collected, the page shows its previous image, or nothing.
 	*/
 
 	struct rowpage_t
 	{
-		QImage *image;
+		QImage *image;				// NULL until the first image is collected
 		unsigned int frame;
 		unsigned int row_index;		// row_index * pixmap_rows = starting row
 		unsigned int row_count;
+		unsigned int frame_length;	// play length of the frame when rendered
 		bool selected;
 
+		bool current;				// image or pending request has the latest rows
+		bool pending;				// a worker is drawing the page
+		unsigned int request;		// id of the last request
+
 		bool isWithin(unsigned int min_frame, unsigned int min_row_index,
 					  unsigned int max_frame, unsigned int max_row_index)
 		{
@@ -41,22 +55,79 @@ namespace gui
 	class RowPages
 	{
 	public:
-		typedef void (*requestCallback_f)(rowpage_t *r, unsigned int rowpagesize, void *data);
+		// called on the requesting thread, returns a copy of what the page
+		// shows for renderCallback
+		typedef void * (*prepareCallback_f)(const rowpage_t *r, unsigned int rowpagesize, void *data);
+		// called on a worker thread, draws the copy and frees it
+		typedef QImage * (*renderCallback_f)(void *source, void *data);
+		// frees a copy that won't be drawn
+		typedef void (*discardCallback_f)(void *source);
+		// called on a worker thread once drawn pages are waiting to be
+		// collected, until the next requestRowPages()
+		typedef void (*readyCallback_f)(void *data);
+		// redraws rows from..to of one channel in an existing page
+		typedef void (*redrawCallback_f)(rowpage_t *r, unsigned int rowpagesize,
+										 unsigned int from, unsigned int to, unsigned int channel, void *data);
 		RowPages();
 		~RowPages();
-		void setRequestCallback(requestCallback_f f);
+		void setRequestCallbacks(prepareCallback_f prepare, renderCallback_f render, discardCallback_f discard);
+		void setReadyCallback(readyCallback_f f);
+		void setRedrawCallback(redrawCallback_f f);
+		// start drawing on worker threads. with 0, pages are drawn in
+		// requestRowPages()
+		void startThreads(unsigned int count);
+		// remove all pages, waits for the pages being drawn
 		void clear();
+		// request every page again, showing the old images meanwhile. if the
+		// layout of a frame changed, the pages are cleared instead
+		void invalidate(const FtmDocument *d);
+		// redraw rows from..to of a channel in the pages of a frame
+		// returns false if the frame's play length changed since the pages
+		// were rendered, the pages have to be cleared then
+		bool redrawRows(void *data, unsigned int frame, unsigned int frame_length,
+						unsigned int from, unsigned int to, unsigned int channel);
 		void requestRowPages(const FtmDocument *d, void *data, int from, int to, unsigned int frame);
 		void render(QPainter &p, unsigned int frame, int from, int row_height);
 	private:
-		// clear invalidated pages (out of range or different selection)
+		struct job_t
+		{
+			unsigned int request;
+			void *source;
+			void *data;
+			QImage *image;
+		};
+
+		// clear invalidated pages (out of range)
 		void cullPages(unsigned int frame,
 					   unsigned int min_frame, unsigned int min_row_index,
 					   unsigned int max_frame, unsigned int max_row_index);
+		// take the images the workers are done with
+		void collectPages();
+		void requestPage(rowpage_t &r, void *data);
+		// drop queued requests of pages that are gone
+		void pruneJobs();
+
+		static void worker_bootstrap(RowPages *rp);
+		void worker();
 
-		requestCallback_f m_requestCallback;
+		prepareCallback_f m_prepareCallback;
+		renderCallback_f m_renderCallback;
+		discardCallback_f m_discardCallback;
+		readyCallback_f m_readyCallback;
+		redrawCallback_f m_redrawCallback;
 		// list guaranteed to (MUST) be in order
 		RowPagesList m_rowPages;
+		unsigned int m_lastRequest;
+
+		std::vector<boost::thread*> m_threads;
+		boost::mutex mtx_jobs;
+		boost::condition cond_jobs;
+		boost::condition cond_idle;
+		std::deque<job_t> m_jobs;
+		std::vector<job_t> m_done;
+		unsigned int m_busy;
+		bool m_readyPosted;
+		bool m_terminate;
 	};
 }
 
@@ -38,7 +38,8 @@ void AlsaSound::callback_bootstrap(void *data)
 void AlsaSound::callback()
 {
 	int err;
-	core::u32 bufsz = m_buffer_size;
+	// the buffer size is in frames
+	core::u32 bufsz = m_buffer_size * channels();
 	core::s16 *buf = new core::s16[bufsz];
 
 	core::u32 sr = sampleRate();
@@ -143,6 +144,7 @@ void AlsaSound::initialize(unsigned int sampleRate, unsigned int channels, unsig
 	snd_pcm_get_params(m_handle, &m_buffer_size, &m_period_size);
 
 	m_sampleRate = sampleRate;
+	m_channels = channels;
 }
 
 void AlsaSound::close()
@@ -51,6 +51,7 @@ void DSound::initialize(unsigned int sampleRate, unsigned int channels, unsigned
 	}
 
 	m_latency_ms = latency_ms;
+	m_channels = channels;
 	m_bufferSize = sampleRate * latency_ms / 1000;
 
 	openChannel(sampleRate);
@@ -233,7 +234,7 @@ bool DSound::openChannel(unsigned int sampleRate)
 
 	memset(&wfx, 0x00, sizeof(WAVEFORMATEX));
 	wfx.cbSize				= sizeof(WAVEFORMATEX);
-	wfx.nChannels			= 1;
+	wfx.nChannels			= m_channels;
 	wfx.nSamplesPerSec		= sampleRate;
 	wfx.wBitsPerSample		= 16;
 	wfx.nBlockAlign			= wfx.nChannels * (wfx.wBitsPerSample / 8);
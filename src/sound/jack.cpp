@@ -17,9 +17,12 @@ struct jacksound_info_t
 	JackSound * sink;
 	jack_client_t * client;
 
-	jack_port_t * out;
+	// one port per channel
+	jack_port_t * out[2];
+	unsigned int channels;
 
-	core::s16 *buf;
+	// interleaved frames, only used in stereo
+	sample_t *buf;
 };
 
 static int process(jack_nframes_t frames, void *arg)
@@ -27,28 +30,45 @@ static int process(jack_nframes_t frames, void *arg)
 	jacksound_info_t *handle = (jacksound_info_t*)arg;
 
 	jack_latency_range_t range;
-	jack_port_get_latency_range(handle->out, JackPlaybackLatency, &range);
+	jack_port_get_latency_range(handle->out[0], JackPlaybackLatency, &range);
 	core::u64 latency_us = range.max - frames*2;
 	latency_us = latency_us * 1000000 / handle->sink->sampleRate();
 
 	handle->sink->applyTime(latency_us);
 
+	const unsigned int chans = handle->channels;
+
 	if (!handle->sink->isPlaying())
 	{
 		// don't play anything
-		sample_t *buf = (sample_t*)jack_port_get_buffer(handle->out, frames);
-		memset(buf, 0, frames*sizeof(sample_t));
+		for (unsigned int c = 0; c < chans; c++)
+		{
+			sample_t *buf = (sample_t*)jack_port_get_buffer(handle->out[c], frames);
+			memset(buf, 0, frames*sizeof(sample_t));
+		}
 		return 0;
 	}
 
-	handle->sink->performSoundCallback(handle->buf, frames);
+	if (chans == 1)
+	{
+		// the sink asks for float samples, so mono is rendered straight
+		// into the port
+		sample_t *buf = (sample_t*)jack_port_get_buffer(handle->out[0], frames);
+		handle->sink->performSoundCallback(buf, frames);
+		return 0;
+	}
 
-	sample_t *buf = (sample_t*)jack_port_get_buffer(handle->out, frames);
+	handle->sink->performSoundCallback(handle->buf, frames);
 
-	// convert s16 to float
-	for (int i = 0; i < frames; i++)
+	// split the interleaved frames, one buffer per port
+	for (unsigned int c = 0; c < chans; c++)
 	{
-		buf[i] = sample_t(handle->buf[i])/sample_t(32768.0);
+		sample_t *buf = (sample_t*)jack_port_get_buffer(handle->out[c], frames);
+		const sample_t *in = handle->buf + c;
+		for (jack_nframes_t i = 0; i < frames; i++)
+		{
+			buf[i] = in[i*chans];
+		}
 	}
 
 	return 0;
@@ -59,6 +79,11 @@ JackSound::JackSound()
 	m_handle = new jacksound_info_t;
 	m_handle->sink = this;
 	m_handle->client = NULL;
+	m_handle->buf = NULL;
+	m_handle->channels = 1;
+
+	// jack mixes in float
+	m_format = core::SAMPLE_FLOAT;
 }
 JackSound::~JackSound()
 {
@@ -89,10 +114,18 @@ void JackSound::initialize(unsigned int sampleRate, unsigned int channels, unsig
 
 	jack_set_process_callback(m_handle->client, process, m_handle);
 
-	m_handle->out = jack_port_register(m_handle->client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	static const char *port_names[2][2] = {{"output", NULL}, {"output_left", "output_right"}};
+
+	m_channels = channels == 2 ? 2 : 1;
+	m_handle->channels = m_channels;
+	for (unsigned int c = 0; c < m_channels; c++)
+	{
+		m_handle->out[c] = jack_port_register(m_handle->client, port_names[m_channels-1][c], JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	}
 
 	jack_nframes_t bufsize = jack_get_buffer_size(m_handle->client);
-	m_handle->buf = new core::s16[bufsize];
+	delete[] m_handle->buf;
+	m_handle->buf = new sample_t[bufsize * m_channels];
 
 	if (jack_activate(m_handle->client))
 	{
@@ -110,13 +143,14 @@ void JackSound::initialize(unsigned int sampleRate, unsigned int channels, unsig
 		return;
 	}
 
-	if (jack_connect(m_handle->client, jack_port_name(m_handle->out), ports[0]) != 0)
-	{
-		fprintf(stderr, "Cannot connect output ports\n");
-	}
-	if (jack_connect(m_handle->client, jack_port_name(m_handle->out), ports[1]) != 0)
+	// a mono port feeds both speakers, stereo ports get one each
+	for (unsigned int i = 0; i < 2 && ports[i] != NULL; i++)
 	{
-		fprintf(stderr, "Cannot connect output ports\n");
+		jack_port_t *out = m_handle->out[m_channels == 2 ? i : 0];
+		if (jack_connect(m_handle->client, jack_port_name(out), ports[i]) != 0)
+		{
+			fprintf(stderr, "Cannot connect output ports\n");
+		}
 	}
 
 	free(ports);
@@ -0,0 +1,117 @@
+#include <string.h>
+#include "TestModule.hpp"
+#include "core/memoryoutput.hpp"
+#include "famitracker-core/App.hpp"
+#include "famitracker-core/FtmDocument.hpp"
+#include "famitracker-core/Instrument.h"
+#include "famitracker-core/SoundGen.hpp"
+#include "famitracker-core/TrackerController.hpp"
+
+static const unsigned int FRAMES = 2;
+static const unsigned int ROWS = 32;
+
+FtmDocument * makeTestModule(unsigned char chip)
+{
+	FtmDocument *doc = new FtmDocument;
+	doc->createEmpty();
+	doc->SelectExpansionChip(chip);
+	doc->SetPatternLength(ROWS);
+	doc->SetFrameCount(FRAMES);
+
+	int inst2A03 = doc->AddInstrument("2A03", SNDCHIP_NONE);
+	int instChip = chip == SNDCHIP_NONE ? inst2A03 : doc->AddInstrument("chip", chip);
+
+	if (chip == SNDCHIP_FDS)
+	{
+		// the modulator runs under the notes
+		CInstrumentFDS *fds = (CInstrumentFDS*)doc->GetInstrument(instChip);
+		fds->SetModulationEnable(true);
+		fds->SetModulationSpeed(37);
+		fds->SetModulationDepth(20);
+		fds->SetModulationDelay(3);
+		for (int i = 0; i < 32; i++)
+			fds->SetModulation(i, (i*5) % 8);
+		for (int i = 0; i < 64; i++)
+			fds->SetSample(i, (i*i/3) % 64);
+	}
+
+	int channels = doc->GetAvailableChannels();
+	for (int ch = 0; ch < channels; ch++)
+	{
+		doc->SetEffColumns(ch, 1);
+		for (unsigned int f = 0; f < FRAMES; f++)
+		{
+			doc->SetPatternAtFrame(f, ch, f);
+			for (unsigned int r = 0; r < ROWS; r++)
+			{
+				stChanNote note;
+				memset(&note, 0, sizeof(note));
+				note.Instrument = MAX_INSTRUMENTS;
+				note.Vol = 0x10;
+
+				if ((r + ch) % 4 == 0)
+				{
+					note.Note = C + (r*5 + ch*3 + f*7) % 12;
+					note.Octave = 2 + (ch+f) % 3;
+					note.Instrument = ch < CHANNELS_DEFAULT ? inst2A03 : instChip;
+					note.Vol = (r*3 + ch) % 16;
+				}
+				else if ((r + ch) % 8 == 6)
+				{
+					note.Note = HALT;
+				}
+
+				if (r % 8 == 1)
+				{
+					note.EffNumber[0] = EF_VIBRATO;
+					note.EffParam[0] = 0x46;
+				}
+				else if (r % 16 == 4)
+				{
+					note.EffNumber[0] = EF_ARPEGGIO;
+					note.EffParam[0] = 0x37;
+				}
+				else if (r % 16 == 12)
+				{
+					note.EffNumber[0] = EF_PORTA_UP;
+					note.EffParam[0] = 0x03;
+				}
+
+				doc->SetNoteData(f, ch, r, &note);
+			}
+		}
+	}
+
+	return doc;
+}
+
+void renderTestModule(const FtmDocument *doc, std::vector<core::s16> &samples)
+{
+	SoundGen *sg = new SoundGen;
+	core::MemoryOutput *out = new core::MemoryOutput(1, 48000);
+
+	sg->setSoundSink(out);
+	sg->setDocument(doc, 0);
+	sg->setRenderEnd(SONG_LOOP_LIMIT, 1);
+	sg->trackerController()->startAt(0, 0);
+	sg->startTracker();
+	out->render();
+
+	samples = out->samples();
+
+	delete sg;
+	delete out;
+}
+
+const char * chipName(unsigned char chip)
+{
+	switch (chip)
+	{
+		case SNDCHIP_NONE: return "2A03";
+		case SNDCHIP_VRC6: return "VRC6";
+		case SNDCHIP_VRC7: return "VRC7";
+		case SNDCHIP_FDS: return "FDS";
+		case SNDCHIP_MMC5: return "MMC5";
+		default: return "?";
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef _TESTMODULE_HPP_
+#define _TESTMODULE_HPP_
+
+#include <vector>
+#include "core/soundsink.hpp"
+
+class FtmDocument;
+
+// A short module using the given expansion chip, with notes, volume changes,
+// effects and a loop on every channel. Made in memory, the tests don't need
+// any files
+FtmDocument * makeTestModule(unsigned char chip);
+
+// Plays the first track of a module through once, on a fresh SoundGen
+void renderTestModule(const FtmDocument *doc, std::vector<core::s16> &samples);
+
+const char * chipName(unsigned char chip);
+
+#endif
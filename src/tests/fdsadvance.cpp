@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <vector>
+#include "core/types.hpp"
+#include "famitracker-core/APU/APU.h"
+#include "famitracker-core/APU/FDSSound.h"
+
+// FDSSoundAdvance may only skip cycles that FDSSoundRender would render to
+// the same output. An FDS trace with a running modulator and envelopes, and
+// register writes in the middle of notes, is rendered on one core every
+// cycle and on another the way CFDS::Process does, skipping. Every cycle
+// must come out the same.
+
+static const unsigned int FRAMES = 240;
+static const uint32 FRAME_CYCLES = 29780;
+static const unsigned int WRITES_PER_FRAME = 8;
+
+class TraceRandom
+{
+public:
+	explicit TraceRandom(core::u32 seed) : m_state(seed){ }
+
+	core::u8 next()
+	{
+		m_state = m_state * 1103515245 + 12345;
+		return (core::u8)(m_state >> 16);
+	}
+private:
+	core::u32 m_state;
+};
+
+// Makes every register write on both cores
+class FDSPair
+{
+public:
+	FDSPair()
+	{
+		FDSSoundInstall3();
+		m_cycle = FDSSoundNew();
+		m_skip = FDSSoundNew();
+		FDSSoundReset(m_cycle);
+		FDSSoundReset(m_skip);
+		FDSSoundVolume(m_cycle, 0);
+		FDSSoundVolume(m_skip, 0);
+	}
+	~FDSPair()
+	{
+		FDSSoundDelete(m_cycle);
+		FDSSoundDelete(m_skip);
+	}
+
+	void write(uint16 address, uint8 value)
+	{
+		FDSSoundWrite(m_cycle, address, value);
+		FDSSoundWrite(m_skip, address, value);
+	}
+
+	// Renders time cycles on both cores, returns how many were skipped
+	uint32 render(uint32 time, std::vector<int32> &cycle, std::vector<int32> &skip)
+	{
+		for (uint32 t = 0; t < time; t++)
+			cycle.push_back(FDSSoundRender(m_cycle));
+
+		uint32 skipped = 0;
+		while (time > 0)
+		{
+			int32 output = FDSSoundRender(m_skip);
+			skip.push_back(output);
+			time--;
+
+			uint32 n = FDSSoundAdvance(m_skip, time);
+			skip.insert(skip.end(), n, output);
+			skipped += n;
+			time -= n;
+		}
+		return skipped;
+	}
+private:
+	FDSSOUND *m_cycle;
+	FDSSOUND *m_skip;
+};
+
+// A register write of the trace, at a random time of the frame
+static void write_random(FDSPair &fds, TraceRandom &r)
+{
+	switch (r.next() % 9)
+	{
+		case 0:
+			// volume envelope, mostly running
+			fds.write(0x4080, (r.next() & 0x40) | (r.next() & 0x3F) | ((r.next() & 0x07) == 0 ? 0x80 : 0));
+			break;
+		case 1:
+			// sweep envelope
+			fds.write(0x4084, (r.next() & 0x40) | (r.next() & 0x3F) | ((r.next() & 0x07) == 0 ? 0x80 : 0));
+			break;
+		case 2:
+			// envelope speed, often lowered below where the count is
+			fds.write(0x408A, r.next() & ((r.next() & 1) ? 0x07 : 0xFF));
+			break;
+		case 3:
+			fds.write(0x4082, r.next());
+			break;
+		case 4:
+			// envelopes on, the wave playing
+			fds.write(0x4083, r.next() & 0x0F);
+			break;
+		case 5:
+			fds.write(0x4085, r.next() & 0x7F);
+			break;
+		case 6:
+			fds.write(0x4086, r.next());
+			break;
+		case 7:
+			// the modulator is sometimes stopped
+			fds.write(0x4087, (r.next() & 0x0F) | ((r.next() & 0x07) == 0 ? 0x80 : 0));
+			break;
+		case 8:
+			fds.write(0x4089, r.next() & 0x03);
+			break;
+	}
+}
+
+int main()
+{
+	FDSPair fds;
+	TraceRandom r(1);
+
+	// a random wave and modulation table
+	fds.write(0x4089, 0x80);
+	for (uint16 a = 0x4040; a < 0x4080; a++)
+		fds.write(a, r.next() & 0x3F);
+	fds.write(0x4089, 0x00);
+
+	fds.write(0x4087, 0x80);
+	for (int i = 0; i < 32; i++)
+		fds.write(0x4088, r.next() & 0x07);
+
+	fds.write(0x4080, 0x20);
+	fds.write(0x4084, 0x10);
+	fds.write(0x4085, 0x00);
+	fds.write(0x408A, 0x10);
+
+	std::vector<int32> cycle, skip;
+	cycle.reserve(FRAME_CYCLES);
+	skip.reserve(FRAME_CYCLES);
+
+	core::u64 cycles = 0, skipped = 0;
+	for (unsigned int frame = 0; frame < FRAMES; frame++)
+	{
+		cycle.clear();
+		skip.clear();
+
+		// a new note every 8 frames
+		if (frame % 8 == 0)
+		{
+			fds.write(0x4080, 0x80 | 0x20);
+			fds.write(0x4082, r.next());
+			fds.write(0x4083, r.next() & 0x0F);
+			fds.write(0x4087, r.next() & 0x0F);
+		}
+
+		uint32 t = 0;
+		for (unsigned int i = 0; i < WRITES_PER_FRAME; i++)
+		{
+			uint32 next = t + (r.next() * (FRAME_CYCLES / WRITES_PER_FRAME)) / 256;
+			skipped += fds.render(next - t, cycle, skip);
+			write_random(fds, r);
+			t = next;
+		}
+		skipped += fds.render(FRAME_CYCLES - t, cycle, skip);
+
+		for (uint32 i = 0; i < FRAME_CYCLES; i++)
+		{
+			if (cycle[i] != skip[i])
+			{
+				printf("frame %u cycle %u: %d rendered every cycle, %d skipping\n",
+					   frame, (unsigned int)i, (int)cycle[i], (int)skip[i]);
+				return 1;
+			}
+		}
+		cycles += FRAME_CYCLES;
+	}
+
+	printf("%u frames identical, %.1f%% of %llu cycles skipped\n", FRAMES,
+		   100.0 * skipped / cycles, (unsigned long long)cycles);
+
+	// the test means little if nothing was skipped
+	return skipped > 0 ? 0 : 1;
+}
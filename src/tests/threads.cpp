@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/thread/barrier.hpp>
+#include "TestModule.hpp"
+#include "famitracker-core/App.hpp"
+#include "famitracker-core/FtmDocument.hpp"
+
+// Every SoundGen has its own APU, mixer and chip state. The same track is
+// rendered on several threads at once, and every render must come out the
+// same as one made alone.
+
+struct render_t
+{
+	const FtmDocument *doc;
+	boost::barrier *start;
+	std::vector<core::s16> samples;
+};
+
+static void render_thread(render_t *r)
+{
+	// all renders run at the same time
+	r->start->wait();
+	renderTestModule(r->doc, r->samples);
+}
+
+static bool test_chip(unsigned char chip, unsigned int threads)
+{
+	FtmDocument *doc = makeTestModule(chip);
+
+	std::vector<core::s16> reference;
+	renderTestModule(doc, reference);
+
+	boost::barrier start(threads);
+	std::vector<render_t> renders(threads);
+	boost::thread_group group;
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		renders[i].doc = doc;
+		renders[i].start = &start;
+		group.create_thread(boost::bind(render_thread, &renders[i]));
+	}
+	group.join_all();
+
+	bool ok = !reference.empty();
+	for (unsigned int i = 0; i < threads; i++)
+	{
+		if (renders[i].samples != reference)
+		{
+			printf("%s: render %u of %u differs\n", chipName(chip), i+1, threads);
+			ok = false;
+		}
+	}
+
+	printf("%s: %u renders of %u samples %s\n", chipName(chip), threads,
+		   (unsigned int)reference.size(), ok ? "identical" : "FAILED");
+
+	delete doc;
+	return ok;
+}
+
+int main()
+{
+	static const unsigned char chips[] = {
+		SNDCHIP_NONE, SNDCHIP_VRC6, SNDCHIP_VRC7, SNDCHIP_FDS, SNDCHIP_MMC5
+	};
+
+	unsigned int threads = boost::thread::hardware_concurrency();
+	if (threads < 4)
+		threads = 4;
+
+	bool ok = true;
+	for (unsigned int i = 0; i < sizeof(chips); i++)
+	{
+		if (!test_chip(chips[i], threads))
+			ok = false;
+	}
+
+	return ok ? 0 : 1;
+}